@@ -0,0 +1,421 @@
+/*
+Accuracy report of the number formats.
+A score is synthesized in every number format at the same time, block by block, and each output is compared with the
+double-precision reference: the error of the mix before clipping (as a signal-to-noise ratio, and its peak and RMS
+level) and the number of 16-bit output samples that differ. The synthesis time of every format is measured as well,
+so the report shows what each format costs in accuracy and what it saves in time.
+With an impulse response (-i), the reverb is checked as well: the start of the double-precision mix is convolved
+block by block with the partitioned FFT, as in a render, and compared with the convolution in the time domain.
+Every score is also streamed with render_stream to its end and compared sample by sample with the .wav file that
+render_file writes, so the two outputs of a render cannot drift apart.
+*/
+
+#define _CRT_SECURE_NO_WARNINGS
+
+#include <string.h>
+#include <math.h>
+#include "accuracy.h"
+#include "score.h"
+#include "render.h"
+#include "mix_bus.h"
+#include "batch.h"
+#include "wall_clock.h"
+#include "reverb.h"
+#include "stream.h"
+
+#define ACCURACY_BLOCK_FRAMES 4096 //Frames synthesized and compared at a time
+#define ACCURACY_REVERB_SECONDS 2 //Length of the mix convolved in the time domain (its time grows with the square)
+#define ACCURACY_STREAM_READ 1000 //Frames asked from the stream at a time (not a multiple of its look-ahead)
+
+//Level of an amplitude in dB full scale, -999 for silence.
+static double accuracy_db(double x){
+    return x > 0 ? 20.0 * log10(x) : -999.0;
+}
+
+/*Synthesizing the scheduled playlist in every number format and comparing the outputs with PRECISION_DOUBLE.
+One mix cursor per format runs over the song block by block, so the memory does not depend on the song length.
+The playlist is scheduled here. The length of the song is returned in 'frames'.
+Returns 1 on success and 0 if there is not enough memory. */
+int accuracy_compare(note *head, int bar_length, accuracy_result results[PRECISION_COUNT], int64_t *frames){
+    mix_cursor c[PRECISION_COUNT];
+    mix_bus bus;
+    double *mix_r[PRECISION_COUNT], *mix_l[PRECISION_COUNT];
+    int16_t *pcm[PRECISION_COUNT];
+    int m, saved = RS(precision), ok = 1, n_seek = 0, d;
+    int64_t a, b, total, k;
+    double t0, e;
+
+    memset(results, 0, PRECISION_COUNT * sizeof(accuracy_result));
+    memset(mix_r, 0, sizeof(mix_r));
+    memset(mix_l, 0, sizeof(mix_l));
+    memset(pcm, 0, sizeof(pcm));
+
+    total = schedule_notes(head, bar_length);
+    *frames = total;
+    if (!mix_bus_init(&bus, head)) return 0;
+    for (m = 0; m < PRECISION_COUNT; m++){
+        mix_r[m] = (double *)malloc(ACCURACY_BLOCK_FRAMES * sizeof(double));
+        mix_l[m] = (double *)malloc(ACCURACY_BLOCK_FRAMES * sizeof(double));
+        pcm[m] = (int16_t *)malloc(2 * ACCURACY_BLOCK_FRAMES * sizeof(int16_t));
+        if (!mix_r[m] || !mix_l[m] || !pcm[m]) ok = 0;
+    }
+    if (!ok) fprintf(stderr, "Out of memory!\n");
+
+    if (ok){
+        //The number format of a cursor is fixed when it is placed.
+        for (m = 0; ok && m < PRECISION_COUNT; m++){
+            results[m].precision = m;
+            RS(precision) = m;
+            ok = mix_cursor_seek(&c[m], &bus, 0);
+            n_seek++;
+        }
+        RS(precision) = saved;
+
+        for (a = 0; ok && a < total; a = b){
+            b = a + ACCURACY_BLOCK_FRAMES;
+            if (b > total) b = total;
+
+            for (m = 0; ok && m < PRECISION_COUNT; m++){
+                t0 = wall_time();
+                ok = mix_cursor_run(&c[m], &bus, b, mix_r[m], mix_l[m]);
+                results[m].synth_ms += 1000.0 * (wall_time() - t0);
+                wav_convert(mix_r[m], mix_l[m], pcm[m], b - a, a);
+            }
+
+            for (m = 0; ok && m < PRECISION_COUNT; m++){
+                for (k = 0; k < b - a; k++){
+                    results[m].signal_sq += mix_r[0][k] * mix_r[0][k] + mix_l[0][k] * mix_l[0][k];
+                    e = fabs(mix_r[m][k] - mix_r[0][k]);
+                    if (e > results[m].peak_error) results[m].peak_error = e;
+                    results[m].error_sq += e * e;
+                    e = fabs(mix_l[m][k] - mix_l[0][k]);
+                    if (e > results[m].peak_error) results[m].peak_error = e;
+                    results[m].error_sq += e * e;
+                }
+                for (k = 0; k < 2 * (b - a); k++){
+                    d = abs(pcm[m][k] - pcm[0][k]);
+                    if (d > 0) results[m].pcm_diff++;
+                    if (d > results[m].pcm_max_diff) results[m].pcm_max_diff = d;
+                }
+            }
+        }
+    }
+
+    for (m = 0; m < n_seek; m++) mix_cursor_free(&c[m]);
+    for (m = 0; m < PRECISION_COUNT; m++){
+        free(mix_r[m]);
+        free(mix_l[m]);
+        free(pcm[m]);
+    }
+    mix_bus_free(&bus);
+    return ok;
+}
+
+/*Convolving the first ACCURACY_REVERB_SECONDS of the double-precision mix with the impulse response of RS(reverb),
+with reverb_run and reverb_drain in blocks of ACCURACY_BLOCK_FRAMES and with reverb_reference, and comparing the two.
+The playlist is scheduled here. Returns 1 on success and 0 if the impulse response cannot be read or there is not enough memory. */
+int accuracy_reverb(note *head, int bar_length, accuracy_reverb_result *r){
+    mix_cursor c;
+    mix_bus bus;
+    reverb v;
+    double *in_r, *in_l, *out_r, *out_l, *ref_r, *ref_l, t0, e;
+    int64_t n, a, b, k, done = 0;
+    int saved = RS(precision), ok;
+
+    memset(r, 0, sizeof(accuracy_reverb_result));
+    memset(&c, 0, sizeof(c));
+    n = schedule_notes(head, bar_length);
+    if (n > (int64_t)ACCURACY_REVERB_SECONDS * RS(rate)) n = (int64_t)ACCURACY_REVERB_SECONDS * RS(rate);
+    if (!reverb_init(&v, RS(reverb), RS(wet))) return 0;
+    if (!mix_bus_init(&bus, head)){
+        reverb_free(&v);
+        return 0;
+    }
+
+    in_r = (double *)malloc((n + 1) * sizeof(double));
+    in_l = (double *)malloc((n + 1) * sizeof(double));
+    out_r = (double *)malloc((n + 1) * sizeof(double));
+    out_l = (double *)malloc((n + 1) * sizeof(double));
+    ref_r = (double *)malloc((n + 1) * sizeof(double));
+    ref_l = (double *)malloc((n + 1) * sizeof(double));
+    ok = in_r && in_l && out_r && out_l && ref_r && ref_l;
+    if (!ok) fprintf(stderr, "Out of memory!\n");
+
+    RS(precision) = PRECISION_DOUBLE;
+    ok = ok && mix_cursor_seek(&c, &bus, 0) && mix_cursor_run(&c, &bus, n, in_r, in_l);
+    RS(precision) = saved;
+
+    if (ok){
+        r->frames = n;
+        memcpy(out_r, in_r, n * sizeof(double));
+        memcpy(out_l, in_l, n * sizeof(double));
+
+        //The frames that come out of a block are moved back to their place in the song (they lag behind the input).
+        t0 = wall_time();
+        for (a = 0; a < n; a = b){
+            b = a + ACCURACY_BLOCK_FRAMES;
+            if (b > n) b = n;
+            k = reverb_run(&v, out_r + a, out_l + a, b - a);
+            memmove(out_r + done, out_r + a, k * sizeof(double));
+            memmove(out_l + done, out_l + a, k * sizeof(double));
+            done += k;
+        }
+        while ((k = reverb_drain(&v, out_r + done, out_l + done, n - done)) > 0) done += k;
+        r->fft_ms = 1000.0 * (wall_time() - t0);
+
+        t0 = wall_time();
+        reverb_reference(&v, in_r, in_l, ref_r, ref_l, n);
+        r->reference_ms = 1000.0 * (wall_time() - t0);
+
+        for (k = 0; k < n; k++){
+            r->signal_sq += ref_r[k] * ref_r[k] + ref_l[k] * ref_l[k];
+            e = fabs(out_r[k] - ref_r[k]);
+            if (e > r->peak_error) r->peak_error = e;
+            r->error_sq += e * e;
+            e = fabs(out_l[k] - ref_l[k]);
+            if (e > r->peak_error) r->peak_error = e;
+            r->error_sq += e * e;
+        }
+    }
+
+    mix_cursor_free(&c);
+    free(in_r);
+    free(in_l);
+    free(out_r);
+    free(out_l);
+    free(ref_r);
+    free(ref_l);
+    mix_bus_free(&bus);
+    reverb_free(&v);
+    return ok;
+}
+
+/*Rendering the playlist with render_file into 'check_file' (16-bit samples, no report, no segment cache) and reading
+it again with render_stream until the stream ends, ACCURACY_STREAM_READ frames at a time. The stream must end after
+the frames of the song and return nothing when it is read again; a stream that goes on is stopped there.
+The file is removed at the end. Returns 1 if both were rendered (whatever the result) and 0 if the file cannot be
+written or read or there is not enough memory. */
+int accuracy_stream(note *head, int bar_length, const char *check_file, accuracy_stream_result *r){
+    render_stream s;
+    render_stats stats;
+    int16_t *pcm, *ref;
+    int64_t n, k, got;
+    int saved_format = RS(format), saved_report = RS(report), header = wav_header_bytes(WAV_PCM16), ok;
+    const char *saved_cache = RS(cache_dir);
+    FILE *f;
+
+    memset(r, 0, sizeof(accuracy_stream_result));
+    memset(&stats, 0, sizeof(stats));
+    RS(format) = WAV_PCM16;
+    RS(report) = 0;
+    RS(cache_dir) = NULL;
+    ok = render_file(head, bar_length, check_file, &stats);
+    RS(format) = saved_format;
+    RS(report) = saved_report;
+    RS(cache_dir) = saved_cache;
+    if (!ok){
+        remove(check_file);
+        return 0;
+    }
+
+    f = fopen(check_file, "rb");
+    if (f == NULL || fseek(f, header, SEEK_SET) != 0){
+        fprintf(stderr, "Unable to read the file '%s'!\n", check_file);
+        if (f) fclose(f);
+        remove(check_file);
+        return 0;
+    }
+    if (!render_stream_open(&s, head, bar_length, DEFAULT_STREAM_LOOKAHEAD)){
+        fclose(f);
+        remove(check_file);
+        return 0;
+    }
+    r->frames = s.total_frames;
+
+    pcm = (int16_t *)malloc(2 * ACCURACY_STREAM_READ * sizeof(int16_t));
+    ref = (int16_t *)malloc(2 * ACCURACY_STREAM_READ * sizeof(int16_t));
+    ok = pcm && ref;
+    if (!ok) fprintf(stderr, "Out of memory!\n");
+
+    while (ok && r->stream_frames <= r->frames){
+        n = render_stream_read(&s, pcm, ACCURACY_STREAM_READ);
+        if (n < 0) ok = 0;
+        if (n <= 0) break;
+        got = (int64_t)fread(ref, 2 * sizeof(int16_t), (size_t)n, f);
+        for (k = 0; k < 2 * got; k++) r->diff_samples += pcm[k] != ref[k];
+        r->diff_samples += 2 * (n - got);
+        r->stream_frames += n;
+        r->file_frames += got;
+    }
+    //The rest of the file, if the stream ended early.
+    while (ok && (got = (int64_t)fread(ref, 2 * sizeof(int16_t), ACCURACY_STREAM_READ, f)) > 0){
+        r->diff_samples += 2 * got;
+        r->file_frames += got;
+    }
+    r->ended = ok && r->stream_frames == r->frames && render_stream_read(&s, pcm, ACCURACY_STREAM_READ) == 0;
+
+    free(pcm);
+    free(ref);
+    render_stream_close(&s);
+    fclose(f);
+    remove(check_file);
+    return ok;
+}
+
+//Printing the check of the stream of one score: a JSON line on stdout and a line of the table on stderr.
+//Returns 1 if the stream matches the file.
+static int accuracy_stream_print(const char *score_file, const accuracy_stream_result *r){
+    int same = r->ended && r->diff_samples == 0 && r->file_frames == r->frames;
+
+    fprintf(stderr, "  stream   %lld of %lld frames%s, %lld samples differ from the .wav file: %s\n",
+            (long long)r->stream_frames, (long long)r->frames, r->ended ? "" : " (does not end)",
+            (long long)r->diff_samples, same ? "identical" : "DIFFERENT");
+    printf("{\"score\":\"%s\",\"stream_frames\":%lld,\"file_frames\":%lld,\"frames\":%lld,\"ended\":%s,\"diff_samples\":%lld,\"identical\":%s}\n",
+           score_file, (long long)r->stream_frames, (long long)r->file_frames, (long long)r->frames,
+           r->ended ? "true" : "false", (long long)r->diff_samples, same ? "true" : "false");
+    return same;
+}
+
+//Printing the check of the reverb of one score: a JSON line on stdout and a line of the table on stderr.
+static void accuracy_reverb_print(const char *score_file, const accuracy_reverb_result *r){
+    double seconds = (double)r->frames / RS(rate);
+
+    if (r->error_sq > 0){
+        fprintf(stderr, "  reverb   %.1f s: SNR %.1f dB, peak error %.1f dB, partitioned FFT %.1f ms (%.1fx realtime), time domain %.1f ms\n",
+                seconds, 10.0 * log10(r->signal_sq / r->error_sq), accuracy_db(r->peak_error),
+                r->fft_ms, r->fft_ms > 0 ? 1000.0 * seconds / r->fft_ms : 0.0, r->reference_ms);
+    }
+    else{
+        fprintf(stderr, "  reverb   %.1f s: exact, partitioned FFT %.1f ms (%.1fx realtime), time domain %.1f ms\n",
+                seconds, r->fft_ms, r->fft_ms > 0 ? 1000.0 * seconds / r->fft_ms : 0.0, r->reference_ms);
+    }
+
+    printf("{\"score\":\"%s\",\"reverb\":\"%s\",\"frames\":%lld,", score_file, RS(reverb), (long long)r->frames);
+    if (r->error_sq > 0){
+        printf("\"snr_db\":%.2f,\"peak_error_dbfs\":%.2f,",
+               10.0 * log10(r->signal_sq / r->error_sq), accuracy_db(r->peak_error));
+    }
+    else printf("\"snr_db\":null,\"peak_error_dbfs\":null,");
+    printf("\"fft_ms\":%.3f,\"reference_ms\":%.3f}\n", r->fft_ms, r->reference_ms);
+}
+
+//Printing the comparison of one score: one JSON line per number format on stdout and a table on stderr.
+static void accuracy_print(const char *score_file, const accuracy_result *r, int64_t frames){
+    int m;
+    double seconds = (double)frames / RS(rate), rms;
+
+    fprintf(stderr, "%s: %.1f s of audio\n", score_file, seconds);
+    fprintf(stderr, "  format   sample    SNR dB   peak error   RMS error   16-bit diffs   max diff   synth ms   realtime\n");
+    for (m = 0; m < PRECISION_COUNT; m++){
+        rms = frames > 0 ? sqrt(r[m].error_sq / (2.0 * frames)) : 0.0;
+
+        if (r[m].error_sq > 0){
+            fprintf(stderr, "  %-6s   %2d bit   %7.1f   %7.1f dB  %7.1f dB   %12lld   %8d   %8.1f   %7.1fx\n",
+                    precision_name(m), m == PRECISION_DOUBLE ? 64 : m == PRECISION_Q15 ? 16 : 32,
+                    10.0 * log10(r[m].signal_sq / r[m].error_sq), accuracy_db(r[m].peak_error), accuracy_db(rms),
+                    (long long)r[m].pcm_diff, r[m].pcm_max_diff, r[m].synth_ms,
+                    r[m].synth_ms > 0 ? 1000.0 * seconds / r[m].synth_ms : 0.0);
+        }
+        else{
+            fprintf(stderr, "  %-6s   %2d bit   %7s   %10s   %9s   %12lld   %8d   %8.1f   %7.1fx\n",
+                    precision_name(m), m == PRECISION_DOUBLE ? 64 : m == PRECISION_Q15 ? 16 : 32, "exact", "-", "-",
+                    (long long)r[m].pcm_diff, r[m].pcm_max_diff, r[m].synth_ms,
+                    r[m].synth_ms > 0 ? 1000.0 * seconds / r[m].synth_ms : 0.0);
+        }
+
+        //An exact match has no finite SNR; it is written as null.
+        printf("{\"score\":\"%s\",\"precision\":\"%s\",\"frames\":%lld,", score_file, precision_name(m), (long long)frames);
+        if (r[m].error_sq > 0){
+            printf("\"snr_db\":%.2f,\"peak_error_dbfs\":%.2f,\"rms_error_dbfs\":%.2f,",
+                   10.0 * log10(r[m].signal_sq / r[m].error_sq), accuracy_db(r[m].peak_error), accuracy_db(rms));
+        }
+        else printf("\"snr_db\":null,\"peak_error_dbfs\":null,\"rms_error_dbfs\":null,");
+        printf("\"pcm_diff_samples\":%lld,\"pcm_max_diff\":%d,\"synth_ms\":%.3f,\"synth_frames_per_sec\":%.0f}\n",
+               (long long)r[m].pcm_diff, r[m].pcm_max_diff, r[m].synth_ms,
+               r[m].synth_ms > 0 ? 1000.0 * frames / r[m].synth_ms : 0.0);
+    }
+}
+
+static void accuracy_usage(const char *program){
+    fprintf(stderr,
+            "Usage: %s --accuracy [-b SEC] [-i FILE] [-w LEVEL] score.txt ...\n"
+            "Synthesizes every score in all number formats (double, float, q31, q15) and compares them with double,\n"
+            "and checks that the stream of every score (-p) matches its .wav file sample by sample.\n"
+            "The results are printed as JSON lines on stdout and as a table on stderr.\n"
+            "  -b SEC    duration of one bar in seconds (default %d)\n"
+            "  -i FILE   also compare the reverb with the impulse response FILE (.wav) with its time-domain reference,\n"
+            "            over the first %d seconds of the mix\n"
+            "  -w LEVEL  level of the reverb signal (default %.1f)\n",
+            program, DEFAULT_BAR_LENGTH, ACCURACY_REVERB_SECONDS, DEFAULT_REVERB_WET);
+}
+
+/*Command line entry point of the accuracy report. The note table must already be loaded.
+Returns EXIT_SUCCESS if every score was compared and EXIT_FAILURE otherwise. */
+int accuracy_main(int argc, char **argv){
+    accuracy_result results[PRECISION_COUNT];
+    accuracy_reverb_result reverb_result;
+    accuracy_stream_result stream_result;
+    char check_file[1100];
+    score sc;
+    arena notes;
+    note *head;
+    int64_t frames;
+    int i, bar_length = DEFAULT_BAR_LENGTH, n_scores = 0, ok = 1;
+
+    for (i = 1; i < argc && argv[i][0] == '-'; i += 2){
+        if (i + 1 >= argc) ok = 0;
+        else if (strcmp(argv[i], "-b") == 0) ok = (bar_length = atoi(argv[i + 1])) > 0;
+        else if (strcmp(argv[i], "-i") == 0) RS(reverb) = argv[i + 1];
+        else if (strcmp(argv[i], "-w") == 0) ok = (RS(wet) = atof(argv[i + 1])) > 0;
+        else ok = 0;
+        if (!ok){
+            accuracy_usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (i >= argc){
+        accuracy_usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    arena_init(&notes, DEFAULT_SLAB_SIZE);
+    if (!score_init(&sc, 0)) return EXIT_FAILURE;
+
+    for (; i < argc; i++){
+        score_clear(&sc);
+        arena_reset(&notes);
+        if (!score_load_file(&sc, argv[i])){
+            fprintf(stderr, "Error: file '%s' doesn't open!\n", argv[i]);
+            ok = 0;
+            continue;
+        }
+        head = score_sort(&sc) ? score_make_playlist_in(&sc, &notes) : NULL;
+        if (head == NULL){
+            fprintf(stderr, "Score '%s' has no notes.\n", argv[i]);
+            ok = 0;
+            continue;
+        }
+        if (!accuracy_compare(head, bar_length, results, &frames)){
+            ok = 0;
+            continue;
+        }
+        accuracy_print(argv[i], results, frames);
+        if (RS(reverb) != NULL){
+            if (!accuracy_reverb(head, bar_length, &reverb_result)){
+                ok = 0;
+                continue;
+            }
+            accuracy_reverb_print(argv[i], &reverb_result);
+        }
+        snprintf(check_file, sizeof(check_file), "%s.stream-check.wav", argv[i]);
+        if (!accuracy_stream(head, bar_length, check_file, &stream_result) || !accuracy_stream_print(argv[i], &stream_result)){
+            ok = 0;
+            continue;
+        }
+        n_scores++;
+    }
+
+    score_free(&sc);
+    arena_free(&notes);
+    return ok && n_scores > 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
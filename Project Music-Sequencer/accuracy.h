@@ -0,0 +1,46 @@
+#pragma once
+
+#ifndef ACCURACY_H
+#define ACCURACY_H
+
+#include<stdio.h>
+#include<stdlib.h>
+#include <stdint.h>
+#include"voice_bank.h"
+
+//Difference between the output of one number format and the double-precision reference.
+typedef struct accuracy_result_struct{
+	int precision; //PRECISION_...
+	double signal_sq; //Sum of the squared samples of the reference mix
+	double error_sq; //Sum of the squared differences of the mix
+	double peak_error; //Largest difference of the mix (1.0 = full scale)
+	int64_t pcm_diff; //16-bit output samples that differ from the reference
+	int pcm_max_diff; //Largest difference of the 16-bit samples
+	double synth_ms; //Synthesis time
+} accuracy_result;
+
+//Difference between the partitioned convolution of the reverb (reverb_run) and its time-domain reference.
+typedef struct accuracy_reverb_result_struct{
+	int64_t frames; //Frames of the mix compared
+	double signal_sq; //Sum of the squared samples of the reference
+	double error_sq; //Sum of the squared differences
+	double peak_error; //Largest difference (1.0 = full scale)
+	double fft_ms; //Time of reverb_run and reverb_drain
+	double reference_ms; //Time of reverb_reference
+} accuracy_reverb_result;
+
+//Comparison of the 16-bit samples of a render_stream, read to its end, with the .wav file written by render_file.
+typedef struct accuracy_stream_result_struct{
+	int64_t frames; //Frames of the song (from the schedule)
+	int64_t stream_frames; //Frames read from the stream before it ended
+	int64_t file_frames; //Frames of the samples of the file
+	int64_t diff_samples; //16-bit samples that differ between the stream and the file
+	int ended; //1 if the stream ended with the song and returns no frames after its end
+} accuracy_stream_result;
+
+int accuracy_compare(note* head, int bar_length, accuracy_result results[PRECISION_COUNT], int64_t* frames);
+int accuracy_reverb(note* head, int bar_length, accuracy_reverb_result* r);
+int accuracy_stream(note* head, int bar_length, const char* check_file, accuracy_stream_result* r);
+int accuracy_main(int argc, char** argv);
+
+#endif // ACCURACY_H
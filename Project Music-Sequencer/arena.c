@@ -0,0 +1,74 @@
+/*
+Arena (bump) allocator.
+Objects that live for the same time, like the notes of one render, are placed one after another in large slabs.
+Allocation is a pointer increment, objects that are used together are close in memory,
+and everything is released at once instead of with one free() per object.
+*/
+
+#define _CRT_SECURE_NO_WARNINGS
+
+#include "arena.h"
+
+//Size of the slab header, rounded up so the data is aligned.
+#define SLAB_HEADER ((sizeof(arena_slab) + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1))
+
+void arena_init(arena *a, size_t slab_size){
+    a->head = NULL;
+    a->slab_size = slab_size > 0 ? slab_size : DEFAULT_SLAB_SIZE;
+    a->n_allocs = 0;
+    a->bytes = 0;
+    a->peak_bytes = 0;
+}
+
+//Allocating 'size' bytes (aligned to ARENA_ALIGN). Returns NULL if there is not enough memory.
+//Requests larger than a slab get a slab of their own.
+void *arena_alloc(arena *a, size_t size){
+    arena_slab *s = a->head;
+    size_t need = (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+    size_t slab;
+    void *p;
+
+    if (s == NULL || s->size - s->used < need){
+        slab = need > a->slab_size ? need : a->slab_size;
+        s = (arena_slab *)malloc(SLAB_HEADER + slab);
+        if (s == NULL) return NULL;
+
+        s->size = slab;
+        s->used = 0;
+        s->next = a->head;
+        a->head = s;
+        a->bytes += slab;
+        if (a->bytes > a->peak_bytes) a->peak_bytes = a->bytes;
+    }
+
+    p = (char *)s + SLAB_HEADER + s->used;
+    s->used += need;
+    a->n_allocs++;
+    return p;
+}
+
+//Releasing all allocations. The most recent slab is kept for the next use of the arena.
+void arena_reset(arena *a){
+    arena_slab *s, *t;
+
+    if (a->head != NULL){
+        s = a->head->next;
+        while (s != NULL){
+            t = s->next;
+            a->bytes -= s->size;
+            free(s);
+            s = t;
+        }
+        a->head->next = NULL;
+        a->head->used = 0;
+    }
+    a->n_allocs = 0;
+}
+
+//Releasing all memory of the arena.
+void arena_free(arena *a){
+    arena_reset(a);
+    free(a->head);
+    a->head = NULL;
+    a->bytes = 0;
+}
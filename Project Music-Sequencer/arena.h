@@ -0,0 +1,35 @@
+#pragma once
+
+#ifndef ARENA_H
+#define ARENA_H
+
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+
+#define DEFAULT_SLAB_SIZE (1 << 20) //Size of one arena slab in bytes
+#define ARENA_ALIGN 16 //Alignment of every allocation (enough for SSE/AVX loads)
+
+//One large block of memory of an arena. The data follows the header.
+typedef struct arena_slab_struct{
+	struct arena_slab_struct* next; //Previously filled slab
+	size_t size; //Bytes of data in the slab
+	size_t used; //Bytes handed out from the slab
+} arena_slab;
+
+//Bump allocator: allocations are taken one after another from large slabs
+//and are only released all together, by arena_reset or arena_free.
+typedef struct arena_struct{
+	arena_slab* head; //Slab that allocations are currently taken from
+	size_t slab_size;
+	size_t n_allocs; //Allocations since the last reset
+	size_t bytes; //Bytes reserved in slabs
+	size_t peak_bytes; //Highest value of 'bytes' since arena_init
+} arena;
+
+void arena_init(arena* a, size_t slab_size);
+void* arena_alloc(arena* a, size_t size);
+void arena_reset(arena* a);
+void arena_free(arena* a);
+
+#endif // ARENA_H
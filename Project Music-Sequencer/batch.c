@@ -0,0 +1,498 @@
+/*
+Batch rendering without the menu.
+The score files are given on the command line (as names, wildcard patterns or a manifest file),
+rendered at the same time on a worker pool, each with its own score index and note arena,
+and a timing summary with one line per score is printed at the end.
+*/
+
+#define _CRT_SECURE_NO_WARNINGS
+
+#include <string.h>
+#include <errno.h>
+#include "batch.h"
+#include "score.h"
+#include "render.h"
+#include "file_map.h"
+#include "wall_clock.h"
+#include "worker_pool.h"
+#include "stream.h"
+#include "render_cache.h"
+#include "prototype.h"
+#include "score_spool.h"
+#include "render_spool.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#include <io.h>
+#include <fcntl.h>
+#else
+#include <glob.h>
+#endif
+
+/*Generating a file name. If a file with this name already exists, an index is added to it.
+The file is created here, and only if it does not exist yet, so renders that run at the same time
+(in this program or in another one) can never get the same name.
+Returns 1 on success and 0 if the file cannot be created (for example if the directory does not exist). */
+int generate_new_filename(const char* base_filename, char* new_filename) {
+    int counter = 1;
+    char temp_filename[1100];
+    FILE* f;
+
+    if (strlen(base_filename) > 1024 - 16) return 0;
+    sprintf(temp_filename, "%s.wav", base_filename);
+
+    while ((f = fopen(temp_filename, "wbx")) == NULL) {
+        if (errno != EEXIST) return 0;
+        sprintf(temp_filename, "%s_%d.wav", base_filename, counter);
+        counter++;
+    }
+    fclose(f);
+
+    strcpy(new_filename, temp_filename);
+    return 1;
+}
+
+//Adding a score file to the batch. Returns 0 if there is not enough memory.
+int batch_add_file(batch *b, const char *filename){
+    batch_job *t;
+    char *name;
+    size_t len = strlen(filename);
+
+    if (b->n_jobs == b->capacity){
+        t = (batch_job *)realloc(b->jobs, (b->capacity ? 2 * (size_t)b->capacity : 64) * sizeof(batch_job));
+        if (t == NULL){
+            fprintf(stderr, "Out of memory!\n");
+            return 0;
+        }
+        b->jobs = t;
+        b->capacity = b->capacity ? 2 * b->capacity : 64;
+    }
+
+    name = (char *)malloc(len + 1);
+    if (name == NULL){
+        fprintf(stderr, "Out of memory!\n");
+        return 0;
+    }
+    memcpy(name, filename, len + 1);
+
+    t = &b->jobs[b->n_jobs++];
+    memset(t, 0, sizeof(batch_job));
+    t->score_file = name;
+    return 1;
+}
+
+//Adding the score files that match a wildcard pattern like "scores/*.txt" (in name order).
+//A name without wildcards is added as it is. Returns 0 if there is not enough memory.
+int batch_add_pattern(batch *b, const char *pattern){
+    int ok = 1, found = 0;
+
+    if (strpbrk(pattern, "*?[") == NULL) return batch_add_file(b, pattern);
+
+#ifdef _WIN32
+    {
+        WIN32_FIND_DATAA fd;
+        HANDLE h;
+        char path[MAX_PATH * 2];
+        size_t dir_len;
+        const char *slash = strrchr(pattern, '\\'), *slash2 = strrchr(pattern, '/');
+
+        //FindFirstFile returns names without the directory of the pattern.
+        if (slash2 > slash) slash = slash2;
+        dir_len = slash ? (size_t)(slash - pattern + 1) : 0;
+        if (dir_len >= MAX_PATH) return 1;
+        memcpy(path, pattern, dir_len);
+
+        h = FindFirstFileA(pattern, &fd);
+        if (h != INVALID_HANDLE_VALUE){
+            do{
+                if (fd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) continue;
+                strcpy(path + dir_len, fd.cFileName);
+                ok = batch_add_file(b, path);
+                found++;
+            } while (ok && FindNextFileA(h, &fd));
+            FindClose(h);
+        }
+    }
+#else
+    {
+        glob_t g;
+        size_t i;
+
+        if (glob(pattern, 0, NULL, &g) == 0){
+            for (i = 0; ok && i < g.gl_pathc; i++){
+                ok = batch_add_file(b, g.gl_pathv[i]);
+                found++;
+            }
+        }
+        globfree(&g);
+    }
+#endif
+
+    if (!found) fprintf(stderr, "No score files match '%s'.\n", pattern);
+    return ok;
+}
+
+/*Adding the score files listed in a manifest: one file name or wildcard pattern per line.
+Empty lines and lines starting with '#' are skipped.
+Returns 0 if the manifest cannot be opened or there is not enough memory. */
+int batch_add_manifest(batch *b, const char *filename){
+    file_map m;
+    const char *p, *end, *line_end;
+    char name[1024];
+    size_t len;
+    int ok = 1;
+
+    if (!file_map_open(&m, filename)) return 0;
+
+    p = m.data;
+    end = m.data + m.size;
+    while (ok && p < end){
+        line_end = (const char *)memchr(p, '\n', end - p);
+        if (line_end == NULL) line_end = end;
+
+        //Trimming blanks at both ends of the line.
+        while (p < line_end && (*p == ' ' || *p == '\t')) p++;
+        len = line_end - p;
+        while (len > 0 && (p[len - 1] == ' ' || p[len - 1] == '\t' || p[len - 1] == '\r')) len--;
+
+        if (len > 0 && *p != '#'){
+            if (len < sizeof(name)){
+                memcpy(name, p, len);
+                name[len] = '\0';
+                ok = batch_add_pattern(b, name);
+            }
+            else fprintf(stderr, "Skipping a name longer than %d characters in '%s'.\n", (int)sizeof(name) - 1, filename);
+        }
+        p = line_end + 1;
+    }
+
+    file_map_close(&m);
+    return ok;
+}
+
+//The output name of a score without the extension: the score file name without its extension, in out_dir.
+//Returns 0 if the name is too long.
+static int output_base(const char *out_dir, const char *score_file, char *base, size_t size){
+    const char *name = score_file, *p, *dot;
+    size_t dir_len = 0, name_len;
+
+    for (p = score_file; *p; p++){
+        if (*p == '/' || *p == '\\') name = p + 1;
+    }
+    dot = strrchr(name, '.');
+    name_len = dot && dot != name ? (size_t)(dot - name) : strlen(name);
+
+    if (out_dir != NULL && *out_dir) dir_len = strlen(out_dir);
+    if (dir_len + name_len + 2 > size) return 0;
+
+    if (dir_len){
+        memcpy(base, out_dir, dir_len);
+        if (out_dir[dir_len - 1] != '/' && out_dir[dir_len - 1] != '\\') base[dir_len++] = '/';
+    }
+    memcpy(base + dir_len, name, name_len);
+    base[dir_len + name_len] = '\0';
+    return 1;
+}
+
+/*Rendering one score of the batch out of core (see score_spool.h): the score is sorted in runs in RS(spool) and
+rendered while the runs are merged, so the memory does not depend on the length of the score. */
+static void batch_run_spool_job(batch *b, batch_job *j){
+    score_spool sp;
+    render_stats stats;
+    char base[1024];
+    double t0, t1, t2;
+
+    t0 = wall_time();
+    if (!score_spool_init(&sp)){
+        j->error = "out of memory";
+        return;
+    }
+    if (!score_spool_load_file(&sp, j->score_file)) j->error = "score file can't be spooled";
+    else if (sp.n_events == 0) j->error = "score has no notes";
+    t1 = wall_time();
+
+    if (j->error == NULL){
+        if (!output_base(b->out_dir, j->score_file, base, sizeof(base)) || !generate_new_filename(base, j->out_file)){
+            j->error = "output file can't be created";
+        }
+    }
+    if (j->error == NULL){
+        memset(&stats, 0, sizeof(stats));
+        stats.load_ms = 1000.0 * (t1 - t0);
+        if (render_spool_file(&sp, b->bar_length, j->out_file, &stats)) j->frames = stats.frames;
+        else j->error = "rendering failed";
+    }
+    j->n_notes = (int)sp.n_notes;
+    t2 = wall_time();
+
+    j->parse_ms = 1000.0 * (t1 - t0);
+    j->render_ms = 1000.0 * (t2 - t1);
+    j->total_ms = 1000.0 * (t2 - t0);
+    score_spool_free(&sp);
+}
+
+//Rendering one score of the batch. Every job has its own score index and note arena,
+//the note table and the render settings are only read.
+static void batch_run_job(void *ctx, int job){
+    batch *b = (batch *)ctx;
+    batch_job *j = &b->jobs[job];
+    score sc;
+    arena notes;
+    file_map m;
+    note *head = NULL, *q;
+    render_stats stats;
+    char base[1024];
+    double t0, t1, t2, t_sort, t_playlist;
+    int count;
+
+    if (RS(spool) != NULL){
+        batch_run_spool_job(b, j);
+        return;
+    }
+
+    t0 = wall_time();
+    arena_init(&notes, DEFAULT_SLAB_SIZE);
+    if (!score_init(&sc, 0)){
+        j->error = "out of memory";
+        return;
+    }
+
+    //Reading and sorting the score.
+    t_sort = t0;
+    if (!file_map_open(&m, j->score_file)) j->error = "score file doesn't open";
+    else{
+        count = score_parse(&sc, m.data, m.size);
+        file_map_close(&m);
+        t_sort = wall_time();
+        if (count < 0 || !score_sort(&sc)) j->error = "out of memory";
+    }
+    t_playlist = wall_time();
+    if (j->error == NULL){
+        head = score_make_playlist_in(&sc, &notes);
+        if (head == NULL) j->error = "score has no notes";
+    }
+    for (q = head; q != NULL; q = q->next) j->n_notes++;
+    t1 = wall_time();
+
+    //Writing the song.
+    if (j->error == NULL){
+        if (!output_base(b->out_dir, j->score_file, base, sizeof(base)) || !generate_new_filename(base, j->out_file)){
+            j->error = "output file can't be created";
+        }
+    }
+    if (j->error == NULL){
+        memset(&stats, 0, sizeof(stats));
+        stats.load_ms = 1000.0 * (t_sort - t0);
+        stats.sort_ms = 1000.0 * (t_playlist - t_sort);
+        stats.playlist_ms = 1000.0 * (t1 - t_playlist);
+        stats.note_allocs = notes.n_allocs;
+        stats.note_peak_bytes = notes.peak_bytes;
+        if (render_file(head, b->bar_length, j->out_file, &stats)) j->frames = stats.frames;
+        else j->error = "rendering failed";
+    }
+    t2 = wall_time();
+
+    j->parse_ms = 1000.0 * (t1 - t0);
+    j->render_ms = 1000.0 * (t2 - t1);
+    j->total_ms = 1000.0 * (t2 - t0);
+
+    score_free(&sc);
+    arena_free(&notes);
+}
+
+//Rendering all scores of the batch, parallel_jobs at a time.
+void batch_run(batch *b){
+    int n_threads = b->parallel_jobs > 0 ? b->parallel_jobs : cpu_count();
+
+    if (b->bar_length <= 0) b->bar_length = DEFAULT_BAR_LENGTH;
+    parallel_for(b->n_jobs, n_threads, batch_run_job, b);
+}
+
+//Printing one line per score and the totals of the batch.
+void batch_print_summary(batch *b, double wall_ms, FILE *f){
+    batch_job *j;
+    int i, n_ok = 0;
+    double seconds, audio = 0, work_ms = 0;
+
+    fprintf(f, "%5s %8s %10s %10s %11s %10s %10s  %s\n", "job", "notes", "audio s", "parse ms", "render ms", "total ms", "realtime", "result");
+    for (i = 0; i < b->n_jobs; i++){
+        j = &b->jobs[i];
+        seconds = (double)j->frames / RS(rate);
+        fprintf(f, "%5d %8d %10.1f %10.2f %11.2f %10.2f %9.1fx  ", i + 1, j->n_notes, seconds,
+                j->parse_ms, j->render_ms, j->total_ms, j->total_ms > 0 ? 1000.0 * seconds / j->total_ms : 0.0);
+        if (j->error == NULL) fprintf(f, "%s\n", j->out_file);
+        else fprintf(f, "FAILED: %s (%s)\n", j->error, j->score_file);
+
+        if (j->error == NULL) n_ok++;
+        audio += seconds;
+        work_ms += j->total_ms;
+    }
+    fprintf(f, "Rendered %d of %d scores (%.1f s of audio) in %.3f s, %.3f s of work on %d parallel jobs (%.2fx).\n",
+            n_ok, b->n_jobs, audio, wall_ms / 1000.0, work_ms / 1000.0,
+            b->parallel_jobs > 0 ? b->parallel_jobs : cpu_count(), wall_ms > 0 ? work_ms / wall_ms : 0.0);
+}
+
+//Releasing the job list.
+void batch_free(batch *b){
+    int i;
+
+    for (i = 0; i < b->n_jobs; i++) free((void *)b->jobs[i].score_file);
+    free(b->jobs);
+    b->jobs = NULL;
+    b->n_jobs = 0;
+    b->capacity = 0;
+}
+
+static void batch_usage(const char *program){
+    fprintf(stderr,
+            "Usage: %s [options] score.txt ...\n"
+            "Renders every score file to a .wav file. Score names may contain wildcards (* ? [).\n"
+            "  -m FILE   read score file names from a manifest, one per line\n"
+            "  -o DIR    write the .wav files to DIR (default: current directory)\n"
+            "  -b SEC    duration of one bar in seconds (default %d)\n"
+            "  -j N      number of scores rendered at the same time (default 0 = one per processor)\n"
+            "  -t N      render threads per score (default 1, 0 = one per processor)\n"
+            "  -p FORMAT stream one score to stdout while it is rendered, FORMAT is raw (16-bit R/L samples) or wav\n"
+            "  -q MODE   number format of the synthesis: double (default), float, q31 or q15\n"
+            "  -d 0|1    TPDF dither of the 16-bit output (default 0)\n"
+            "  -k 0|1    prototype mode: all notes of a pitch play one cached waveform (default 0)\n"
+            "  -R RATE   sample rate in Hz (default 44100; 11025 or 22050 for quick previews, 48000 or 96000 for masters)\n"
+            "  -s FORMAT sample format of the .wav files: 16 (16-bit integers, default) or float (32-bit floats)\n"
+            "  -c DIR    keep rendered bars in the segment cache DIR and render only the bars that changed\n"
+            "  -x DIR    sort the scores out of core, with temporary files in DIR, for scores larger than the memory\n"
+            "  -i FILE   add a convolution reverb to the mix, with the impulse response of the .wav file FILE\n"
+            "  -w LEVEL  level of the reverb signal (default %.1f)\n"
+            "  -r 0|1    print a JSON report of every render on stderr (default 1)\n"
+            "  -P SEC    print a progress line every SEC seconds during a render (default 0 = off)\n"
+            "Without arguments the interactive menu is started.\n",
+            program, DEFAULT_BAR_LENGTH, DEFAULT_REVERB_WET);
+}
+
+/*Command line entry point of the batch mode. The note table must already be loaded.
+Returns EXIT_SUCCESS if every score was rendered and EXIT_FAILURE otherwise. */
+int batch_main(int argc, char **argv){
+    batch b;
+    int i, ok = 1, stream_format = -1;
+    double t0;
+
+    memset(&b, 0, sizeof(b));
+    b.bar_length = DEFAULT_BAR_LENGTH;
+    RS(threads) = 1;
+
+    for (i = 1; ok && i < argc; i++){
+        if (argv[i][0] == '-' && argv[i][1] != '\0' && argv[i][2] == '\0'){
+            if (argv[i][1] == 'h'){
+                batch_usage(argv[0]);
+                batch_free(&b);
+                return EXIT_SUCCESS;
+            }
+            if (strchr("mobjtprPcqdsRkxiw", argv[i][1]) == NULL){
+                fprintf(stderr, "Unknown option %s.\n", argv[i]);
+                ok = 0;
+                break;
+            }
+            if (i + 1 >= argc){
+                fprintf(stderr, "Option %s needs a value.\n", argv[i]);
+                ok = 0;
+                break;
+            }
+            switch (argv[i][1]){
+            case 'm':
+                if (!batch_add_manifest(&b, argv[i + 1])){
+                    fprintf(stderr, "Error: manifest '%s' doesn't open!\n", argv[i + 1]);
+                    ok = 0;
+                }
+                break;
+            case 'o': b.out_dir = argv[i + 1]; break;
+            case 'b': b.bar_length = atoi(argv[i + 1]); break;
+            case 'j': b.parallel_jobs = atoi(argv[i + 1]); break;
+            case 't': RS(threads) = atoi(argv[i + 1]); break;
+            case 'r': RS(report) = atoi(argv[i + 1]); break;
+            case 'P': RS(progress) = atof(argv[i + 1]); break;
+            case 'c': RS(cache_dir) = argv[i + 1]; break;
+            case 'x': RS(spool) = argv[i + 1]; break;
+            case 'i': RS(reverb) = argv[i + 1]; break;
+            case 'w': RS(wet) = atof(argv[i + 1]); break;
+            case 'd': RS(dither) = atoi(argv[i + 1]) != 0; break;
+            case 'k': RS(prototypes) = atoi(argv[i + 1]) != 0; break;
+            case 'R':
+                RS(rate) = atoi(argv[i + 1]);
+                if (RS(rate) < MIN_SAMPLE_RATE || RS(rate) > MAX_SAMPLE_RATE){
+                    fprintf(stderr, "The sample rate must be between %d and %d Hz.\n", MIN_SAMPLE_RATE, MAX_SAMPLE_RATE);
+                    ok = 0;
+                }
+                break;
+            case 's':
+                if (strcmp(argv[i + 1], "16") == 0) RS(format) = WAV_PCM16;
+                else if (strcmp(argv[i + 1], "float") == 0) RS(format) = WAV_FLOAT32;
+                else{
+                    fprintf(stderr, "Unknown sample format %s.\n", argv[i + 1]);
+                    ok = 0;
+                }
+                break;
+            case 'q':
+                RS(precision) = precision_from_name(argv[i + 1]);
+                if (RS(precision) < 0){
+                    fprintf(stderr, "Unknown number format %s.\n", argv[i + 1]);
+                    ok = 0;
+                }
+                break;
+            case 'p':
+                if (strcmp(argv[i + 1], "raw") == 0) stream_format = STREAM_RAW;
+                else if (strcmp(argv[i + 1], "wav") == 0) stream_format = STREAM_WAV;
+                else{
+                    fprintf(stderr, "Unknown stream format %s.\n", argv[i + 1]);
+                    ok = 0;
+                }
+                break;
+            }
+            i++;
+        }
+        else ok = batch_add_pattern(&b, argv[i]);
+    }
+
+    if (ok && (b.bar_length <= 0 || b.parallel_jobs < 0 || RS(threads) < 0 || RS(progress) < 0 || RS(wet) <= 0)){
+        fprintf(stderr, "Bar length and reverb level must be positive, job and thread counts and the progress interval 0 or more.\n");
+        ok = 0;
+    }
+    if (ok && RS(spool) != NULL && (stream_format >= 0 || RS(cache_dir) != NULL)){
+        fprintf(stderr, "Streams and the segment cache need the whole score in memory; -x cannot be used with -p or -c.\n");
+        ok = 0;
+    }
+    if (!ok || b.n_jobs == 0){
+        if (ok) fprintf(stderr, "No score files to render.\n");
+        batch_usage(argv[0]);
+        batch_free(&b);
+        return EXIT_FAILURE;
+    }
+
+    //Streaming: the samples go to stdout as they are rendered, all messages go to stderr.
+    if (stream_format >= 0){
+        if (b.n_jobs != 1){
+            fprintf(stderr, "Only one score can be streamed.\n");
+            ok = 0;
+        }
+        else if (RS(format) != WAV_PCM16){
+            fprintf(stderr, "Streams are written as 16-bit samples only.\n");
+            ok = 0;
+        }
+        else{
+#ifdef _WIN32
+            _setmode(_fileno(stdout), _O_BINARY);
+#endif
+            ok = stream_score(b.jobs[0].score_file, b.bar_length, stream_format, stdout);
+        }
+        batch_free(&b);
+        return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    t0 = wall_time();
+    batch_run(&b);
+    batch_print_summary(&b, 1000.0 * (wall_time() - t0), stdout);
+
+    for (i = 0; i < b.n_jobs; i++){
+        if (b.jobs[i].error != NULL) ok = 0;
+    }
+    batch_free(&b);
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
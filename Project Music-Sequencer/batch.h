@@ -0,0 +1,43 @@
+#pragma once
+
+#ifndef BATCH_H
+#define BATCH_H
+
+#include<stdio.h>
+#include<stdlib.h>
+#include <stdint.h>
+
+#define DEFAULT_BAR_LENGTH 2 //Duration of one bar in seconds.
+
+//One score of a batch render and its results.
+typedef struct batch_job_struct{
+	const char* score_file; //Input score
+	char out_file[1024]; //Output .wav file, chosen when the job runs
+	const char* error; //NULL if the job succeeded, otherwise the reason it failed
+	int n_notes; //Notes in the playlist
+	int64_t frames; //Frames written
+	double parse_ms; //Reading and sorting the score
+	double render_ms; //Scheduling, synthesis and writing the .wav file
+	double total_ms;
+} batch_job;
+
+//A list of score files to render with the options of the batch.
+typedef struct batch_struct{
+	batch_job* jobs;
+	int n_jobs;
+	int capacity;
+	int bar_length; //Duration of one bar in seconds
+	const char* out_dir; //Directory of the output files, NULL for the current directory
+	int parallel_jobs; //Number of scores rendered at the same time, 0 = one per processor
+} batch;
+
+int generate_new_filename(const char* base_filename, char* new_filename);
+int batch_add_file(batch* b, const char* filename);
+int batch_add_pattern(batch* b, const char* pattern);
+int batch_add_manifest(batch* b, const char* filename);
+void batch_run(batch* b);
+void batch_print_summary(batch* b, double wall_ms, FILE* f);
+void batch_free(batch* b);
+int batch_main(int argc, char** argv);
+
+#endif // BATCH_H
@@ -0,0 +1,357 @@
+/*
+Benchmark.
+A synthetic score with a chosen number of notes, polyphony, pitch range and order is generated in memory
+and run through every stage of the program: note table, parse, sort, playlist, schedule, synthesis and WAV write.
+Each stage is timed on its own (the best of several runs), and the throughput is printed as one JSON line on stdout,
+so results of different builds can be compared by a script.
+*/
+
+#define _CRT_SECURE_NO_WARNINGS
+
+#include <string.h>
+#include "bench.h"
+#include "note_table.h"
+#include "score.h"
+#include "render.h"
+#include "mix_bus.h"
+#include "prototype.h"
+#include "wall_clock.h"
+
+#ifdef _WIN32
+#define BENCH_NULL_DEVICE "NUL"
+#else
+#define BENCH_NULL_DEVICE "/dev/null"
+#endif
+
+#define BENCH_BLOCK_FRAMES 4096 //Frames synthesized and written at a time
+
+//Random generator of the score generator (splitmix64).
+static uint64_t bench_rng(uint64_t *state){
+    uint64_t z = (*state += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+/*Generating a score text in the format of the score files ("bar<TAB>index<TAB>note" per line).
+The notes start at even intervals, chosen so that 'polyphony' notes sound at the same time on average
+(every note lasts voice_max_frames() frames), and get random pitches from the range low..high of the note table.
+Returns the text (to be freed by the caller) and its length in 'len', or NULL if there is not enough memory. */
+char *bench_generate(const bench_score *g, size_t *len){
+    char *text, *p;
+    int *order;
+    int i, k, t, bar;
+    uint64_t rng = g->seed;
+    double rate, seconds;
+    long index_us;
+
+    text = (char *)malloc((size_t)g->n_notes * 32 + 1);
+    order = (int *)malloc((size_t)(g->n_notes > 0 ? g->n_notes : 1) * sizeof(int));
+    if (text == NULL || order == NULL){
+        fprintf(stderr, "Out of memory!\n");
+        free(text);
+        free(order);
+        return NULL;
+    }
+
+    //The order in which the notes are written to the text.
+    for (i = 0; i < g->n_notes; i++) order[i] = g->order == BENCH_REVERSED ? g->n_notes - 1 - i : i;
+    if (g->order == BENCH_SHUFFLED){
+        for (i = g->n_notes - 1; i > 0; i--){
+            k = (int)(bench_rng(&rng) % (uint64_t)(i + 1));
+            t = order[i]; order[i] = order[k]; order[k] = t;
+        }
+    }
+
+    //Notes started per second.
+    rate = g->polyphony * RS(rate) / (double)voice_max_frames();
+
+    p = text;
+    for (i = 0; i < g->n_notes; i++){
+        seconds = order[i] / rate;
+        bar = (int)(seconds / g->bar_length);
+        //The index is written with 6 decimals and rounded down, so it stays below 1.0.
+        index_us = (long)((seconds - (double)bar * g->bar_length) / g->bar_length * 1e6);
+        if (index_us > 999999) index_us = 999999;
+
+        k = g->low + (int)(bench_rng(&rng) % (uint64_t)(g->high - g->low + 1));
+        p += sprintf(p, "%d\t0.%06ld\t%s\n", bar, index_us, note_names[k]);
+    }
+
+    free(order);
+    *len = (size_t)(p - text);
+    return text;
+}
+
+//Index of a note name in the note table, or -1.
+static int bench_find_note(const char *name){
+    int i;
+
+    for (i = 0; i < NOTE_TABLE_SIZE; i++){
+        if (strcmp(note_names[i], name) == 0) return i;
+    }
+    return -1;
+}
+
+//Keeping the smaller time of every stage.
+static void bench_keep_best(bench_times *best, const bench_times *t, int first){
+    if (first){
+        *best = *t;
+        return;
+    }
+    if (t->table < best->table) best->table = t->table;
+    if (t->parse < best->parse) best->parse = t->parse;
+    if (t->sort < best->sort) best->sort = t->sort;
+    if (t->playlist < best->playlist) best->playlist = t->playlist;
+    if (t->schedule < best->schedule) best->schedule = t->schedule;
+    if (t->synth < best->synth) best->synth = t->synth;
+    if (t->write < best->write) best->write = t->write;
+    if (t->end_to_end < best->end_to_end) best->end_to_end = t->end_to_end;
+}
+
+//Items per second for a stage that took 'ms' milliseconds.
+static double bench_rate(double items, double ms){
+    return ms > 0 ? items * 1000.0 / ms : 0.0;
+}
+
+/*One run of all stages over the score text. The frames of the song are returned in 'frames'.
+The synthesis and the write stage run block by block with one render cursor, so their times can be told apart;
+the end-to-end render afterwards uses render_file (and RS(threads)) as the program does.
+Returns 0 on error. */
+static int bench_run(const bench_score *g, const char *text, size_t len, const char *out_file,
+                     score *sc, arena *notes, bench_times *t, int64_t *frames){
+    note *head;
+    mix_bus bus;
+    mix_cursor c;
+    render_stats stats;
+    double *mix_r = NULL, *mix_l = NULL, t0;
+    int16_t *pcm = NULL;
+    int64_t a, b, total;
+    int ok = 1;
+    FILE *f;
+
+    memset(t, 0, sizeof(bench_times));
+    score_clear(sc);
+    arena_reset(notes);
+
+    t0 = wall_time();
+    note_table_builtin();
+    t->table = 1000.0 * (wall_time() - t0);
+
+    t0 = wall_time();
+    if (score_parse(sc, text, len) < 0) return 0;
+    t->parse = 1000.0 * (wall_time() - t0);
+
+    t0 = wall_time();
+    if (!score_sort(sc)) return 0;
+    t->sort = 1000.0 * (wall_time() - t0);
+
+    t0 = wall_time();
+    head = score_make_playlist_in(sc, notes);
+    t->playlist = 1000.0 * (wall_time() - t0);
+    if (head == NULL) return 0;
+
+    t0 = wall_time();
+    total = schedule_notes(head, g->bar_length);
+    t->schedule = 1000.0 * (wall_time() - t0);
+    *frames = total;
+
+    //Synthesis and write, timed separately.
+    if (!mix_bus_init(&bus, head)) return 0;
+    mix_r = (double *)malloc(BENCH_BLOCK_FRAMES * sizeof(double));
+    mix_l = (double *)malloc(BENCH_BLOCK_FRAMES * sizeof(double));
+    pcm = (int16_t *)malloc(2 * BENCH_BLOCK_FRAMES * sizeof(int16_t));
+    f = fopen(out_file, "wb");
+    if (!mix_r || !mix_l || !pcm || !f){
+        fprintf(stderr, f ? "Out of memory!\n" : "Unable to open file for output!\n");
+        ok = 0;
+    }
+
+    if (ok){
+        write_wav_header(f, total, WAV_PCM16);
+
+        t0 = wall_time();
+        ok = mix_cursor_seek(&c, &bus, 0);
+        t->synth += 1000.0 * (wall_time() - t0);
+        for (a = 0; ok && a < total; a = b){
+            b = a + BENCH_BLOCK_FRAMES;
+            if (b > total) b = total;
+
+            t0 = wall_time();
+            ok = mix_cursor_run(&c, &bus, b, mix_r, mix_l);
+            t->synth += 1000.0 * (wall_time() - t0);
+
+            t0 = wall_time();
+            wav_convert(mix_r, mix_l, pcm, b - a, a);
+            fwrite(pcm, 2 * sizeof(int16_t), (size_t)(b - a), f);
+            t->write += 1000.0 * (wall_time() - t0);
+        }
+        mix_cursor_free(&c);
+    }
+    if (f) fclose(f);
+    mix_bus_free(&bus);
+    free(mix_r);
+    free(mix_l);
+    free(pcm);
+    if (!ok) return 0;
+
+    //The whole render as the program does it.
+    memset(&stats, 0, sizeof(stats));
+    t0 = wall_time();
+    ok = render_file(head, g->bar_length, out_file, &stats);
+    t->end_to_end = 1000.0 * (wall_time() - t0);
+    return ok;
+}
+
+static void bench_usage(const char *program){
+    fprintf(stderr,
+            "Usage: %s --bench [options]\n"
+            "Generates a synthetic score and times every stage. The results are printed as JSON on stdout.\n"
+            "  -n N      number of notes (default 10000)\n"
+            "  -p P      average number of notes sounding at the same time (default 8);\n"
+            "            the song lasts about N * 3 s / P\n"
+            "  -l NOTE   lowest note (default C2)\n"
+            "  -H NOTE   highest note (default C7)\n"
+            "  -s ORDER  order of the notes in the score: sorted, reversed or shuffled (default sorted)\n"
+            "  -b SEC    duration of one bar in seconds (default 2)\n"
+            "  -t N      render threads of the end-to-end render (default 1, 0 = one per processor)\n"
+            "  -r N      runs; the best time of every stage is reported (default 3)\n"
+            "  -S SEED   seed of the generator (default 1)\n"
+            "  -q MODE   number format of the synthesis: double (default), float, q31 or q15\n"
+            "  -d 0|1    TPDF dither of the 16-bit output (default 0)\n"
+            "  -k 0|1    prototype mode: all notes of a pitch play one cached waveform (default 0)\n"
+            "  -R RATE   sample rate in Hz (default 44100)\n"
+            "  -o FILE   .wav file to write (default: the null device)\n"
+            "  -f FILE   also save the generated score to FILE\n",
+            program);
+}
+
+/*Command line entry point of the benchmark (argv[0] is the program name, the options follow).
+Returns EXIT_SUCCESS or EXIT_FAILURE. */
+int bench_main(int argc, char **argv){
+    bench_score g;
+    bench_times t, best;
+    score sc;
+    arena notes;
+    char *text;
+    const char *out_file = BENCH_NULL_DEVICE, *score_file = NULL, *low = "C2", *high = "C7", *order = "sorted";
+    size_t len;
+    int64_t frames = 0;
+    double seconds, pipeline_ms;
+    int i, runs = 3, ok = 1;
+    FILE *f;
+
+    note_table_builtin();
+    memset(&g, 0, sizeof(g));
+    memset(&best, 0, sizeof(best));
+    g.n_notes = 10000;
+    g.polyphony = 8;
+    g.bar_length = 2;
+    g.seed = 1;
+    RS(threads) = 1;
+    RS(report) = 0; //The benchmark prints its own report.
+
+    for (i = 1; ok && i < argc; i++){
+        if (strcmp(argv[i], "-h") == 0){
+            bench_usage(argv[0]);
+            return EXIT_SUCCESS;
+        }
+        if (argv[i][0] != '-' || argv[i][1] == '\0' || argv[i][2] != '\0' || strchr("nplHsbtrSofqdRk", argv[i][1]) == NULL){
+            fprintf(stderr, "Unknown option %s.\n", argv[i]);
+            ok = 0;
+            break;
+        }
+        if (i + 1 >= argc){
+            fprintf(stderr, "Option %s needs a value.\n", argv[i]);
+            ok = 0;
+            break;
+        }
+        switch (argv[i][1]){
+        case 'n': g.n_notes = atoi(argv[i + 1]); break;
+        case 'p': g.polyphony = atof(argv[i + 1]); break;
+        case 'l': low = argv[i + 1]; break;
+        case 'H': high = argv[i + 1]; break;
+        case 's': order = argv[i + 1]; break;
+        case 'b': g.bar_length = atoi(argv[i + 1]); break;
+        case 't': RS(threads) = atoi(argv[i + 1]); break;
+        case 'r': runs = atoi(argv[i + 1]); break;
+        case 'S': g.seed = strtoull(argv[i + 1], NULL, 10); break;
+        case 'o': out_file = argv[i + 1]; break;
+        case 'f': score_file = argv[i + 1]; break;
+        case 'q': RS(precision) = precision_from_name(argv[i + 1]); break;
+        case 'd': RS(dither) = atoi(argv[i + 1]) != 0; break;
+        case 'k': RS(prototypes) = atoi(argv[i + 1]) != 0; break;
+        case 'R': RS(rate) = atoi(argv[i + 1]); break;
+        }
+        i++;
+    }
+
+    g.low = bench_find_note(low);
+    g.high = bench_find_note(high);
+    if (strcmp(order, "sorted") == 0) g.order = BENCH_SORTED;
+    else if (strcmp(order, "reversed") == 0) g.order = BENCH_REVERSED;
+    else if (strcmp(order, "shuffled") == 0) g.order = BENCH_SHUFFLED;
+    else g.order = -1;
+
+    if (ok && (g.n_notes <= 0 || g.polyphony <= 0 || g.low < 0 || g.high < g.low || g.order < 0
+               || g.bar_length <= 0 || RS(threads) < 0 || runs <= 0 || RS(precision) < 0
+               || RS(rate) < MIN_SAMPLE_RATE || RS(rate) > MAX_SAMPLE_RATE)){
+        fprintf(stderr, "Invalid benchmark settings.\n");
+        ok = 0;
+    }
+    if (!ok){
+        bench_usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    fprintf(stderr, "Generating %d notes (about %.0f s of audio)...\n", g.n_notes,
+            g.n_notes * (double)voice_max_frames() / RS(rate) / g.polyphony);
+    text = bench_generate(&g, &len);
+    if (text == NULL) return EXIT_FAILURE;
+    if (score_file != NULL){
+        f = fopen(score_file, "wb");
+        if (f == NULL || fwrite(text, 1, len, f) != len) fprintf(stderr, "Unable to write '%s'.\n", score_file);
+        if (f) fclose(f);
+    }
+
+    arena_init(&notes, DEFAULT_SLAB_SIZE);
+    if (!score_init(&sc, g.n_notes)){
+        free(text);
+        return EXIT_FAILURE;
+    }
+
+    for (i = 0; ok && i < runs; i++){
+        ok = bench_run(&g, text, len, out_file, &sc, &notes, &t, &frames);
+        if (ok) bench_keep_best(&best, &t, i == 0);
+    }
+
+    if (ok){
+        seconds = (double)frames / RS(rate);
+        pipeline_ms = best.parse + best.sort + best.playlist + best.end_to_end;
+
+        fprintf(stderr, "%d notes, %.1f s of audio, best of %d runs:\n", g.n_notes, seconds, runs);
+        fprintf(stderr, "  table %10.3f ms\n  parse %10.3f ms\n  sort %11.3f ms\n  playlist %7.3f ms\n"
+                        "  schedule %7.3f ms\n  synth %10.3f ms\n  write %10.3f ms\n  render_file %4.3f ms (%d threads)\n",
+                best.table, best.parse, best.sort, best.playlist, best.schedule, best.synth, best.write,
+                best.end_to_end, RS(threads));
+
+        printf("{\"notes\":%d,\"frames\":%lld,\"polyphony\":%g,\"order\":\"%s\",\"sample_rate\":%d,\"precision\":\"%s\",\"dither\":%d,\"prototypes\":%d,\"threads\":%d,\"runs\":%d,"
+               "\"ms\":{\"table\":%.3f,\"parse\":%.3f,\"sort\":%.3f,\"playlist\":%.3f,\"schedule\":%.3f,"
+               "\"synth\":%.3f,\"write\":%.3f,\"render_file\":%.3f},"
+               "\"parse_notes_per_sec\":%.0f,\"sort_notes_per_sec\":%.0f,\"playlist_notes_per_sec\":%.0f,"
+               "\"schedule_frames_per_sec\":%.0f,\"synth_frames_per_sec\":%.0f,\"write_frames_per_sec\":%.0f,"
+               "\"render_frames_per_sec\":%.0f,\"realtime\":%.2f,\"notes_per_sec\":%.0f}\n",
+               g.n_notes, (long long)frames, g.polyphony, order, RS(rate), precision_name(RS(precision)), RS(dither), RS(prototypes), RS(threads), runs,
+               best.table, best.parse, best.sort, best.playlist, best.schedule, best.synth, best.write, best.end_to_end,
+               bench_rate(g.n_notes, best.parse), bench_rate(g.n_notes, best.sort), bench_rate(g.n_notes, best.playlist),
+               bench_rate((double)frames, best.schedule), bench_rate((double)frames, best.synth),
+               bench_rate((double)frames, best.write), bench_rate((double)frames, best.end_to_end),
+               best.end_to_end > 0 ? seconds * 1000.0 / best.end_to_end : 0.0, bench_rate(g.n_notes, pipeline_ms));
+    }
+    else fprintf(stderr, "Benchmark failed!\n");
+
+    score_free(&sc);
+    arena_free(&notes);
+    free(text);
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#ifndef BENCH_H
+#define BENCH_H
+
+#include<stdio.h>
+#include<stdlib.h>
+#include <stdint.h>
+
+//Orders of the notes in a generated score.
+#define BENCH_SORTED 0 //By time, as written by hand
+#define BENCH_REVERSED 1 //Last note first
+#define BENCH_SHUFFLED 2 //Random order
+
+//Settings of the synthetic score.
+typedef struct bench_score_struct{
+	int n_notes; //Number of notes
+	double polyphony; //Average number of notes that sound at the same time
+	int low, high; //Pitch range: indices into note_names/note_freq
+	int order; //BENCH_SORTED, BENCH_REVERSED or BENCH_SHUFFLED
+	int bar_length; //Duration of one bar in seconds
+	uint64_t seed; //Seed of the generator
+} bench_score;
+
+//Wall time of every stage in milliseconds.
+typedef struct bench_times_struct{
+	double table; //Building the note table
+	double parse; //score_parse
+	double sort; //score_sort
+	double playlist; //score_make_playlist_in (notes and their initial waveforms)
+	double schedule; //schedule_notes
+	double synth; //Synthesis (one render cursor)
+	double write; //PCM conversion and fwrite
+	double end_to_end; //render_file from start to end, on RS(threads) threads
+} bench_times;
+
+char* bench_generate(const bench_score* g, size_t* len);
+int bench_main(int argc, char** argv);
+
+#endif // BENCH_H
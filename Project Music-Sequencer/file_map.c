@@ -0,0 +1,117 @@
+/*
+Memory-mapped input files (MapViewOfFile on Windows, mmap elsewhere).
+*/
+
+#define _CRT_SECURE_NO_WARNINGS
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "file_map.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+//Reading the whole file into memory, for files that cannot be mapped.
+static int file_map_read(file_map *m, const char *filename){
+    FILE *f;
+    char *buf = NULL, *t;
+    size_t size = 0, cap = 0, got;
+
+    f = fopen(filename, "rb");
+    if (f == NULL) return 0;
+
+    do{
+        if (size == cap){
+            cap = cap ? 2 * cap : 65536;
+            t = (char *)realloc(buf, cap);
+            if (t == NULL){
+                free(buf);
+                fclose(f);
+                return 0;
+            }
+            buf = t;
+        }
+        got = fread(buf + size, 1, cap - size, f);
+        size += got;
+    } while (got > 0);
+
+    fclose(f);
+    m->data = buf;
+    m->size = size;
+    m->mapped = 0;
+    return 1;
+}
+
+//Opening a file for reading. Returns 1 on success and 0 if the file cannot be opened.
+int file_map_open(file_map *m, const char *filename){
+#ifdef _WIN32
+    HANDLE file, mapping;
+    LARGE_INTEGER size;
+    const void *view;
+
+    m->file = m->mapping = NULL;
+    file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE) return 0;
+
+    if (GetFileSizeEx(file, &size) && size.QuadPart > 0 && (unsigned long long)size.QuadPart <= (size_t)-1){
+        mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+        if (mapping != NULL){
+            view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+            if (view != NULL){
+                m->data = (const char *)view;
+                m->size = (size_t)size.QuadPart;
+                m->mapped = 1;
+                m->file = file;
+                m->mapping = mapping;
+                return 1;
+            }
+            CloseHandle(mapping);
+        }
+    }
+    CloseHandle(file);
+#else
+    int fd;
+    struct stat st;
+    void *view;
+
+    fd = open(filename, O_RDONLY);
+    if (fd < 0) return 0;
+
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0){
+        view = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (view != MAP_FAILED){
+            close(fd);
+            m->data = (const char *)view;
+            m->size = (size_t)st.st_size;
+            m->mapped = 1;
+            return 1;
+        }
+    }
+    close(fd);
+#endif
+    //Empty files, pipes and files that cannot be mapped are read the usual way.
+    return file_map_read(m, filename);
+}
+
+void file_map_close(file_map *m){
+    if (m->mapped){
+#ifdef _WIN32
+        UnmapViewOfFile(m->data);
+        CloseHandle((HANDLE)m->mapping);
+        CloseHandle((HANDLE)m->file);
+#else
+        munmap((void *)m->data, m->size);
+#endif
+    }
+    else free((void *)m->data);
+
+    m->data = NULL;
+    m->size = 0;
+    m->mapped = 0;
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+#ifndef FILE_MAP_H
+#define FILE_MAP_H
+
+#include<stddef.h>
+
+//A read-only view of a whole file. The data is mapped into memory, not copied;
+//if the file cannot be mapped it is read into a buffer instead.
+typedef struct file_map_struct{
+	const char* data;
+	size_t size;
+	int mapped; //1 if data is a memory mapping, 0 if it is a malloc'ed copy
+#ifdef _WIN32
+	void* file; //File and mapping handles
+	void* mapping;
+#endif
+} file_map;
+
+int file_map_open(file_map* m, const char* filename);
+void file_map_close(file_map* m);
+
+#endif // FILE_MAP_H
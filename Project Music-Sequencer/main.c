@@ -1,46 +1,53 @@
 #define _CRT_SECURE_NO_WARNINGS
 
-#include "bst.h"
 #include "note_io.h"
+#include "sequencer.h"
+#include "render.h"
+#include "batch.h"
+#include "bench.h"
+#include "render_cache.h"
+#include "accuracy.h"
+#include "render_daemon.h"
 #include <string.h>
-#include <sys/stat.h> //Needed to access the stat function.
-                      //In this case, stat is used to check whether a file exists.
 
-//The function checks if a file with the specified name exists.
-//It returns 1 if the file exists and 0 if the file does not exist or an error occurred.
-int file_exists(const char* filename) {
-    struct stat buffer;
-    return (stat(filename, &buffer) == 0);
-}
-
-//Generating a file name. If a file with this name already exists, an index is added to it. 
-void generate_new_filename(const char* base_filename, char* new_filename) {
-    int counter = 1;
-    char temp_filename[256];
-    sprintf(temp_filename, "%s.wav", base_filename);
-
-    while (file_exists(temp_filename)) {
-        sprintf(temp_filename, "%s_%d.wav", base_filename, counter);
-        counter++;
-    }
-
-    strcpy(new_filename, temp_filename);
-}
-
-int main() {
-    int choice, bar, semitones, i;
-    double freq, index, time_shift;
-    char note1[5], note2[5];
-    BST_Node* root = NULL;
-    BST_Node* new_note = NULL;
-    BST_Node* t = NULL;
+//With arguments the program renders the given score files in batch mode (see batch_main),
+//"--bench" runs the benchmark (see bench_main), "--accuracy" compares the number formats (see accuracy_main),
+//"--daemon" serves render requests on a socket and "--client" sends them (see render_daemon.h),
+//and without arguments it shows the menu.
+int main(int argc, char** argv) {
+    int choice;
+    sequencer seq;
     char filename[1024];
     char out_filename[1024];
-    char line[1024];
-    FILE* f;
-
-    // Read note names and frequencies from file "frequencies_of_notes.txt".
-    read_note_table();
+    char cache_dir[1024];
+    char reverb_path[1024];
+    int result;
+    double mb;
+
+    //The note names and frequencies of "frequencies_of_notes.txt" are built into the program.
+    sequencer_library_init();
+    if (argc > 1) {
+        if (strcmp(argv[1], "--bench") == 0) {
+            argv[1] = argv[0];
+            result = bench_main(argc - 1, argv + 1);
+        }
+        else if (strcmp(argv[1], "--accuracy") == 0) {
+            argv[1] = argv[0];
+            result = accuracy_main(argc - 1, argv + 1);
+        }
+        else if (strcmp(argv[1], "--daemon") == 0) {
+            argv[1] = argv[0];
+            result = render_daemon_main(argc - 1, argv + 1);
+        }
+        else if (strcmp(argv[1], "--client") == 0) {
+            argv[1] = argv[0];
+            result = render_client_main(argc - 1, argv + 1);
+        }
+        else result = batch_main(argc, argv);
+        sequencer_library_free();
+        return result;
+    }
+    RS(progress) = 1.0; //Progress of long renders, once a second.
 
     choice = 0;
     while (choice != 2) {
@@ -48,6 +55,13 @@ int main() {
         printf("----MENU----\n ");
         printf("1 > Create audio file\n ");
         printf("2 > Exit\n ");
+        printf("3 > Set number of render threads (now %d, 0 = all processors)\n ", RS(threads));
+        printf("4 > Set voice limits (now release at %.1f dB, at most %d voices, 0 = no limit)\n ", RS(threshold_db), RS(polyphony));
+        printf("5 > Set segment cache directory (now %s)\n ", RS(cache_dir) ? RS(cache_dir) : "none");
+        printf("6 > Set synthesis number format (now %s)\n ", precision_name(RS(precision)));
+        printf("7 > Set sample rate (now %d Hz)\n ", RS(rate));
+        printf("8 > Set prototype mode (now %s)\n ", RS(prototypes) ? "on" : "off");
+        printf("9 > Set reverb (now %s, level %.2f)\n ", RS(reverb) ? RS(reverb) : "none", RS(wet));
         printf(">> ");
 
         scanf("%d", &choice);
@@ -67,55 +81,102 @@ int main() {
             fgets(out_filename, 1024, stdin);
             strtok(out_filename, "\n");
 
-            generate_new_filename(out_filename, out_filename);
-
-            f = fopen(filename, "r");
-            if (f == NULL) {
+            //Reading the score: the file is memory-mapped and parsed in one pass.
+            //Each line contains the bar, the index and the note name.
+            //The notes are sorted by time and made into a playlist with the settings chosen in the menu.
+            //The time of every stage goes into the report of the render.
+            if (sequencer_init(&seq) != SEQUENCER_OK || sequencer_load_file(&seq, filename) == SEQUENCER_ERROR_MEMORY) {
+                fprintf(stderr, "Out of memory!\n");
+            }
+            else if (seq.error == SEQUENCER_ERROR_OPEN) {
                 printf("Error: file doesn't open!\n");
             }
             else {
-                //Reading a string from a file.
-                while (fgets(line, 1024, f)) {
-                    //Extracting bar and index.
-                    sscanf(line, "%d %lf", &bar, &index);
-                    i = strlen(line);
-
-                    /*Newline character removal:
-                    * If the last character of the string is a newline character ('\n'), 
-                    * it is replaced with a null character ('\0').*/
-                    if (line[i - 1] == '\n') line[i - 1] = '\0';
-
-                    /*Note extraction: 
-                    * If the penultimate character of a line is a tab ('\t'), the line is copied starting from the third character from the end. 
-                    * Otherwise, the string is copied starting from the fourth character from the end to the note1 variable.*/
-                    if (line[i - 4] == '\t') strcpy(note1, &line[i - 3]);
-                    else strcpy(note1, &line[i - 4]);
-
-                    //Frequency initialization: The note frequency (freq) is initialized to -1.
-                    /*Note frequency search: 
-                    * The note in the note_names array is searched.
-                    * If a note is found, freq is set to the appropriate value from the note_freq array.*/
-                    freq = -1;
-                    for (i = 0; i < 100; i++) {
-                        if (strcmp(note_names[i], note1) == 0) { freq = note_freq[i]; break; }
-                    }
-
-                    //Node creation and insertion: If freq is greater than 0, a new Binary Search Tree (BST) node with frequency, beat, and index is created and inserted into the tree.
-                    if (freq > 0) {
-                        new_note = newBST_Node(freq, bar, index);
-                        root = BST_insert(root, new_note);
+                mb = (double)seq.score_bytes / (1024.0 * 1024.0);
+                fprintf(stderr, "Parsed %d notes (%.3f MB) in %.3f ms, %.1f MB/s\n", seq.score_notes, mb,
+                        seq.stats.load_ms, seq.stats.load_ms > 0 ? mb / (seq.stats.load_ms / 1000.0) : 0.0);
+                if (seq.error != SEQUENCER_OK) {
+                    printf("Error: %s!\n", sequencer_error_text(seq.error));
+                }
+                //The output file name is chosen (and the file created) only when there are notes to write.
+                else if (!generate_new_filename(out_filename, out_filename)) {
+                    printf("Error: output file can't be created!\n");
+                }
+                else {
+                    fprintf(stderr, "\nThe song will be written to the '%s' file.\nPlease wait.\n\n", out_filename);
+                    if (sequencer_render(&seq, out_filename) == SEQUENCER_OK) {
+                        fprintf(stderr, "Memory: %zu notes (note arena peak %.1f KB), %zu delay lines (%zu reused, arena peak %.1f KB)\n",
+                                seq.stats.note_allocs, seq.stats.note_peak_bytes / 1024.0, seq.stats.delay_allocs,
+                                seq.stats.delay_reused, seq.stats.delay_peak_bytes / 1024.0);
                     }
                 }
-                fclose(f);
             }
-            //Creating a playlist, writing to a file, and clearing the binary tree.
-            BST_makePlayList(root);
-            play_notes(2, out_filename);
-            delete_BST(root);
-            root = NULL;
+            sequencer_free(&seq);
+        }
+        else if (choice == 3){
+            //The song is split into time segments that are rendered in parallel.
+            //The output does not depend on the number of threads.
+            printf("Input number of render threads: \n> ");
+            if (scanf("%d", &RS(threads)) != 1 || RS(threads) < 0) RS(threads) = 1;
+            getchar();
+        }
+        else if (choice == 4){
+            //A voice is released when its level falls below the threshold, or when a new note steals it
+            //because RS(polyphony) voices are already playing.
+            printf("Input release threshold in dB (for example -96): \n> ");
+            if (scanf("%lf", &RS(threshold_db)) != 1) RS(threshold_db) = DEFAULT_VOICE_THRESHOLD_DB;
+            getchar();
+            printf("Input maximum number of voices (0 = no limit): \n> ");
+            if (scanf("%d", &RS(polyphony)) != 1 || RS(polyphony) < 0) RS(polyphony) = 0;
+            getchar();
+        }
+        else if (choice == 5){
+            //With a cache directory, a song that is rendered again after an edit of its score
+            //only synthesizes the bars that changed.
+            printf("Input segment cache directory (empty = no cache): \n> ");
+            if (fgets(cache_dir, 1024, stdin) == NULL) cache_dir[0] = '\0';
+            cache_dir[strcspn(cache_dir, "\r\n")] = '\0';
+            RS(cache_dir) = cache_dir[0] ? cache_dir : NULL;
+        }
+        else if (choice == 6){
+            //float and the fixed-point formats are faster or smaller than double, at a small loss of accuracy
+            //(see "--accuracy").
+            printf("Input number format (double, float, q31 or q15): \n> ");
+            if (fgets(filename, 1024, stdin) == NULL) filename[0] = '\0';
+            filename[strcspn(filename, "\r\n")] = '\0';
+            if (precision_from_name(filename) >= 0) RS(precision) = precision_from_name(filename);
+            else printf("Unknown number format %s.\n", filename);
+        }
+        else if (choice == 7){
+            //A preview at 11025 or 22050 Hz takes a quarter or half of the time; 48000 or 96000 Hz are for final masters.
+            printf("Input sample rate in Hz (11025, 22050, 44100, 48000, 96000, ...): \n> ");
+            if (scanf("%d", &RS(rate)) != 1 || RS(rate) < MIN_SAMPLE_RATE || RS(rate) > MAX_SAMPLE_RATE){
+                printf("The sample rate must be between %d and %d Hz.\n", MIN_SAMPLE_RATE, MAX_SAMPLE_RATE);
+                RS(rate) = DEFAULT_SAMPLE_RATE;
+            }
+            getchar();
+        }
+        else if (choice == 8){
+            //The seeds of the notes are chosen when the score is read, so the mode applies to the next score.
+            printf("Input 1 to play every note of a pitch from one cached waveform, 0 for a voice per note: \n> ");
+            if (scanf("%d", &RS(prototypes)) != 1) RS(prototypes) = 0;
+            RS(prototypes) = RS(prototypes) != 0;
+            getchar();
+        }
+        else if (choice == 9){
+            //The impulse response is a .wav file, for example the recording of a hand clap in a hall.
+            printf("Input impulse response file (.wav, empty = no reverb): \n> ");
+            if (fgets(reverb_path, 1024, stdin) == NULL) reverb_path[0] = '\0';
+            reverb_path[strcspn(reverb_path, "\r\n")] = '\0';
+            RS(reverb) = reverb_path[0] ? reverb_path : NULL;
+            if (RS(reverb) != NULL){
+                printf("Input reverb level (for example %.1f): \n> ", DEFAULT_REVERB_WET);
+                if (scanf("%lf", &RS(wet)) != 1 || RS(wet) <= 0) RS(wet) = DEFAULT_REVERB_WET;
+                getchar();
+            }
         }
     }
-    //Clearing the tree before exiting the program.
-    delete_BST(root);
+    //Clearing the prototypes before exiting the program.
+    sequencer_library_free();
     return 0;
 }
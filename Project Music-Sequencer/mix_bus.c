@@ -0,0 +1,184 @@
+/*
+Mixing bus of a song with several tracks.
+Every track of the playlist is rendered on its own, with its own voices, into a buffer of its own; the bus then sums
+the tracks block by block in track order, each with the gain and pan of its track. The tracks do not depend on each
+other, so they can be rendered on different threads, and the sum is the same for any number of threads.
+A song with only the main track at gain 1 in the centre is rendered straight into the mix, as before there were tracks.
+*/
+
+#define _CRT_SECURE_NO_WARNINGS
+
+#include <string.h>
+#include "mix_bus.h"
+
+//The gains of a track follow from its gain and pan: the pan turns down the channel on the other side,
+//so a track in the centre keeps both channels at its gain.
+static void mix_track_gains(const mix_track *track, double *gain_r, double *gain_l){
+    *gain_r = track->gain * (track->pan < 0 ? 1.0 + track->pan : 1.0);
+    *gain_l = track->gain * (track->pan > 0 ? 1.0 - track->pan : 1.0);
+}
+
+/*Splitting a scheduled playlist into its tracks (see mix_track).
+Returns 1 on success and 0 if there is not enough memory. */
+int mix_bus_init(mix_bus *m, note *head){
+    note *q;
+    int t, *fill = NULL;
+
+    memset(m, 0, sizeof(mix_bus));
+    m->n_tracks = 1;
+    for (q = head; q != NULL; q = q->next){
+        m->n_notes++;
+        if (q->track->index >= m->n_tracks) m->n_tracks = q->track->index + 1;
+    }
+
+    m->notes = (note **)malloc((m->n_notes + 1) * sizeof(note *));
+    m->first = (int *)calloc(m->n_tracks + 1, sizeof(int));
+    m->gain_r = (double *)malloc(m->n_tracks * sizeof(double));
+    m->gain_l = (double *)malloc(m->n_tracks * sizeof(double));
+    fill = (int *)malloc(m->n_tracks * sizeof(int));
+    if (!m->notes || !m->first || !m->gain_r || !m->gain_l || !fill){
+        fprintf(stderr, "Out of memory!\n");
+        free(fill);
+        mix_bus_free(m);
+        return 0;
+    }
+
+    //Counting the notes of every track, then placing them track by track.
+    for (t = 0; t < m->n_tracks; t++){
+        m->gain_r[t] = m->gain_l[t] = 1.0;
+    }
+    for (q = head; q != NULL; q = q->next) m->first[q->track->index + 1]++;
+    for (t = 0; t < m->n_tracks; t++){
+        m->first[t + 1] += m->first[t];
+        fill[t] = m->first[t];
+    }
+    for (q = head; q != NULL; q = q->next){
+        t = q->track->index;
+        m->notes[fill[t]++] = q;
+        if (fill[t] - 1 == m->first[t]) mix_track_gains(q->track, &m->gain_r[t], &m->gain_l[t]);
+    }
+    free(fill);
+    return 1;
+}
+
+/*Adding a track to the gains of the bus, as track m->n_tracks (the index of 'track').
+Used for playlists that arrive note by note (see render_spool.c), where the bus has gains but no notes.
+Returns 1 on success and 0 if there is not enough memory. */
+int mix_bus_add_track(mix_bus *m, const mix_track *track){
+    double *t;
+
+    t = (double *)realloc(m->gain_r, (m->n_tracks + 1) * sizeof(double));
+    if (t != NULL) m->gain_r = t;
+    if (t == NULL || (t = (double *)realloc(m->gain_l, (m->n_tracks + 1) * sizeof(double))) == NULL){
+        fprintf(stderr, "Out of memory!\n");
+        return 0;
+    }
+    m->gain_l = t;
+    mix_track_gains(track, &m->gain_r[m->n_tracks], &m->gain_l[m->n_tracks]);
+    m->n_tracks++;
+    return 1;
+}
+
+void mix_bus_free(mix_bus *m){
+    free(m->notes);
+    free(m->first);
+    free(m->gain_r);
+    free(m->gain_l);
+    memset(m, 0, sizeof(mix_bus));
+}
+
+//The notes of track t; their number is returned in 'n_notes'.
+note **mix_bus_track(const mix_bus *m, int t, int *n_notes){
+    *n_notes = m->first[t + 1] - m->first[t];
+    return m->notes + m->first[t];
+}
+
+/*Mixing n frames of track t into mix_r/mix_l. Track 0 sets the mix and the other tracks are added to it,
+so the tracks must be mixed in order. r/l may be the same buffers as mix_r/mix_l. */
+void mix_bus_add(const mix_bus *m, int t, const double *r, const double *l, double *mix_r, double *mix_l, int64_t n){
+    double gr = m->gain_r[t], gl = m->gain_l[t];
+    int64_t k;
+
+    if (t == 0){
+        if (r == mix_r && l == mix_l && gr == 1.0 && gl == 1.0) return;
+        for (k = 0; k < n; k++){
+            mix_r[k] = gr * r[k];
+            mix_l[k] = gl * l[k];
+        }
+    }
+    else{
+        for (k = 0; k < n; k++){
+            mix_r[k] += gr * r[k];
+            mix_l[k] += gl * l[k];
+        }
+    }
+}
+
+//Placing a render cursor on every track at 'frame' (see render_cursor_seek).
+int mix_cursor_seek(mix_cursor *c, const mix_bus *m, int64_t frame){
+    note **notes;
+    int t, n;
+
+    memset(c, 0, sizeof(mix_cursor));
+    c->pos = frame;
+    c->track = (render_cursor *)malloc(m->n_tracks * sizeof(render_cursor));
+    if (c->track == NULL){
+        fprintf(stderr, "Out of memory!\n");
+        return 0;
+    }
+    for (t = 0; t < m->n_tracks; t++){
+        notes = mix_bus_track(m, t, &n);
+        c->n_seek++;
+        if (!render_cursor_seek(&c->track[t], notes, n, frame)) return 0;
+    }
+    return 1;
+}
+
+/*Rendering the frames from the cursor position up to 'end' (exclusive) into mix_r/mix_l: every track is rendered
+into the track buffer and mixed. Track 0 is rendered into the mix itself.
+Returns 1 on success and 0 if there is not enough memory. */
+int mix_cursor_run(mix_cursor *c, const mix_bus *m, int64_t end, double *mix_r, double *mix_l){
+    note **notes;
+    double *t_r, *t_l;
+    int t, n;
+    int64_t frames = end - c->pos;
+
+    if (frames > c->capacity && m->n_tracks > 1){
+        t_r = (double *)realloc(c->track_r, frames * sizeof(double));
+        if (t_r != NULL) c->track_r = t_r;
+        t_l = (double *)realloc(c->track_l, frames * sizeof(double));
+        if (t_l != NULL) c->track_l = t_l;
+        if (t_r == NULL || t_l == NULL){
+            fprintf(stderr, "Out of memory!\n");
+            return 0;
+        }
+        c->capacity = frames;
+    }
+
+    for (t = 0; t < m->n_tracks; t++){
+        notes = mix_bus_track(m, t, &n);
+        t_r = t == 0 ? mix_r : c->track_r;
+        t_l = t == 0 ? mix_l : c->track_l;
+        if (!render_cursor_run(&c->track[t], notes, n, end, t_r, t_l)) return 0;
+        mix_bus_add(m, t, t_r, t_l, mix_r, mix_l, frames);
+    }
+    c->pos = end;
+    return 1;
+}
+
+//Adding the statistics of the cursors of all tracks to 'stats' (see render_cursor_stats).
+void mix_cursor_stats(mix_cursor *c, render_stats *stats){
+    int t;
+
+    for (t = 0; t < c->n_seek; t++) render_cursor_stats(&c->track[t], stats);
+}
+
+void mix_cursor_free(mix_cursor *c){
+    int t;
+
+    for (t = 0; t < c->n_seek; t++) render_cursor_free(&c->track[t]);
+    free(c->track);
+    free(c->track_r);
+    free(c->track_l);
+    memset(c, 0, sizeof(mix_cursor));
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#ifndef MIX_BUS_H
+#define MIX_BUS_H
+
+#include<stdio.h>
+#include<stdlib.h>
+#include <stdint.h>
+#include"render.h"
+
+//The tracks of a scheduled playlist and the gains with which they are summed into the song.
+typedef struct mix_bus_struct{
+	int n_tracks;
+	int n_notes;
+	note** notes; //Notes of all tracks, track by track, each track in playlist order
+	int* first; //The notes of track t are notes[first[t]] .. notes[first[t + 1] - 1]
+	double* gain_r; //Right and left gain of every track (gain and pan together)
+	double* gain_l;
+} mix_bus;
+
+//Rendering of all tracks of a mix bus from one position: one render cursor per track.
+typedef struct mix_cursor_struct{
+	render_cursor* track; //Cursor of every track
+	int n_seek; //Cursors that have been placed
+	double* track_r; //Samples of one track before they are mixed
+	double* track_l;
+	int64_t capacity; //Frames of track_r/track_l
+	int64_t pos; //Next frame to render
+} mix_cursor;
+
+int mix_bus_init(mix_bus* m, note* head);
+int mix_bus_add_track(mix_bus* m, const mix_track* track);
+void mix_bus_free(mix_bus* m);
+note** mix_bus_track(const mix_bus* m, int t, int* n_notes);
+void mix_bus_add(const mix_bus* m, int t, const double* r, const double* l, double* mix_r, double* mix_l, int64_t n);
+int mix_cursor_seek(mix_cursor* c, const mix_bus* m, int64_t frame);
+int mix_cursor_run(mix_cursor* c, const mix_bus* m, int64_t end, double* mix_r, double* mix_l);
+void mix_cursor_stats(mix_cursor* c, render_stats* stats);
+void mix_cursor_free(mix_cursor* c);
+
+#endif // MIX_BUS_H
@@ -1,32 +1,38 @@
 /*
 Note synthesizer implementation. 
 This file describes the functions of reading note frequencies, 
-initializing a note from input values, inserting a note into a playlist, implementing the Karplus-Strong algorithm, writing a file header, and writing notes to a file.
+initializing a note from input values, implementing the Karplus-Strong algorithm, and writing a file header.
 */
 
 #define _CRT_SECURE_NO_WARNINGS
 
 #include <math.h>
 #include "note_io.h"
+#include "render.h"
+#include "note_table.h"
+#include "prototype.h"
 
 #define PI 3.14159265358979323846
 
-note* playlist_head = NULL;
+const mix_track main_track = { 0, 1.0, 0.0 };
 
 //Read note names and frequencies from file "frequencies_of_notes.txt". Don't rename it!
-void read_note_table(void){
+//The same table is built into the program (note_table_builtin); this function is only needed for a changed table.
+//The table is shared by all renders, so it must not be read while a render runs.
+//Returns 1 on success and 0 if the file cannot be opened.
+int read_note_table(void){
     FILE *f;
     char line[1024];
     int idx;
    
     f = fopen("frequencies_of_notes.txt", "r");
     if (f == NULL){
-      printf("Error: file doesn't open!\n");
-      exit(EXIT_FAILURE);
+      fprintf(stderr, "Error: file doesn't open!\n");
+      return 0;
     }
     
     idx = 0;
-    while (fgets(&line[0], 1024, f))
+    while (idx < 100 && fgets(&line[0], 1024, f))
     {
       note_names[idx][0] = line[0];
       note_names[idx][1] = line[1];
@@ -41,73 +47,99 @@ void read_note_table(void){
       
       idx++;
     }
+    fclose(f);
+
+    note_table_index(idx);
+    return 1;
+}
+
+//Next value of a note's random generator (splitmix64).
+static uint64_t note_rng_next(uint64_t *state){
+    uint64_t z = (*state += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+//Uniform random number from 0.0 to 1.0 (53 random bits).
+static double note_rng_uniform(uint64_t *state){
+    return (double)(note_rng_next(state) >> 11) * (1.0 / 9007199254740991.0);
+}
+
+//Seed of a note's random generator. It depends only on RS(seed) and on the note itself (frequency and position),
+//so a note always gets the same initial waveform, whatever the order in which notes are created or rendered.
+uint64_t note_seed(double freq, int bar, double index){
+    uint64_t h = RS(seed), bits;
+
+    memcpy(&bits, &freq, sizeof(bits));
+    h ^= note_rng_next(&bits);
+    h = note_rng_next(&h) ^ (uint64_t)(uint32_t)bar;
+    memcpy(&bits, &index, sizeof(bits));
+    h ^= note_rng_next(&bits);
+    return note_rng_next(&h);
 }
 
 //Creating and initializing a note from an input file that describe the note's frequency, and its position in the song.
-note *new_note(double freq, int bar, double index){
+//The note and its waveform are allocated next to each other in the arena 'a' (every playlist has its own).
+//Returns NULL if there is not enough memory.
+note *new_note_in(arena *a, double freq, int bar, double index){
     note *n;
-    n = (note *)calloc(1, sizeof(note));
+    int wave_length;
 
+    //The size of the waveform array should match the number of samples needed to represent a waveform at the note's frequency.
+    //The formula is: length = sampling_rate / note_frequency.
+    wave_length = round((double)RS(rate) / freq);
+    if (wave_length < 2) wave_length = 2; //Notes near the Nyquist frequency of a low preview rate
+
+    n = (note *)arena_alloc(a, sizeof(note) + wave_length * sizeof(double));
     if (!n){
         fprintf(stderr, "Out of memory!\n");
-        exit(EXIT_FAILURE);
+        return NULL;
     }
+    //The waveform array directly follows the note record.
+    note_init(n, freq, bar, index, (double *)(n + 1));
+    return(n);
+}
+
+/*Initializing the note record 'n' for a note of frequency 'freq' at (bar, index), with its initial waveform in 'waveform'
+(wave_length values). With 'waveform' NULL the note is lazy: it has no waveform until it is played, when the voice bank
+makes it from the note's seed (see note_waveform). Lazy notes keep the memory of a long playlist small. */
+void note_init(note *n, double freq, int bar, double index, double *waveform){
+    uint64_t rng;
+
+    memset(n, 0, sizeof(note));
  
     n->freq = freq;
     n->bar = bar;
     n->index = index;
     n->input_idx = 0;
     n->output_idx = 1;
-    n->out_tminus1 = ((double)rand() / (double)RAND_MAX)-.5;
+    //Each note has its own random generator, seeded from the note itself.
+    //In prototype mode all notes of a pitch have the same seed, so they can share one waveform (see prototype.h).
+    n->seed = RS(prototypes) ? note_seed(freq, 0, 0.0) : note_seed(freq, bar, index);
+    rng = n->seed;
+    n->out_tminus1 = note_rng_uniform(&rng)-.5;
     n->n_sampled = 0;
+    n->time = bar + index;
+    n->tempo = 1.0;
+    n->track = &main_track;
     n->next = NULL;
 
-    //Creating a dynamically allocated array to store the waveform of the note.
-    //The size of this array should match the number of samples needed to represent a waveform at the note's frequency.
-    //The formula is: length = sampling_rate / note_frequency.
-    n->wave_length = round((double)FS / n->freq);
-    n->waveform = (double *)calloc(n->wave_length, sizeof(double));
+    n->wave_length = round((double)RS(rate) / freq);
+    if (n->wave_length < 2) n->wave_length = 2;
+    n->waveform = waveform;
+    if (waveform != NULL) note_waveform(n, waveform);
+}
 
-    if (!n){
-    fprintf(stderr,"Ran out of memory allocating waveform.\n");
-    return(NULL);
-    }
+//Writing the initial waveform of note 'n' (wave_length values) to 'waveform'. The values follow out_tminus1 in the
+//note's random generator, so a lazy note gets the same waveform as one that was created with it.
+void note_waveform(const note *n, double *waveform){
+    uint64_t rng = n->seed;
 
-    //Initializing the note's waveform. 
+    note_rng_uniform(&rng); //out_tminus1
     for (int i = 0; i < n->wave_length; i++){
-        *(n->waveform + i) = (1.0*(double)rand() / (double)RAND_MAX)-.5;
+        *(waveform + i) = (1.0*note_rng_uniform(&rng))-.5;
     }
-
-    return(n);
-}
-
-//Inserting a new note at the requested location. 
-note *playlist_insert(note *head, double freq, int bar, double index){
-    note *n_n, *p;
-    n_n = new_note(freq, bar, index);
-
-    if (n_n == NULL) return head;
-    if (head == NULL) return n_n;
-
-    p = head;
-
-    while (p->next != NULL) p = p->next;
-
-    p->next = n_n;
-
-    return head;  
-}
-
-//Releasing memory
-void delete_playlist(note *head){
-   note *t;
-   
-   while (head != NULL){
-     t = head->next;
-     free(head->waveform);
-     free(head);
-     head = t;
-   }
 }
 
 /*Simulating the sound of a plucked string.
@@ -129,7 +161,7 @@ double KS_string_sample(note *n){
     double cutoff_frequency = 30000.0; //The cutoff frequency of the filter.
     double RC = 1.0 / (cutoff_frequency * 2 * PI); //Filter time constant, which is calculated by the formula for RC-chain in a low-pass filter. 
                                                    //The smaller the RC, the faster the filter responds to changes in the input signal.
-    double alpha = 1.0 / (1.0 + RC * FS); //Filter smoothing factor, which determines how much the new input signal affects the filter output. 
+    double alpha = 1.0 / (1.0 + RC * RS(rate)); //Filter smoothing factor, which determines how much the new input signal affects the filter output. 
                                           //An alpha value close to 1 means that the influence of the new input is greater, while a value close to 0 means that the influence of the previous output is greater.
     
     new_input = alpha * new_input + (1 - alpha) * n->previous_input;
@@ -137,7 +169,7 @@ double KS_string_sample(note *n){
 
     // Update delay length based on note frequency
     double frequency = n->freq;  // Adjust as needed
-    int delay_length = (int)(FS / frequency);
+    int delay_length = (int)(RS(rate) / frequency);
     if (delay_length < 1) delay_length = 1;  // Ensure delay length is at least 1
 
     // Update internal state
@@ -152,177 +184,74 @@ double KS_string_sample(note *n){
     return(output);
 }
 
-//Writing out the .wav header for the output file.
-void write_wav_header(FILE *f, unsigned int samples){
-    char txt[250];
-    uint32_t chunk2size;
-    uint32_t tmp;
-    unsigned char tmp2;
-    // Compute the chunk size in bytes
-    chunk2size = samples * 2 * 16 / 8; //samples, 2 channels, 16 bits/channel, 8 bits per byte
-
-    strcpy(&txt[0], "RIFF"); //RIFF (Resource Interchange File Format) header
-    fwrite(&txt[0], 4*sizeof(unsigned char), 1, f);
-    //Writing the size of the entire file minus the 8 bytes for "RIFF" and file size
-    tmp = chunk2size + 36; //36 bytes for headers excluding the data chunk
-    fwrite(&tmp, 4 * sizeof(unsigned char), 1, f);
-
-    strcpy(&txt[0], "WAVE"); //Wave file identifier
-    fwrite(&txt[0], 4 * sizeof(unsigned char), 1, f);
-
-    strcpy(&txt[0], "fmt "); //Format section
-    fwrite(&txt[0], 4 * sizeof(unsigned char), 1, f);
-    tmp = 16;
-    fwrite(&tmp, 4 * sizeof(unsigned char), 1, f);
-    tmp2 = 1;
-    fwrite(&tmp2, sizeof(unsigned char), 1, f);
-    tmp2 = 0;		
-    fwrite(&tmp2, sizeof(unsigned char), 1, f);
-    tmp2 = 2;
-    fwrite(&tmp2, sizeof(unsigned char), 1, f);
-    tmp2 = 0;		
-    fwrite(&tmp2, sizeof(unsigned char), 1, f);
-    tmp = FS; //Writing the sample rate
-    fwrite(&tmp, 4 * sizeof(unsigned char), 1, f); //Sampling rate
-    tmp = FS * 2 * 16 / 8;	//Byte rate (sampling rate * num channels * bits/channel / 8 bits)				
-    fwrite(&tmp, 4 * sizeof(unsigned char), 1, f); 
-    tmp2 = 2 * 16 / 8; //Block alignment (number of channels * bits per sample / 8)
-    fwrite(&tmp2, sizeof(unsigned char), 1, f);
-    tmp2 = 0;
-    fwrite(&tmp2, sizeof(unsigned char), 1, f);
-    tmp2 = 16; //Bits per sample
-    fwrite(&tmp2, sizeof(unsigned char), 1, f);
-    tmp2 = 0;
-    fwrite(&tmp2, sizeof(unsigned char), 1, f); 
-
-    strcpy(&txt[0], "data"); //Data field follows
-    fwrite(&txt[0], 4 * sizeof(unsigned char), 1, f); 
-    //Writing the size of the data chunk
-    fwrite(&chunk2size, 4 * sizeof(unsigned char), 1, f);
-}
+//Storing a value in little-endian byte order, as in the .wav header.
+static void put_le(unsigned char *p, uint64_t value, int bytes){
+    int i;
 
-/*The main synthesis function.
-It starts a time counter from bar=1, idex=0 and plays out the notes in the song at the specified times. 
-Notes are placed in a temporary linked list and pointers are used to keep track of which notes are active at any given moment.
-bar_length indicates the duration in seconds for each bar, and controls the overall speed of playback. */
-void play_notes(int bar_length, const char* filename){
-    note *q, *st, *ed;
-    int bar, max_bar, max_length, s_idx;
-    double index;
-    unsigned int sample_idx, max_sample_idx;
-    int16_t this_sample_int;
-    double this_sample, this_sample_r, this_sample_l;
-    double balance,fAmp;
-    int done;
-    FILE *f;
+    for (i = 0; i < bytes; i++) p[i] = (unsigned char)(value >> (8 * i));
+}
 
-    if (playlist_head == NULL){
-        printf("Input playlist is empty!\n");
-        return;
+/*Writing out the .wav header for the output file: 'frames' stereo frames of 16-bit integer (WAV_PCM16)
+or 32-bit float (WAV_FLOAT32) samples. The header always has room for a "ds64" chunk (written as a "JUNK" chunk
+that players skip), so it has the same size for any length: files with more than 4 GiB of samples are written
+as RF64, where the 32-bit sizes are 0xFFFFFFFF and the real sizes are in the ds64 chunk.
+A writer that does not know the length yet writes the header with 0 frames and patches it at the end (see wav_header_patch).
+With WAV_UNKNOWN_LENGTH frames, the sizes are 0xFFFFFFFF, which players read as a stream that lasts until the end
+of the file; it is used for outputs that cannot be patched (see wav_header_start). */
+void write_wav_header(FILE *f, int64_t frames, int format){
+    unsigned char h[WAV_HEADER_MAX];
+    int n = 0, bits = format == WAV_FLOAT32 ? 32 : 16;
+    uint64_t data_bytes = (uint64_t)frames * 2 * (bits / 8); //frames, 2 channels, bits/channel, 8 bits per byte
+    uint64_t riff_bytes = wav_header_bytes(format) - 8 + data_bytes; //size of the entire file minus "RIFF" and the size
+    int rf64 = riff_bytes > 0xFFFFFFFFULL;
+
+    if (frames == WAV_UNKNOWN_LENGTH){
+        data_bytes = riff_bytes = frames = 0xFFFFFFFF;
+        rf64 = 0;
     }
 
-    max_bar = 0;
-    q = playlist_head;
-
-    while (q != NULL){
-        max_bar = q->bar;
-        q = q->next;
+    memcpy(h + n, rf64 ? "RF64" : "RIFF", 4); //RIFF (Resource Interchange File Format) header
+    put_le(h + n + 4, rf64 ? 0xFFFFFFFFULL : riff_bytes, 4);
+    memcpy(h + n + 8, "WAVE", 4); //Wave file identifier
+    n += 12;
+
+    //64-bit sizes (RF64) or padding of the same size
+    memset(h + n, 0, 36);
+    memcpy(h + n, rf64 ? "ds64" : "JUNK", 4);
+    put_le(h + n + 4, 28, 4);
+    if (rf64){
+        put_le(h + n + 8, riff_bytes, 8);
+        put_le(h + n + 16, data_bytes, 8);
+        put_le(h + n + 24, (uint64_t)frames, 8);
     }
-
-    max_length = 3 * FS; // Maximum note length, number of seconds * sampling rate.
-
-    //Calculating song length in samples 
-    max_sample_idx = bar_length * FS * (max_bar + 1);
-
-    fprintf(stderr, "\nThe song will be written to the '%s' file.\nPlease wait.\n\n", filename); 
-
-    f = fopen(filename, "wb+");	// Open output file (.wav) for writing.
-    if (f){
-        //Main loop of the synthesis part. 
-        //Monitors the current bar:index position and plays any notes that are active within this interval.
-        write_wav_header(f,max_sample_idx);
-
-        st = ed = playlist_head;
-        sample_idx = 0; 
-
-        for (bar = playlist_head->bar; bar <= max_bar; bar++){
-            for (index=0; index <= 1.0; index += 1.0 / (bar_length * 44100.0)){
-                
-                done = 0;
-                while(!done){
-                    done = 1;
-                    if (ed->next != NULL){
-                        if ((double)ed->next->bar + ed->next->index <= (double)bar + index){
-	                        ed = ed->next;
-	                        done = 1;
-                        }
-                    }
-                }
-    
-                //For each note, generate any needed samples, and output to file
-
-                //Need to generate all the samples for this index
-                if (st!=NULL){
-                    q=st;
-                    this_sample_l=0;
-                    this_sample_r=0;
-
-                    while(ed->next != q){
-                        balance = (q->freq - 525.0);
-
-                        if (balance < 0) balance = (525.0 + balance) / 525.0;
-
-                        else balance = balance / (5000.0 - 525.0);
-
-                        fAmp = (pow(q->freq, .33) / 18.0); //Amplitude boost for high frequencies notes
-                        this_sample = KS_string_sample(q) * fAmp;
-                        this_sample_l += (balance) * this_sample;
-                        this_sample_r += (1.0 - balance) * this_sample;
-                        q = q->next;
-                    }
-
-                    //Transforming to a 2-byte signed integer for each channel, and write to file
-                    this_sample_r = tanh(this_sample_r);
-                    this_sample_int = (int16_t)(this_sample_r * 32700);
-                    fwrite(&this_sample_int, 2 * sizeof(unsigned char), 1, f); //R channel
-                    this_sample_l = tanh(this_sample_l);
-                    this_sample_int = (int16_t)(this_sample_l * 32700);
-                    fwrite(&this_sample_int, 2 * sizeof(unsigned char), 1, f); //L channel
-
-                    sample_idx++;
-                }
-
-                //Fill out the remainder of the file with zeros.
-                else{
-                    for (s_idx = 0; s_idx < 44100; s_idx++){
-                        this_sample_int = 0;
-                        fwrite(&this_sample, 2 * sizeof(unsigned char), 1, f); //L channel
-                        fwrite(&this_sample, 2 * sizeof(unsigned char), 1, f); //R channel
-                        sample_idx++;
-                    }
-                }
- 
-                //Checking if notes have ended 
-                done = 0;
-                while (!done){
-                    done = 1;
-                    if (st != NULL && st != ed->next)
-                    if (st->n_sampled > max_length){
-                    st = st->next;
-                    done = 0;
-                    }       
-                }
-
-                if (sample_idx > max_sample_idx) break;
-            }
-            if (sample_idx > max_sample_idx) break;
-        }
-	
-        fclose(f);
+    n += 36;
+
+    memcpy(h + n, "fmt ", 4); //Format section
+    put_le(h + n + 4, format == WAV_FLOAT32 ? 18 : 16, 4);
+    put_le(h + n + 8, format == WAV_FLOAT32 ? 3 : 1, 2); //1 = integer PCM, 3 = IEEE float
+    put_le(h + n + 10, 2, 2); //Number of channels
+    put_le(h + n + 12, RS(rate), 4); //Sampling rate
+    put_le(h + n + 16, RS(rate) * 2 * bits / 8, 4); //Byte rate (sampling rate * num channels * bits/channel / 8 bits)
+    put_le(h + n + 20, 2 * bits / 8, 2); //Block alignment (number of channels * bits per sample / 8)
+    put_le(h + n + 22, bits, 2); //Bits per sample
+    n += 24;
+    if (format == WAV_FLOAT32){
+        put_le(h + n, 0, 2); //Size of the format extension
+        n += 2;
+        memcpy(h + n, "fact", 4); //Number of frames, required for formats other than integer PCM
+        put_le(h + n + 4, 4, 4);
+        put_le(h + n + 8, rf64 ? 0xFFFFFFFFULL : (uint64_t)frames, 4);
+        n += 12;
     }
-    else fprintf(stderr, "Unable to open file for output!\n");
 
-    //Cleaning playlist
-    delete_playlist(playlist_head);
-    playlist_head = NULL;
+    memcpy(h + n, "data", 4); //Data field follows
+    put_le(h + n + 4, rf64 ? 0xFFFFFFFFULL : data_bytes, 4); //Size of the data chunk
+    n += 8;
+
+    fwrite(h, 1, n, f);
+}
+
+//Size of the header written by write_wav_header: 80 bytes for WAV_PCM16, 94 for WAV_FLOAT32.
+int wav_header_bytes(int format){
+    return format == WAV_FLOAT32 ? 94 : 80;
 }
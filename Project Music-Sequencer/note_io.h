@@ -8,36 +8,59 @@
 #include<string.h>
 #include<math.h>
 #include <stdint.h>
+#include "render_settings.h"
+#include "wav_writer.h"
+#include "arena.h"
 
-#define FS 44100 //The sampling frequency for note generation in Hz. 
+#define DEFAULT_SAMPLE_RATE 44100 //The default sampling frequency for note generation in Hz.
+#define MIN_SAMPLE_RATE 8000 //Lowest sample rate of a render (11025 and 22050 are quick previews)
+#define MAX_SAMPLE_RATE 192000 //Highest sample rate of a render (48000 and 96000 are usual for masters)
+#define WAV_PCM16 0 //Sample format of the .wav file: 16-bit integers
+#define WAV_FLOAT32 1 //Sample format of the .wav file: 32-bit floats
+#define WAV_HEADER_MAX 96 //Largest .wav header in bytes
+#define WAV_UNKNOWN_LENGTH (-1) //Frame count of a .wav header for a stream whose length is not known
+
+//A track of the song. The notes of a track are rendered together, and the track is mixed into the song
+//with its own gain and pan (see mix_bus.h).
+typedef struct mix_track_struct{
+	int index; //Position of the track in the mix, from 0
+	double gain; //Linear gain of the track (1 = unchanged)
+	double pan; //Balance of the track from -1 (left only) through 0 (centre) to 1 (right only)
+} mix_track;
 
 //The data representing a single note
 typedef struct note_struct{
 	double freq; //Note's frequency
 	int bar; //Which bar has a note
 	double index; //Time index within the bar (from 0 to 1.0)
-	double* waveform; //Dynamic array for waves
+	double* waveform; //Dynamic array for waves (NULL for a lazy note, see note_init)
 	double out_tminus1;		
 	double previous_input;	
 	int wave_length;
 	int input_idx, output_idx;
 	int n_sampled; //Counter of samples have been generated for this note. 
 	               //Need to stop playing notes after a specified duration has been reached.
+	uint64_t seed; //Seed of the note's random generator (see note_seed)
+	double time; //Start of the note in bars at the base tempo, from bar 0 (bar + index, or as set by score_make_playlist_in from the tempo changes)
+	double tempo; //Tempo factor in effect at the note (1 = bar_length seconds per bar)
+	int64_t start_sample; //Frame at which the note starts playing (set by schedule_notes)
+	int64_t end_sample; //Frame at which the note is released (set by schedule_notes)
+	const mix_track* track; //Track of the note (main_track, or as set by score_make_playlist_in)
 	struct note_struct* next; //A linked list for notes
 } note;
 
 // GLOBAL data
-extern note* playlist_head;
-char    note_names[100][5]; //Note names from the file "frequencies_of_notes.txt"
-double  note_freq[100]; //Note frequencies from the file "frequencies_of_notes.txt"
-
-void read_note_table(void);
-note* new_note(double freq, int bar, double index);
-note* playlist_insert(note* head, double freq, int bar, double index);
-void delete_playlist(note* head);
+//The settings of the renders (RS(rate), RS(block_frames), RS(seed), ...) are in render_settings.h.
+extern const mix_track main_track; //The only track of a song without track lines: gain 1, centre.
+
+int read_note_table(void);
+uint64_t note_seed(double freq, int bar, double index);
+note* new_note_in(arena* a, double freq, int bar, double index);
+void note_init(note* n, double freq, int bar, double index, double* waveform);
+void note_waveform(const note* n, double* waveform);
 double KS_string_sample(note* n);
-void write_wav_header(FILE* f, unsigned int samples);
-void play_notes(int bar_length, const char* filename);
+void write_wav_header(FILE* f, int64_t frames, int format);
+int wav_header_bytes(int format);
 
 
 #endif // NOTE_IO_H
@@ -0,0 +1,87 @@
+/*
+Note name table.
+The stock table of note names and frequencies (the contents of frequencies_of_notes.txt) is built into the program,
+so no file has to be read at startup. Note names are looked up with a perfect hash:
+a name like "C4" or "F3#" is turned into a unique code from its letter, octave and sharp sign,
+and the code is the index into the frequency table.
+*/
+
+#define _CRT_SECURE_NO_WARNINGS
+
+#include "note_table.h"
+
+//The stock note table, generated from frequencies_of_notes.txt.
+static const struct{
+    const char* name;
+    double freq;
+} stock_notes[NOTE_TABLE_SIZE] = {
+    {"C0", 16.35}, {"C0#", 17.32}, {"D0", 18.35}, {"D0#", 19.45}, {"E0", 20.60}, {"F0", 21.83},
+    {"F0#", 23.12}, {"G0", 24.50}, {"G0#", 25.96}, {"A0", 27.50}, {"A0#", 29.14}, {"B0", 30.87},
+    {"C1", 32.70}, {"C1#", 34.65}, {"D1", 36.71}, {"D1#", 38.89}, {"E1", 41.20}, {"F1", 43.65},
+    {"F1#", 46.25}, {"G1", 49.00}, {"G1#", 51.91}, {"A1", 55.00}, {"A1#", 58.27}, {"B1", 61.74},
+    {"C2", 65.41}, {"C2#", 69.30}, {"D2", 73.42}, {"D2#", 77.78}, {"E2", 82.41}, {"F2", 87.31},
+    {"F2#", 92.50}, {"G2", 98.00}, {"G2#", 103.83}, {"A2", 110.00}, {"A2#", 116.54}, {"B2", 123.47},
+    {"C3", 130.81}, {"C3#", 138.59}, {"D3", 146.83}, {"D3#", 155.56}, {"E3", 164.81}, {"F3", 174.61},
+    {"F3#", 185.00}, {"G3", 196.00}, {"G3#", 207.65}, {"A3", 220.00}, {"A3#", 233.08}, {"B3", 246.94},
+    {"C4", 261.63}, {"C4#", 277.18}, {"D4", 293.66}, {"D4#", 311.13}, {"E4", 329.63}, {"F4", 349.23},
+    {"F4#", 369.99}, {"G4", 392.00}, {"G4#", 415.30}, {"A4", 440.00}, {"A4#", 466.16}, {"B4", 493.88},
+    {"C5", 523.25}, {"C5#", 554.37}, {"D5", 587.33}, {"D5#", 622.25}, {"E5", 659.26}, {"F5", 698.46},
+    {"F5#", 739.99}, {"G5", 783.99}, {"G5#", 830.61}, {"A5", 880.00}, {"A5#", 932.33}, {"B5", 978.77},
+    {"C6", 1046.50}, {"C6#", 1108.73}, {"D6", 1174.66}, {"D6#", 1244.51}, {"E6", 1318.51}, {"F6", 1396.91},
+    {"F6#", 1479.98}, {"G6", 1567.98}, {"G6#", 1661.22}, {"A6", 1760.00}, {"A6#", 1864.66}, {"B6", 1975.53},
+    {"C7", 2093.00}, {"C7#", 2217.46}, {"D7", 2349.32}, {"D7#", 2489.02}, {"E7", 2637.02}, {"F7", 2793.83},
+    {"F7#", 2959.96}, {"G7", 3135.96}, {"G7#", 3322.44}, {"A7", 3520.00}, {"A7#", 3729.31}, {"B7", 3951.07},
+    {"C8", 4186.01}, {"C8#", 4434.92}, {"D8", 4698.64}, {"D8#", 4978.03}
+};
+
+char note_names[NOTE_TABLE_SIZE][5];
+double note_freq[NOTE_TABLE_SIZE];
+
+//Frequency of every note code, 0.0 for codes that are not in the table.
+static double freq_by_code[NOTE_CODES];
+
+//Perfect hash of a note name: letter A-G, octave 0-9 and an optional '#'.
+//Returns the code (0 .. NOTE_CODES-1), or -1 if the text is not a note name.
+int note_code(const char *name, size_t len){
+    int letter, octave, sharp;
+
+    if (len != 2 && len != 3) return -1;
+    if (name[0] < 'A' || name[0] > 'G') return -1;
+    if (name[1] < '0' || name[1] > '9') return -1;
+    if (len == 3 && name[2] != '#') return -1;
+
+    letter = name[0] - 'A';
+    octave = name[1] - '0';
+    sharp = (len == 3);
+    return (letter * 10 + octave) * 2 + sharp;
+}
+
+//Filling note_names/note_freq and the hash table from the built-in stock table.
+void note_table_builtin(void){
+    int i;
+
+    for (i = 0; i < NOTE_TABLE_SIZE; i++){
+        strcpy(note_names[i], stock_notes[i].name);
+        note_freq[i] = stock_notes[i].freq;
+    }
+    note_table_index(NOTE_TABLE_SIZE);
+}
+
+//Rebuilding the hash table from the first n entries of note_names/note_freq (after read_note_table).
+void note_table_index(int n){
+    int i, code;
+
+    memset(freq_by_code, 0, sizeof(freq_by_code));
+    for (i = 0; i < n; i++){
+        code = note_code(note_names[i], strlen(note_names[i]));
+        if (code >= 0) freq_by_code[code] = note_freq[i];
+    }
+}
+
+//Frequency of the note with the given name (not null-terminated), or -1 if there is no such note.
+double note_lookup(const char *name, size_t len){
+    int code = note_code(name, len);
+
+    if (code < 0 || freq_by_code[code] <= 0.0) return -1;
+    return freq_by_code[code];
+}
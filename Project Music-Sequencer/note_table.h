@@ -0,0 +1,24 @@
+#pragma once
+
+#ifndef NOTE_TABLE_H
+#define NOTE_TABLE_H
+
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include"note_io.h"
+
+#define NOTE_TABLE_SIZE 100 //Number of notes in the stock table
+#define NOTE_CODES 140 //Number of possible note codes: 7 letters * 10 octaves * (natural, sharp)
+
+// GLOBAL data
+//The note table is shared by all renders. It is built once at startup and only read afterwards.
+extern char note_names[NOTE_TABLE_SIZE][5]; //Note names from the file "frequencies_of_notes.txt"
+extern double note_freq[NOTE_TABLE_SIZE]; //Note frequencies from the file "frequencies_of_notes.txt"
+
+int note_code(const char* name, size_t len);
+void note_table_builtin(void);
+void note_table_index(int n);
+double note_lookup(const char* name, size_t len);
+
+#endif // NOTE_TABLE_H
@@ -0,0 +1,245 @@
+/*
+Per-pitch prototype cache.
+In prototype mode every note of a pitch gets the same seed (see new_note_in), so all notes of that pitch produce the
+same samples until they are released. The voice of each pitch is then synthesized only once, with the voice bank in the
+number format of the render, and kept in a cache that all render threads share. Playing a note is an addition of a
+slice of its prototype at the note's offset, which costs a few instructions per sample instead of a Karplus-Strong step.
+The cache is bounded by prototype_cache_bytes: when it is full, the prototypes that were used least recently are evicted.
+*/
+
+#define _CRT_SECURE_NO_WARNINGS
+
+#include <string.h>
+#include "prototype.h"
+#include "render.h"
+#include "worker_pool.h"
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#define PT_USE_AVX
+#endif
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define PT_USE_SSE2
+#endif
+
+size_t prototype_cache_bytes = (size_t)DEFAULT_PROTOTYPE_CACHE_MB << 20;
+
+//The cache: prototypes in no particular order, found by a linear search (there are at most a few hundred pitches).
+static note_prototype **cache = NULL;
+static int n_cached = 0;
+static int cache_capacity = 0;
+static size_t cache_used = 0; //Bytes of the samples of all cached prototypes
+static uint64_t cache_clock = 0; //Counts the uses, for last_use
+static pool_mutex cache_lock;
+
+//Must be called once before the first render, while only one thread runs.
+void prototype_cache_init(void){
+    pool_mutex_init(&cache_lock);
+}
+
+//Releasing all prototypes. No render may be running.
+void prototype_cache_free(void){
+    int i;
+
+    for (i = 0; i < n_cached; i++){
+        free(cache[i]->r);
+        free(cache[i]->l);
+        free(cache[i]);
+    }
+    free(cache);
+    cache = NULL;
+    n_cached = cache_capacity = 0;
+    cache_used = 0;
+}
+
+//Bytes of the samples in the cache.
+size_t prototype_cache_used(void){
+    size_t used;
+
+    pool_mutex_lock(&cache_lock);
+    used = cache_used;
+    pool_mutex_unlock(&cache_lock);
+    return used;
+}
+
+//1 if prototype p has the key of the pitch 'freq' with the current settings.
+static int prototype_matches(const note_prototype *p, const note_prototype *key){
+    return p->freq == key->freq && p->seed == key->seed && p->rate == key->rate
+        && p->precision == key->precision && p->threshold_db == key->threshold_db && p->max_frames == key->max_frames;
+}
+
+static note_prototype *prototype_find(const note_prototype *key){
+    int i;
+
+    for (i = 0; i < n_cached; i++){
+        if (prototype_matches(cache[i], key)) return cache[i];
+    }
+    return NULL;
+}
+
+/*Synthesizing the prototype of a pitch: one voice in a bank of its own, sampled until it is released.
+Returns 0 if there is not enough memory. */
+static int prototype_build(note_prototype *p){
+    voice_bank b;
+    arena a;
+    note *n;
+    int64_t k;
+    double l, r;
+    float *t;
+    int ok;
+
+    p->r = (float *)malloc(p->max_frames * sizeof(float));
+    p->l = (float *)malloc(p->max_frames * sizeof(float));
+    arena_init(&a, 64 * 1024);
+    ok = p->r != NULL && p->l != NULL && voice_bank_init(&b, 1, pow(10.0, p->threshold_db / 20.0), p->precision);
+    if (ok){
+        n = new_note_in(&a, p->freq, 0, 0.0);
+        ok = n != NULL;
+        if (ok){
+            n->seed = p->seed;
+            n->start_sample = 0;
+            n->end_sample = p->max_frames;
+            ok = voice_bank_add(&b, n);
+        }
+        for (k = 0; ok && k < p->max_frames && b.n_voices > 0; k++){
+            voice_bank_sample(&b, &l, &r);
+            p->r[k] = (float)r;
+            p->l[k] = (float)l;
+        }
+        p->length = k;
+        voice_bank_free(&b);
+    }
+    arena_free(&a);
+    if (!ok){
+        fprintf(stderr, "Out of memory!\n");
+        return 0;
+    }
+
+    //Notes that decay early need less memory than the length cap.
+    if (p->length < p->max_frames){
+        if ((t = (float *)realloc(p->r, (p->length + 1) * sizeof(float))) != NULL) p->r = t;
+        if ((t = (float *)realloc(p->l, (p->length + 1) * sizeof(float))) != NULL) p->l = t;
+    }
+    return 1;
+}
+
+//Evicting the least recently used prototypes that are not in use until the cache fits in prototype_cache_bytes.
+//The caller holds the lock.
+static void prototype_evict(void){
+    int i, lru;
+
+    while (cache_used > prototype_cache_bytes){
+        lru = -1;
+        for (i = 0; i < n_cached; i++){
+            if (cache[i]->refs == 0 && (lru < 0 || cache[i]->last_use < cache[lru]->last_use)) lru = i;
+        }
+        if (lru < 0) return; //Everything left is in use; the bound is exceeded until it is released
+
+        cache_used -= 2 * cache[lru]->length * sizeof(float);
+        free(cache[lru]->r);
+        free(cache[lru]->l);
+        free(cache[lru]);
+        cache[lru] = cache[--n_cached];
+    }
+}
+
+/*The prototype of the pitch 'freq' for the current sample rate, number format, release threshold and length cap.
+It is synthesized if it is not in the cache; 'built' is then incremented. The prototype stays valid until it is
+given back with prototype_release. Returns NULL if there is not enough memory. */
+note_prototype *prototype_get(double freq, int *built){
+    note_prototype key, *p, *q, **t;
+
+    memset(&key, 0, sizeof(key));
+    key.freq = freq;
+    key.seed = note_seed(freq, 0, 0.0);
+    key.rate = RS(rate);
+    key.precision = RS(precision);
+    key.threshold_db = RS(threshold_db);
+    key.max_frames = voice_max_frames();
+
+    pool_mutex_lock(&cache_lock);
+    p = prototype_find(&key);
+    if (p != NULL){
+        p->refs++;
+        p->last_use = ++cache_clock;
+    }
+    pool_mutex_unlock(&cache_lock);
+    if (p != NULL) return p;
+
+    //The synthesis runs outside the lock, so other threads can mix in the meantime.
+    p = (note_prototype *)malloc(sizeof(note_prototype));
+    if (p == NULL){
+        fprintf(stderr, "Out of memory!\n");
+        return NULL;
+    }
+    *p = key;
+    if (!prototype_build(p)){
+        free(p->r);
+        free(p->l);
+        free(p);
+        return NULL;
+    }
+    (*built)++;
+
+    pool_mutex_lock(&cache_lock);
+    q = prototype_find(&key);
+    if (q == NULL && n_cached == cache_capacity){
+        t = (note_prototype **)realloc(cache, (cache_capacity + 64) * sizeof(note_prototype *));
+        if (t != NULL){
+            cache = t;
+            cache_capacity += 64;
+        }
+    }
+    if (q != NULL || n_cached == cache_capacity){
+        //Another thread has stored the same prototype in the meantime (that one is used),
+        //or there is no memory to store this one.
+        free(p->r);
+        free(p->l);
+        free(p);
+        p = q;
+    }
+    else{
+        cache[n_cached++] = p;
+        cache_used += 2 * p->length * sizeof(float);
+    }
+    if (p != NULL){
+        p->refs++;
+        p->last_use = ++cache_clock;
+        prototype_evict();
+    }
+    else fprintf(stderr, "Out of memory!\n");
+    pool_mutex_unlock(&cache_lock);
+    return p;
+}
+
+//Giving back a prototype of prototype_get.
+void prototype_release(note_prototype *p){
+    pool_mutex_lock(&cache_lock);
+    p->refs--;
+    prototype_evict();
+    pool_mutex_unlock(&cache_lock);
+}
+
+//Adding n frames of the prototype, from frame 'offset' on, to mix_r/mix_l. 4 frames at a time with AVX, 2 with SSE2.
+void prototype_mix(const note_prototype *p, int64_t offset, double *mix_r, double *mix_l, int64_t n){
+    const float *r = p->r + offset, *l = p->l + offset;
+    int64_t k = 0;
+
+#ifdef PT_USE_AVX
+    for (; k + 4 <= n; k += 4){
+        _mm256_storeu_pd(mix_r + k, _mm256_add_pd(_mm256_loadu_pd(mix_r + k), _mm256_cvtps_pd(_mm_loadu_ps(r + k))));
+        _mm256_storeu_pd(mix_l + k, _mm256_add_pd(_mm256_loadu_pd(mix_l + k), _mm256_cvtps_pd(_mm_loadu_ps(l + k))));
+    }
+#endif
+#ifdef PT_USE_SSE2
+    for (; k + 2 <= n; k += 2){
+        _mm_storeu_pd(mix_r + k, _mm_add_pd(_mm_loadu_pd(mix_r + k), _mm_cvtps_pd(_mm_castsi128_ps(_mm_loadl_epi64((const __m128i *)(r + k))))));
+        _mm_storeu_pd(mix_l + k, _mm_add_pd(_mm_loadu_pd(mix_l + k), _mm_cvtps_pd(_mm_castsi128_ps(_mm_loadl_epi64((const __m128i *)(l + k))))));
+    }
+#endif
+    for (; k < n; k++){
+        mix_r[k] += r[k];
+        mix_l[k] += l[k];
+    }
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#ifndef PROTOTYPE_H
+#define PROTOTYPE_H
+
+#include<stdio.h>
+#include<stdlib.h>
+#include <stdint.h>
+#include"note_io.h"
+
+#define DEFAULT_PROTOTYPE_CACHE_MB 256 //Default memory bound of the prototype cache in MB.
+
+// GLOBAL data
+extern size_t prototype_cache_bytes; //Memory bound of the prototype cache in bytes, shared by all renders
+
+//The waveform of one pitch: the samples of one voice from its start until it is released, with the amplitude boost
+//and the pan applied. The settings it was synthesized with are part of its key.
+typedef struct note_prototype_struct{
+	double freq;
+	uint64_t seed; //Seed of the notes of this pitch (note_seed(freq, 0, 0))
+	int rate; //RS(rate)
+	int precision; //RS(precision)
+	double threshold_db; //RS(threshold_db)
+	int64_t max_frames; //voice_max_frames()
+	float* r; //Right and left channel, 'length' samples each
+	float* l;
+	int64_t length; //Frames until the voice is released
+	int refs; //Renders that use the prototype at the moment; it is not evicted while refs > 0
+	uint64_t last_use; //Time of the last use, for evicting the least recently used prototypes
+} note_prototype;
+
+void prototype_cache_init(void);
+void prototype_cache_free(void);
+note_prototype* prototype_get(double freq, int* built);
+void prototype_release(note_prototype* p);
+void prototype_mix(const note_prototype* p, int64_t offset, double* mix_r, double* mix_l, int64_t n);
+size_t prototype_cache_used(void);
+
+#endif // PROTOTYPE_H
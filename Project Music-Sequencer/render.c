@@ -0,0 +1,502 @@
+/*
+Rendering of the playlist.
+schedule_notes works out in advance at which frame every note starts and stops sounding,
+so any part of the song can be rendered without rendering everything before it.
+A voice is also released early when it has decayed below the release threshold. This depends only on the samples
+of the voice itself, so it happens at the same frame whichever segment renders the voice.
+render_song splits the song into time segments and renders the tracks of every segment on a pool of worker threads,
+and sums them on the mix bus (see mix_bus.c).
+Notes that ring across a segment boundary are carried over by replaying their samples up to the segment start,
+which gives exactly the same samples as a serial render, for any number of threads.
+*/
+
+#define _CRT_SECURE_NO_WARNINGS
+
+#include "render.h"
+#include "worker_pool.h"
+#include "wall_clock.h"
+#include "render_cache.h"
+#include "mix_bus.h"
+#include "prototype.h"
+#include <stdarg.h>
+
+
+//Longest a note plays, in frames at the current sample rate.
+int64_t voice_max_frames(void){
+    return RS(max_length) > 0 ? RS(max_length) : (int64_t)DEFAULT_VOICE_MAX_SECONDS * RS(rate);
+}
+
+/*Scheduling pass. Every note gets the frame at which it starts (start_sample) and the frame at which it is released
+at the latest (end_sample), as 64-bit integers. The start frame is computed from the start time of the note in bars
+(see score_make_playlist_in, which applies the tempo changes) with one rounding, so the timing does not drift on long songs
+and the notes of a chord start at the same frame. The song begins with the bar of the first note and ends with the bar
+of the last one.
+Every note plays for voice_max_frames() frames. With RS(polyphony) set, a note that starts while RS(polyphony) notes
+of its track are playing steals the voice of the oldest one, which ends at that frame; every track has its own voices.
+Returns the length of the song in frames. */
+int64_t schedule_notes(note *head, int bar_length){
+    note *q, *st, *last;
+    int n_active, t, n_tracks = 1;
+    int64_t total, max_length = voice_max_frames();
+    double bar_frames = (double)bar_length * RS(rate), origin;
+
+    if (head == NULL) return 0;
+
+    for (last = head; last->next != NULL; last = last->next);
+    origin = head->time - head->index / head->tempo;
+    total = (int64_t)floor((last->time + (1.0 - last->index) / last->tempo - origin) * bar_frames + 0.5);
+
+    for (q = head; q != NULL; q = q->next){
+        q->start_sample = (int64_t)floor((q->time - origin) * bar_frames + 0.5);
+        if (q->start_sample > total) q->start_sample = total;
+        if (q->track->index >= n_tracks) n_tracks = q->track->index + 1;
+    }
+
+    //Release frames, track by track. All notes have the same length, so the sounding notes of the track between st
+    //and q always end in playlist order, and the oldest of them is the first one.
+    for (t = 0; t < n_tracks; t++){
+        st = head;
+        n_active = 0;
+        for (q = head; q != NULL; q = q->next){
+            if (q->track->index != t) continue;
+            while (st != q && (st->track->index != t || st->end_sample <= q->start_sample)){
+                if (st->track->index == t) n_active--;
+                st = st->next;
+            }
+            if (RS(polyphony) > 0 && n_active >= RS(polyphony)){
+                st->end_sample = q->start_sample;
+                st = st->next;
+                n_active--;
+            }
+            q->end_sample = q->start_sample + max_length;
+            if (q->end_sample > total) q->end_sample = total;
+            n_active++;
+        }
+    }
+    return total;
+}
+
+//The first note of the scheduled playlist that may still be sounding at 'frame' (binary search):
+//no note plays for longer than voice_max_frames() frames.
+int render_find_note(note **notes, int n_notes, int64_t frame){
+    int lo = 0, hi = n_notes, mid;
+    int64_t max_length = voice_max_frames();
+
+    while (lo < hi){
+        mid = (lo + hi) / 2;
+        if (notes[mid]->start_sample + max_length <= frame) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+//Placing the cursor at 'frame'. The notes that are sounding at this frame are added to the bank
+//and advanced by the number of samples they have already played. Notes that have already decayed are left out.
+int render_cursor_seek(render_cursor *c, note **notes, int n_notes, int64_t frame){
+    int v;
+
+    c->next = render_find_note(notes, n_notes, frame);
+    c->pos = frame;
+    c->voice_samples = 0;
+    c->preroll_samples = 0;
+    memset(c->voice_hist, 0, sizeof(c->voice_hist));
+    c->peak_voices = 0;
+    c->prototypes = RS(prototypes);
+    c->prototype_builds = 0;
+    if (c->prototypes) return 1; //Nothing to replay: every note is mixed from its offset in the prototype
+
+    if (!voice_bank_init(&c->bank, 64, pow(10.0, RS(threshold_db) / 20.0), RS(precision))) return 0;
+
+    while (c->next < n_notes && notes[c->next]->start_sample < frame){
+        if (notes[c->next]->end_sample > frame){
+            if (!voice_bank_add(&c->bank, notes[c->next])) return 0;
+            v = c->bank.n_voices - 1;
+            c->preroll_samples += frame - notes[c->next]->start_sample;
+            if (!voice_bank_skip(&c->bank, v, frame - notes[c->next]->start_sample)) voice_bank_remove(&c->bank, v);
+        }
+        c->next++;
+    }
+    return 1;
+}
+
+//Histogram bucket of a number of voices: 0, 1, 2-3, 4-7, ...
+static int voice_bucket(int n){
+    int k = 0;
+
+    while (n > 0 && k < RENDER_HIST_BUCKETS - 1){
+        n >>= 1;
+        k++;
+    }
+    return k;
+}
+
+/*Rendering in prototype mode: the frames are cleared and the slice of the prototype of every note that sounds in them
+is added, in playlist order, so every frame is the same sum whichever segment it is rendered in.
+A note ends at its end_sample (stolen or at the length cap) or where its prototype ends (released below the threshold).
+Only voice_samples is counted; the voice histogram is not collected. */
+static int render_cursor_run_prototypes(render_cursor *c, note **notes, int n_notes, int64_t end, double *mix_r, double *mix_l){
+    note_prototype *p;
+    note *q;
+    int64_t a, b;
+    int i;
+
+    memset(mix_r, 0, (end - c->pos) * sizeof(double));
+    memset(mix_l, 0, (end - c->pos) * sizeof(double));
+
+    for (i = render_find_note(notes, n_notes, c->pos); i < n_notes && notes[i]->start_sample < end; i++){
+        q = notes[i];
+        if (q->end_sample <= c->pos || q->end_sample <= q->start_sample) continue;
+
+        p = prototype_get(q->freq, &c->prototype_builds);
+        if (p == NULL) return 0;
+        a = q->start_sample > c->pos ? q->start_sample : c->pos;
+        b = q->start_sample + p->length;
+        if (b > q->end_sample) b = q->end_sample;
+        if (b > end) b = end;
+        if (a < b){
+            prototype_mix(p, a - q->start_sample, mix_r + (a - c->pos), mix_l + (a - c->pos), b - a);
+            c->voice_samples += b - a;
+        }
+        prototype_release(p);
+    }
+    c->pos = end;
+    return 1;
+}
+
+/*Rendering the frames from the cursor position up to 'end' (exclusive) into mix_r/mix_l.
+The frames are rendered in spans between note starts, so the playlist is only looked at where a note begins.
+Voices are released inside voice_bank_sample after their last sample. */
+int render_cursor_run(render_cursor *c, note **notes, int n_notes, int64_t end, double *mix_r, double *mix_l){
+    int64_t t, span_end;
+    double l, r;
+    int n;
+
+    if (c->prototypes) return render_cursor_run_prototypes(c, notes, n_notes, end, mix_r, mix_l);
+
+    for (t = c->pos; t < end; ){
+        //Starting the notes that begin at this frame. Notes whose voice was stolen at once are not played.
+        while (c->next < n_notes && notes[c->next]->start_sample <= t){
+            if (notes[c->next]->end_sample > t && !voice_bank_add(&c->bank, notes[c->next])) return 0;
+            c->next++;
+        }
+        span_end = end;
+        if (c->next < n_notes && notes[c->next]->start_sample < span_end) span_end = notes[c->next]->start_sample;
+
+        for (; t < span_end; t++){
+            n = c->bank.n_voices;
+            c->voice_samples += n;
+            c->voice_hist[voice_bucket(n)]++;
+            if (n > c->peak_voices) c->peak_voices = n;
+
+            voice_bank_sample(&c->bank, &l, &r);
+            mix_r[t - c->pos] = r;
+            mix_l[t - c->pos] = l;
+        }
+    }
+    c->pos = end;
+    return 1;
+}
+
+//Adding the delay-line statistics and the counters of a cursor to 'stats'.
+void render_cursor_stats(render_cursor *c, render_stats *stats){
+    int i;
+
+    if (!c->prototypes){
+        stats->delay_allocs += c->bank.delay_allocs;
+        stats->delay_reused += c->bank.delay_reused;
+        stats->delay_peak_bytes += c->bank.delay_arena.peak_bytes;
+    }
+    stats->prototype_builds += c->prototype_builds;
+    stats->voice_samples += c->voice_samples;
+    stats->preroll_samples += c->preroll_samples;
+    for (i = 0; i < RENDER_HIST_BUCKETS; i++) stats->voice_hist[i] += c->voice_hist[i];
+    if (c->peak_voices > stats->peak_voices) stats->peak_voices = c->peak_voices;
+}
+
+void render_cursor_free(render_cursor *c){
+    if (!c->prototypes) voice_bank_free(&c->bank);
+}
+
+//Work shared by the threads that render one round of segments. Every job renders one track of one segment.
+typedef struct song_job_struct{
+    mix_bus* bus;
+    int64_t total_frames;
+    int64_t seg_frames; //Length of a segment
+    int first_segment; //Segment rendered by jobs 0 .. n_tracks - 1 of the round
+    double** mix_r; //Output buffer of every job
+    double** mix_l;
+    int* ok; //Result of every job
+    render_stats* stats; //Statistics of every job
+} song_job;
+
+static void render_segment_job(void *ctx, int job){
+    song_job *s = (song_job *)ctx;
+    render_cursor c;
+    note **notes;
+    int64_t a, b;
+    int n;
+
+    a = (s->first_segment + job / s->bus->n_tracks) * s->seg_frames;
+    b = a + s->seg_frames;
+    if (b > s->total_frames) b = s->total_frames;
+    notes = mix_bus_track(s->bus, job % s->bus->n_tracks, &n);
+
+    s->ok[job] = render_cursor_seek(&c, notes, n, a)
+              && render_cursor_run(&c, notes, n, b, s->mix_r[job], s->mix_l[job]);
+    render_cursor_stats(&c, &s->stats[job]);
+    render_cursor_free(&c);
+}
+
+//Adding the statistics of the jobs of one round of segments to the statistics of the song.
+//The cursors of a round exist at the same time, so their delay-line peaks add up.
+void render_stats_add_round(render_stats *stats, const render_stats *jobs, int n_jobs){
+    size_t round_peak = 0;
+    int i, k;
+
+    for (i = 0; i < n_jobs; i++){
+        stats->delay_allocs += jobs[i].delay_allocs;
+        stats->delay_reused += jobs[i].delay_reused;
+        round_peak += jobs[i].delay_peak_bytes;
+        stats->voice_samples += jobs[i].voice_samples;
+        stats->preroll_samples += jobs[i].preroll_samples;
+        for (k = 0; k < RENDER_HIST_BUCKETS; k++) stats->voice_hist[k] += jobs[i].voice_hist[k];
+        if (jobs[i].peak_voices > stats->peak_voices) stats->peak_voices = jobs[i].peak_voices;
+        stats->prototype_builds += jobs[i].prototype_builds;
+        stats->clipped += jobs[i].clipped;
+    }
+    if (round_peak > stats->delay_peak_bytes) stats->delay_peak_bytes = round_peak;
+}
+
+//Printing a progress line on stderr when RS(progress) seconds have passed since the last one.
+void render_progress(const render_stats *stats, int64_t done, int64_t total_frames, double t_start, double *t_last){
+    double now;
+
+    if (RS(progress) <= 0) return;
+    now = wall_time();
+    if (now - *t_last < RS(progress) && done < total_frames) return;
+    *t_last = now;
+
+    fprintf(stderr, "Rendering '%s': %5.1f%% (%.1f of %.1f s), %.1fx realtime\n", stats->name ? stats->name : "",
+            total_frames > 0 ? 100.0 * done / total_frames : 100.0, (double)done / RS(rate), (double)total_frames / RS(rate),
+            now > t_start ? (double)done / RS(rate) / (now - t_start) : 0.0);
+}
+
+/*Rendering the scheduled playlist into the output.
+With one thread the song is rendered front to back with one render cursor per track (see mix_cursor).
+With more threads the tracks of the segments are rendered in rounds of about one job per thread; after each round
+the tracks of every segment are summed on the mix bus and the segments are written in order.
+The delay-line statistics, the counters and the synthesis and write times are added to 'stats'.
+Returns 1 on success and 0 if there is not enough memory. */
+int render_song(note *head, int64_t total_frames, wav_writer *out, render_stats *stats){
+    song_job s;
+    mix_bus bus;
+    mix_cursor c;
+    int i, t, n_threads, n_segments, n_round, n_buffers, n_jobs, ok;
+    int64_t a, b;
+    double t0, t_start, t_last;
+
+    memset(&s, 0, sizeof(s));
+    ok = mix_bus_init(&bus, head);
+    s.bus = &bus;
+    n_threads = RS(threads) > 0 ? RS(threads) : cpu_count();
+    s.seg_frames = RS(segment_length) > 0 ? RS(segment_length) : (int64_t)DEFAULT_SEGMENT_SECONDS * RS(rate);
+    n_segments = (int)((total_frames + s.seg_frames - 1) / s.seg_frames);
+    if (n_threads > n_segments * bus.n_tracks) n_threads = n_segments > 0 ? n_segments * bus.n_tracks : 1;
+
+    //Segments per round: enough for one job per thread.
+    n_round = (n_threads + bus.n_tracks - 1) / bus.n_tracks;
+    n_buffers = n_threads == 1 ? 1 : n_round * bus.n_tracks;
+
+    s.mix_r = (double **)calloc(n_buffers, sizeof(double *));
+    s.mix_l = (double **)calloc(n_buffers, sizeof(double *));
+    s.ok = (int *)calloc(n_buffers, sizeof(int));
+    s.stats = (render_stats *)calloc(n_buffers, sizeof(render_stats));
+    if (!s.mix_r || !s.mix_l || !s.ok || !s.stats) ok = 0;
+    for (i = 0; ok && i < n_buffers; i++){
+        s.mix_r[i] = (double *)malloc(s.seg_frames * sizeof(double));
+        s.mix_l[i] = (double *)malloc(s.seg_frames * sizeof(double));
+        if (!s.mix_r[i] || !s.mix_l[i]) ok = 0;
+    }
+
+    if (ok){
+        s.total_frames = total_frames;
+
+        t_start = t_last = wall_time();
+
+        if (n_threads == 1){
+            ok = mix_cursor_seek(&c, &bus, 0);
+            for (a = 0; ok && a < total_frames; a = b){
+                b = a + s.seg_frames;
+                if (b > total_frames) b = total_frames;
+
+                t0 = wall_time();
+                ok = mix_cursor_run(&c, &bus, b, s.mix_r[0], s.mix_l[0]);
+                stats->synth_ms += 1000.0 * (wall_time() - t0);
+
+                t0 = wall_time();
+                if (ok) wav_writer_put_block(out, s.mix_r[0], s.mix_l[0], b - a);
+                stats->write_ms += 1000.0 * (wall_time() - t0);
+                render_progress(stats, b, total_frames, t_start, &t_last);
+            }
+            mix_cursor_stats(&c, stats);
+            mix_cursor_free(&c);
+        }
+        else{
+            for (s.first_segment = 0; ok && s.first_segment < n_segments; s.first_segment += n_round){
+                n_jobs = n_segments - s.first_segment;
+                if (n_jobs > n_round) n_jobs = n_round;
+                n_jobs *= bus.n_tracks;
+
+                memset(s.stats, 0, n_jobs * sizeof(render_stats));
+                t0 = wall_time();
+                parallel_for(n_jobs, n_threads, render_segment_job, &s);
+                stats->synth_ms += 1000.0 * (wall_time() - t0);
+
+                render_stats_add_round(stats, s.stats, n_jobs);
+
+                //Mixing the tracks of every segment into the buffer of its first track,
+                //and stitching the segments of the round together in time order.
+                t0 = wall_time();
+                b = 0;
+                for (i = 0; ok && i < n_jobs; i += bus.n_tracks){
+                    a = (s.first_segment + i / bus.n_tracks) * s.seg_frames;
+                    b = a + s.seg_frames;
+                    if (b > total_frames) b = total_frames;
+                    for (t = 0; ok && t < bus.n_tracks; t++){
+                        ok = s.ok[i + t];
+                        if (ok) mix_bus_add(&bus, t, s.mix_r[i + t], s.mix_l[i + t], s.mix_r[i], s.mix_l[i], b - a);
+                    }
+                    if (ok) wav_writer_put_block(out, s.mix_r[i], s.mix_l[i], b - a);
+                }
+                stats->write_ms += 1000.0 * (wall_time() - t0);
+                render_progress(stats, b, total_frames, t_start, &t_last);
+            }
+        }
+    }
+    else fprintf(stderr, "Out of memory!\n");
+
+    for (i = 0; s.mix_r && s.mix_l && i < n_buffers; i++){
+        free(s.mix_r[i]);
+        free(s.mix_l[i]);
+    }
+    free(s.mix_r);
+    free(s.mix_l);
+    free(s.ok);
+    free(s.stats);
+    mix_bus_free(&bus);
+    return ok;
+}
+
+/*Rendering a playlist into a .wav file in one pass: the notes are scheduled and the song is synthesized after a header
+of length 0, through the segment cache if RS(cache_dir) is set (the cache holds dry segments, so it is not used
+with the reverb). The header is patched with the length of the
+samples when they are all written, so the length of the song need not be known in advance.
+The playlist is not changed apart from the schedule, so several playlists can be rendered into different files at the same time.
+The statistics of the render are added to 'stats', and with RS(report) set they are printed on stderr at the end.
+Returns 1 on success and 0 if the file cannot be written or there is not enough memory. */
+int render_file(note *head, int bar_length, const char *filename, render_stats *stats){
+    int ok, seekable;
+    int64_t total_frames;
+    wav_writer out;
+    FILE *f;
+    double t_start, t0;
+
+    t_start = wall_time();
+    if (stats->name == NULL) stats->name = filename;
+
+    f = fopen(filename, "wb+");	// Open output file (.wav) for writing.
+    if (f == NULL){
+        fprintf(stderr, "Unable to open file for output!\n");
+        return 0;
+    }
+    //The writer reports why it cannot be opened (memory, or the impulse response of the reverb).
+    if (!wav_writer_open(&out, f, RS(block_frames))){
+        fclose(f);
+        return 0;
+    }
+    seekable = wav_header_start(f, out.format);
+
+    t0 = wall_time();
+    total_frames = schedule_notes(head, bar_length);
+    stats->schedule_ms += 1000.0 * (wall_time() - t0);
+
+    if (RS(cache_dir) != NULL && out.reverb == NULL) ok = render_song_cached(head, total_frames, bar_length, f, stats);
+    else ok = render_song(head, total_frames, &out, stats);
+    if (ok) stats->frames += total_frames;
+    else fprintf(stderr, "Rendering failed!\n");
+
+    t0 = wall_time();
+    wav_writer_close(&out);
+    if (ok && out.failed){
+        fprintf(stderr, "Unable to write the file '%s'!\n", filename);
+        ok = 0;
+    }
+    //A pipe keeps the header of a stream of unknown length.
+    if (ok && seekable && !wav_header_patch(f, total_frames, out.format)) fprintf(stderr, "The length of '%s' could not be set in its header.\n", filename);
+    if (fclose(f) != 0) ok = 0;
+    stats->write_ms += 1000.0 * (wall_time() - t0);
+    stats->clipped += out.clipped;
+    stats->reverb_ms += out.reverb_ms;
+    stats->total_ms += 1000.0 * (wall_time() - t_start);
+
+    if (ok && RS(report)) render_stats_report(stats, stderr);
+    return ok;
+}
+
+//Appending formatted text to the report line. Text that does not fit is cut off.
+static void report_add(char *line, size_t size, size_t *len, const char *format, ...){
+    va_list args;
+    int n;
+
+    if (*len + 1 >= size) return;
+    va_start(args, format);
+    n = vsnprintf(line + *len, size - *len, format, args);
+    va_end(args);
+    if (n > 0) *len += (size_t)n < size - *len ? (size_t)n : size - *len - 1;
+}
+
+/*Printing the statistics of a render as one line of JSON:
+the counters, the active-voice histogram (frames by number of voices), the time of every stage and the memory use.
+The line is written with a single call, so the reports of renders that end at the same time do not mix. */
+void render_stats_report(const render_stats *stats, FILE *f){
+    char line[4096];
+    size_t len = 0;
+    const char *c;
+    int i, last = 0;
+    double seconds = (double)stats->frames / RS(rate);
+
+    report_add(line, sizeof(line), &len, "{\"render\":\"");
+    for (c = stats->name; c != NULL && *c; c++){
+        if (*c == '"' || *c == '\\') report_add(line, sizeof(line), &len, "\\%c", *c);
+        else if ((unsigned char)*c < 0x20) report_add(line, sizeof(line), &len, "\\u%04x", (unsigned char)*c);
+        else report_add(line, sizeof(line), &len, "%c", *c);
+    }
+
+    report_add(line, sizeof(line), &len, "\",\"frames\":%lld,\"seconds\":%.3f,\"realtime\":%.1f,\"notes\":%zu,"
+               "\"sample_rate\":%d,\"precision\":\"%s\",\"dither\":%d,\"prototypes\":%d,\"voice_samples\":%llu,\"preroll_samples\":%llu,\"avg_voices\":%.2f,\"peak_voices\":%d,",
+               (long long)stats->frames, seconds, stats->total_ms > 0 ? 1000.0 * seconds / stats->total_ms : 0.0,
+               stats->note_allocs, RS(rate), precision_name(RS(precision)), RS(dither), RS(prototypes), (unsigned long long)stats->voice_samples, (unsigned long long)stats->preroll_samples,
+               stats->frames > 0 ? (double)stats->voice_samples / stats->frames : 0.0, stats->peak_voices);
+
+    //Histogram buckets up to the last one that is not empty.
+    for (i = 0; i < RENDER_HIST_BUCKETS; i++){
+        if (stats->voice_hist[i] > 0) last = i;
+    }
+    report_add(line, sizeof(line), &len, "\"voice_histogram\":{");
+    for (i = 0; i <= last; i++){
+        if (i > 0) report_add(line, sizeof(line), &len, ",");
+        if (i < 2) report_add(line, sizeof(line), &len, "\"%d\"", i);
+        else if (i == RENDER_HIST_BUCKETS - 1) report_add(line, sizeof(line), &len, "\"%d+\"", 1 << (i - 1));
+        else report_add(line, sizeof(line), &len, "\"%d-%d\"", 1 << (i - 1), (1 << i) - 1);
+        report_add(line, sizeof(line), &len, ":%llu", (unsigned long long)stats->voice_hist[i]);
+    }
+
+    report_add(line, sizeof(line), &len, "},\"clipped\":%llu,\"cache_hits\":%d,\"cache_misses\":%d,\"prototype_builds\":%d,"
+               "\"ms\":{\"load\":%.3f,\"sort\":%.3f,\"playlist\":%.3f,\"schedule\":%.3f,\"synth\":%.3f,\"write\":%.3f,\"reverb\":%.3f,\"total\":%.3f},"
+               "\"memory\":{\"note_peak_bytes\":%zu,\"delay_allocs\":%zu,\"delay_reused\":%zu,\"delay_peak_bytes\":%zu}}\n",
+               (unsigned long long)stats->clipped, stats->cache_hits, stats->cache_misses, stats->prototype_builds, stats->load_ms, stats->sort_ms, stats->playlist_ms,
+               stats->schedule_ms, stats->synth_ms, stats->write_ms, stats->reverb_ms, stats->total_ms,
+               stats->note_peak_bytes, stats->delay_allocs, stats->delay_reused, stats->delay_peak_bytes);
+
+    fputs(line, f);
+}
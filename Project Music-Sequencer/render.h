@@ -0,0 +1,68 @@
+#pragma once
+
+#ifndef RENDER_H
+#define RENDER_H
+
+#include<stdio.h>
+#include<stdlib.h>
+#include <stdint.h>
+#include"note_io.h"
+#include"voice_bank.h"
+#include"wav_writer.h"
+
+#define DEFAULT_SEGMENT_SECONDS 8 //Length of one render segment in seconds.
+#define DEFAULT_VOICE_THRESHOLD_DB -96.0 //Default release threshold, below the smallest step of 16-bit output.
+#define DEFAULT_VOICE_MAX_SECONDS 3 //Default maximum note length in seconds.
+#define RENDER_HIST_BUCKETS 16 //Buckets of the active-voice histogram: 0, 1, 2-3, 4-7, ... voices, the last one open-ended.
+
+//Statistics of one render.
+typedef struct render_stats_struct{
+	size_t note_allocs; //Note records allocated for the playlist
+	size_t note_peak_bytes; //Peak size of the note arena
+	size_t delay_allocs; //Delay lines handed out to voices
+	size_t delay_reused; //Delay lines that were recycled from a voice that had ended
+	size_t delay_peak_bytes; //Peak size of the delay-line arenas of the render cursors that run at the same time
+	int64_t frames; //Frames written to the output
+	const char* name; //Output file, shown in the progress lines and in the report
+	//Hot-path counters. They are collected on every render: a few additions per frame.
+	uint64_t voice_samples; //Samples synthesized by the voices (one Karplus-Strong step each)
+	uint64_t preroll_samples; //Samples replayed to carry notes across segment boundaries
+	uint64_t voice_hist[RENDER_HIST_BUCKETS]; //Frames by the number of voices sounding in them
+	int peak_voices; //Largest number of voices sounding in one frame
+	int prototype_builds; //Pitches synthesized for the prototype cache (see prototype.h)
+	uint64_t clipped; //Output samples beyond full scale, where tanh clipping took place
+	int cache_hits; //Segments taken from the segment cache (see render_cache.h)
+	int cache_misses; //Segments rendered because they were not in the cache
+	//Wall time of every stage in milliseconds. load/sort/playlist are filled in by the caller of render_file.
+	double load_ms, sort_ms, playlist_ms, schedule_ms, synth_ms, write_ms, total_ms;
+	double reverb_ms; //Part of write_ms spent in the master-bus reverb (see reverb.h)
+} render_stats;
+
+//Position of a render inside the playlist: voices of the bank are the sounding notes before 'next', in playlist order.
+//In prototype mode the bank is not used.
+typedef struct render_cursor_struct{
+	voice_bank bank;
+	int next; //Next note that has not started yet
+	int64_t pos; //Next frame to render
+	uint64_t voice_samples; //Counters of the cursor, see render_stats
+	uint64_t preroll_samples;
+	uint64_t voice_hist[RENDER_HIST_BUCKETS];
+	int peak_voices;
+	int prototypes; //1: the cursor mixes note prototypes instead of playing voices (RS(prototypes) when it was placed)
+	int prototype_builds;
+} render_cursor;
+
+int64_t schedule_notes(note* head, int bar_length);
+int64_t voice_max_frames(void);
+int render_find_note(note** notes, int n_notes, int64_t frame);
+int render_cursor_seek(render_cursor* c, note** notes, int n_notes, int64_t frame);
+int render_cursor_run(render_cursor* c, note** notes, int n_notes, int64_t end, double* mix_r, double* mix_l);
+void render_cursor_free(render_cursor* c);
+void render_cursor_stats(render_cursor* c, render_stats* stats);
+void render_stats_add_round(render_stats* stats, const render_stats* jobs, int n_jobs);
+void render_progress(const render_stats* stats, int64_t done, int64_t total_frames, double t_start, double* t_last);
+int render_song(note* head, int64_t total_frames, wav_writer* out, render_stats* stats);
+int render_file(note* head, int bar_length, const char* filename, render_stats* stats);
+void render_stats_report(const render_stats* stats, FILE* f);
+
+#endif // RENDER_H
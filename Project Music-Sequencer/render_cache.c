@@ -0,0 +1,428 @@
+/*
+Incremental rendering with a segment cache.
+The song is cut into segments of one bar. The samples of a segment depend only on the notes that sound in it:
+their frequency, their seed (which gives the initial waveform), and their start and release frames relative to the
+segment start, taken in playlist order, which is the order in which the voices are summed.
+A hash of these is the name of the segment in the cache directory. After an edit of the score only the bars whose
+notes changed, and the bars into which the changed notes ring, are synthesized again; all other segments are copied
+from the cache into the new output. Equal bars at different places of a song, or in different songs, share one file.
+In a song with several tracks every track of a segment is also cached on its own, before the mix bus; a bar in which
+one track changed is then mixed from the new samples of that track and the cached samples of the others.
+*/
+
+#define _CRT_SECURE_NO_WARNINGS
+
+#include <string.h>
+#include <errno.h>
+#include "render_cache.h"
+#include "worker_pool.h"
+#include "wall_clock.h"
+#include "prototype.h"
+
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#endif
+
+#define CACHE_COPY_BYTES 65536 //Buffer used to copy cached segments to the output.
+
+//Adding a 64-bit value to a hash (splitmix64 finalizer, as in the note seeds).
+static uint64_t hash_add(uint64_t h, uint64_t value){
+    uint64_t z = (h ^ value) + 0x9E3779B97F4A7C15ULL;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+static uint64_t hash_add_double(uint64_t h, double value){
+    uint64_t bits;
+
+    memcpy(&bits, &value, sizeof(bits));
+    return hash_add(h, bits);
+}
+
+//Adding the settings of the synthesis of the frames [a, b) to a hash.
+static uint64_t hash_settings(uint64_t h, int64_t a, int64_t b){
+    h = hash_add(h, RS(rate));
+    h = hash_add(h, (uint64_t)(b - a));
+    h = hash_add_double(h, RS(threshold_db));
+    //Prototype mode plays other waveforms; without it the hashes are the same as before there was one.
+    if (RS(prototypes)) h = hash_add(h, 0x70726F746FULL);
+    return hash_add(h, (uint64_t)RS(precision));
+}
+
+//Adding every note of 'notes' that sounds in the frames [a, b) to a hash, in playlist order, with its start and release
+//frames relative to 'a'. Notes that never play (stolen at once, or past the end) are left out.
+static uint64_t hash_notes(uint64_t h, note **notes, int n_notes, int64_t a, int64_t b){
+    note *q;
+    int i;
+
+    for (i = render_find_note(notes, n_notes, a); i < n_notes && notes[i]->start_sample < b; i++){
+        q = notes[i];
+        if (q->end_sample <= a || q->end_sample <= q->start_sample) continue;
+        h = hash_add(h, (uint64_t)(q->start_sample - a));
+        h = hash_add(h, (uint64_t)(q->end_sample - a));
+        h = hash_add_double(h, q->freq);
+        h = hash_add(h, q->seed);
+    }
+    return h;
+}
+
+/*Hash of the frames [a, b) of the song on the mix bus 'm'.
+It covers the settings that change the samples, the gains of the tracks and every note that sounds in the segment.
+A song with only the main track at gain 1 has the same hashes as before there were tracks. */
+uint64_t segment_hash(const mix_bus *m, int64_t a, int64_t b){
+    uint64_t h = RENDER_CACHE_VERSION;
+    note **notes;
+    int t, n;
+
+    h = hash_settings(h, a, b);
+    h = hash_add(h, (uint64_t)RS(dither));
+    h = hash_add(h, (uint64_t)RS(format));
+    //The dither noise depends on the position in the song, so dithered bars are not shared between places.
+    if (RS(dither)) h = hash_add(h, (uint64_t)a);
+
+    for (t = 0; t < m->n_tracks; t++){
+        if (m->n_tracks > 1 || m->gain_r[t] != 1.0 || m->gain_l[t] != 1.0){
+            h = hash_add(h, (uint64_t)t);
+            h = hash_add_double(h, m->gain_r[t]);
+            h = hash_add_double(h, m->gain_l[t]);
+        }
+        notes = mix_bus_track(m, t, &n);
+        h = hash_notes(h, notes, n, a, b);
+    }
+    return h;
+}
+
+//Hash of the frames [a, b) of one track before it is mixed: the synthesis settings and the notes of the track.
+uint64_t track_hash(note **notes, int n_notes, int64_t a, int64_t b){
+    uint64_t h = RENDER_CACHE_VERSION ^ 0x7472616B; //"trak": the track files are named apart from the segments
+
+    h = hash_settings(h, a, b);
+    return hash_notes(h, notes, n_notes, a, b);
+}
+
+//Creating the cache directory if it does not exist yet.
+static void cache_make_dir(const char *dir){
+#ifdef _WIN32
+    _mkdir(dir);
+#else
+    mkdir(dir, 0777);
+#endif
+}
+
+//Name of the cache file of a segment ("pcm") or of a track of a segment ("trk").
+static void segment_path(uint64_t hash, const char *type, char *path, size_t size){
+    snprintf(path, size, "%s/%016llx.%s", RS(cache_dir), (unsigned long long)hash, type);
+}
+
+//Returns 1 if the cache file exists and has the size of the segment.
+static int segment_cached(const char *path, int64_t bytes){
+    FILE *f = fopen(path, "rb");
+    long size = -1;
+
+    if (f == NULL) return 0;
+    if (fseek(f, 0, SEEK_END) == 0) size = ftell(f);
+    fclose(f);
+    return size == bytes;
+}
+
+/*Storing a rendered segment in the cache: 'frames' frames of 'frame_bytes' bytes from 'pcm', followed by as many
+from 'pcm2' if it is not NULL. It is written to a temporary file that is renamed when complete,
+so renders that run at the same time never read a partly written segment.
+Returns 0 if the segment cannot be stored; the render goes on without it. */
+static int segment_store(const char *path, const void *pcm, const void *pcm2, int64_t frames, int frame_bytes){
+    char temp[1100];
+    FILE *f;
+    int counter = 0, ok;
+
+    do {
+        snprintf(temp, sizeof(temp), "%s.%d.tmp", path, counter++);
+        f = fopen(temp, "wbx");
+    } while (f == NULL && errno == EEXIST);
+    if (f == NULL) return 0;
+
+    ok = fwrite(pcm, frame_bytes, (size_t)frames, f) == (size_t)frames;
+    if (pcm2 != NULL) ok &= fwrite(pcm2, frame_bytes, (size_t)frames, f) == (size_t)frames;
+    if (fclose(f) != 0) ok = 0;
+    if (!ok){
+        remove(temp);
+        return 0;
+    }
+    //rename fails on Windows when another render has just stored the same segment, with the same samples.
+    if (rename(temp, path) != 0){
+        remove(temp);
+        return segment_cached(path, (pcm2 != NULL ? 2 : 1) * frames * frame_bytes);
+    }
+    return 1;
+}
+
+//Reading the cached samples of a track of 'frames' frames into r and l. Returns 0 if they cannot be read.
+static int track_load(const char *path, double *r, double *l, int64_t frames){
+    FILE *f = fopen(path, "rb");
+    int ok;
+
+    if (f == NULL) return 0;
+    ok = fread(r, sizeof(double), (size_t)frames, f) == (size_t)frames
+      && fread(l, sizeof(double), (size_t)frames, f) == (size_t)frames;
+    fclose(f);
+    return ok;
+}
+
+//Appending a cached segment of 'bytes' bytes to the output. Returns 0 if it cannot be read or written.
+static int segment_copy(const char *path, int64_t bytes, FILE *out, char *buf){
+    FILE *f = fopen(path, "rb");
+    size_t n;
+    int64_t done = 0;
+
+    if (f == NULL) return 0;
+    while ((n = fread(buf, 1, CACHE_COPY_BYTES, f)) > 0){
+        if (fwrite(buf, 1, n, out) != n) break;
+        done += n;
+    }
+    fclose(f);
+    return done == bytes;
+}
+
+//Work shared by the threads that render one round of segments that are not in the cache.
+//A segment of the round has a slot with a buffer for each of its tracks.
+typedef struct cache_job_struct{
+    mix_bus* bus;
+    int64_t total_frames;
+    int64_t seg_frames; //Length of a segment (one bar)
+    uint64_t* hash; //Hash of every segment of the song
+    uint64_t* track_hash; //Hash of every track of every segment (songs with more than one track)
+    char* track_hit; //1 for the tracks of the segments that are in the cache
+    int* segment; //Segment of every slot of the round
+    int* job_slot; //Slot and track rendered by every job of the round
+    int* job_track;
+    double** mix_r; //Track buffers of every slot, n_tracks per slot; the first one of a slot receives the mix
+    double** mix_l;
+    void** pcm; //Output of every slot
+    int format; //Sample format of the output (RS(format))
+    int frame_bytes; //Bytes of one output frame
+    int* ok; //Result of every slot
+    render_stats* stats; //Statistics of every job
+} cache_job;
+
+//Frames [a, b) of the segment of a slot.
+static void cache_slot_frames(cache_job *s, int slot, int64_t *a, int64_t *b){
+    *a = s->segment[slot] * s->seg_frames;
+    *b = *a + s->seg_frames;
+    if (*b > s->total_frames) *b = s->total_frames;
+}
+
+//Rendering one track of a segment. In a song with several tracks it is stored in the cache on its own.
+static void render_track_job(void *ctx, int job){
+    cache_job *s = (cache_job *)ctx;
+    render_cursor c;
+    note **notes;
+    char path[1024];
+    int64_t a, b;
+    int n, slot = s->job_slot[job], t = s->job_track[job], k = slot * s->bus->n_tracks + t, ok;
+
+    cache_slot_frames(s, slot, &a, &b);
+    notes = mix_bus_track(s->bus, t, &n);
+    ok = render_cursor_seek(&c, notes, n, a)
+      && render_cursor_run(&c, notes, n, b, s->mix_r[k], s->mix_l[k]);
+    render_cursor_stats(&c, &s->stats[job]);
+    render_cursor_free(&c);
+    if (!ok){
+        s->ok[slot] = 0;
+        return;
+    }
+
+    if (s->bus->n_tracks > 1){
+        segment_path(s->track_hash[(size_t)s->segment[slot] * s->bus->n_tracks + t], "trk", path, sizeof(path));
+        if (!segment_store(path, s->mix_r[k], s->mix_l[k], b - a, sizeof(double))) fprintf(stderr, "Unable to store the track '%s' in the cache!\n", path);
+    }
+}
+
+//Mixing the tracks of a segment (the rendered ones and the cached ones) and storing the segment in the cache.
+static void mix_segment_job(void *ctx, int slot){
+    cache_job *s = (cache_job *)ctx;
+    char path[1024];
+    int64_t a, b;
+    int t, n_tracks = s->bus->n_tracks, k = slot * n_tracks;
+    size_t h;
+
+    if (!s->ok[slot]) return;
+    cache_slot_frames(s, slot, &a, &b);
+
+    for (t = 0; t < n_tracks; t++){
+        h = (size_t)s->segment[slot] * n_tracks + t;
+        if (n_tracks > 1 && s->track_hit[h]){
+            segment_path(s->track_hash[h], "trk", path, sizeof(path));
+            if (!track_load(path, s->mix_r[k + t], s->mix_l[k + t], b - a)){
+                fprintf(stderr, "Unable to read the cached track '%s'!\n", path);
+                s->ok[slot] = 0;
+                return;
+            }
+        }
+        mix_bus_add(s->bus, t, s->mix_r[k + t], s->mix_l[k + t], s->mix_r[k], s->mix_l[k], b - a);
+    }
+
+    s->stats[slot].clipped += wav_convert_to(s->mix_r[k], s->mix_l[k], s->pcm[slot], b - a, a, s->format);
+    segment_path(s->hash[s->segment[slot]], "pcm", path, sizeof(path));
+    if (!segment_store(path, s->pcm[slot], NULL, b - a, s->frame_bytes)) fprintf(stderr, "Unable to store the segment '%s' in the cache!\n", path);
+}
+
+/*Rendering the scheduled playlist into the file 'f' (after the header) through the segment cache in RS(cache_dir).
+Segments that are in the cache are copied. For the others, the tracks that are not in the cache are rendered on
+RS(threads) threads (and stored in the cache when the song has several tracks), mixed with the cached tracks,
+stored in the cache and written. So after an edit of one track only that track is synthesized again, and a change
+of the gain or pan of a track only mixes the cached tracks again. The output is the same as the one of render_song.
+The cache hits and misses, the counters of the rendered tracks and the synthesis and write times are added to 'stats'.
+Returns 1 on success and 0 if there is not enough memory or the output cannot be written. */
+int render_song_cached(note *head, int64_t total_frames, int bar_length, FILE *f, render_stats *stats){
+    cache_job s;
+    mix_bus bus;
+    note **notes;
+    char path[1024];
+    char *hit = NULL, *copy_buf = NULL;
+    int i, t, n, first, last, slot, n_threads, n_segments, n_tracks, n_slots, n_jobs, ok;
+    int64_t a, b;
+    size_t h;
+    double t0, t_start, t_last;
+
+    if (strlen(RS(cache_dir)) > sizeof(path) - 32){
+        fprintf(stderr, "The name of the cache directory is too long!\n");
+        return 0;
+    }
+    cache_make_dir(RS(cache_dir));
+
+    memset(&s, 0, sizeof(s));
+    ok = mix_bus_init(&bus, head);
+    s.bus = &bus;
+    n_tracks = bus.n_tracks;
+    n_threads = RS(threads) > 0 ? RS(threads) : cpu_count();
+    s.seg_frames = (int64_t)bar_length * RS(rate);
+    s.format = RS(format);
+    s.frame_bytes = 2 * wav_sample_bytes(s.format);
+    n_segments = (int)((total_frames + s.seg_frames - 1) / s.seg_frames);
+    n_slots = n_threads < n_segments ? n_threads : n_segments > 0 ? n_segments : 1;
+
+    s.hash = (uint64_t *)malloc((n_segments + 1) * sizeof(uint64_t));
+    s.track_hash = (uint64_t *)malloc(((size_t)n_segments * n_tracks + 1) * sizeof(uint64_t));
+    s.track_hit = (char *)calloc((size_t)n_segments * n_tracks + 1, 1);
+    hit = (char *)malloc(n_segments + 1);
+    copy_buf = (char *)malloc(CACHE_COPY_BYTES);
+    s.segment = (int *)calloc(n_slots, sizeof(int));
+    s.job_slot = (int *)calloc(n_slots * n_tracks, sizeof(int));
+    s.job_track = (int *)calloc(n_slots * n_tracks, sizeof(int));
+    s.mix_r = (double **)calloc(n_slots * n_tracks, sizeof(double *));
+    s.mix_l = (double **)calloc(n_slots * n_tracks, sizeof(double *));
+    s.pcm = (void **)calloc(n_slots, sizeof(void *));
+    s.ok = (int *)calloc(n_slots, sizeof(int));
+    s.stats = (render_stats *)calloc(n_slots * n_tracks, sizeof(render_stats));
+    if (!s.hash || !s.track_hash || !s.track_hit || !hit || !copy_buf || !s.segment || !s.job_slot || !s.job_track
+        || !s.mix_r || !s.mix_l || !s.pcm || !s.ok || !s.stats) ok = 0;
+    for (i = 0; ok && i < n_slots * n_tracks; i++){
+        s.mix_r[i] = (double *)malloc(s.seg_frames * sizeof(double));
+        s.mix_l[i] = (double *)malloc(s.seg_frames * sizeof(double));
+        if (!s.mix_r[i] || !s.mix_l[i]) ok = 0;
+    }
+    for (i = 0; ok && i < n_slots; i++){
+        s.pcm[i] = malloc(s.seg_frames * s.frame_bytes);
+        if (!s.pcm[i]) ok = 0;
+    }
+
+    if (ok){
+        s.total_frames = total_frames;
+
+        //Hashing every segment and looking it up in the cache, and the tracks of the segments that are not in it.
+        for (i = 0; i < n_segments; i++){
+            a = i * s.seg_frames;
+            b = a + s.seg_frames;
+            if (b > total_frames) b = total_frames;
+            s.hash[i] = segment_hash(&bus, a, b);
+            segment_path(s.hash[i], "pcm", path, sizeof(path));
+            hit[i] = (char)segment_cached(path, (b - a) * s.frame_bytes);
+            if (hit[i]) stats->cache_hits++;
+            else stats->cache_misses++;
+
+            for (t = 0; !hit[i] && n_tracks > 1 && t < n_tracks; t++){
+                h = (size_t)i * n_tracks + t;
+                notes = mix_bus_track(&bus, t, &n);
+                s.track_hash[h] = track_hash(notes, n, a, b);
+                segment_path(s.track_hash[h], "trk", path, sizeof(path));
+                s.track_hit[h] = (char)segment_cached(path, (b - a) * 2 * (int64_t)sizeof(double));
+            }
+        }
+
+        t_start = t_last = wall_time();
+        for (first = 0; ok && first < n_segments; first = last){
+            //A round reaches up to the n_threads-th segment that has to be mixed,
+            //or less when its tracks already make n_threads jobs.
+            slot = 0;
+            n_jobs = 0;
+            for (last = first; last < n_segments && (hit[last] || (slot < n_slots && n_jobs < n_threads)); last++){
+                if (hit[last]) continue;
+                s.segment[slot] = last;
+                s.ok[slot] = 1;
+                for (t = 0; t < n_tracks; t++){
+                    if (n_tracks > 1 && s.track_hit[(size_t)last * n_tracks + t]) continue;
+                    s.job_slot[n_jobs] = slot;
+                    s.job_track[n_jobs] = t;
+                    n_jobs++;
+                }
+                slot++;
+            }
+
+            if (slot > 0){
+                memset(s.stats, 0, (n_jobs > slot ? n_jobs : slot) * sizeof(render_stats));
+                t0 = wall_time();
+                parallel_for(n_jobs, n_threads, render_track_job, &s);
+                parallel_for(slot, n_threads, mix_segment_job, &s);
+                stats->synth_ms += 1000.0 * (wall_time() - t0);
+                render_stats_add_round(stats, s.stats, n_jobs > slot ? n_jobs : slot);
+            }
+
+            //Splicing the cached and the new segments together in time order.
+            t0 = wall_time();
+            slot = 0;
+            for (i = first; ok && i < last; i++){
+                a = i * s.seg_frames;
+                b = a + s.seg_frames;
+                if (b > total_frames) b = total_frames;
+
+                if (hit[i]){
+                    segment_path(s.hash[i], "pcm", path, sizeof(path));
+                    ok = segment_copy(path, (b - a) * s.frame_bytes, f, copy_buf);
+                    if (!ok) fprintf(stderr, "Unable to copy the cached segment '%s'!\n", path);
+                }
+                else{
+                    ok = s.ok[slot] && fwrite(s.pcm[slot], s.frame_bytes, (size_t)(b - a), f) == (size_t)(b - a);
+                    slot++;
+                }
+            }
+            stats->write_ms += 1000.0 * (wall_time() - t0);
+
+            b = last * s.seg_frames;
+            render_progress(stats, b < total_frames ? b : total_frames, total_frames, t_start, &t_last);
+        }
+    }
+    else fprintf(stderr, "Out of memory!\n");
+
+    for (i = 0; s.mix_r && s.mix_l && i < n_slots * n_tracks; i++){
+        free(s.mix_r[i]);
+        free(s.mix_l[i]);
+    }
+    for (i = 0; s.pcm && i < n_slots; i++) free(s.pcm[i]);
+    free(s.mix_r);
+    free(s.mix_l);
+    free(s.pcm);
+    free(s.segment);
+    free(s.job_slot);
+    free(s.job_track);
+    free(s.ok);
+    free(s.stats);
+    free(s.hash);
+    free(s.track_hash);
+    free(s.track_hit);
+    free(hit);
+    free(copy_buf);
+    mix_bus_free(&bus);
+    return ok;
+}
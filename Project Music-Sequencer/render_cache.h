@@ -0,0 +1,20 @@
+#pragma once
+
+#ifndef RENDER_CACHE_H
+#define RENDER_CACHE_H
+
+#include<stdio.h>
+#include<stdlib.h>
+#include <stdint.h>
+#include"render.h"
+#include"mix_bus.h"
+
+//Version of the synthesis, part of every segment hash. It must be changed together with anything that changes
+//the samples of a note (the string model, the pan, the release, the output conversion), so old segments are not reused.
+#define RENDER_CACHE_VERSION 2
+
+uint64_t segment_hash(const mix_bus* m, int64_t a, int64_t b);
+uint64_t track_hash(note** notes, int n_notes, int64_t a, int64_t b);
+int render_song_cached(note* head, int64_t total_frames, int bar_length, FILE* f, render_stats* stats);
+
+#endif // RENDER_CACHE_H
@@ -0,0 +1,908 @@
+/*
+Render daemon and its client.
+The daemon listens on a Unix domain socket and keeps what a render needs warm between requests: the note table,
+the prototype cache and a fixed set of worker threads, each of which waits for the next connection. Every request is
+rendered with a sequencer of its own (see sequencer.h), so requests with different settings run at the same time.
+The results are kept in a content-addressed cache on disk: the name of a .wav file is a hash of the score text and of
+every setting that changes its samples, so a repeated request is answered with the file that is already there.
+The cache is bounded; when it is full, the results that were used least recently are removed.
+On Windows the sockets are Winsock AF_UNIX sockets (Windows 10 version 1803 and later).
+*/
+
+#define _CRT_SECURE_NO_WARNINGS
+
+//Winsock must come before windows.h (included by worker_pool.h).
+#ifdef _WIN32
+#include <winsock2.h>
+#include <afunix.h>
+#include <direct.h>
+#ifdef _MSC_VER
+#pragma comment(lib, "ws2_32.lib")
+#endif
+typedef SOCKET sock_t;
+#define SOCK_INVALID INVALID_SOCKET
+#define sock_close closesocket
+#define file_seek _fseeki64
+#define file_tell _ftelli64
+#else
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include <signal.h>
+#include <glob.h>
+typedef int sock_t;
+#define SOCK_INVALID (-1)
+#define sock_close close
+#define file_seek fseeko
+#define file_tell ftello
+#endif
+
+#include <string.h>
+#include "render_daemon.h"
+#include "sequencer.h"
+#include "worker_pool.h"
+#include "wall_clock.h"
+#include "file_map.h"
+#include "render_cache.h"
+#include "prototype.h"
+#include "batch.h"
+
+#define DAEMON_COPY_BYTES 65536 //Buffer of the .wav bytes sent to a client
+
+//A result in the cache: the file <key>.wav in the cache directory.
+typedef struct daemon_entry_struct{
+    uint64_t key; //Hash of the score text and the settings
+    int64_t bytes; //Size of the file
+    uint64_t last_use; //Time of the last use, for removing the least recently used results
+} daemon_entry;
+
+//State of the daemon, shared by its workers. The fields after 'lock' are only used while it is held.
+typedef struct render_daemon_struct{
+    const char *socket_path;
+    const char *cache_dir; //Absolute path, so the paths in the replies can be used from any directory
+    const char *ir_dir; //Absolute path of the directory of the impulse responses, NULL = no reverb
+    int64_t cache_limit; //Disk bound of the cache in bytes
+    int n_workers;
+    render_settings settings; //Settings of a request before its options
+    sock_t listener;
+    pool_mutex lock;
+    daemon_entry *entries;
+    int n_entries;
+    int capacity;
+    int64_t cache_bytes; //Bytes of all results in the cache
+    uint64_t clock; //Counts the uses, for last_use
+    uint64_t requests, hits, renders, errors, evictions;
+    int stop; //Set by a shutdown request
+} render_daemon;
+
+//A connection with a read buffer, so the lines of a request are not read with a system call per byte.
+typedef struct daemon_conn_struct{
+    sock_t s;
+    char buf[4096];
+    int n; //Bytes in the buffer
+    int pos; //Next unread byte
+} daemon_conn;
+
+//Starting the sockets. Returns 0 if they cannot be used.
+static int sockets_start(void){
+#ifdef _WIN32
+    WSADATA wsa;
+
+    return WSAStartup(MAKEWORD(2, 2), &wsa) == 0;
+#else
+    signal(SIGPIPE, SIG_IGN); //A peer that goes away makes send fail instead of ending the program
+    return 1;
+#endif
+}
+
+static void sockets_stop(void){
+#ifdef _WIN32
+    WSACleanup();
+#endif
+}
+
+//The address of the socket file 'path'. Returns 0 if the path is too long.
+static int socket_address(const char *path, struct sockaddr_un *a){
+    memset(a, 0, sizeof(*a));
+    a->sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(a->sun_path)) return 0;
+    strcpy(a->sun_path, path);
+    return 1;
+}
+
+//Connecting to the daemon at 'path'. Returns SOCK_INVALID if no daemon listens there.
+static sock_t socket_connect(const char *path){
+    struct sockaddr_un a;
+    sock_t s;
+
+    if (!socket_address(path, &a)) return SOCK_INVALID;
+    s = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (s == SOCK_INVALID) return s;
+    if (connect(s, (struct sockaddr *)&a, sizeof(a)) != 0){
+        sock_close(s);
+        return SOCK_INVALID;
+    }
+    return s;
+}
+
+//Closing a connection that sends nothing for 'seconds' seconds.
+static void socket_timeout(sock_t s, int seconds){
+#ifdef _WIN32
+    DWORD ms = (DWORD)seconds * 1000;
+
+    setsockopt(s, SOL_SOCKET, SO_RCVTIMEO, (const char *)&ms, sizeof(ms));
+#else
+    struct timeval tv;
+
+    tv.tv_sec = seconds;
+    tv.tv_usec = 0;
+    setsockopt(s, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+#endif
+}
+
+//Sending n bytes. Returns 0 if the connection is broken.
+static int send_all(sock_t s, const char *p, int64_t n){
+    int k;
+
+    while (n > 0){
+        k = send(s, p, n > (1 << 30) ? (1 << 30) : (int)n, 0);
+        if (k <= 0) return 0;
+        p += k;
+        n -= k;
+    }
+    return 1;
+}
+
+//Reading one line, without its line end, into 'line'.
+//Returns the length of the line, or -1 if the connection ends first or the line does not fit.
+static int conn_read_line(daemon_conn *c, char *line, int size){
+    int len = 0;
+    char ch;
+
+    for (;;){
+        if (c->pos == c->n){
+            c->n = recv(c->s, c->buf, sizeof(c->buf), 0);
+            c->pos = 0;
+            if (c->n <= 0){
+                c->n = 0;
+                return -1;
+            }
+        }
+        ch = c->buf[c->pos++];
+        if (ch == '\n') break;
+        if (len + 1 >= size) return -1;
+        line[len++] = ch;
+    }
+    if (len > 0 && line[len - 1] == '\r') len--;
+    line[len] = '\0';
+    return len;
+}
+
+//Reading n bytes. Returns 0 if the connection ends first.
+static int conn_read(daemon_conn *c, char *p, int64_t n){
+    int k;
+
+    while (n > 0){
+        if (c->pos < c->n){
+            k = c->n - c->pos < n ? c->n - c->pos : (int)n;
+            memcpy(p, c->buf + c->pos, k);
+            c->pos += k;
+        }
+        else{
+            k = recv(c->s, p, n > (1 << 30) ? (1 << 30) : (int)n, 0);
+            if (k <= 0) return 0;
+        }
+        p += k;
+        n -= k;
+    }
+    return 1;
+}
+
+//Size of a file in bytes, or -1 if it cannot be opened.
+static int64_t file_size(const char *path){
+    FILE *f = fopen(path, "rb");
+    int64_t size = -1;
+
+    if (f == NULL) return -1;
+    if (file_seek(f, 0, SEEK_END) == 0) size = (int64_t)file_tell(f);
+    fclose(f);
+    return size;
+}
+
+//Adding a 64-bit value to a key (the splitmix64 finalizer, as in the segment hashes).
+static uint64_t key_add(uint64_t h, uint64_t value){
+    uint64_t z = (h ^ value) + 0x9E3779B97F4A7C15ULL;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+//Adding len bytes to a key, 8 at a time.
+static uint64_t key_add_bytes(uint64_t h, const char *data, int64_t len){
+    uint64_t v;
+    int64_t i;
+
+    h = key_add(h, (uint64_t)len);
+    for (i = 0; i + 8 <= len; i += 8){
+        memcpy(&v, data + i, 8);
+        h = key_add(h, v);
+    }
+    if (i < len){
+        v = 0;
+        memcpy(&v, data + i, (size_t)(len - i));
+        h = key_add(h, v);
+    }
+    return h;
+}
+
+/*The key of a result: a hash of the score text and of every setting that changes the bytes of the .wav file.
+The render threads, the block size and the segment length are left out, because the output does not depend on them.
+With the reverb, the key has the bytes of the impulse response, so a changed file is not answered from the cache.
+Returns 0 if the impulse response cannot be read. */
+static int result_key(const char *text, int64_t len, const render_settings *s, int bar_length, uint64_t *key){
+    uint64_t h = RENDER_CACHE_VERSION ^ 0x726573756C74ULL, v; //"result"
+    file_map m;
+
+    h = key_add(h, (uint64_t)s->rate);
+    h = key_add(h, s->seed);
+    memcpy(&v, &s->threshold_db, sizeof(v));
+    h = key_add(h, v);
+    h = key_add(h, (uint64_t)s->max_length);
+    h = key_add(h, (uint64_t)s->polyphony);
+    h = key_add(h, (uint64_t)s->precision);
+    h = key_add(h, (uint64_t)s->dither);
+    h = key_add(h, (uint64_t)s->format);
+    h = key_add(h, (uint64_t)s->prototypes);
+    h = key_add(h, (uint64_t)bar_length);
+    if (s->reverb != NULL){
+        if (!file_map_open(&m, s->reverb)) return 0;
+        memcpy(&v, &s->wet, sizeof(v));
+        h = key_add(h, v);
+        h = key_add_bytes(h, m.data, (int64_t)m.size);
+        file_map_close(&m);
+    }
+    *key = key_add_bytes(h, text, len);
+    return 1;
+}
+
+static void result_path(const render_daemon *d, uint64_t key, char *path, size_t size){
+    snprintf(path, size, "%s/%016llx.wav", d->cache_dir, (unsigned long long)key);
+}
+
+//The result with the given key, or NULL. The caller holds the lock.
+static daemon_entry *entry_find(render_daemon *d, uint64_t key){
+    int i;
+
+    for (i = 0; i < d->n_entries; i++){
+        if (d->entries[i].key == key) return &d->entries[i];
+    }
+    return NULL;
+}
+
+//Adding a result of 'bytes' bytes to the index, as the most recently used one.
+//Returns 0 if there is not enough memory. The caller holds the lock.
+static int entry_add(render_daemon *d, uint64_t key, int64_t bytes){
+    daemon_entry *e = entry_find(d, key), *t;
+
+    if (e == NULL){
+        if (d->n_entries == d->capacity){
+            t = (daemon_entry *)realloc(d->entries, (d->capacity ? 2 * (size_t)d->capacity : 256) * sizeof(daemon_entry));
+            if (t == NULL){
+                fprintf(stderr, "Out of memory!\n");
+                return 0;
+            }
+            d->entries = t;
+            d->capacity = d->capacity ? 2 * d->capacity : 256;
+        }
+        e = &d->entries[d->n_entries++];
+        e->key = key;
+        e->bytes = 0;
+    }
+    d->cache_bytes += bytes - e->bytes;
+    e->bytes = bytes;
+    e->last_use = ++d->clock;
+    return 1;
+}
+
+//Removing a result from the index. The caller holds the lock.
+static void entry_remove(render_daemon *d, daemon_entry *e){
+    d->cache_bytes -= e->bytes;
+    *e = d->entries[--d->n_entries];
+}
+
+//Removing the least recently used results, except 'keep', until the cache fits in its bound.
+//A client that is reading a removed file keeps reading it. The caller holds the lock.
+static void daemon_evict(render_daemon *d, uint64_t keep){
+    char path[1100];
+    int i, lru;
+
+    while (d->cache_bytes > d->cache_limit){
+        lru = -1;
+        for (i = 0; i < d->n_entries; i++){
+            if (d->entries[i].key != keep && (lru < 0 || d->entries[i].last_use < d->entries[lru].last_use)) lru = i;
+        }
+        if (lru < 0) return;
+
+        result_path(d, d->entries[lru].key, path, sizeof(path));
+        remove(path);
+        entry_remove(d, &d->entries[lru]);
+        d->evictions++;
+    }
+}
+
+//Adding a file of the cache directory to the index if its name is a key. Returns 0 if there is not enough memory.
+static int daemon_scan_file(render_daemon *d, const char *name){
+    char path[1100], ext[8];
+    unsigned long long key;
+    int64_t bytes;
+
+    if (strlen(name) != 20 || sscanf(name, "%16llx%7s", &key, ext) != 2 || strcmp(ext, ".wav") != 0) return 1;
+    result_path(d, key, path, sizeof(path));
+    bytes = file_size(path);
+    return bytes < 0 || entry_add(d, key, bytes);
+}
+
+//Adding the results that earlier runs of the daemon left in the cache directory to the index.
+//Returns 0 if there is not enough memory.
+static int daemon_scan_cache(render_daemon *d){
+    char pattern[1100];
+    int ok = 1;
+
+    snprintf(pattern, sizeof(pattern), "%s/*.wav", d->cache_dir);
+#ifdef _WIN32
+    {
+        WIN32_FIND_DATAA fd;
+        HANDLE h = FindFirstFileA(pattern, &fd);
+
+        if (h != INVALID_HANDLE_VALUE){
+            do{
+                ok = daemon_scan_file(d, fd.cFileName);
+            } while (ok && FindNextFileA(h, &fd));
+            FindClose(h);
+        }
+    }
+#else
+    {
+        glob_t g;
+        size_t i;
+
+        if (glob(pattern, 0, NULL, &g) == 0){
+            for (i = 0; ok && i < g.gl_pathc; i++) ok = daemon_scan_file(d, strrchr(g.gl_pathv[i], '/') + 1);
+        }
+        globfree(&g);
+    }
+#endif
+    return ok;
+}
+
+/*Checking the name of an impulse response in a request: a relative path in the directory of the impulse responses,
+without an empty or ".." part, so that a client cannot read other files of the machine. */
+static int daemon_ir_name_ok(const char *name){
+    const char *p = name, *q;
+
+    if (*name == '\0' || *name == '/' || *name == '\\' || strchr(name, ':') != NULL) return 0;
+    while (*p != '\0'){
+        for (q = p; *q != '\0' && *q != '/' && *q != '\\'; q++) ;
+        if (q == p || (q - p == 2 && p[0] == '.' && p[1] == '.')) return 0;
+        p = *q != '\0' ? q + 1 : q;
+    }
+    return p[-1] != '/' && p[-1] != '\\';
+}
+
+/*Applying one option line of a render request. The impulse response of "reverb" is a name in the directory 'ir_dir';
+its path is written to 'reverb_path' (DAEMON_LINE bytes). Returns NULL, or the reason the option is invalid. */
+static const char *daemon_option(render_settings *s, int *bar_length, int *reply_wav, int64_t *len, char *reverb_path,
+                                 const char *ir_dir, const char *name, const char *value){
+    if (strcmp(name, "rate") == 0) s->rate = atoi(value);
+    else if (strcmp(name, "precision") == 0){
+        if (precision_from_name(value) < 0) return "unknown number format";
+        s->precision = precision_from_name(value);
+    }
+    else if (strcmp(name, "prototypes") == 0) s->prototypes = atoi(value) != 0;
+    else if (strcmp(name, "dither") == 0) s->dither = atoi(value) != 0;
+    else if (strcmp(name, "format") == 0){
+        if (strcmp(value, "16") == 0) s->format = WAV_PCM16;
+        else if (strcmp(value, "float") == 0) s->format = WAV_FLOAT32;
+        else return "unknown sample format";
+    }
+    else if (strcmp(name, "polyphony") == 0) s->polyphony = atoi(value) > 0 ? atoi(value) : 0;
+    else if (strcmp(name, "threshold") == 0) s->threshold_db = atof(value);
+    else if (strcmp(name, "seed") == 0) s->seed = strtoull(value, NULL, 10);
+    else if (strcmp(name, "threads") == 0) s->threads = atoi(value) >= 0 ? atoi(value) : 1;
+    else if (strcmp(name, "reverb") == 0){
+        if (ir_dir == NULL) return "the daemon has no impulse responses";
+        if (!daemon_ir_name_ok(value) || snprintf(reverb_path, DAEMON_LINE, "%s/%s", ir_dir, value) >= DAEMON_LINE){
+            return "invalid impulse response name";
+        }
+        s->reverb = reverb_path;
+    }
+    else if (strcmp(name, "wet") == 0){
+        s->wet = atof(value);
+        if (s->wet <= 0) return "reverb level must be positive";
+    }
+    else if (strcmp(name, "bar") == 0){
+        *bar_length = atoi(value);
+        if (*bar_length <= 0) return "bar length must be positive";
+    }
+    else if (strcmp(name, "reply") == 0){
+        if (strcmp(value, "wav") == 0) *reply_wav = 1;
+        else if (strcmp(value, "path") == 0) *reply_wav = 0;
+        else return "unknown reply";
+    }
+    else if (strcmp(name, "score") == 0){
+        *len = strtoll(value, NULL, 10);
+        if (*len < 0 || *len > DAEMON_MAX_SCORE_BYTES) return "invalid score length";
+    }
+    else return "unknown option";
+    return NULL;
+}
+
+/*Rendering the .wav file of a score into the cache as <key>.wav. The file is written under a temporary name of the
+worker and renamed when it is complete, so no client ever sees a partly written result. Another worker may have
+stored the same result in the meantime; the files are the same, so either one is kept.
+The size of the result is put in *bytes, and with 'open_file' set the file is opened into *f. Both happen while the lock
+is held, so another worker cannot evict the result before it is sent.
+Returns NULL, or the reason the render failed. */
+static const char *daemon_render_result(render_daemon *d, const char *text, int64_t len, const render_settings *settings,
+                                        int bar_length, uint64_t key, int worker, int open_file, FILE **f, int64_t *bytes){
+    sequencer s;
+    char path[1100], temp[1100];
+    int error;
+
+    result_path(d, key, path, sizeof(path));
+    snprintf(temp, sizeof(temp), "%s/%016llx.%d.tmp", d->cache_dir, (unsigned long long)key, worker);
+
+    error = sequencer_init(&s);
+    if (error == SEQUENCER_OK){
+        s.settings = *settings;
+        s.bar_length = bar_length;
+        error = sequencer_load_text(&s, text, (size_t)len);
+    }
+    if (error == SEQUENCER_OK) error = sequencer_render(&s, temp);
+    sequencer_free(&s);
+    if (error != SEQUENCER_OK){
+        remove(temp);
+        return sequencer_error_text(error);
+    }
+
+    pool_mutex_lock(&d->lock);
+    if (rename(temp, path) != 0) remove(temp);
+    *bytes = file_size(path);
+    if (*bytes >= 0 && entry_add(d, key, *bytes)){
+        d->renders++;
+        daemon_evict(d, key);
+        if (open_file) *f = fopen(path, "rb");
+    }
+    else *bytes = -1;
+    pool_mutex_unlock(&d->lock);
+    if (*bytes < 0) return "the result cannot be stored";
+    return open_file && *f == NULL ? "the result cannot be read" : NULL;
+}
+
+//Serving a render request: its options and score are read, the result is taken from the cache or rendered into it,
+//and its path (and with "reply wav" its bytes) is sent back.
+static void daemon_render(render_daemon *d, daemon_conn *c, int worker){
+    render_settings settings = d->settings;
+    daemon_entry *e;
+    char line[DAEMON_LINE], name[64], value[DAEMON_LINE], path[1100], reverb_path[DAEMON_LINE], *text = NULL, *copy;
+    const char *error = NULL, *option_error;
+    int bar_length = DEFAULT_BAR_LENGTH, reply_wav = 0, hit = 0, ok;
+    int64_t len = -1, bytes = -1;
+    uint64_t key = 0;
+    size_t k;
+    FILE *f = NULL;
+    double t0 = wall_time();
+
+    //The options, up to the score line, and the score text. A request with an invalid option is still read to its
+    //end, so that the client is not cut off while it sends the score and gets the error.
+    do{
+        if (conn_read_line(c, line, sizeof(line)) < 0) return;
+        name[0] = '\0';
+        if (sscanf(line, "%63s %2047[^\n]", name, value) != 2) option_error = "invalid request line";
+        else option_error = daemon_option(&settings, &bar_length, &reply_wav, &len, reverb_path, d->ir_dir, name, value);
+        if (error == NULL) error = option_error;
+    } while (strcmp(name, "score") != 0);
+    if (len >= 0 && len <= DAEMON_MAX_SCORE_BYTES){
+        text = (char *)malloc((size_t)len + 1);
+        if (text == NULL && error == NULL) error = "out of memory";
+        if (text != NULL && !conn_read(c, text, len)){
+            free(text);
+            return;
+        }
+    }
+
+    //A result that is in the cache is opened while the lock is held, so it cannot be removed before it is sent.
+    if (error == NULL && !result_key(text, len, &settings, bar_length, &key)) error = "the impulse response cannot be read";
+    if (error == NULL){
+        result_path(d, key, path, sizeof(path));
+        pool_mutex_lock(&d->lock);
+        e = entry_find(d, key);
+        if (e != NULL){
+            f = fopen(path, "rb");
+            if (f != NULL){
+                e->last_use = ++d->clock;
+                bytes = e->bytes;
+                hit = 1;
+                d->hits++;
+            }
+            else entry_remove(d, e); //Removed from the directory by someone else
+        }
+        pool_mutex_unlock(&d->lock);
+    }
+    if (error == NULL && !hit) error = daemon_render_result(d, text, len, &settings, bar_length, key, worker, reply_wav, &f, &bytes);
+    free(text);
+
+    if (error != NULL){
+        snprintf(line, sizeof(line), "error %s\n", error);
+        send_all(c->s, line, strlen(line));
+        pool_mutex_lock(&d->lock);
+        d->errors++;
+        pool_mutex_unlock(&d->lock);
+    }
+    else{
+        snprintf(line, sizeof(line), "ok %s %lld %s\n", hit ? "hit" : "render", (long long)bytes, path);
+        ok = send_all(c->s, line, strlen(line));
+        copy = f != NULL ? (char *)malloc(DAEMON_COPY_BYTES) : NULL;
+        while (ok && copy != NULL && (k = fread(copy, 1, DAEMON_COPY_BYTES, f)) > 0) ok = send_all(c->s, copy, k);
+        free(copy);
+    }
+    if (f != NULL) fclose(f);
+    fprintf(stderr, "%016llx %s in %.1f ms\n", (unsigned long long)key, error != NULL ? error : hit ? "hit" : "rendered",
+            1000.0 * (wall_time() - t0));
+}
+
+//Sending the counters of the daemon as one line of JSON.
+static void daemon_stats(render_daemon *d, sock_t s){
+    char line[DAEMON_LINE];
+
+    pool_mutex_lock(&d->lock);
+    snprintf(line, sizeof(line), "ok {\"requests\":%llu,\"hits\":%llu,\"renders\":%llu,\"errors\":%llu,\"evictions\":%llu,"
+             "\"results\":%d,\"cache_bytes\":%lld,\"cache_limit\":%lld,\"workers\":%d,\"prototype_cache_bytes\":%zu}\n",
+             (unsigned long long)d->requests, (unsigned long long)d->hits, (unsigned long long)d->renders,
+             (unsigned long long)d->errors, (unsigned long long)d->evictions, d->n_entries, (long long)d->cache_bytes,
+             (long long)d->cache_limit, d->n_workers, prototype_cache_used());
+    pool_mutex_unlock(&d->lock);
+    send_all(s, line, strlen(line));
+}
+
+//Stopping the daemon: every other worker is woken from accept with a connection of its own and sees 'stop'.
+static void daemon_shutdown(render_daemon *d, sock_t s){
+    sock_t w;
+    int i;
+
+    pool_mutex_lock(&d->lock);
+    d->stop = 1;
+    pool_mutex_unlock(&d->lock);
+    send_all(s, "ok\n", 3);
+    for (i = 1; i < d->n_workers; i++){
+        w = socket_connect(d->socket_path);
+        if (w != SOCK_INVALID) sock_close(w);
+    }
+}
+
+//Serving one connection: a command line and its request.
+static void daemon_serve(render_daemon *d, sock_t s, int worker){
+    daemon_conn c;
+    char line[DAEMON_LINE];
+
+    c.s = s;
+    c.n = c.pos = 0;
+    if (conn_read_line(&c, line, sizeof(line)) < 0) return;
+
+    pool_mutex_lock(&d->lock);
+    d->requests++;
+    pool_mutex_unlock(&d->lock);
+
+    if (strcmp(line, "render") == 0) daemon_render(d, &c, worker);
+    else if (strcmp(line, "stats") == 0) daemon_stats(d, s);
+    else if (strcmp(line, "shutdown") == 0) daemon_shutdown(d, s);
+    else send_all(s, "error unknown command\n", 22);
+}
+
+static int daemon_stopping(render_daemon *d){
+    int stop;
+
+    pool_mutex_lock(&d->lock);
+    stop = d->stop;
+    pool_mutex_unlock(&d->lock);
+    return stop;
+}
+
+//A worker: it takes the next connection, serves it and waits for the next one, until the daemon stops.
+static void daemon_worker(void *ctx, int worker){
+    render_daemon *d = (render_daemon *)ctx;
+    sock_t s;
+
+    while (!daemon_stopping(d)){
+        s = accept(d->listener, NULL, NULL);
+        if (s == SOCK_INVALID) continue;
+        if (daemon_stopping(d)){
+            sock_close(s);
+            return;
+        }
+
+        socket_timeout(s, DAEMON_TIMEOUT_SECONDS);
+        daemon_serve(d, s, worker);
+        sock_close(s);
+    }
+}
+
+//Creating the listening socket. A socket file on which no daemon listens is left over from a daemon that did not
+//end normally and is replaced. Returns 0 if the daemon cannot listen.
+static int daemon_listen(render_daemon *d){
+    struct sockaddr_un a;
+    sock_t s;
+
+    if (!socket_address(d->socket_path, &a)){
+        fprintf(stderr, "The socket path '%s' is too long.\n", d->socket_path);
+        return 0;
+    }
+    s = socket_connect(d->socket_path);
+    if (s != SOCK_INVALID){
+        sock_close(s);
+        fprintf(stderr, "A daemon is already listening on '%s'.\n", d->socket_path);
+        return 0;
+    }
+    remove(d->socket_path);
+
+    d->listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (d->listener == SOCK_INVALID) ;
+    else if (bind(d->listener, (struct sockaddr *)&a, sizeof(a)) != 0 || listen(d->listener, 64) != 0){
+        sock_close(d->listener);
+        d->listener = SOCK_INVALID;
+    }
+    if (d->listener == SOCK_INVALID){
+        fprintf(stderr, "Unable to listen on '%s'!\n", d->socket_path);
+        return 0;
+    }
+    return 1;
+}
+
+static void render_daemon_usage(const char *program){
+    fprintf(stderr,
+            "Usage: %s [options] SOCKET\n"
+            "Serves render requests on the Unix domain socket SOCKET until a client sends shutdown.\n"
+            "  -w N      worker threads, requests served at the same time (default %d)\n"
+            "  -C DIR    directory of the result cache (default %s)\n"
+            "  -M MB     disk bound of the result cache in MB (default %d)\n"
+            "  -I DIR    directory of the impulse responses that requests may name (default none: no reverb)\n"
+            "  -t N      render threads per request (default 1, 0 = one per processor); a request may choose its own\n"
+            "  -r 0|1    print a JSON report of every render on stderr (default 1)\n",
+            program, DEFAULT_DAEMON_WORKERS, DEFAULT_DAEMON_CACHE_DIR, DEFAULT_DAEMON_CACHE_MB);
+}
+
+//Command line of the daemon (program --daemon ...). The note table and the prototype cache are prepared by main.
+int render_daemon_main(int argc, char **argv){
+    render_daemon d;
+    char *dir = NULL, *ir_dir = NULL;
+    int i, ok = 1;
+
+    memset(&d, 0, sizeof(d));
+    d.cache_dir = DEFAULT_DAEMON_CACHE_DIR;
+    d.cache_limit = (int64_t)DEFAULT_DAEMON_CACHE_MB << 20;
+    d.n_workers = DEFAULT_DAEMON_WORKERS;
+    RS(threads) = 1;
+
+    for (i = 1; ok && i < argc; i++){
+        if (argv[i][0] == '-' && argv[i][1] != '\0' && argv[i][2] == '\0'){
+            if (argv[i][1] == 'h'){
+                render_daemon_usage(argv[0]);
+                return EXIT_SUCCESS;
+            }
+            if (strchr("wCMItr", argv[i][1]) == NULL || i + 1 >= argc){
+                fprintf(stderr, i + 1 >= argc ? "Option %s needs a value.\n" : "Unknown option %s.\n", argv[i]);
+                ok = 0;
+                break;
+            }
+            switch (argv[i][1]){
+            case 'w': d.n_workers = atoi(argv[i + 1]); break;
+            case 'C': d.cache_dir = argv[i + 1]; break;
+            case 'M': d.cache_limit = (int64_t)(atof(argv[i + 1]) * 1048576.0); break;
+            case 'I': d.ir_dir = argv[i + 1]; break;
+            case 't': RS(threads) = atoi(argv[i + 1]); break;
+            case 'r': RS(report) = atoi(argv[i + 1]); break;
+            }
+            i++;
+        }
+        else if (d.socket_path == NULL) d.socket_path = argv[i];
+        else{
+            fprintf(stderr, "Only one socket can be given.\n");
+            ok = 0;
+        }
+    }
+    if (ok && (d.socket_path == NULL || d.n_workers < 1 || d.cache_limit < 0 || RS(threads) < 0)){
+        if (d.socket_path != NULL) fprintf(stderr, "The worker count must be positive, the cache bound and thread count 0 or more.\n");
+        ok = 0;
+    }
+    if (!ok){
+        render_daemon_usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    d.settings = *render_settings_current();
+
+    //The cache directory as an absolute path.
+#ifdef _WIN32
+    _mkdir(d.cache_dir);
+    dir = _fullpath(NULL, d.cache_dir, 0);
+#else
+    mkdir(d.cache_dir, 0777);
+    dir = realpath(d.cache_dir, NULL);
+#endif
+    if (dir == NULL || strlen(dir) > 1000){
+        fprintf(stderr, "Unable to open the cache directory '%s'!\n", d.cache_dir);
+        free(dir);
+        return EXIT_FAILURE;
+    }
+    d.cache_dir = dir;
+
+    //The directory of the impulse responses as an absolute path too; the names of the requests are looked up in it.
+    if (d.ir_dir != NULL){
+#ifdef _WIN32
+        ir_dir = _fullpath(NULL, d.ir_dir, 0);
+#else
+        ir_dir = realpath(d.ir_dir, NULL);
+#endif
+        if (ir_dir == NULL || strlen(ir_dir) > 1000){
+            fprintf(stderr, "Unable to open the impulse response directory '%s'!\n", d.ir_dir);
+            free(ir_dir);
+            free(dir);
+            return EXIT_FAILURE;
+        }
+        d.ir_dir = ir_dir;
+    }
+
+    if (!sockets_start()){
+        fprintf(stderr, "The sockets cannot be used!\n");
+        free(ir_dir);
+        free(dir);
+        return EXIT_FAILURE;
+    }
+    pool_mutex_init(&d.lock);
+    ok = daemon_scan_cache(&d) && daemon_listen(&d);
+    if (ok){
+        daemon_evict(&d, 0);
+        fprintf(stderr, "Listening on '%s' with %d workers; result cache '%s' (%d results, %.1f of %.1f MB).\n",
+                d.socket_path, d.n_workers, d.cache_dir, d.n_entries, d.cache_bytes / 1048576.0, d.cache_limit / 1048576.0);
+
+        parallel_for(d.n_workers, d.n_workers, daemon_worker, &d);
+
+        sock_close(d.listener);
+        remove(d.socket_path);
+        fprintf(stderr, "Stopped after %llu requests: %llu hits, %llu renders, %llu errors, %llu results removed.\n",
+                (unsigned long long)d.requests, (unsigned long long)d.hits, (unsigned long long)d.renders,
+                (unsigned long long)d.errors, (unsigned long long)d.evictions);
+    }
+    pool_mutex_destroy(&d.lock);
+    sockets_stop();
+    free(d.entries);
+    free(ir_dir);
+    free(dir);
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+static void render_client_usage(const char *program){
+    fprintf(stderr,
+            "Usage: %s [options] SOCKET score.txt | stats | shutdown\n"
+            "Sends a score to the render daemon on SOCKET and prints the path of the .wav file in its result cache.\n"
+            "  -o FILE   write the .wav file to FILE instead\n"
+            "  -b SEC    duration of one bar in seconds (default %d)\n"
+            "  -t N      render threads\n"
+            "  -q MODE   number format of the synthesis: double, float, q31 or q15\n"
+            "  -d 0|1    TPDF dither of the 16-bit output\n"
+            "  -k 0|1    prototype mode\n"
+            "  -R RATE   sample rate in Hz\n"
+            "  -s FORMAT sample format: 16 or float\n"
+            "  -i NAME   add a convolution reverb with the impulse response NAME (.wav) in the -I directory of the daemon\n"
+            "  -w LEVEL  level of the reverb signal\n"
+            "Options that are not given have the defaults of the daemon.\n",
+            program, DEFAULT_BAR_LENGTH);
+}
+
+/*Command line of the client (program --client ...): a small client for trying out the daemon and for scripts.
+stats and shutdown print the reply of the daemon. Returns EXIT_SUCCESS if the daemon answered with "ok". */
+int render_client_main(int argc, char **argv){
+    static const char *names[] = { "bar", "threads", "precision", "dither", "prototypes", "rate", "format", "reverb", "wet" };
+    static const char letters[] = "btqdkRsiw";
+    char options[DAEMON_LINE], line[DAEMON_LINE], request[2 * DAEMON_LINE], kind[16], *copy;
+    const char *socket_path = NULL, *command = NULL, *out_file = NULL;
+    int i, n = 0, ok = 1, pos;
+    long long bytes, k;
+    double t0 = wall_time();
+    daemon_conn c;
+    file_map m;
+    FILE *f;
+
+    options[0] = '\0';
+    for (i = 1; ok && i < argc; i++){
+        if (argv[i][0] == '-' && argv[i][1] != '\0' && argv[i][2] == '\0'){
+            if (argv[i][1] == 'h'){
+                render_client_usage(argv[0]);
+                return EXIT_SUCCESS;
+            }
+            if ((argv[i][1] != 'o' && strchr(letters, argv[i][1]) == NULL) || i + 1 >= argc){
+                fprintf(stderr, i + 1 >= argc ? "Option %s needs a value.\n" : "Unknown option %s.\n", argv[i]);
+                ok = 0;
+                break;
+            }
+            if (argv[i][1] == 'o') out_file = argv[i + 1];
+            else if (argv[i][1] == 'i' && (!daemon_ir_name_ok(argv[i + 1]) || strpbrk(argv[i + 1], "\r\n") != NULL ||
+                                           strlen(argv[i + 1]) > 1000)){
+                fprintf(stderr, "Invalid impulse response name %s: it must be a relative path without '..'.\n", argv[i + 1]);
+                ok = 0;
+            }
+            else if (argv[i][1] == 'i') n += snprintf(options + n, sizeof(options) - n, "reverb %s\n", argv[i + 1]);
+            else if (strpbrk(argv[i + 1], " \t\r\n") != NULL || strlen(argv[i + 1]) > 64){
+                fprintf(stderr, "Invalid value %s.\n", argv[i + 1]);
+                ok = 0;
+            }
+            else n += snprintf(options + n, sizeof(options) - n, "%s %s\n", names[strchr(letters, argv[i][1]) - letters], argv[i + 1]);
+            i++;
+        }
+        else if (socket_path == NULL) socket_path = argv[i];
+        else if (command == NULL) command = argv[i];
+        else{
+            fprintf(stderr, "Only one score can be rendered.\n");
+            ok = 0;
+        }
+    }
+    if (!ok || command == NULL){
+        render_client_usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    if (!sockets_start()){
+        fprintf(stderr, "The sockets cannot be used!\n");
+        return EXIT_FAILURE;
+    }
+    c.s = socket_connect(socket_path);
+    c.n = c.pos = 0;
+    if (c.s == SOCK_INVALID){
+        fprintf(stderr, "No daemon listens on '%s'.\n", socket_path);
+        sockets_stop();
+        return EXIT_FAILURE;
+    }
+
+    if (strcmp(command, "stats") == 0 || strcmp(command, "shutdown") == 0){
+        snprintf(line, sizeof(line), "%s\n", command);
+        ok = send_all(c.s, line, strlen(line)) && conn_read_line(&c, line, sizeof(line)) >= 0;
+        if (ok) printf("%s\n", line);
+        ok = ok && strncmp(line, "ok", 2) == 0;
+    }
+    else if (!file_map_open(&m, command)){
+        fprintf(stderr, "Error: file doesn't open!\n");
+        ok = 0;
+    }
+    else{
+        //The request: the options, the kind of reply and the score.
+        snprintf(request, sizeof(request), "render\n%sreply %s\nscore %lld\n", options, out_file ? "wav" : "path", (long long)m.size);
+        if (send_all(c.s, request, strlen(request))) send_all(c.s, m.data, m.size); //An error reply may come before the score is sent
+        ok = conn_read_line(&c, line, sizeof(line)) >= 0;
+        file_map_close(&m);
+
+        if (ok && sscanf(line, "ok %15s %lld %n", kind, &bytes, &pos) == 2){
+            if (out_file != NULL){
+                f = fopen(out_file, "wb");
+                copy = (char *)malloc(DAEMON_COPY_BYTES);
+                ok = f != NULL && copy != NULL;
+                for (; ok && bytes > 0; bytes -= k){
+                    k = bytes < DAEMON_COPY_BYTES ? bytes : DAEMON_COPY_BYTES;
+                    ok = conn_read(&c, copy, k) && fwrite(copy, 1, (size_t)k, f) == (size_t)k;
+                }
+                if (f != NULL && fclose(f) != 0) ok = 0;
+                free(copy);
+                if (!ok) fprintf(stderr, "Unable to write the file '%s'!\n", out_file);
+            }
+            else printf("%s\n", line + pos);
+            if (ok) fprintf(stderr, "%s (%s) in %.1f ms\n", out_file ? out_file : line + pos, kind, 1000.0 * (wall_time() - t0));
+        }
+        else{
+            fprintf(stderr, "%s\n", ok ? line : "The daemon did not answer.");
+            ok = 0;
+        }
+    }
+    sock_close(c.s);
+    sockets_stop();
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#ifndef RENDER_DAEMON_H
+#define RENDER_DAEMON_H
+
+#include<stdio.h>
+#include<stdlib.h>
+#include <stdint.h>
+
+#define DEFAULT_DAEMON_WORKERS 4 //Requests served at the same time
+#define DEFAULT_DAEMON_CACHE_DIR "render_results" //Directory of the result cache
+#define DEFAULT_DAEMON_CACHE_MB 1024 //Disk bound of the result cache in MB
+#define DAEMON_MAX_SCORE_BYTES (256 << 20) //Largest score text of a request
+#define DAEMON_TIMEOUT_SECONDS 60 //A connection that sends nothing for this long is closed
+#define DAEMON_LINE 2048 //Longest line of a request or a reply
+
+/*The protocol, one request per connection. A request starts with a command line:
+"render", "stats" or "shutdown". A render request goes on with option lines "name value" (rate, precision,
+prototypes, dither, format, polyphony, threshold, seed, bar, threads, reverb, wet, reply) and ends with the line
+"score N", which is followed by N bytes of score text. The value is the rest of the line; "reverb" takes the name of
+an impulse response in the directory the daemon was started with (-I), a relative path without "..".
+The reply is one line: "ok hit|render BYTES PATH" for a render (followed by the BYTES bytes of the .wav file
+with "reply wav"), "ok {...}" with the counters as JSON for stats, "ok" for shutdown, or "error TEXT". */
+
+int render_daemon_main(int argc, char** argv);
+int render_client_main(int argc, char** argv);
+
+#endif // RENDER_DAEMON_H
@@ -0,0 +1,48 @@
+/*
+Render settings.
+The settings that used to be process-wide globals are fields of a render_settings record. Each thread has a pointer to
+its current settings in thread-local storage; a thread that has not chosen any uses the settings of the process, so a
+program with one render at a time reads and writes the settings as before, under their old names.
+*/
+
+#define _CRT_SECURE_NO_WARNINGS
+
+#include "render_settings.h"
+#include "render.h"
+#include "score_spool.h"
+#include "reverb.h"
+
+#ifdef _MSC_VER
+#define THREAD_LOCAL __declspec(thread)
+#else
+#define THREAD_LOCAL _Thread_local
+#endif
+
+//The defaults of all settings, in the order of the fields of render_settings.
+#define SETTINGS_DEFAULTS { DEFAULT_SAMPLE_RATE, 1, DEFAULT_BLOCK_FRAMES, 1, 0, DEFAULT_VOICE_THRESHOLD_DB, 0, 0, \
+                            PRECISION_DOUBLE, 1, 0, 0, WAV_PCM16, NULL, 0, NULL, DEFAULT_SPOOL_RUN_EVENTS, \
+                            NULL, DEFAULT_REVERB_WET }
+
+static render_settings process_settings = SETTINGS_DEFAULTS;
+static THREAD_LOCAL render_settings *thread_settings = NULL;
+
+//Filling 's' with the default settings.
+void render_settings_default(render_settings *s){
+    static const render_settings defaults = SETTINGS_DEFAULTS;
+
+    *s = defaults;
+}
+
+//The settings the calling thread renders with.
+render_settings *render_settings_current(void){
+    return thread_settings != NULL ? thread_settings : &process_settings;
+}
+
+//Making 's' the current settings of the calling thread (NULL = the settings of the process) and returning the
+//settings it had before, so they can be restored. 's' must stay valid while the thread uses it.
+render_settings *render_settings_use(render_settings *s){
+    render_settings *previous = thread_settings;
+
+    thread_settings = s;
+    return previous;
+}
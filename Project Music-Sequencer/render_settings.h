@@ -0,0 +1,42 @@
+#pragma once
+
+#ifndef RENDER_SETTINGS_H
+#define RENDER_SETTINGS_H
+
+#include<stdio.h>
+#include<stdlib.h>
+#include <stdint.h>
+
+/*The settings of a render. Every thread renders with its current settings: the settings of the process, unless the
+thread has chosen its own with render_settings_use. Renders with different settings can so run at the same time in one
+process (see sequencer.h); parallel_for gives its workers the settings of the calling thread. */
+typedef struct render_settings_struct{
+	int rate; //Sampling frequency of the renders in Hz. It must be set before the notes are created.
+	uint64_t seed; //Seed from which the random generators of all notes are derived.
+	int block_frames; //Number of frames buffered before each write to the .wav file.
+	int threads; //Number of render threads: 1 renders serially, 0 uses one thread per processor.
+	int segment_length; //Length of the time segments that are rendered in parallel, 0 = DEFAULT_SEGMENT_SECONDS at the sample rate.
+	double threshold_db; //A voice is released once its envelope is below this level (dB full scale).
+	int max_length; //A voice is released after this many frames at the latest, 0 = DEFAULT_VOICE_MAX_SECONDS at the sample rate.
+	int polyphony; //Maximum number of voices at the same time, 0 = no limit. The oldest voice is stolen for a new note.
+	int precision; //Number format of the synthesis: PRECISION_DOUBLE (the default), PRECISION_FLOAT, PRECISION_Q31 or PRECISION_Q15.
+	int report; //1: render_file prints a JSON report of the render on stderr when it ends.
+	double progress; //Seconds between progress lines on stderr during a render, 0 = no progress lines.
+	int dither; //1 = TPDF dither of the 16-bit output, 0 = plain truncation (default)
+	int format; //Sample format of the .wav files: WAV_PCM16 (default) or WAV_FLOAT32
+	const char* cache_dir; //Directory of the segment cache, NULL = render_file does not use the cache.
+	int prototypes; //1: every note of a pitch plays the same waveform, mixed from the prototype cache. 0 = off (default)
+	const char* spool; //Directory of the spool files, NULL = scores are loaded into memory (score_load_file).
+	int run_events; //Notes per sorted run, DEFAULT_SPOOL_RUN_EVENTS by default
+	const char* reverb; //Impulse response (.wav) of the master-bus reverb, NULL = no reverb (default)
+	double wet; //Level of the reverb signal added to the dry mix, DEFAULT_REVERB_WET by default
+} render_settings;
+
+void render_settings_default(render_settings* s);
+render_settings* render_settings_current(void);
+render_settings* render_settings_use(render_settings* s);
+
+//A setting of the current thread by the name of its field, e.g. RS(rate) or RS(threads). It can be read and assigned.
+#define RS(field) (render_settings_current()->field)
+
+#endif // RENDER_SETTINGS_H
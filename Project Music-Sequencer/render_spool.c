@@ -0,0 +1,201 @@
+/*
+Rendering of a playlist that arrives note by note from a spooled score (see score_spool.h).
+Every track keeps a window of notes: the notes that may still be sounding and the notes that start within the next
+voice_max_frames() frames. A note can only steal the voice of a note that started at most voice_max_frames() frames
+before it, so when a block is rendered the release frames of all notes that start in it are final, and they are the
+same as the ones schedule_notes gives on the whole playlist. Notes are given back to the spool as soon as they can no
+longer sound, so the memory follows the number of notes around the render position, not the length of the song.
+The blocks are rendered serially, with one render cursor per track, and give the same samples as render_file.
+*/
+
+#define _CRT_SECURE_NO_WARNINGS
+
+#include <string.h>
+#include "render_spool.h"
+#include "mix_bus.h"
+#include "wall_clock.h"
+
+//The window of notes of one track and the render cursor of the track.
+typedef struct spool_track_struct{
+    note** notes; //Notes that may still sound or have not started yet, in playlist order
+    int n_notes;
+    int capacity;
+    int st; //Oldest note that may hold a voice, for RS(polyphony) (see schedule_notes)
+    render_cursor c;
+} spool_track;
+
+/*Adding note q to the window of its track, with its release frame as in schedule_notes: it plays for max_length
+frames, and with RS(polyphony) set it steals the voice of the oldest note of its track that is still playing.
+A track that has not had notes yet gets a window, a render cursor at frame 'a' and its gains on the mix bus.
+Returns 0 if there is not enough memory. */
+static int spool_schedule(spool_track **tracks, mix_bus *bus, note *q, int64_t a, int64_t max_length){
+    spool_track *tr;
+    note **t;
+
+    if (q->track->index == bus->n_tracks){
+        tr = (spool_track *)realloc(*tracks, (bus->n_tracks + 1) * sizeof(spool_track));
+        if (tr == NULL){
+            fprintf(stderr, "Out of memory!\n");
+            return 0;
+        }
+        *tracks = tr;
+        tr = &tr[bus->n_tracks];
+        memset(tr, 0, sizeof(spool_track));
+        if (!mix_bus_add_track(bus, q->track)) return 0;
+        if (!render_cursor_seek(&tr->c, NULL, 0, a)){
+            render_cursor_free(&tr->c);
+            bus->n_tracks--;
+            return 0;
+        }
+    }
+    tr = &(*tracks)[q->track->index];
+
+    while (tr->st < tr->n_notes && tr->notes[tr->st]->end_sample <= q->start_sample) tr->st++;
+    if (RS(polyphony) > 0 && tr->n_notes - tr->st >= RS(polyphony)){
+        tr->notes[tr->st]->end_sample = q->start_sample;
+        tr->st++;
+    }
+    q->end_sample = q->start_sample + max_length;
+
+    if (tr->n_notes == tr->capacity){
+        t = (note **)realloc(tr->notes, (tr->capacity ? 2 * (size_t)tr->capacity : 256) * sizeof(note *));
+        if (t == NULL){
+            fprintf(stderr, "Out of memory!\n");
+            return 0;
+        }
+        tr->notes = t;
+        tr->capacity = tr->capacity ? 2 * tr->capacity : 256;
+    }
+    tr->notes[tr->n_notes++] = q;
+    return 1;
+}
+
+//Giving the notes of a track that cannot sound at 'frame' or later back to the spool.
+static void spool_release(score_spool *sp, spool_track *tr, int64_t frame){
+    int i, k = render_find_note(tr->notes, tr->n_notes, frame);
+
+    for (i = 0; i < k; i++) score_spool_recycle(sp, tr->notes[i]);
+    memmove(tr->notes, tr->notes + k, (tr->n_notes - k) * sizeof(note *));
+    tr->n_notes -= k;
+    tr->c.next = tr->c.next > k ? tr->c.next - k : 0;
+    tr->st = tr->st > k ? tr->st - k : 0;
+}
+
+/*Rendering a spooled score into a .wav file while its runs are merged. The notes are taken from the spool as the render
+reaches them, and the length of the song is known when the last note has been read; the header is patched at the end,
+as in render_file. The progress lines estimate the length from the share of the notes read so far.
+The segment cache and the render threads are not used. The statistics of the render are added to 'stats', and with
+RS(report) set they are printed on stderr at the end.
+Returns 1 on success and 0 if the file cannot be written, the spool cannot be read or there is not enough memory. */
+int render_spool_file(score_spool *sp, int bar_length, const char *filename, render_stats *stats){
+    spool_track *tracks = NULL, *tr;
+    mix_bus bus;
+    wav_writer out;
+    note *q, *last = NULL;
+    double *mix_r, *mix_l, *track_r, *track_l, *t_r, *t_l;
+    double bar_frames = (double)bar_length * RS(rate), origin = 0, t0, t_start, t_last;
+    int64_t a, b, seg, total = -1, max_length = voice_max_frames();
+    int t, ok, seekable;
+    FILE *f;
+
+    t_start = wall_time();
+    if (stats->name == NULL) stats->name = filename;
+
+    f = fopen(filename, "wb+");
+    if (f == NULL){
+        fprintf(stderr, "Unable to open file for output!\n");
+        return 0;
+    }
+    //The writer reports why it cannot be opened (memory, or the impulse response of the reverb).
+    if (!wav_writer_open(&out, f, RS(block_frames))){
+        fclose(f);
+        return 0;
+    }
+    seekable = wav_header_start(f, out.format);
+
+    memset(&bus, 0, sizeof(bus));
+    seg = RS(segment_length) > 0 ? RS(segment_length) : (int64_t)DEFAULT_SEGMENT_SECONDS * RS(rate);
+    mix_r = (double *)malloc(seg * sizeof(double));
+    mix_l = (double *)malloc(seg * sizeof(double));
+    track_r = (double *)malloc(seg * sizeof(double));
+    track_l = (double *)malloc(seg * sizeof(double));
+    ok = mix_r && mix_l && track_r && track_l;
+    if (!ok) fprintf(stderr, "Out of memory!\n");
+
+    //The song begins with the bar of the first note, as in schedule_notes.
+    q = ok ? score_spool_next(sp) : NULL;
+    if (q != NULL){
+        origin = q->time - q->index / q->tempo;
+        q->start_sample = (int64_t)floor((q->time - origin) * bar_frames + 0.5);
+    }
+
+    t_last = t_start;
+    for (a = 0; ok; a = b){
+        b = a + seg;
+
+        //Scheduling every note that starts before b + max_length: the notes that start in this block are then final.
+        t0 = wall_time();
+        while (ok && q != NULL && q->start_sample < b + max_length){
+            ok = spool_schedule(&tracks, &bus, q, a, max_length);
+            last = q;
+            q = score_spool_next(sp);
+            if (q != NULL) q->start_sample = (int64_t)floor((q->time - origin) * bar_frames + 0.5);
+        }
+        if (ok && q == NULL){
+            if (sp->failed) ok = 0;
+            total = last == NULL ? 0 : (int64_t)floor((last->time + (1.0 - last->index) / last->tempo - origin) * bar_frames + 0.5);
+            if (b > total) b = total;
+        }
+        stats->schedule_ms += 1000.0 * (wall_time() - t0);
+        if (!ok || a >= b) break;
+
+        //Every track into its buffer and onto the mix bus; track 0 is rendered into the mix itself.
+        t0 = wall_time();
+        for (t = 0; ok && t < bus.n_tracks; t++){
+            tr = &tracks[t];
+            t_r = t == 0 ? mix_r : track_r;
+            t_l = t == 0 ? mix_l : track_l;
+            ok = render_cursor_run(&tr->c, tr->notes, tr->n_notes, b, t_r, t_l);
+            if (ok) mix_bus_add(&bus, t, t_r, t_l, mix_r, mix_l, b - a);
+            spool_release(sp, tr, b);
+        }
+        stats->synth_ms += 1000.0 * (wall_time() - t0);
+
+        t0 = wall_time();
+        if (ok) wav_writer_put_block(&out, mix_r, mix_l, b - a);
+        stats->write_ms += 1000.0 * (wall_time() - t0);
+        render_progress(stats, b, total >= 0 ? total : (int64_t)((double)b * sp->n_events / sp->n_notes), t_start, &t_last);
+    }
+    if (ok) stats->frames += total;
+    else fprintf(stderr, "Rendering failed!\n");
+
+    for (t = 0; t < bus.n_tracks; t++){
+        render_cursor_stats(&tracks[t].c, stats);
+        render_cursor_free(&tracks[t].c);
+        free(tracks[t].notes);
+    }
+    free(tracks);
+    mix_bus_free(&bus);
+    free(mix_r);
+    free(mix_l);
+    free(track_r);
+    free(track_l);
+    stats->note_allocs = sp->notes.n_allocs;
+    stats->note_peak_bytes = sp->notes.peak_bytes;
+
+    t0 = wall_time();
+    wav_writer_close(&out);
+    if (ok && out.failed){
+        fprintf(stderr, "Unable to write the file '%s'!\n", filename);
+        ok = 0;
+    }
+    if (ok && seekable && !wav_header_patch(f, total, out.format)) fprintf(stderr, "The length of '%s' could not be set in its header.\n", filename);
+    if (fclose(f) != 0) ok = 0;
+    stats->write_ms += 1000.0 * (wall_time() - t0);
+    stats->clipped += out.clipped;
+    stats->reverb_ms += out.reverb_ms;
+    stats->total_ms += 1000.0 * (wall_time() - t_start);
+
+    if (ok && RS(report)) render_stats_report(stats, stderr);
+    return ok;
+}
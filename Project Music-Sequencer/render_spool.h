@@ -0,0 +1,14 @@
+#pragma once
+
+#ifndef RENDER_SPOOL_H
+#define RENDER_SPOOL_H
+
+#include<stdio.h>
+#include<stdlib.h>
+#include <stdint.h>
+#include"render.h"
+#include"score_spool.h"
+
+int render_spool_file(score_spool* sp, int bar_length, const char* filename, render_stats* stats);
+
+#endif // RENDER_SPOOL_H
@@ -0,0 +1,1185 @@
+/*
+Convolution reverb of the master bus (see reverb.h).
+The impulse response is read from a .wav file (16, 24 or 32-bit integers, or 32 or 64-bit floats, mono or stereo; the
+first channel is the right one, as in the files of the sequencer), resampled to the sample rate if it has another one,
+and scaled to the energy of a unit impulse times the wet level. A mono response is used for both channels.
+The convolution is partitioned (overlap-save): the first stage has partitions of the render block, so the reverb adds
+one block of latency, and the later stages have larger ones, which need fewer FFTs per frame and fewer products per
+block (see reverb_plan). The two channels share one complex FFT per block.
+The FFT is an iterative radix-2 transform in single precision on separate real and imaginary arrays, with the twiddle
+factors of every stage stored next to each other, so its butterflies and the products of the spectra run 8 bins at a
+time with AVX or 4 with SSE2. Two stages are done in each pass over the points. The forward transform leaves the
+spectrum in bit-reversed order and the inverse one takes it in that order, so the points are never reordered.
+reverb_reference convolves in the time domain. It is slow (the work grows with the length of the response for every
+frame) and is kept to check the partitioned convolution (see accuracy_main).
+*/
+
+#define _CRT_SECURE_NO_WARNINGS
+
+#include <string.h>
+#include <math.h>
+#include "reverb.h"
+#include "render_settings.h"
+#include "file_map.h"
+#include "wav_writer.h"
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#define RV_USE_AVX
+#endif
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define RV_USE_SSE2
+#endif
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+#define REVERB_FFT_POINTS 2048 //Points of the FFT done through several stages at a time (see reverb_fft)
+#define REVERB_MAC_BINS 2048 //Bins of the sum over the partitions done at a time (see reverb_block)
+#define REVERB_MAC_COST 3.0 //Cost of the products of one partition per frame, in FFT passes (see reverb_stage_cost)
+
+//Little-endian fields of a .wav file.
+static unsigned wav_u16(const unsigned char *p){
+    return p[0] | (unsigned)p[1] << 8;
+}
+
+static uint32_t wav_u32(const unsigned char *p){
+    return p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+//Sample 'i' of the data of a .wav file as a double from -1 to 1.
+static double wav_sample(const unsigned char *p, int is_float, int bits, int64_t i){
+    float f;
+    double d;
+
+    p += i * (bits / 8);
+    if (is_float && bits == 32){
+        memcpy(&f, p, 4);
+        return f;
+    }
+    if (is_float){
+        memcpy(&d, p, 8);
+        return d;
+    }
+    switch (bits){
+    case 8: return (p[0] - 128) / 128.0;
+    case 16: return (int16_t)wav_u16(p) / 32768.0;
+    case 24: return (int32_t)((uint32_t)p[0] << 8 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 24) / 2147483648.0;
+    default: return (int32_t)wav_u32(p) / 2147483648.0;
+    }
+}
+
+/*Reading the impulse response of a .wav file at the sample rate into ir_r/ir_l (both pointing to one array for a mono
+response). Returns 1 on success and 0 if the file cannot be read, has an unsupported format or there is not enough memory. */
+static int reverb_read_ir(reverb *v, const char *filename){
+    file_map m;
+    const unsigned char *p, *data = NULL, *end;
+    uint32_t size;
+    int64_t frames = 0, n, i, k;
+    unsigned tag = 0, channels = 0, rate = 0, bits = 0;
+    double pos, t, a, b;
+    int c;
+
+    if (!file_map_open(&m, filename)){
+        fprintf(stderr, "Unable to open the impulse response '%s'!\n", filename);
+        return 0;
+    }
+    p = (const unsigned char *)m.data;
+    end = p + m.size;
+
+    //The chunks of the file: "fmt " describes the samples, "data" holds them. Other chunks (ds64, JUNK, ...) are skipped.
+    if (m.size >= 12 && (memcmp(p, "RIFF", 4) == 0 || memcmp(p, "RF64", 4) == 0) && memcmp(p + 8, "WAVE", 4) == 0){
+        for (p += 12; end - p >= 8 && data == NULL; p += 8 + size + (size & 1)){
+            size = wav_u32(p + 4);
+            if (memcmp(p, "fmt ", 4) == 0 && size >= 16 && end - p >= 24){
+                tag = wav_u16(p + 8);
+                channels = wav_u16(p + 10);
+                rate = wav_u32(p + 12);
+                bits = wav_u16(p + 22);
+                if (tag == 0xFFFE && size >= 40 && end - p >= 34) tag = wav_u16(p + 32); //WAVE_FORMAT_EXTENSIBLE
+            }
+            else if (memcmp(p, "data", 4) == 0){
+                data = p + 8;
+                //A length of 0 or beyond the file is a stream or an RF64 file: the samples go to the end of the file.
+                n = size == 0 || size > (uint64_t)(end - data) ? end - data : size;
+                frames = channels > 0 && bits >= 8 ? n / (channels * (bits / 8)) : 0;
+            }
+            if ((uint64_t)(end - p) < 8 + (uint64_t)size) break;
+        }
+    }
+    if (data == NULL || channels == 0 || rate == 0 || !((tag == 1 && (bits == 8 || bits == 16 || bits == 24 || bits == 32)) ||
+                                                        (tag == 3 && (bits == 32 || bits == 64)))){
+        fprintf(stderr, "The impulse response '%s' is not a PCM or float .wav file!\n", filename);
+        file_map_close(&m);
+        return 0;
+    }
+    if (frames == 0 || frames > (int64_t)REVERB_MAX_SECONDS * rate){
+        fprintf(stderr, "The impulse response '%s' must be longer than 0 and at most %d s long.\n", filename, REVERB_MAX_SECONDS);
+        file_map_close(&m);
+        return 0;
+    }
+
+    //Resampling to the sample rate by linear interpolation.
+    v->ir_frames = (int64_t)ceil((double)frames * RS(rate) / rate);
+    v->ir_r = (double *)malloc(v->ir_frames * sizeof(double));
+    v->ir_l = channels > 1 ? (double *)malloc(v->ir_frames * sizeof(double)) : v->ir_r;
+    if (!v->ir_r || !v->ir_l){
+        fprintf(stderr, "Out of memory!\n");
+        file_map_close(&m);
+        return 0;
+    }
+    for (c = 0; c < (channels > 1 ? 2 : 1); c++){
+        for (i = 0; i < v->ir_frames; i++){
+            pos = (double)i * rate / RS(rate);
+            k = (int64_t)pos;
+            t = pos - k;
+            a = wav_sample(data, tag == 3, bits, k * channels + c);
+            b = k + 1 < frames ? wav_sample(data, tag == 3, bits, (k + 1) * channels + c) : 0.0;
+            (c == 0 ? v->ir_r : v->ir_l)[i] = a + t * (b - a);
+        }
+    }
+    file_map_close(&m);
+    return 1;
+}
+
+//The butterflies of one group of a stage of the forward FFT (decimation in frequency): a, b = a + b, (a - b) w.
+static void reverb_dif_butterflies(float *ar, float *ai, float *br, float *bi, const float *tr, const float *ti, int half){
+    int k = 0;
+    float xr, xi;
+#ifdef RV_USE_AVX
+    __m256 wr8, wi8, xr8, xi8, ar8, ai8, br8, bi8;
+#endif
+#ifdef RV_USE_SSE2
+    __m128 wr4, wi4, xr4, xi4, ar4, ai4, br4, bi4;
+#endif
+
+#ifdef RV_USE_AVX
+    for (; k + 8 <= half; k += 8){
+        ar8 = _mm256_loadu_ps(ar + k);
+        ai8 = _mm256_loadu_ps(ai + k);
+        br8 = _mm256_loadu_ps(br + k);
+        bi8 = _mm256_loadu_ps(bi + k);
+        wr8 = _mm256_loadu_ps(tr + k);
+        wi8 = _mm256_loadu_ps(ti + k);
+        _mm256_storeu_ps(ar + k, _mm256_add_ps(ar8, br8));
+        _mm256_storeu_ps(ai + k, _mm256_add_ps(ai8, bi8));
+        xr8 = _mm256_sub_ps(ar8, br8);
+        xi8 = _mm256_sub_ps(ai8, bi8);
+        _mm256_storeu_ps(br + k, _mm256_sub_ps(_mm256_mul_ps(xr8, wr8), _mm256_mul_ps(xi8, wi8)));
+        _mm256_storeu_ps(bi + k, _mm256_add_ps(_mm256_mul_ps(xr8, wi8), _mm256_mul_ps(xi8, wr8)));
+    }
+#endif
+#ifdef RV_USE_SSE2
+    for (; k + 4 <= half; k += 4){
+        ar4 = _mm_loadu_ps(ar + k);
+        ai4 = _mm_loadu_ps(ai + k);
+        br4 = _mm_loadu_ps(br + k);
+        bi4 = _mm_loadu_ps(bi + k);
+        wr4 = _mm_loadu_ps(tr + k);
+        wi4 = _mm_loadu_ps(ti + k);
+        _mm_storeu_ps(ar + k, _mm_add_ps(ar4, br4));
+        _mm_storeu_ps(ai + k, _mm_add_ps(ai4, bi4));
+        xr4 = _mm_sub_ps(ar4, br4);
+        xi4 = _mm_sub_ps(ai4, bi4);
+        _mm_storeu_ps(br + k, _mm_sub_ps(_mm_mul_ps(xr4, wr4), _mm_mul_ps(xi4, wi4)));
+        _mm_storeu_ps(bi + k, _mm_add_ps(_mm_mul_ps(xr4, wi4), _mm_mul_ps(xi4, wr4)));
+    }
+#endif
+    for (; k < half; k++){
+        xr = ar[k] - br[k];
+        xi = ai[k] - bi[k];
+        ar[k] += br[k];
+        ai[k] += bi[k];
+        br[k] = xr * tr[k] - xi * ti[k];
+        bi[k] = xr * ti[k] + xi * tr[k];
+    }
+}
+
+/*Two stages of the forward FFT in one pass over a group of 4 * half points: the stage of 2 * half on the pairs (a, c)
+and (b, d), then the stage of 'half' on the pairs (a, b) and (c, d), where a, b, c, d are the quarters of the group. */
+static void reverb_dif_butterflies2(float *re, float *im, const float *tw_re, const float *tw_im, int half){
+    int k = 0;
+    float *r0 = re, *i0 = im, *r1 = re + half, *i1 = im + half, *r2 = re + 2 * half, *i2 = im + 2 * half, *r3 = re + 3 * half, *i3 = im + 3 * half;
+    const float *t1r = tw_re + half, *t1i = tw_im + half, *t2r = tw_re + 2 * half, *t2i = tw_im + 2 * half;
+    const float *t3r = t2r + half, *t3i = t2i + half;
+    float wr, wi, xr, xi, ar, ai, br, bi, cr, ci, dr, di;
+#ifdef RV_USE_AVX
+    __m256 wr8, wi8, xr8, xi8, ar8, ai8, br8, bi8, cr8, ci8, dr8, di8;
+#endif
+#ifdef RV_USE_SSE2
+    __m128 wr4, wi4, xr4, xi4, ar4, ai4, br4, bi4, cr4, ci4, dr4, di4;
+#endif
+
+#ifdef RV_USE_AVX
+    for (; k + 8 <= half; k += 8){
+        ar8 = _mm256_loadu_ps(r0 + k); //First stage: a, c = a + c, (a - c) w2; b, d = b + d, (b - d) w3
+        ai8 = _mm256_loadu_ps(i0 + k);
+        cr8 = _mm256_loadu_ps(r2 + k);
+        ci8 = _mm256_loadu_ps(i2 + k);
+        xr8 = _mm256_sub_ps(ar8, cr8);
+        xi8 = _mm256_sub_ps(ai8, ci8);
+        ar8 = _mm256_add_ps(ar8, cr8);
+        ai8 = _mm256_add_ps(ai8, ci8);
+        wr8 = _mm256_loadu_ps(t2r + k);
+        wi8 = _mm256_loadu_ps(t2i + k);
+        cr8 = _mm256_sub_ps(_mm256_mul_ps(xr8, wr8), _mm256_mul_ps(xi8, wi8));
+        ci8 = _mm256_add_ps(_mm256_mul_ps(xr8, wi8), _mm256_mul_ps(xi8, wr8));
+        br8 = _mm256_loadu_ps(r1 + k);
+        bi8 = _mm256_loadu_ps(i1 + k);
+        dr8 = _mm256_loadu_ps(r3 + k);
+        di8 = _mm256_loadu_ps(i3 + k);
+        xr8 = _mm256_sub_ps(br8, dr8);
+        xi8 = _mm256_sub_ps(bi8, di8);
+        br8 = _mm256_add_ps(br8, dr8);
+        bi8 = _mm256_add_ps(bi8, di8);
+        wr8 = _mm256_loadu_ps(t3r + k);
+        wi8 = _mm256_loadu_ps(t3i + k);
+        dr8 = _mm256_sub_ps(_mm256_mul_ps(xr8, wr8), _mm256_mul_ps(xi8, wi8));
+        di8 = _mm256_add_ps(_mm256_mul_ps(xr8, wi8), _mm256_mul_ps(xi8, wr8));
+
+        wr8 = _mm256_loadu_ps(t1r + k); //Second stage: a, b = a + b, (a - b) w1; c, d = c + d, (c - d) w1
+        wi8 = _mm256_loadu_ps(t1i + k);
+        _mm256_storeu_ps(r0 + k, _mm256_add_ps(ar8, br8));
+        _mm256_storeu_ps(i0 + k, _mm256_add_ps(ai8, bi8));
+        xr8 = _mm256_sub_ps(ar8, br8);
+        xi8 = _mm256_sub_ps(ai8, bi8);
+        _mm256_storeu_ps(r1 + k, _mm256_sub_ps(_mm256_mul_ps(xr8, wr8), _mm256_mul_ps(xi8, wi8)));
+        _mm256_storeu_ps(i1 + k, _mm256_add_ps(_mm256_mul_ps(xr8, wi8), _mm256_mul_ps(xi8, wr8)));
+        _mm256_storeu_ps(r2 + k, _mm256_add_ps(cr8, dr8));
+        _mm256_storeu_ps(i2 + k, _mm256_add_ps(ci8, di8));
+        xr8 = _mm256_sub_ps(cr8, dr8);
+        xi8 = _mm256_sub_ps(ci8, di8);
+        _mm256_storeu_ps(r3 + k, _mm256_sub_ps(_mm256_mul_ps(xr8, wr8), _mm256_mul_ps(xi8, wi8)));
+        _mm256_storeu_ps(i3 + k, _mm256_add_ps(_mm256_mul_ps(xr8, wi8), _mm256_mul_ps(xi8, wr8)));
+    }
+#endif
+#ifdef RV_USE_SSE2
+    for (; k + 4 <= half; k += 4){
+        ar4 = _mm_loadu_ps(r0 + k);
+        ai4 = _mm_loadu_ps(i0 + k);
+        cr4 = _mm_loadu_ps(r2 + k);
+        ci4 = _mm_loadu_ps(i2 + k);
+        xr4 = _mm_sub_ps(ar4, cr4);
+        xi4 = _mm_sub_ps(ai4, ci4);
+        ar4 = _mm_add_ps(ar4, cr4);
+        ai4 = _mm_add_ps(ai4, ci4);
+        wr4 = _mm_loadu_ps(t2r + k);
+        wi4 = _mm_loadu_ps(t2i + k);
+        cr4 = _mm_sub_ps(_mm_mul_ps(xr4, wr4), _mm_mul_ps(xi4, wi4));
+        ci4 = _mm_add_ps(_mm_mul_ps(xr4, wi4), _mm_mul_ps(xi4, wr4));
+        br4 = _mm_loadu_ps(r1 + k);
+        bi4 = _mm_loadu_ps(i1 + k);
+        dr4 = _mm_loadu_ps(r3 + k);
+        di4 = _mm_loadu_ps(i3 + k);
+        xr4 = _mm_sub_ps(br4, dr4);
+        xi4 = _mm_sub_ps(bi4, di4);
+        br4 = _mm_add_ps(br4, dr4);
+        bi4 = _mm_add_ps(bi4, di4);
+        wr4 = _mm_loadu_ps(t3r + k);
+        wi4 = _mm_loadu_ps(t3i + k);
+        dr4 = _mm_sub_ps(_mm_mul_ps(xr4, wr4), _mm_mul_ps(xi4, wi4));
+        di4 = _mm_add_ps(_mm_mul_ps(xr4, wi4), _mm_mul_ps(xi4, wr4));
+
+        wr4 = _mm_loadu_ps(t1r + k);
+        wi4 = _mm_loadu_ps(t1i + k);
+        _mm_storeu_ps(r0 + k, _mm_add_ps(ar4, br4));
+        _mm_storeu_ps(i0 + k, _mm_add_ps(ai4, bi4));
+        xr4 = _mm_sub_ps(ar4, br4);
+        xi4 = _mm_sub_ps(ai4, bi4);
+        _mm_storeu_ps(r1 + k, _mm_sub_ps(_mm_mul_ps(xr4, wr4), _mm_mul_ps(xi4, wi4)));
+        _mm_storeu_ps(i1 + k, _mm_add_ps(_mm_mul_ps(xr4, wi4), _mm_mul_ps(xi4, wr4)));
+        _mm_storeu_ps(r2 + k, _mm_add_ps(cr4, dr4));
+        _mm_storeu_ps(i2 + k, _mm_add_ps(ci4, di4));
+        xr4 = _mm_sub_ps(cr4, dr4);
+        xi4 = _mm_sub_ps(ci4, di4);
+        _mm_storeu_ps(r3 + k, _mm_sub_ps(_mm_mul_ps(xr4, wr4), _mm_mul_ps(xi4, wi4)));
+        _mm_storeu_ps(i3 + k, _mm_add_ps(_mm_mul_ps(xr4, wi4), _mm_mul_ps(xi4, wr4)));
+    }
+#endif
+    for (; k < half; k++){
+        xr = r0[k] - r2[k];
+        xi = i0[k] - i2[k];
+        ar = r0[k] + r2[k];
+        ai = i0[k] + i2[k];
+        cr = xr * t2r[k] - xi * t2i[k];
+        ci = xr * t2i[k] + xi * t2r[k];
+        xr = r1[k] - r3[k];
+        xi = i1[k] - i3[k];
+        br = r1[k] + r3[k];
+        bi = i1[k] + i3[k];
+        dr = xr * t3r[k] - xi * t3i[k];
+        di = xr * t3i[k] + xi * t3r[k];
+
+        wr = t1r[k];
+        wi = t1i[k];
+        r0[k] = ar + br;
+        i0[k] = ai + bi;
+        xr = ar - br;
+        xi = ai - bi;
+        r1[k] = xr * wr - xi * wi;
+        i1[k] = xr * wi + xi * wr;
+        r2[k] = cr + dr;
+        i2[k] = ci + di;
+        xr = cr - dr;
+        xi = ci - di;
+        r3[k] = xr * wr - xi * wi;
+        i3[k] = xr * wi + xi * wr;
+    }
+}
+
+//The butterflies of one group of a stage of the inverse FFT (decimation in time): a, b = a + conj(w) b, a - conj(w) b.
+static void reverb_dit_butterflies(float *ar, float *ai, float *br, float *bi, const float *tr, const float *ti, int half){
+    int k = 0;
+    float xr, xi, wr, wi;
+#ifdef RV_USE_AVX
+    __m256 wr8, wi8, br8, bi8, xr8, xi8, ar8, ai8;
+#endif
+#ifdef RV_USE_SSE2
+    __m128 wr4, wi4, br4, bi4, xr4, xi4, ar4, ai4;
+#endif
+
+#ifdef RV_USE_AVX
+    for (; k + 8 <= half; k += 8){
+        wr8 = _mm256_loadu_ps(tr + k);
+        wi8 = _mm256_loadu_ps(ti + k);
+        br8 = _mm256_loadu_ps(br + k);
+        bi8 = _mm256_loadu_ps(bi + k);
+        xr8 = _mm256_add_ps(_mm256_mul_ps(br8, wr8), _mm256_mul_ps(bi8, wi8));
+        xi8 = _mm256_sub_ps(_mm256_mul_ps(bi8, wr8), _mm256_mul_ps(br8, wi8));
+        ar8 = _mm256_loadu_ps(ar + k);
+        ai8 = _mm256_loadu_ps(ai + k);
+        _mm256_storeu_ps(br + k, _mm256_sub_ps(ar8, xr8));
+        _mm256_storeu_ps(bi + k, _mm256_sub_ps(ai8, xi8));
+        _mm256_storeu_ps(ar + k, _mm256_add_ps(ar8, xr8));
+        _mm256_storeu_ps(ai + k, _mm256_add_ps(ai8, xi8));
+    }
+#endif
+#ifdef RV_USE_SSE2
+    for (; k + 4 <= half; k += 4){
+        wr4 = _mm_loadu_ps(tr + k);
+        wi4 = _mm_loadu_ps(ti + k);
+        br4 = _mm_loadu_ps(br + k);
+        bi4 = _mm_loadu_ps(bi + k);
+        xr4 = _mm_add_ps(_mm_mul_ps(br4, wr4), _mm_mul_ps(bi4, wi4));
+        xi4 = _mm_sub_ps(_mm_mul_ps(bi4, wr4), _mm_mul_ps(br4, wi4));
+        ar4 = _mm_loadu_ps(ar + k);
+        ai4 = _mm_loadu_ps(ai + k);
+        _mm_storeu_ps(br + k, _mm_sub_ps(ar4, xr4));
+        _mm_storeu_ps(bi + k, _mm_sub_ps(ai4, xi4));
+        _mm_storeu_ps(ar + k, _mm_add_ps(ar4, xr4));
+        _mm_storeu_ps(ai + k, _mm_add_ps(ai4, xi4));
+    }
+#endif
+    for (; k < half; k++){
+        wr = tr[k];
+        wi = ti[k];
+        xr = br[k] * wr + bi[k] * wi;
+        xi = bi[k] * wr - br[k] * wi;
+        br[k] = ar[k] - xr;
+        bi[k] = ai[k] - xi;
+        ar[k] += xr;
+        ai[k] += xi;
+    }
+}
+
+/*Two stages of the inverse FFT in one pass over a group of 4 * half points: the stage of 'half' on the pairs (a, b) and
+(c, d), then the stage of 2 * half on the pairs (a, c) and (b, d), where a, b, c, d are the quarters of the group. */
+static void reverb_dit_butterflies2(float *re, float *im, const float *tw_re, const float *tw_im, int half){
+    int k = 0;
+    float *r0 = re, *i0 = im, *r1 = re + half, *i1 = im + half, *r2 = re + 2 * half, *i2 = im + 2 * half, *r3 = re + 3 * half, *i3 = im + 3 * half;
+    const float *t1r = tw_re + half, *t1i = tw_im + half, *t2r = tw_re + 2 * half, *t2i = tw_im + 2 * half;
+    const float *t3r = t2r + half, *t3i = t2i + half;
+    float wr, wi, xr, xi, ar, ai, br, bi, cr, ci, dr, di;
+#ifdef RV_USE_AVX
+    __m256 wr8, wi8, xr8, xi8, ar8, ai8, br8, bi8, cr8, ci8, dr8, di8;
+#endif
+#ifdef RV_USE_SSE2
+    __m128 wr4, wi4, xr4, xi4, ar4, ai4, br4, bi4, cr4, ci4, dr4, di4;
+#endif
+
+#ifdef RV_USE_AVX
+    for (; k + 8 <= half; k += 8){
+        wr8 = _mm256_loadu_ps(t1r + k);
+        wi8 = _mm256_loadu_ps(t1i + k);
+        ar8 = _mm256_loadu_ps(r0 + k);
+        ai8 = _mm256_loadu_ps(i0 + k);
+        xr8 = _mm256_loadu_ps(r1 + k);
+        xi8 = _mm256_loadu_ps(i1 + k);
+        br8 = _mm256_add_ps(_mm256_mul_ps(xr8, wr8), _mm256_mul_ps(xi8, wi8));
+        bi8 = _mm256_sub_ps(_mm256_mul_ps(xi8, wr8), _mm256_mul_ps(xr8, wi8));
+        cr8 = _mm256_loadu_ps(r2 + k);
+        ci8 = _mm256_loadu_ps(i2 + k);
+        xr8 = _mm256_loadu_ps(r3 + k);
+        xi8 = _mm256_loadu_ps(i3 + k);
+        dr8 = _mm256_add_ps(_mm256_mul_ps(xr8, wr8), _mm256_mul_ps(xi8, wi8));
+        di8 = _mm256_sub_ps(_mm256_mul_ps(xi8, wr8), _mm256_mul_ps(xr8, wi8));
+        xr8 = _mm256_sub_ps(ar8, br8); //First stage: a, b = a + b, a - b; c, d = c + d, c - d
+        xi8 = _mm256_sub_ps(ai8, bi8);
+        ar8 = _mm256_add_ps(ar8, br8);
+        ai8 = _mm256_add_ps(ai8, bi8);
+        br8 = xr8;
+        bi8 = xi8;
+        xr8 = _mm256_sub_ps(cr8, dr8);
+        xi8 = _mm256_sub_ps(ci8, di8);
+        cr8 = _mm256_add_ps(cr8, dr8);
+        ci8 = _mm256_add_ps(ci8, di8);
+
+        wr8 = _mm256_loadu_ps(t2r + k); //Second stage: c *= w2, d *= w3
+        wi8 = _mm256_loadu_ps(t2i + k);
+        dr8 = _mm256_add_ps(_mm256_mul_ps(cr8, wr8), _mm256_mul_ps(ci8, wi8));
+        di8 = _mm256_sub_ps(_mm256_mul_ps(ci8, wr8), _mm256_mul_ps(cr8, wi8));
+        _mm256_storeu_ps(r0 + k, _mm256_add_ps(ar8, dr8));
+        _mm256_storeu_ps(i0 + k, _mm256_add_ps(ai8, di8));
+        _mm256_storeu_ps(r2 + k, _mm256_sub_ps(ar8, dr8));
+        _mm256_storeu_ps(i2 + k, _mm256_sub_ps(ai8, di8));
+        wr8 = _mm256_loadu_ps(t3r + k);
+        wi8 = _mm256_loadu_ps(t3i + k);
+        dr8 = _mm256_add_ps(_mm256_mul_ps(xr8, wr8), _mm256_mul_ps(xi8, wi8));
+        di8 = _mm256_sub_ps(_mm256_mul_ps(xi8, wr8), _mm256_mul_ps(xr8, wi8));
+        _mm256_storeu_ps(r1 + k, _mm256_add_ps(br8, dr8));
+        _mm256_storeu_ps(i1 + k, _mm256_add_ps(bi8, di8));
+        _mm256_storeu_ps(r3 + k, _mm256_sub_ps(br8, dr8));
+        _mm256_storeu_ps(i3 + k, _mm256_sub_ps(bi8, di8));
+    }
+#endif
+#ifdef RV_USE_SSE2
+    for (; k + 4 <= half; k += 4){
+        wr4 = _mm_loadu_ps(t1r + k);
+        wi4 = _mm_loadu_ps(t1i + k);
+        ar4 = _mm_loadu_ps(r0 + k);
+        ai4 = _mm_loadu_ps(i0 + k);
+        xr4 = _mm_loadu_ps(r1 + k);
+        xi4 = _mm_loadu_ps(i1 + k);
+        br4 = _mm_add_ps(_mm_mul_ps(xr4, wr4), _mm_mul_ps(xi4, wi4));
+        bi4 = _mm_sub_ps(_mm_mul_ps(xi4, wr4), _mm_mul_ps(xr4, wi4));
+        cr4 = _mm_loadu_ps(r2 + k);
+        ci4 = _mm_loadu_ps(i2 + k);
+        xr4 = _mm_loadu_ps(r3 + k);
+        xi4 = _mm_loadu_ps(i3 + k);
+        dr4 = _mm_add_ps(_mm_mul_ps(xr4, wr4), _mm_mul_ps(xi4, wi4));
+        di4 = _mm_sub_ps(_mm_mul_ps(xi4, wr4), _mm_mul_ps(xr4, wi4));
+        xr4 = _mm_sub_ps(ar4, br4);
+        xi4 = _mm_sub_ps(ai4, bi4);
+        ar4 = _mm_add_ps(ar4, br4);
+        ai4 = _mm_add_ps(ai4, bi4);
+        br4 = xr4;
+        bi4 = xi4;
+        xr4 = _mm_sub_ps(cr4, dr4);
+        xi4 = _mm_sub_ps(ci4, di4);
+        cr4 = _mm_add_ps(cr4, dr4);
+        ci4 = _mm_add_ps(ci4, di4);
+
+        wr4 = _mm_loadu_ps(t2r + k);
+        wi4 = _mm_loadu_ps(t2i + k);
+        dr4 = _mm_add_ps(_mm_mul_ps(cr4, wr4), _mm_mul_ps(ci4, wi4));
+        di4 = _mm_sub_ps(_mm_mul_ps(ci4, wr4), _mm_mul_ps(cr4, wi4));
+        _mm_storeu_ps(r0 + k, _mm_add_ps(ar4, dr4));
+        _mm_storeu_ps(i0 + k, _mm_add_ps(ai4, di4));
+        _mm_storeu_ps(r2 + k, _mm_sub_ps(ar4, dr4));
+        _mm_storeu_ps(i2 + k, _mm_sub_ps(ai4, di4));
+        wr4 = _mm_loadu_ps(t3r + k);
+        wi4 = _mm_loadu_ps(t3i + k);
+        dr4 = _mm_add_ps(_mm_mul_ps(xr4, wr4), _mm_mul_ps(xi4, wi4));
+        di4 = _mm_sub_ps(_mm_mul_ps(xi4, wr4), _mm_mul_ps(xr4, wi4));
+        _mm_storeu_ps(r1 + k, _mm_add_ps(br4, dr4));
+        _mm_storeu_ps(i1 + k, _mm_add_ps(bi4, di4));
+        _mm_storeu_ps(r3 + k, _mm_sub_ps(br4, dr4));
+        _mm_storeu_ps(i3 + k, _mm_sub_ps(bi4, di4));
+    }
+#endif
+    for (; k < half; k++){
+        wr = t1r[k];
+        wi = t1i[k];
+        ar = r0[k];
+        ai = i0[k];
+        br = r1[k] * wr + i1[k] * wi;
+        bi = i1[k] * wr - r1[k] * wi;
+        cr = r2[k];
+        ci = i2[k];
+        dr = r3[k] * wr + i3[k] * wi;
+        di = i3[k] * wr - r3[k] * wi;
+        xr = ar - br;
+        xi = ai - bi;
+        ar += br;
+        ai += bi;
+        br = xr;
+        bi = xi;
+        xr = cr - dr;
+        xi = ci - di;
+        cr += dr;
+        ci += di;
+
+        wr = t2r[k];
+        wi = t2i[k];
+        dr = cr * wr + ci * wi;
+        di = ci * wr - cr * wi;
+        r0[k] = ar + dr;
+        i0[k] = ai + di;
+        r2[k] = ar - dr;
+        i2[k] = ai - di;
+        wr = t3r[k];
+        wi = t3i[k];
+        dr = xr * wr + xi * wi;
+        di = xi * wr - xr * wi;
+        r1[k] = br + dr;
+        i1[k] = bi + di;
+        r3[k] = br - dr;
+        i3[k] = bi - di;
+    }
+}
+
+//Adding the products of two spectra of n bins to an accumulator: a[k] += h[k] s[k].
+static void reverb_mac(float *ar, float *ai, const float *hr, const float *hi, const float *sr, const float *si, int n){
+    int k = 0;
+#ifdef RV_USE_AVX
+    __m256 hr8, hi8, sr8, si8;
+#endif
+#ifdef RV_USE_SSE2
+    __m128 hr4, hi4, sr4, si4;
+#endif
+
+#ifdef RV_USE_AVX
+    for (; k + 8 <= n; k += 8){
+        hr8 = _mm256_loadu_ps(hr + k);
+        hi8 = _mm256_loadu_ps(hi + k);
+        sr8 = _mm256_loadu_ps(sr + k);
+        si8 = _mm256_loadu_ps(si + k);
+        _mm256_storeu_ps(ar + k, _mm256_add_ps(_mm256_loadu_ps(ar + k), _mm256_sub_ps(_mm256_mul_ps(hr8, sr8), _mm256_mul_ps(hi8, si8))));
+        _mm256_storeu_ps(ai + k, _mm256_add_ps(_mm256_loadu_ps(ai + k), _mm256_add_ps(_mm256_mul_ps(hr8, si8), _mm256_mul_ps(hi8, sr8))));
+    }
+#endif
+#ifdef RV_USE_SSE2
+    for (; k + 4 <= n; k += 4){
+        hr4 = _mm_loadu_ps(hr + k);
+        hi4 = _mm_loadu_ps(hi + k);
+        sr4 = _mm_loadu_ps(sr + k);
+        si4 = _mm_loadu_ps(si + k);
+        _mm_storeu_ps(ar + k, _mm_add_ps(_mm_loadu_ps(ar + k), _mm_sub_ps(_mm_mul_ps(hr4, sr4), _mm_mul_ps(hi4, si4))));
+        _mm_storeu_ps(ai + k, _mm_add_ps(_mm_loadu_ps(ai + k), _mm_add_ps(_mm_mul_ps(hr4, si4), _mm_mul_ps(hi4, sr4))));
+    }
+#endif
+    for (; k < n; k++){
+        ar[k] += hr[k] * sr[k] - hi[k] * si[k];
+        ai[k] += hr[k] * si[k] + hi[k] * sr[k];
+    }
+}
+
+/*The last two stages of the forward FFT on n points: their twiddle factors are 1 and -i. With SSE, 4 groups of 4 points
+are transposed so that every vector holds the same point of the 4 groups. */
+static void reverb_dif_last(float *re, float *im, int n){
+    int i;
+    float ar, ai, br, bi, cr, ci, dr, di;
+#ifdef RV_USE_SSE2
+    __m128 p0, p1, p2, p3, q0, q1, q2, q3, ar4, ai4, br4, bi4, cr4, ci4, dr4, di4;
+#endif
+
+    i = 0;
+#ifdef RV_USE_SSE2
+    for (; i + 16 <= n; i += 16){
+        p0 = _mm_loadu_ps(re + i);
+        p1 = _mm_loadu_ps(re + i + 4);
+        p2 = _mm_loadu_ps(re + i + 8);
+        p3 = _mm_loadu_ps(re + i + 12);
+        q0 = _mm_loadu_ps(im + i);
+        q1 = _mm_loadu_ps(im + i + 4);
+        q2 = _mm_loadu_ps(im + i + 8);
+        q3 = _mm_loadu_ps(im + i + 12);
+        _MM_TRANSPOSE4_PS(p0, p1, p2, p3);
+        _MM_TRANSPOSE4_PS(q0, q1, q2, q3);
+        ar4 = _mm_add_ps(p0, p2);
+        ai4 = _mm_add_ps(q0, q2);
+        cr4 = _mm_sub_ps(p0, p2);
+        ci4 = _mm_sub_ps(q0, q2);
+        br4 = _mm_add_ps(p1, p3);
+        bi4 = _mm_add_ps(q1, q3);
+        dr4 = _mm_sub_ps(q1, q3);
+        di4 = _mm_sub_ps(p3, p1);
+        p0 = _mm_add_ps(ar4, br4);
+        q0 = _mm_add_ps(ai4, bi4);
+        p1 = _mm_sub_ps(ar4, br4);
+        q1 = _mm_sub_ps(ai4, bi4);
+        p2 = _mm_add_ps(cr4, dr4);
+        q2 = _mm_add_ps(ci4, di4);
+        p3 = _mm_sub_ps(cr4, dr4);
+        q3 = _mm_sub_ps(ci4, di4);
+        _MM_TRANSPOSE4_PS(p0, p1, p2, p3);
+        _MM_TRANSPOSE4_PS(q0, q1, q2, q3);
+        _mm_storeu_ps(re + i, p0);
+        _mm_storeu_ps(re + i + 4, p1);
+        _mm_storeu_ps(re + i + 8, p2);
+        _mm_storeu_ps(re + i + 12, p3);
+        _mm_storeu_ps(im + i, q0);
+        _mm_storeu_ps(im + i + 4, q1);
+        _mm_storeu_ps(im + i + 8, q2);
+        _mm_storeu_ps(im + i + 12, q3);
+    }
+#endif
+    for (; i < n; i += 4){
+        ar = re[i] + re[i + 2];
+        ai = im[i] + im[i + 2];
+        cr = re[i] - re[i + 2];
+        ci = im[i] - im[i + 2];
+        br = re[i + 1] + re[i + 3];
+        bi = im[i + 1] + im[i + 3];
+        dr = im[i + 1] - im[i + 3];
+        di = re[i + 3] - re[i + 1];
+        re[i] = ar + br;
+        im[i] = ai + bi;
+        re[i + 1] = ar - br;
+        im[i + 1] = ai - bi;
+        re[i + 2] = cr + dr;
+        im[i + 2] = ci + di;
+        re[i + 3] = cr - dr;
+        im[i + 3] = ci - di;
+    }
+}
+
+/*Forward FFT of n points in place, by decimation in frequency: the spectrum comes out in bit-reversed order, which is
+all the convolution needs, so the points are never reordered. The stages whose groups fit in REVERB_FFT_POINTS are done
+block by block, so that a block stays in the cache through all of them. */
+static void reverb_fft(const reverb *v, float *re, float *im, int n){
+    int i, j, h, half = n / 2, stages = 0, m = n < REVERB_FFT_POINTS ? n : REVERB_FFT_POINTS;
+
+    //The stages down to half = 4 two at a time, after one on its own if their number is odd.
+    for (i = 4; i < n; i <<= 1) stages++;
+    if (stages & 1){
+        reverb_dif_butterflies(re, im, re + half, im + half, v->tw_re + half, v->tw_im + half, half);
+        half >>= 1;
+    }
+    for (; half >= 8 && 2 * half > m; half >>= 2){
+        for (i = 0; i < n; i += 2 * half) reverb_dif_butterflies2(re + i, im + i, v->tw_re, v->tw_im, half / 2);
+    }
+    for (j = 0; j < n; j += m){
+        for (h = half; h >= 8; h >>= 2){
+            for (i = j; i < j + m; i += 2 * h) reverb_dif_butterflies2(re + i, im + i, v->tw_re, v->tw_im, h / 2);
+        }
+        reverb_dif_last(re + j, im + j, m);
+    }
+}
+
+//The first two stages of the inverse FFT on n points: their twiddle factors are 1 and i. With SSE, 4 groups at a time,
+//transposed.
+static void reverb_dit_first(float *re, float *im, int n){
+    int i;
+    float ar, ai, br, bi, cr, ci, dr, di;
+#ifdef RV_USE_SSE2
+    __m128 p0, p1, p2, p3, q0, q1, q2, q3, ar4, ai4, br4, bi4, cr4, ci4, dr4, di4;
+#endif
+
+    i = 0;
+#ifdef RV_USE_SSE2
+    for (; i + 16 <= n; i += 16){
+        p0 = _mm_loadu_ps(re + i);
+        p1 = _mm_loadu_ps(re + i + 4);
+        p2 = _mm_loadu_ps(re + i + 8);
+        p3 = _mm_loadu_ps(re + i + 12);
+        q0 = _mm_loadu_ps(im + i);
+        q1 = _mm_loadu_ps(im + i + 4);
+        q2 = _mm_loadu_ps(im + i + 8);
+        q3 = _mm_loadu_ps(im + i + 12);
+        _MM_TRANSPOSE4_PS(p0, p1, p2, p3);
+        _MM_TRANSPOSE4_PS(q0, q1, q2, q3);
+        ar4 = _mm_add_ps(p0, p1);
+        ai4 = _mm_add_ps(q0, q1);
+        br4 = _mm_sub_ps(p0, p1);
+        bi4 = _mm_sub_ps(q0, q1);
+        cr4 = _mm_add_ps(p2, p3);
+        ci4 = _mm_add_ps(q2, q3);
+        dr4 = _mm_sub_ps(q3, q2);
+        di4 = _mm_sub_ps(p2, p3);
+        p0 = _mm_add_ps(ar4, cr4);
+        q0 = _mm_add_ps(ai4, ci4);
+        p2 = _mm_sub_ps(ar4, cr4);
+        q2 = _mm_sub_ps(ai4, ci4);
+        p1 = _mm_add_ps(br4, dr4);
+        q1 = _mm_add_ps(bi4, di4);
+        p3 = _mm_sub_ps(br4, dr4);
+        q3 = _mm_sub_ps(bi4, di4);
+        _MM_TRANSPOSE4_PS(p0, p1, p2, p3);
+        _MM_TRANSPOSE4_PS(q0, q1, q2, q3);
+        _mm_storeu_ps(re + i, p0);
+        _mm_storeu_ps(re + i + 4, p1);
+        _mm_storeu_ps(re + i + 8, p2);
+        _mm_storeu_ps(re + i + 12, p3);
+        _mm_storeu_ps(im + i, q0);
+        _mm_storeu_ps(im + i + 4, q1);
+        _mm_storeu_ps(im + i + 8, q2);
+        _mm_storeu_ps(im + i + 12, q3);
+    }
+#endif
+    for (; i < n; i += 4){
+        ar = re[i] + re[i + 1];
+        ai = im[i] + im[i + 1];
+        br = re[i] - re[i + 1];
+        bi = im[i] - im[i + 1];
+        cr = re[i + 2] + re[i + 3];
+        ci = im[i + 2] + im[i + 3];
+        dr = im[i + 3] - im[i + 2];
+        di = re[i + 2] - re[i + 3];
+        re[i] = ar + cr;
+        im[i] = ai + ci;
+        re[i + 2] = ar - cr;
+        im[i + 2] = ai - ci;
+        re[i + 1] = br + dr;
+        im[i + 1] = bi + di;
+        re[i + 3] = br - dr;
+        im[i + 3] = bi - di;
+    }
+}
+
+/*Inverse FFT of n points in place, by decimation in time from a spectrum in bit-reversed order to samples in natural
+order, in blocks of REVERB_FFT_POINTS as long as the groups fit in them. The 1/n scale is left out; it is in the
+partition spectra. */
+static void reverb_ifft(const reverb *v, float *re, float *im, int n){
+    int i, j, half = 4, m = n < REVERB_FFT_POINTS ? n : REVERB_FFT_POINTS;
+
+    for (j = 0; j < n; j += m){
+        reverb_dit_first(re + j, im + j, m);
+        for (half = 4; 4 * half <= m; half <<= 2){
+            for (i = j; i < j + m; i += 4 * half) reverb_dit_butterflies2(re + i, im + i, v->tw_re, v->tw_im, half);
+        }
+    }
+    //The other stages two at a time, and the last one on its own if their number is odd.
+    for (; 4 * half <= n; half <<= 2){
+        for (i = 0; i < n; i += 4 * half) reverb_dit_butterflies2(re + i, im + i, v->tw_re, v->tw_im, half);
+    }
+    if (half < n) reverb_dit_butterflies(re, im, re + half, im + half, v->tw_re + half, v->tw_im + half, half);
+}
+
+/*Separating the spectra of the right (R) and the left (L) channel of Z = FFT(r + i l) of n = 2 * b points in bit-reversed
+order: R[k] = (Z[k] + conj Z[n-k]) / 2 and L[k] = (Z[k] - conj Z[n-k]) / 2i, for the bins 0..b (see reverb_block).
+R goes to xr/xi[0..b] and L to xr/xi[b+1..2b+1]. */
+static void reverb_split(float *xr, float *xi, const float *zr, const float *zi, int b){
+    int n = 2 * b, nb = b + 1, t, j, m;
+    float re_a, im_a, re_b, im_b;
+#ifdef RV_USE_SSE2
+    __m128 h = _mm_set1_ps(0.5f), ra, ia, rb, ib;
+#endif
+
+    xr[0] = zr[0];
+    xi[0] = 0;
+    xr[nb] = zi[0];
+    xi[nb] = 0;
+    xr[b] = zr[1];
+    xi[b] = 0;
+    xr[nb + b] = zi[1];
+    xi[nb + b] = 0;
+    for (t = 2; t < n; t <<= 1){
+        j = t;
+#ifdef RV_USE_SSE2
+        //The even points of 8 at j and the odd points of the 8 at the mirror, in reverse order.
+        for (; t >= 8 && j < 2 * t; j += 8){
+            m = j >> 1;
+            ra = _mm_shuffle_ps(_mm_loadu_ps(zr + j), _mm_loadu_ps(zr + j + 4), _MM_SHUFFLE(2, 0, 2, 0));
+            ia = _mm_shuffle_ps(_mm_loadu_ps(zi + j), _mm_loadu_ps(zi + j + 4), _MM_SHUFFLE(2, 0, 2, 0));
+            rb = _mm_shuffle_ps(_mm_loadu_ps(zr + 3 * t - 4 - j), _mm_loadu_ps(zr + 3 * t - 8 - j), _MM_SHUFFLE(1, 3, 1, 3));
+            ib = _mm_shuffle_ps(_mm_loadu_ps(zi + 3 * t - 4 - j), _mm_loadu_ps(zi + 3 * t - 8 - j), _MM_SHUFFLE(1, 3, 1, 3));
+            _mm_storeu_ps(xr + m, _mm_mul_ps(h, _mm_add_ps(ra, rb)));
+            _mm_storeu_ps(xi + m, _mm_mul_ps(h, _mm_sub_ps(ia, ib)));
+            _mm_storeu_ps(xr + nb + m, _mm_mul_ps(h, _mm_add_ps(ia, ib)));
+            _mm_storeu_ps(xi + nb + m, _mm_mul_ps(h, _mm_sub_ps(rb, ra)));
+        }
+#endif
+        for (; j < 2 * t; j += 2){
+            m = j >> 1;
+            re_a = zr[j];
+            im_a = zi[j];
+            re_b = zr[3 * t - 1 - j];
+            im_b = -zi[3 * t - 1 - j];
+            xr[m] = 0.5f * (re_a + re_b);
+            xi[m] = 0.5f * (im_a + im_b);
+            xr[nb + m] = 0.5f * (im_a - im_b);
+            xi[nb + m] = -0.5f * (re_a - re_b);
+        }
+    }
+}
+
+/*Packing the spectra of the right (Yr, ar/ai[0..b]) and left (Yl, ar/ai[b+1..2b+1]) output as Z = Yr + i Yl of 2 * b
+points in bit-reversed order, with Z[n-k] from the conjugates. With SSE, the 8 points at j and the 8 at their mirror
+are written together: the odd points of each block come from the even ones of the other. */
+static void reverb_pack(float *zr, float *zi, const float *ar, const float *ai, int b){
+    int n = 2 * b, nb = b + 1, t, j, m, e;
+    float re_a, im_a, re_b, im_b;
+#ifdef RV_USE_SSE2
+    __m128 era, eia, ora, oia, erb, eib, orb, oib;
+#endif
+
+    zr[0] = ar[0] - ai[nb];
+    zi[0] = ai[0] + ar[nb];
+    zr[1] = ar[b] - ai[nb + b];
+    zi[1] = ai[b] + ar[nb + b];
+    for (t = 2; t < n; t <<= 1){
+#ifdef RV_USE_SSE2
+        if (t >= 8){
+            for (j = t; j < t + t / 2; j += 8){
+                e = 3 * t - 8 - j;
+                //Yr + i Yl at the even points, conj(Yr) + i conj(Yl) at the mirrors, for the bins of j and of e.
+                m = j >> 1;
+                era = _mm_sub_ps(_mm_loadu_ps(ar + m), _mm_loadu_ps(ai + nb + m));
+                eia = _mm_add_ps(_mm_loadu_ps(ai + m), _mm_loadu_ps(ar + nb + m));
+                ora = _mm_add_ps(_mm_loadu_ps(ar + m), _mm_loadu_ps(ai + nb + m));
+                oia = _mm_sub_ps(_mm_loadu_ps(ar + nb + m), _mm_loadu_ps(ai + m));
+                m = e >> 1;
+                erb = _mm_sub_ps(_mm_loadu_ps(ar + m), _mm_loadu_ps(ai + nb + m));
+                eib = _mm_add_ps(_mm_loadu_ps(ai + m), _mm_loadu_ps(ar + nb + m));
+                orb = _mm_add_ps(_mm_loadu_ps(ar + m), _mm_loadu_ps(ai + nb + m));
+                oib = _mm_sub_ps(_mm_loadu_ps(ar + nb + m), _mm_loadu_ps(ai + m));
+                ora = _mm_shuffle_ps(ora, ora, _MM_SHUFFLE(0, 1, 2, 3));
+                oia = _mm_shuffle_ps(oia, oia, _MM_SHUFFLE(0, 1, 2, 3));
+                orb = _mm_shuffle_ps(orb, orb, _MM_SHUFFLE(0, 1, 2, 3));
+                oib = _mm_shuffle_ps(oib, oib, _MM_SHUFFLE(0, 1, 2, 3));
+                _mm_storeu_ps(zr + j, _mm_unpacklo_ps(era, orb));
+                _mm_storeu_ps(zr + j + 4, _mm_unpackhi_ps(era, orb));
+                _mm_storeu_ps(zi + j, _mm_unpacklo_ps(eia, oib));
+                _mm_storeu_ps(zi + j + 4, _mm_unpackhi_ps(eia, oib));
+                _mm_storeu_ps(zr + e, _mm_unpacklo_ps(erb, ora));
+                _mm_storeu_ps(zr + e + 4, _mm_unpackhi_ps(erb, ora));
+                _mm_storeu_ps(zi + e, _mm_unpacklo_ps(eib, oia));
+                _mm_storeu_ps(zi + e + 4, _mm_unpackhi_ps(eib, oia));
+            }
+            continue;
+        }
+#endif
+        for (j = t; j < 2 * t; j += 2){
+            m = j >> 1;
+            re_a = ar[m];
+            im_a = ai[m];
+            re_b = ar[nb + m];
+            im_b = ai[nb + m];
+            zr[j] = re_a - im_b;
+            zi[j] = im_a + re_b;
+            zr[3 * t - 1 - j] = re_a + im_b;
+            zi[3 * t - 1 - j] = re_b - im_a;
+        }
+    }
+}
+
+/*Convolving the input block of stage 'g' that ends at frame 'end' of the mix: its spectrum goes into the delay line, and
+the inverse FFT of the sum of the delayed spectra times the partition spectra (the last 'block' points of the circular
+convolution, overlap-save) is added to the wet signal from frame end - block + offset on. The two channels are separated
+after the forward FFT and packed again before the inverse one.
+The spectra stay in the bit-reversed order of the FFT: bin k < block is at the even point 2 m and half-spectrum index m,
+and the bin 'block' is at the point 1 and index 'block'. Bin n - k is at the mirror of the point of bin k in its octave. */
+static void reverb_block(reverb *v, reverb_stage *g, int64_t end){
+    int b = g->block, n = 2 * b, nb = b + 1, j, m, p, q, w, c, k;
+    float *zr = v->z_re, *zi = v->z_im, *ar, *ai;
+
+    //The last n frames of the input ring, in two pieces when they wrap around.
+    w = (int)((end - n) & v->in_mask);
+    m = v->in_mask + 1 - w < n ? v->in_mask + 1 - w : n;
+    memcpy(zr, v->in_r + w, m * sizeof(float));
+    memcpy(zi, v->in_l + w, m * sizeof(float));
+    memcpy(zr + m, v->in_r, (n - m) * sizeof(float));
+    memcpy(zi + m, v->in_l, (n - m) * sizeof(float));
+    reverb_fft(v, zr, zi, n);
+    reverb_split(g->x_re + (size_t)g->slot * 2 * nb, g->x_im + (size_t)g->slot * 2 * nb, zr, zi, b);
+
+    //The sum over the partitions, a few bins at a time so that the sum stays in the cache: partition p meets the input
+    //block of p blocks ago.
+    ar = v->acc_re;
+    ai = v->acc_im;
+    memset(ar, 0, 2 * nb * sizeof(float));
+    memset(ai, 0, 2 * nb * sizeof(float));
+    for (c = 0; c < 2 * nb; c += REVERB_MAC_BINS){
+        k = 2 * nb - c < REVERB_MAC_BINS ? 2 * nb - c : REVERB_MAC_BINS;
+        for (p = 0; p < g->n_parts; p++){
+            q = g->slot - p < 0 ? g->slot - p + g->n_parts : g->slot - p;
+            reverb_mac(ar + c, ai + c, g->h_re + (size_t)p * 2 * nb + c, g->h_im + (size_t)p * 2 * nb + c,
+                       g->x_re + (size_t)q * 2 * nb + c, g->x_im + (size_t)q * 2 * nb + c, k);
+        }
+    }
+    g->slot = g->slot + 1 == g->n_parts ? 0 : g->slot + 1;
+
+    reverb_pack(zr, zi, ar, ai, b);
+    reverb_ifft(v, zr, zi, n);
+
+    //The last b points, added to the wet ring in two pieces when they wrap around.
+    w = (int)((end - b + g->offset) & v->wet_mask);
+    m = v->wet_mask + 1 - w < b ? v->wet_mask + 1 - w : b;
+    for (j = 0; j < m; j++){
+        v->wet_r[w + j] += zr[b + j];
+        v->wet_l[w + j] += zi[b + j];
+    }
+    for (; j < b; j++){
+        v->wet_r[j - m] += zr[b + j];
+        v->wet_l[j - m] += zi[b + j];
+    }
+}
+
+//Estimated cost of a stage per frame of the mix, in units of one FFT pass: two FFTs of 2 * block points and the
+//products of the spectra of every partition.
+static double reverb_stage_cost(int block, int n_parts){
+    int passes = 0, k;
+
+    for (k = 1; k < 2 * block; k <<= 1) passes++;
+    return 2.0 * passes + REVERB_MAC_COST * n_parts;
+}
+
+/*Choosing the partition sizes of the response from frame 'offset' on, after a stage of 'block' frames: either the
+rest in partitions of 'block' frames, or enough of them to reach a larger size, whose blocks must come out before the
+frames they add to are handed out (its offset at least its block minus the first block), and the best choice after it.
+Returns the estimated cost, and the number of stages with their sizes in blocks/parts when 'blocks' is not NULL. */
+static double reverb_plan(const reverb *v, int block, int64_t offset, int *n_stages, int *blocks, int *parts){
+    int64_t rest = v->ir_frames - offset, need;
+    int next, p, n = 0, bl[REVERB_MAX_STAGES], pa[REVERB_MAX_STAGES];
+    double best, c;
+
+    best = reverb_stage_cost(block, (int)((rest + block - 1) / block));
+    p = (int)((rest + block - 1) / block);
+    *n_stages = 1;
+    blocks[0] = block;
+    parts[0] = p;
+    for (next = 2 * block; next <= REVERB_MAX_BLOCK && *n_stages < REVERB_MAX_STAGES; next <<= 1){
+        need = next - v->block - offset;
+        p = need <= 0 ? 1 : (int)((need + block - 1) / block);
+        if ((int64_t)p * block >= rest) break;
+        c = reverb_stage_cost(block, p) + reverb_plan(v, next, offset + (int64_t)p * block, &n, bl, pa);
+        if (c < best && n + 1 <= REVERB_MAX_STAGES){
+            best = c;
+            *n_stages = n + 1;
+            blocks[0] = block;
+            parts[0] = p;
+            memcpy(blocks + 1, bl, n * sizeof(int));
+            memcpy(parts + 1, pa, n * sizeof(int));
+        }
+    }
+    return best;
+}
+
+/*Preparing the reverb with the impulse response of a .wav file at the sample rate and with the first partition of the
+render block of the calling thread (RS(rate), RS(block_frames)). 'wet' is the level of the reverb signal, which is
+added to the dry mix.
+Returns 1 on success and 0 if the impulse response cannot be read or there is not enough memory. */
+int reverb_init(reverb *v, const char *ir_file, double wet){
+    int b, n, nb, p, c, k, half, g, max_block, blocks[REVERB_MAX_STAGES], parts[REVERB_MAX_STAGES];
+    int render_block = RS(block_frames) > 0 ? RS(block_frames) : DEFAULT_BLOCK_FRAMES;
+    int64_t i, offset, wet_frames;
+    double energy_r = 0, energy_l = 0, scale;
+    const double *ir;
+    reverb_stage *st;
+
+    memset(v, 0, sizeof(reverb));
+    if (!reverb_read_ir(v, ir_file)){
+        reverb_free(v);
+        return 0;
+    }
+
+    //Scaling the response to the energy of a unit impulse times the wet level, with the level of the louder channel.
+    for (i = 0; i < v->ir_frames; i++){
+        energy_r += v->ir_r[i] * v->ir_r[i];
+        energy_l += v->ir_l[i] * v->ir_l[i];
+    }
+    if (energy_r + energy_l == 0){
+        fprintf(stderr, "The impulse response '%s' is silent.\n", ir_file);
+        reverb_free(v);
+        return 0;
+    }
+    scale = wet / sqrt(energy_r > energy_l ? energy_r : energy_l);
+    for (i = 0; i < v->ir_frames; i++){
+        v->ir_r[i] *= scale;
+        if (v->ir_l != v->ir_r) v->ir_l[i] *= scale;
+    }
+
+    //The first partition is the render block rounded up to a power of 2, and the later ones the cheapest plan.
+    for (b = REVERB_MIN_BLOCK; b < REVERB_MAX_BLOCK && b < render_block; b <<= 1) ;
+    v->block = b;
+    reverb_plan(v, b, 0, &v->n_stages, blocks, parts);
+    max_block = blocks[v->n_stages - 1];
+
+    offset = 0;
+    for (g = 0; g < v->n_stages; g++){
+        st = &v->stage[g];
+        st->block = blocks[g];
+        st->n_parts = parts[g];
+        st->offset = offset;
+        offset += (int64_t)parts[g] * blocks[g];
+        nb = st->block + 1;
+        st->h_re = (float *)calloc((size_t)st->n_parts * 2 * nb, sizeof(float));
+        st->h_im = (float *)calloc((size_t)st->n_parts * 2 * nb, sizeof(float));
+        st->x_re = (float *)calloc((size_t)st->n_parts * 2 * nb, sizeof(float));
+        st->x_im = (float *)calloc((size_t)st->n_parts * 2 * nb, sizeof(float));
+        if (!st->h_re || !st->h_im || !st->x_re || !st->x_im){
+            fprintf(stderr, "Out of memory!\n");
+            reverb_free(v);
+            return 0;
+        }
+    }
+    //The wet ring holds the frames from the block being handed out to the end of the block of the last stage.
+    for (wet_frames = 1; wet_frames < b + v->stage[v->n_stages - 1].offset; wet_frames <<= 1) ;
+    v->wet_mask = (int)wet_frames - 1;
+    v->in_mask = 2 * max_block - 1;
+    n = 2 * max_block;
+    v->acc_re = (float *)malloc(2 * (max_block + 1) * sizeof(float));
+    v->acc_im = (float *)malloc(2 * (max_block + 1) * sizeof(float));
+    v->z_re = (float *)malloc(n * sizeof(float));
+    v->z_im = (float *)malloc(n * sizeof(float));
+    v->tw_re = (float *)malloc(n * sizeof(float));
+    v->tw_im = (float *)malloc(n * sizeof(float));
+    v->in_r = (float *)calloc(n, sizeof(float));
+    v->in_l = (float *)calloc(n, sizeof(float));
+    v->wet_r = (double *)calloc((size_t)wet_frames, sizeof(double));
+    v->wet_l = (double *)calloc((size_t)wet_frames, sizeof(double));
+    v->dry_r = (double *)calloc(b, sizeof(double));
+    v->dry_l = (double *)calloc(b, sizeof(double));
+    v->out_r = (double *)calloc(b, sizeof(double));
+    v->out_l = (double *)calloc(b, sizeof(double));
+    if (!v->acc_re || !v->acc_im || !v->z_re || !v->z_im || !v->tw_re || !v->tw_im || !v->in_r || !v->in_l ||
+        !v->wet_r || !v->wet_l || !v->dry_r || !v->dry_l || !v->out_r || !v->out_l){
+        fprintf(stderr, "Out of memory!\n");
+        reverb_free(v);
+        return 0;
+    }
+
+    for (half = 1; half < n; half <<= 1){
+        for (k = 0; k < half; k++){
+            v->tw_re[half + k] = (float)cos(M_PI * k / half);
+            v->tw_im[half + k] = (float)-sin(M_PI * k / half);
+        }
+    }
+
+    //The spectrum of every partition, zero-padded to 2 * block points and divided by their number for the inverse FFT.
+    for (g = 0; g < v->n_stages; g++){
+        st = &v->stage[g];
+        b = st->block;
+        nb = b + 1;
+        for (p = 0; p < st->n_parts; p++){
+            for (c = 0; c < 2; c++){
+                ir = (c == 0 ? v->ir_r : v->ir_l) + st->offset + (int64_t)p * b;
+                memset(v->z_re, 0, 2 * b * sizeof(float));
+                memset(v->z_im, 0, 2 * b * sizeof(float));
+                for (k = 0; k < b && st->offset + (int64_t)p * b + k < v->ir_frames; k++) v->z_re[k] = (float)(ir[k] / (2 * b));
+                reverb_fft(v, v->z_re, v->z_im, 2 * b);
+                for (k = 0; k < b; k++){
+                    st->h_re[((size_t)p * 2 + c) * nb + k] = v->z_re[2 * k];
+                    st->h_im[((size_t)p * 2 + c) * nb + k] = v->z_im[2 * k];
+                }
+                st->h_re[((size_t)p * 2 + c) * nb + b] = v->z_re[1];
+                st->h_im[((size_t)p * 2 + c) * nb + b] = v->z_im[1];
+            }
+        }
+    }
+    v->skip = v->block;
+    return 1;
+}
+
+//Putting n frames into the reverb and taking out the frames that are ready, in place. Returns the frames taken out.
+static int64_t reverb_feed(reverb *v, double *r, double *l, int64_t n){
+    int64_t i = 0, out = 0, k, s, end;
+    int b = v->block, g, j, in, w;
+
+    while (i < n){
+        k = b - v->pos;
+        if (k > n - i) k = n - i;
+        //The blocks of the first stage divide the input ring, so a block never wraps around.
+        in = (int)((v->blocks * b + v->pos) & v->in_mask);
+        memcpy(v->dry_r + v->pos, r + i, (size_t)k * sizeof(double));
+        memcpy(v->dry_l + v->pos, l + i, (size_t)k * sizeof(double));
+        for (j = 0; j < k; j++){
+            v->in_r[in + j] = (float)r[i + j];
+            v->in_l[in + j] = (float)l[i + j];
+        }
+
+        //The output is never ahead of the input, so it does not overwrite frames that have not been read.
+        s = v->skip < k ? v->skip : k;
+        v->skip -= s;
+        memcpy(r + out, v->out_r + v->pos + s, (size_t)(k - s) * sizeof(double));
+        memcpy(l + out, v->out_l + v->pos + s, (size_t)(k - s) * sizeof(double));
+        out += k - s;
+
+        v->pos += (int)k;
+        i += k;
+        if (v->pos == b){
+            //Every stage whose block ends here, then the dry block plus its reverb signal.
+            end = ++v->blocks * b;
+            for (g = 0; g < v->n_stages; g++){
+                if (end % v->stage[g].block == 0) reverb_block(v, &v->stage[g], end);
+            }
+            //The first block divides the wet ring, so it does not wrap around either.
+            w = (int)((end - b) & v->wet_mask);
+            for (j = 0; j < b; j++){
+                v->out_r[j] = v->dry_r[j] + v->wet_r[w + j];
+                v->out_l[j] = v->dry_l[j] + v->wet_l[w + j];
+            }
+            memset(v->wet_r + w, 0, b * sizeof(double));
+            memset(v->wet_l + w, 0, b * sizeof(double));
+            v->pos = 0;
+        }
+    }
+    return out;
+}
+
+/*Adding the reverb to n frames of the mix, in place. The frames come out one block later: the first call hands out
+fewer frames than it is given (the count is returned, and the frames are at the start of r/l), and reverb_drain hands
+out the rest when the mix has ended. Together they give every frame of the mix in its place. */
+int64_t reverb_run(reverb *v, double *r, double *l, int64_t n){
+    int64_t out = reverb_feed(v, r, l, n);
+
+    v->frames_in += n;
+    v->frames_out += out;
+    return out;
+}
+
+//Writing up to n of the frames that the reverb still holds to r/l when the mix has ended. Returns the number of
+//frames written, 0 when all have been handed out.
+int64_t reverb_drain(reverb *v, double *r, double *l, int64_t n){
+    int64_t done = 0, k;
+
+    if (n > v->frames_in - v->frames_out) n = v->frames_in - v->frames_out;
+    while (done < n){
+        memset(r + done, 0, (size_t)(n - done) * sizeof(double));
+        memset(l + done, 0, (size_t)(n - done) * sizeof(double));
+        k = reverb_feed(v, r + done, l + done, n - done);
+        done += k;
+    }
+    v->frames_out += done;
+    return done;
+}
+
+/*The reverb in the time domain, for checking reverb_run: out = in + the convolution of in with the impulse response,
+for n frames of a mix that starts with in[0]. */
+void reverb_reference(const reverb *v, const double *in_r, const double *in_l, double *out_r, double *out_l, int64_t n){
+    int64_t i, j, m;
+    double sr, sl;
+
+    for (i = 0; i < n; i++){
+        sr = in_r[i];
+        sl = in_l[i];
+        m = i + 1 < v->ir_frames ? i + 1 : v->ir_frames;
+        for (j = 0; j < m; j++){
+            sr += v->ir_r[j] * in_r[i - j];
+            sl += v->ir_l[j] * in_l[i - j];
+        }
+        out_r[i] = sr;
+        out_l[i] = sl;
+    }
+}
+
+void reverb_free(reverb *v){
+    int g;
+
+    if (v->ir_l != v->ir_r) free(v->ir_l);
+    free(v->ir_r);
+    for (g = 0; g < REVERB_MAX_STAGES; g++){
+        free(v->stage[g].h_re);
+        free(v->stage[g].h_im);
+        free(v->stage[g].x_re);
+        free(v->stage[g].x_im);
+    }
+    free(v->acc_re);
+    free(v->acc_im);
+    free(v->z_re);
+    free(v->z_im);
+    free(v->tw_re);
+    free(v->tw_im);
+    free(v->in_r);
+    free(v->in_l);
+    free(v->wet_r);
+    free(v->wet_l);
+    free(v->dry_r);
+    free(v->dry_l);
+    free(v->out_r);
+    free(v->out_l);
+    memset(v, 0, sizeof(reverb));
+}
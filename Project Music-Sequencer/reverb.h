@@ -0,0 +1,73 @@
+#pragma once
+
+#ifndef REVERB_H
+#define REVERB_H
+
+#include<stdio.h>
+#include<stdlib.h>
+#include <stdint.h>
+
+#define REVERB_MAX_BLOCK 32768 //Largest partition of the impulse response in frames
+#define REVERB_MIN_BLOCK 64 //Smallest partition, the latency of the reverb with very small render blocks
+#define REVERB_MAX_STAGES 12 //Partition sizes of one impulse response
+#define REVERB_MAX_SECONDS 30 //Longest impulse response
+#define DEFAULT_REVERB_WET 0.3 //Default level of the reverb signal added to the dry mix
+
+//Partitions of one size: the impulse response from 'offset' on, in n_parts partitions of 'block' frames.
+typedef struct reverb_stage_struct{
+	int block; //Partition length in frames (a power of 2)
+	int n_parts; //Partitions of the stage
+	int64_t offset; //First frame of the impulse response in the stage
+	float* h_re; //Spectra of the partitions, bins 0..block of both channels: [(part * 2 + channel) * (block + 1) + bin]
+	float* h_im;
+	float* x_re; //Delay line of the input spectra, in the same layout, one slot per partition
+	float* x_im;
+	int slot; //Slot of the next input block in the delay line
+} reverb_stage;
+
+/*Convolution reverb of the master bus, by non-uniformly partitioned overlap-save. The impulse response is cut into
+stages of partitions of growing size: the first one has the size of the render block, RS(block_frames), and sets the
+latency, and the later ones start far enough into the response that their longer blocks are ready in time. The spectrum
+of every partition is computed once with an FFT of 2 * block points. Every stage convolves the mix block by block:
+the spectrum of every input block is kept in a delay line, and the output block is the inverse FFT of the sum of the
+delayed input spectra times the partition spectra, added to the wet signal 'offset' frames later. Both channels go
+through one complex FFT, the right channel as the real part and the left one as the imaginary part.
+The output is delayed by one block of the first stage; reverb_run and reverb_drain hide the delay, so the reverb adds
+no time to the song. */
+typedef struct reverb_struct{
+	int block; //Partition length of the first stage in frames; the latency
+	int n_stages; //Stages in use
+	reverb_stage stage[REVERB_MAX_STAGES];
+	int64_t ir_frames; //Length of the impulse response at the sample rate
+	double* ir_r; //Impulse response of the right and left channel, scaled by the wet level (for reverb_reference)
+	double* ir_l;
+	float* acc_re; //Sum of the products of both channels, for the largest partition
+	float* acc_im;
+	float* z_re; //FFT buffer of 2 * the largest partition
+	float* z_im;
+	float* tw_re; //Twiddle factors of every FFT stage: [half + k] = exp(-i pi k / half)
+	float* tw_im;
+	float* in_r; //Ring of the last 2 * the largest partition input frames, in the precision of the FFT
+	float* in_l;
+	int in_mask; //Length of the input ring - 1 (a power of 2)
+	double* wet_r; //Ring of the reverb signal of the frames from the current block on, added up by the stages
+	double* wet_l;
+	int wet_mask; //Length of the wet ring - 1 (a power of 2)
+	double* dry_r; //The current input block
+	double* dry_l;
+	double* out_r; //Output of the previous block, handed out while the current block fills
+	double* out_l;
+	int pos; //Frames of the current input block
+	int64_t blocks; //Input blocks of the first stage convolved so far
+	int64_t skip; //Output frames still to be dropped for the delay of the first block
+	int64_t frames_in; //Frames of the mix given to reverb_run
+	int64_t frames_out; //Frames handed out
+} reverb;
+
+int reverb_init(reverb* v, const char* ir_file, double wet);
+int64_t reverb_run(reverb* v, double* r, double* l, int64_t n);
+int64_t reverb_drain(reverb* v, double* r, double* l, int64_t n);
+void reverb_reference(const reverb* v, const double* in_r, const double* in_l, double* out_r, double* out_l, int64_t n);
+void reverb_free(reverb* v);
+
+#endif // REVERB_H
@@ -0,0 +1,513 @@
+/*
+Score index.
+The notes of a score are collected in a flat array, ordered by (bar, index) with one sort,
+and turned into the playlist for render_file in a single pass. The tempo changes of the score are applied in the same pass:
+every note gets its start time in bars at the base tempo, from which schedule_notes computes its start frame.
+A score that is already sorted (the normal case) is detected in O(n) and not sorted again.
+Score files are memory-mapped and tokenized in one pass without copying the text.
+*/
+
+#define _CRT_SECURE_NO_WARNINGS
+
+#include "score.h"
+#include "note_table.h"
+#include "file_map.h"
+#include "wall_clock.h"
+
+//Initializing an empty score with room for 'capacity' events. Returns 0 if there is not enough memory.
+int score_init(score *s, int capacity){
+    if (capacity < 64) capacity = 64;
+
+    s->n_events = 0;
+    s->capacity = capacity;
+    s->tempos = NULL;
+    s->n_tempos = 0;
+    s->tempo_capacity = 0;
+    s->events = (score_event *)malloc(capacity * sizeof(score_event));
+    s->tracks = (score_track *)malloc(16 * sizeof(score_track));
+    s->track_capacity = 16;
+
+    if (s->events == NULL || s->tracks == NULL){
+        fprintf(stderr, "Out of memory!\n");
+        free(s->events);
+        free(s->tracks);
+        s->events = NULL;
+        s->tracks = NULL;
+        s->capacity = 0;
+        s->track_capacity = 0;
+        return 0;
+    }
+    score_clear(s);
+    return 1;
+}
+
+//Adding a note event to the score. A note with an index outside [0.0, 1.0) is skipped and counted in n_invalid.
+//Returns 0 if there is not enough memory.
+int score_add(score *s, double freq, int bar, double index){
+    score_event *t;
+
+    if (index >= 1.0 || index < 0.0){
+        fprintf(stderr, "Invalid index %g at bar %d skipped. The index must be from 0.0 to below 1.0.\n", index, bar);
+        s->n_invalid++;
+        return 1;
+    }
+
+    if (s->n_events == s->capacity){
+        t = (score_event *)realloc(s->events, 2 * (size_t)s->capacity * sizeof(score_event));
+        if (t == NULL){
+            fprintf(stderr, "Out of memory!\n");
+            return 0;
+        }
+        s->events = t;
+        s->capacity *= 2;
+    }
+
+    t = &s->events[s->n_events];
+    t->freq = freq;
+    t->bar = bar;
+    t->index = index;
+    t->seq = s->n_events;
+    t->track = s->current_track;
+    s->n_events++;
+    return 1;
+}
+
+//Adding a tempo change to the score. Changes with a factor that is not above 0 are skipped.
+//Returns 0 if there is not enough memory.
+int score_add_tempo(score *s, double factor, int bar, double index){
+    score_tempo *t;
+
+    if (index >= 1.0 || index < 0.0 || !(factor > 0)){
+        fprintf(stderr, "Invalid tempo change at bar %d skipped.\n", bar);
+        return 1;
+    }
+
+    if (s->n_tempos == s->tempo_capacity){
+        t = (score_tempo *)realloc(s->tempos, (s->tempo_capacity + 16) * sizeof(score_tempo));
+        if (t == NULL){
+            fprintf(stderr, "Out of memory!\n");
+            return 0;
+        }
+        s->tempos = t;
+        s->tempo_capacity += 16;
+    }
+
+    t = &s->tempos[s->n_tempos];
+    t->factor = factor;
+    t->bar = bar;
+    t->index = index;
+    t->seq = s->n_tempos;
+    s->n_tempos++;
+    return 1;
+}
+
+/*Making the track 'name' (of 'len' characters) the track of the notes that are added next.
+A track that is not in the score yet is added with gain 1 in the centre; "main" is track 0.
+Names longer than SCORE_TRACK_NAME - 1 characters are cut off.
+Returns the position of the track in s->tracks, or -1 if there is not enough memory. */
+int score_select_track(score *s, const char *name, size_t len){
+    score_track *t;
+    int i;
+
+    if (len > SCORE_TRACK_NAME - 1) len = SCORE_TRACK_NAME - 1;
+    for (i = 0; i < s->n_tracks; i++){
+        if (strlen(s->tracks[i].name) == len && memcmp(s->tracks[i].name, name, len) == 0) break;
+    }
+
+    if (i == s->n_tracks){
+        if (s->n_tracks == s->track_capacity){
+            t = (score_track *)realloc(s->tracks, 2 * (size_t)s->track_capacity * sizeof(score_track));
+            if (t == NULL){
+                fprintf(stderr, "Out of memory!\n");
+                return -1;
+            }
+            s->tracks = t;
+            s->track_capacity *= 2;
+        }
+        t = &s->tracks[s->n_tracks++];
+        memcpy(t->name, name, len);
+        t->name[len] = '\0';
+        t->gain = 1.0;
+        t->pan = 0.0;
+    }
+    s->current_track = i;
+    return i;
+}
+
+//1 if tempo change x comes before tempo change y, in the same order as the notes.
+static int score_tempo_before(const score_tempo *x, const score_tempo *y){
+    if (x->bar != y->bar) return x->bar < y->bar;
+    if (x->index != y->index) return x->index < y->index;
+    return x->seq < y->seq;
+}
+
+//1 if event x comes before event y: by bar, then by index, then by position in the file.
+static int score_event_before(const score_event *x, const score_event *y){
+    if (x->bar != y->bar) return x->bar < y->bar;
+    if (x->index != y->index) return x->index < y->index;
+    return x->seq < y->seq;
+}
+
+/*Sorting the events by time with a natural merge sort.
+The events are split into runs that are already in order (runs in reverse order are flipped),
+and neighbouring runs are merged until one run is left. This is O(n log n) in general,
+and O(n) for a sorted score or a score that consists of a few sorted parts.
+Returns 0 if there is not enough memory for the merge buffer. */
+int score_sort(score *s){
+    score_event *src, *dst, *t;
+    score_event tmp;
+    int *runs;
+    int n = s->n_events;
+    int n_runs, r, out, lo, mid, hi, i, j, k;
+    score_tempo tempo;
+
+    //A score has few tempo changes; they are sorted by insertion.
+    for (i = 1; i < s->n_tempos; i++){
+        tempo = s->tempos[i];
+        for (j = i; j > 0 && score_tempo_before(&tempo, &s->tempos[j - 1]); j--) s->tempos[j] = s->tempos[j - 1];
+        s->tempos[j] = tempo;
+    }
+
+    for (i = 1; i < n; i++){
+        if (score_event_before(&s->events[i], &s->events[i - 1])) break;
+    }
+    if (i >= n) return 1; //Already sorted
+
+    dst = (score_event *)malloc(n * sizeof(score_event));
+    runs = (int *)malloc((n + 1) * sizeof(int));
+    if (dst == NULL || runs == NULL){
+        fprintf(stderr, "Out of memory!\n");
+        free(dst);
+        free(runs);
+        return 0;
+    }
+    src = s->events;
+
+    //Finding the runs. runs[r] is the first event of run r, runs[n_runs] == n.
+    n_runs = 0;
+    for (i = 0; i < n; i = j){
+        runs[n_runs++] = i;
+        j = i + 1;
+        if (j < n && score_event_before(&src[j], &src[i])){
+            while (j < n && score_event_before(&src[j], &src[j - 1])) j++;
+            for (lo = i, hi = j - 1; lo < hi; lo++, hi--){
+                tmp = src[lo]; src[lo] = src[hi]; src[hi] = tmp;
+            }
+        }
+        else{
+            while (j < n && !score_event_before(&src[j], &src[j - 1])) j++;
+        }
+    }
+    runs[n_runs] = n;
+
+    //Merging neighbouring runs until one is left.
+    while (n_runs > 1){
+        out = 0;
+        for (r = 0; r < n_runs; r += 2){
+            lo = runs[r];
+            mid = runs[r + 1];
+            hi = r + 2 <= n_runs ? runs[r + 2] : n;
+            if (r + 1 == n_runs) mid = hi = n;
+
+            i = lo; j = mid; k = lo;
+            while (i < mid && j < hi){
+                if (score_event_before(&src[j], &src[i])) dst[k++] = src[j++];
+                else dst[k++] = src[i++];
+            }
+            memcpy(&dst[k], &src[i], (mid - i) * sizeof(score_event));
+            k += mid - i;
+            memcpy(&dst[k], &src[j], (hi - j) * sizeof(score_event));
+
+            runs[out++] = lo;
+        }
+        n_runs = out;
+        runs[n_runs] = n;
+        t = src; src = dst; dst = t;
+    }
+
+    //The sorted events are in src, the other buffer is released.
+    if (src != s->events){
+        free(s->events);
+        s->events = src;
+        s->capacity = n;
+    }
+    else free(dst);
+    free(runs);
+    return 1;
+}
+
+/*Building the playlist from the sorted score.
+Notes with the same time but different frequencies are played together (a chord).
+A note that repeats another one exactly (same time and frequency) is skipped.
+The start time of every note is converted to bars at the base tempo: the time before the first tempo change counts
+at factor 1, and every change divides the time after it by its factor. The result does not depend on bar_length.
+The tracks of the score that have notes are copied into the arena as the mix tracks of the notes; a score with
+only the main track at gain 1 in the centre plays on main_track. The notes are allocated in the arena 'a'.
+Returns NULL if the score has no notes or there is not enough memory. */
+note *score_make_playlist_in(score *s, arena *a){
+    note *head = NULL, *tail = NULL, *n_n;
+    mix_track **tracks = NULL;
+    score_event *e, *prev = NULL;
+    int i, j, k = 0, n_used = 0;
+    double section_pos = 0.0, section_time = 0.0, factor = 1.0, pos;
+
+    for (i = 0; i < s->n_events; i++){
+        e = &s->events[i];
+
+        //Looking for an exact duplicate (same frequency and track) among all the notes with the same time.
+        for (j = i - 1; j >= 0; j--){
+            prev = &s->events[j];
+            if (prev->bar != e->bar || prev->index != e->index){
+                j = -1;
+                break;
+            }
+            if (prev->freq == e->freq && prev->track == e->track) break;
+        }
+        if (j >= 0) continue;
+
+        n_n = new_note_in(a, e->freq, e->bar, e->index);
+        if (n_n == NULL) return NULL;
+
+        //The mix tracks are numbered in the order of their first note, so tracks without notes are left out.
+        if (s->n_tracks > 1 || s->tracks[0].gain != 1.0 || s->tracks[0].pan != 0.0){
+            if (tracks == NULL){
+                tracks = (mix_track **)arena_alloc(a, s->n_tracks * sizeof(mix_track *));
+                if (tracks == NULL){
+                    fprintf(stderr, "Out of memory!\n");
+                    return NULL;
+                }
+                memset(tracks, 0, s->n_tracks * sizeof(mix_track *));
+            }
+            if (tracks[e->track] == NULL){
+                tracks[e->track] = (mix_track *)arena_alloc(a, sizeof(mix_track));
+                if (tracks[e->track] == NULL){
+                    fprintf(stderr, "Out of memory!\n");
+                    return NULL;
+                }
+                tracks[e->track]->index = n_used++;
+                tracks[e->track]->gain = s->tracks[e->track].gain;
+                tracks[e->track]->pan = s->tracks[e->track].pan;
+            }
+            n_n->track = tracks[e->track];
+        }
+
+        //Entering the tempo sections that begin at or before the note.
+        pos = e->bar + e->index;
+        while (k < s->n_tempos && s->tempos[k].bar + s->tempos[k].index <= pos){
+            section_time += (s->tempos[k].bar + s->tempos[k].index - section_pos) / factor;
+            section_pos = s->tempos[k].bar + s->tempos[k].index;
+            factor = s->tempos[k].factor;
+            k++;
+        }
+        n_n->time = section_time + (pos - section_pos) / factor;
+        n_n->tempo = factor;
+
+        if (tail == NULL) head = n_n;
+        else tail->next = n_n;
+        tail = n_n;
+    }
+    return head;
+}
+
+#define IS_BLANK(c) ((c) == ' ' || (c) == '\t' || (c) == '\r')
+
+//Reading an integer from p (up to end). Returns the position after the number, or NULL if there is no number.
+static const char *parse_int(const char *p, const char *end, int *out){
+    int neg = 0;
+    long long v = 0;
+    const char *start;
+
+    if (p < end && (*p == '+' || *p == '-')) neg = (*p++ == '-');
+    start = p;
+    while (p < end && *p >= '0' && *p <= '9'){
+        if (v < 100000000000LL) v = v * 10 + (*p - '0');
+        p++;
+    }
+    if (p == start) return NULL;
+
+    if (v > 2147483647LL) v = 2147483647LL;
+    *out = (int)(neg ? -v : v);
+    return p;
+}
+
+/*Reading a decimal number from p (up to end). Returns the position after the number, or NULL if there is no number.
+Numbers with up to 15 significant digits and no exponent (like "0.200000") are converted exactly as strtod does:
+the digits form an integer that is exactly representable, and one division by an exact power of ten rounds correctly.
+Other numbers are copied to a short buffer and converted with strtod. */
+static const char *parse_number(const char *p, const char *end, double *out){
+    static const double pow10[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+                                   1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+    const char *start = p;
+    char buf[64];
+    uint64_t m = 0;
+    int neg = 0, digits = 0, frac = 0, exact = 1, any = 0;
+
+    if (p < end && (*p == '+' || *p == '-')) neg = (*p++ == '-');
+    while (p < end && *p >= '0' && *p <= '9'){
+        any = 1;
+        if (digits < 15) m = m * 10 + (*p - '0');
+        else exact = 0;
+        if (m > 0) digits++;
+        p++;
+    }
+    if (p < end && *p == '.'){
+        p++;
+        while (p < end && *p >= '0' && *p <= '9'){
+            any = 1;
+            if (digits < 15 && frac < 22){
+                m = m * 10 + (*p - '0');
+                frac++;
+            }
+            else if (*p != '0') exact = 0;
+            if (m > 0) digits++;
+            p++;
+        }
+    }
+    if (!any) return NULL;
+
+    if (p < end && (*p == 'e' || *p == 'E')){
+        exact = 0;
+        p++;
+        if (p < end && (*p == '+' || *p == '-')) p++;
+        while (p < end && *p >= '0' && *p <= '9') p++;
+    }
+
+    if (exact){
+        *out = (double)m / pow10[frac];
+        if (neg) *out = -*out;
+    }
+    else{
+        if ((size_t)(p - start) >= sizeof(buf)) return NULL;
+        memcpy(buf, start, p - start);
+        buf[p - start] = '\0';
+        *out = strtod(buf, NULL);
+    }
+    return p;
+}
+
+/*Adding the notes of a score text to the score. Every line has the form "bar index note",
+separated by tabs or spaces, for example "0	0.200000	G3". A line "bar index tempo factor", for example
+"16	0.000000	tempo	1.5", changes the tempo from that time on (see score_tempo). A line "track name [gain [pan]]",
+for example "track bass 0.8 -0.5", puts the notes after it on the named track, with the gain and pan if they are given
+(see score_track); so the parts of a song can also be kept in one file per track and loaded into the same score.
+Lines that do not have these forms and notes that are not in the note table are skipped.
+Returns the number of notes added, or -1 if there is not enough memory. */
+int score_parse(score *s, const char *text, size_t len){
+    const char *line = text, *end = text + len, *p, *q, *name;
+    int bar, t, count = 0;
+    double index, freq, value;
+
+    while (line < end){
+        p = line;
+        while (p < end && IS_BLANK(*p)) p++;
+
+        //A track line: the notes after it go to the named track.
+        if (end - p > 5 && memcmp(p, "track", 5) == 0 && IS_BLANK(p[5])){
+            p += 5;
+            while (p < end && IS_BLANK(*p)) p++;
+            name = p;
+            while (p < end && !IS_BLANK(*p) && *p != '\n') p++;
+            if (p > name){
+                t = score_select_track(s, name, p - name);
+                if (t < 0) return -1;
+                while (p < end && IS_BLANK(*p)) p++;
+                q = parse_number(p, end, &value);
+                if (q != NULL){
+                    s->tracks[t].gain = value;
+                    p = q;
+                    while (p < end && IS_BLANK(*p)) p++;
+                    q = parse_number(p, end, &value);
+                    if (q != NULL){
+                        s->tracks[t].pan = value < -1.0 ? -1.0 : value > 1.0 ? 1.0 : value;
+                        p = q;
+                    }
+                }
+            }
+            p = (const char *)memchr(p, '\n', end - p);
+            if (p == NULL) break;
+            line = p + 1;
+            continue;
+        }
+
+        p = parse_int(p, end, &bar);
+        if (p != NULL && p < end && IS_BLANK(*p)){
+            while (p < end && IS_BLANK(*p)) p++;
+            p = parse_number(p, end, &index);
+        }
+        else p = NULL;
+
+        if (p != NULL && p < end && IS_BLANK(*p)){
+            while (p < end && IS_BLANK(*p)) p++;
+            name = p;
+            while (p < end && !IS_BLANK(*p) && *p != '\n') p++;
+
+            freq = note_lookup(name, p - name);
+            if (p - name == 5 && memcmp(name, "tempo", 5) == 0){
+                while (p < end && IS_BLANK(*p)) p++;
+                p = parse_number(p, end, &freq);
+                if (p != NULL && !score_add_tempo(s, freq, bar, index)) return -1;
+            }
+            else if (freq > 0){
+                if (!score_add(s, freq, bar, index)) return -1;
+                count++;
+            }
+        }
+
+        //Going to the next line. The parsers never read past the end of the line.
+        if (p == NULL) p = line;
+        p = (const char *)memchr(p, '\n', end - p);
+        if (p == NULL) break;
+        line = p + 1;
+    }
+    return count;
+}
+
+/*Loading a score file. The file is memory-mapped and parsed in place.
+The parse time and throughput are reported on stderr.
+Returns 1 on success and 0 if the file cannot be opened or there is not enough memory. */
+int score_load_file(score *s, const char *filename){
+    file_map m;
+    double t0, t1, mb;
+    int count;
+
+    t0 = wall_time();
+    if (!file_map_open(&m, filename)) return 0;
+
+    count = score_parse(s, m.data, m.size);
+    t1 = wall_time();
+
+    mb = (double)m.size / (1024.0 * 1024.0);
+    fprintf(stderr, "Parsed %d notes (%.3f MB) in %.3f ms, %.1f MB/s\n", count < 0 ? 0 : count, mb,
+            1000.0 * (t1 - t0), t1 > t0 ? mb / (t1 - t0) : 0.0);
+
+    file_map_close(&m);
+    return count >= 0;
+}
+
+//Removing all events and tracks, the memory is kept for the next score.
+void score_clear(score *s){
+    s->n_events = 0;
+    s->n_invalid = 0;
+    s->n_tempos = 0;
+    strcpy(s->tracks[0].name, "main");
+    s->tracks[0].gain = 1.0;
+    s->tracks[0].pan = 0.0;
+    s->n_tracks = 1;
+    s->current_track = 0;
+}
+
+//Releasing the memory of the score.
+void score_free(score *s){
+    free(s->events);
+    free(s->tempos);
+    free(s->tracks);
+    s->events = NULL;
+    s->tempos = NULL;
+    s->tracks = NULL;
+    s->n_events = 0;
+    s->n_tempos = 0;
+    s->n_tracks = 0;
+    s->capacity = 0;
+    s->tempo_capacity = 0;
+    s->track_capacity = 0;
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#ifndef SCORE_H
+#define SCORE_H
+
+#include<stdio.h>
+#include<stdlib.h>
+#include"note_io.h"
+
+//One note event from a musical score.
+typedef struct score_event_struct{
+	double freq;
+	double index;
+	int bar;
+	int seq; //Position of the event in the input file, keeps notes with the same time in file order
+	int track; //Track of the note (position in score.tracks)
+} score_event;
+
+//A tempo change: from (bar, index) on, the song plays 'factor' times as fast as the bar length says
+//(2 = bars take half as long, 0.5 = twice as long).
+typedef struct score_tempo_struct{
+	double factor;
+	double index;
+	int bar;
+	int seq; //Position of the change in the input file
+} score_tempo;
+
+#define SCORE_TRACK_NAME 32 //Longest track name, with the terminating zero
+
+//A track of the score, declared by a line "track name [gain [pan]]". Track 0 is the main track,
+//which has the notes before the first track line.
+typedef struct score_track_struct{
+	char name[SCORE_TRACK_NAME];
+	double gain; //Linear gain (1 = unchanged)
+	double pan; //-1 = left only, 0 = centre, 1 = right only
+} score_track;
+
+//The score index: all events of a score in one flat array, sorted by time with score_sort.
+typedef struct score_struct{
+	score_event* events;
+	int n_events;
+	int capacity;
+	score_tempo* tempos; //Tempo changes, sorted by time with score_sort
+	int n_tempos;
+	int tempo_capacity;
+	score_track* tracks; //Tracks in the order of their first track line, track 0 = main
+	int n_tracks;
+	int track_capacity;
+	int current_track; //Track of the notes that are added
+	int n_invalid; //Notes that were skipped because their index is not from 0.0 to below 1.0
+} score;
+
+int score_init(score* s, int capacity);
+int score_add(score* s, double freq, int bar, double index);
+int score_add_tempo(score* s, double factor, int bar, double index);
+int score_select_track(score* s, const char* name, size_t len);
+int score_parse(score* s, const char* text, size_t len);
+int score_load_file(score* s, const char* filename);
+int score_sort(score* s);
+note* score_make_playlist_in(score* s, arena* a);
+void score_clear(score* s);
+void score_free(score* s);
+
+#endif // SCORE_H
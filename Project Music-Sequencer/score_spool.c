@@ -0,0 +1,378 @@
+/*
+Out-of-core score ingestion.
+A score that is too large for the memory is read in chunks of SPOOL_READ_BYTES and parsed into a score index of
+RS(run_events) notes at most. Every time the index is full it is sorted (score_sort) and written to the spool file
+as one run, and the index is emptied. The tracks and the tempo changes stay in memory; a score has few of them.
+The runs are then merged with a binary heap of their next events, reading SPOOL_READ_EVENTS events of a run at a time,
+and score_spool_next turns the merged events into playlist notes one by one, exactly as score_make_playlist_in does.
+The notes are lazy: a note record has no waveform until it starts to play, and it is reused once the note has ended.
+A score that fits into one run is sorted in memory and no spool file is written.
+*/
+
+#define _CRT_SECURE_NO_WARNINGS
+
+#include <string.h>
+#include <errno.h>
+#include "score_spool.h"
+#include "wall_clock.h"
+
+#ifdef _WIN32
+#define file_seek _fseeki64
+#else
+#define file_seek fseeko
+#endif
+
+//Initializing an empty spool. Returns 0 if there is not enough memory.
+int score_spool_init(score_spool *sp){
+    memset(sp, 0, sizeof(score_spool));
+    if (!score_init(&sp->sc, 0)) return 0;
+    arena_init(&sp->notes, DEFAULT_SLAB_SIZE);
+    sp->factor = 1.0;
+    return 1;
+}
+
+//1 if event x comes before event y: by bar, then by index, then by position in the file.
+static int spool_event_before(const spool_event *x, const spool_event *y){
+    if (x->bar != y->bar) return x->bar < y->bar;
+    if (x->index != y->index) return x->index < y->index;
+    return x->seq < y->seq;
+}
+
+//Creating the spool file in RS(spool). Its name contains the address of the spool, so the scores of a batch
+//that are spooled at the same time get different files; a name that exists already is never reused.
+static int spool_create_file(score_spool *sp){
+    size_t len = strlen(RS(spool));
+    const char *sep = len > 0 && RS(spool)[len - 1] != '/' && RS(spool)[len - 1] != '\\' ? "/" : "";
+    int i;
+
+    if (len + 64 > sizeof(sp->path)) return 0;
+    for (i = 0; i < 1000; i++){
+        sprintf(sp->path, "%s%sspool_%llx_%d.tmp", RS(spool), sep, (unsigned long long)(uintptr_t)sp, i);
+        sp->f = fopen(sp->path, "wb+x");
+        if (sp->f != NULL) return 1;
+        if (errno != EEXIST) break;
+    }
+    sp->path[0] = '\0';
+    return 0;
+}
+
+/*Sorting the notes of the score index and writing them to the spool file as a new run. The index is emptied.
+Returns 0 if the file cannot be written or there is not enough memory. */
+static int spool_write_run(score_spool *sp){
+    spool_event buf[256];
+    spool_run *r;
+    score_event *e;
+    int i, k = 0;
+
+    if (!score_sort(&sp->sc)) return 0;
+    if (sp->f == NULL && !spool_create_file(sp)){
+        fprintf(stderr, "Unable to create a spool file in '%s'!\n", RS(spool));
+        return 0;
+    }
+    if (sp->n_runs == sp->run_capacity){
+        r = (spool_run *)realloc(sp->runs, (sp->run_capacity + 64) * sizeof(spool_run));
+        if (r == NULL){
+            fprintf(stderr, "Out of memory!\n");
+            return 0;
+        }
+        sp->runs = r;
+        sp->run_capacity += 64;
+    }
+    r = &sp->runs[sp->n_runs++];
+    memset(r, 0, sizeof(spool_run));
+    r->offset = sp->file_bytes;
+    r->left = sp->sc.n_events;
+
+    for (i = 0; i < sp->sc.n_events; i++){
+        e = &sp->sc.events[i];
+        buf[k].freq = e->freq;
+        buf[k].index = e->index;
+        buf[k].bar = e->bar;
+        buf[k].track = e->track;
+        buf[k].seq = sp->seq_base + e->seq;
+        if (++k == 256 || i + 1 == sp->sc.n_events){
+            if (fwrite(buf, sizeof(spool_event), k, sp->f) != (size_t)k){
+                fprintf(stderr, "Unable to write the spool file '%s'!\n", sp->path);
+                return 0;
+            }
+            k = 0;
+        }
+    }
+    sp->file_bytes += (int64_t)sp->sc.n_events * sizeof(spool_event);
+    sp->seq_base += sp->sc.n_events;
+    sp->sc.n_events = 0;
+    return 1;
+}
+
+//Reading the next events of run r into its buffer. Returns 0 if the spool file cannot be read.
+static int spool_fill(score_spool *sp, spool_run *r){
+    int n = r->left < SPOOL_READ_EVENTS ? (int)r->left : SPOOL_READ_EVENTS;
+
+    if (file_seek(sp->f, r->offset, SEEK_SET) != 0 || fread(r->buf, sizeof(spool_event), n, sp->f) != (size_t)n){
+        fprintf(stderr, "Unable to read the spool file '%s'!\n", sp->path);
+        return 0;
+    }
+    r->offset += (int64_t)n * sizeof(spool_event);
+    r->left -= n;
+    r->n = n;
+    r->pos = 0;
+    return 1;
+}
+
+//Moving the run at heap position i down to its place in the heap.
+static void spool_heap_down(score_spool *sp, int i){
+    int c, t;
+    spool_run *r = sp->runs;
+
+    for (;;){
+        c = 2 * i + 1;
+        if (c >= sp->heap_size) break;
+        if (c + 1 < sp->heap_size && spool_event_before(&r[sp->heap[c + 1]].buf[r[sp->heap[c + 1]].pos], &r[sp->heap[c]].buf[r[sp->heap[c]].pos])) c++;
+        if (!spool_event_before(&r[sp->heap[c]].buf[r[sp->heap[c]].pos], &r[sp->heap[i]].buf[r[sp->heap[i]].pos])) break;
+        t = sp->heap[c]; sp->heap[c] = sp->heap[i]; sp->heap[i] = t;
+        i = c;
+    }
+}
+
+//Preparing the merge: a read buffer for every run and the heap of the runs. Returns 0 if there is not enough memory.
+static int spool_start_merge(score_spool *sp){
+    int i;
+
+    sp->heap = (int *)malloc(sp->n_runs * sizeof(int));
+    if (sp->heap == NULL){
+        fprintf(stderr, "Out of memory!\n");
+        return 0;
+    }
+    for (i = 0; i < sp->n_runs; i++){
+        sp->runs[i].buf = (spool_event *)malloc(SPOOL_READ_EVENTS * sizeof(spool_event));
+        if (sp->runs[i].buf == NULL){
+            fprintf(stderr, "Out of memory!\n");
+            return 0;
+        }
+        if (!spool_fill(sp, &sp->runs[i])) return 0;
+        sp->heap[sp->heap_size++] = i;
+    }
+    for (i = sp->heap_size / 2 - 1; i >= 0; i--) spool_heap_down(sp, i);
+    return 1;
+}
+
+/*Reading a score file into the spool: the notes are parsed chunk by chunk and written to the spool file in sorted runs,
+then the merge of the runs is prepared. The score must not have been loaded before.
+The number of notes, runs and the throughput are reported on stderr.
+Returns 1 on success and 0 if the file cannot be read, the spool file cannot be written or there is not enough memory. */
+int score_spool_load_file(score_spool *sp, const char *filename){
+    FILE *in;
+    char *buf, *t;
+    size_t size = SPOOL_READ_BYTES, len = 0, got, cut;
+    int64_t bytes = 0;
+    int count, ok = 1, i;
+    double t0, t1, mb;
+
+    t0 = wall_time();
+    in = fopen(filename, "rb");
+    if (in == NULL) return 0;
+    buf = (char *)malloc(size);
+    if (buf == NULL){
+        fprintf(stderr, "Out of memory!\n");
+        fclose(in);
+        return 0;
+    }
+
+    do{
+        got = fread(buf + len, 1, size - len, in);
+        len += got;
+        bytes += got;
+
+        //Parsing up to the end of the last whole line, or everything at the end of the file.
+        //A line longer than the buffer makes the buffer larger.
+        if (got == 0) cut = len;
+        else{
+            for (cut = len; cut > 0 && buf[cut - 1] != '\n'; cut--);
+            if (cut == 0){
+                if (len == size){
+                    t = (char *)realloc(buf, 2 * size);
+                    if (t == NULL){
+                        fprintf(stderr, "Out of memory!\n");
+                        ok = 0;
+                        break;
+                    }
+                    buf = t;
+                    size *= 2;
+                }
+                continue;
+            }
+        }
+
+        count = score_parse(&sp->sc, buf, cut);
+        if (count < 0){
+            ok = 0;
+            break;
+        }
+        sp->n_events += count;
+        if (sp->sc.n_events >= RS(run_events) && !spool_write_run(sp)){
+            ok = 0;
+            break;
+        }
+        memmove(buf, buf + cut, len - cut);
+        len -= cut;
+    } while (got > 0);
+
+    if (ok && ferror(in)){
+        fprintf(stderr, "Unable to read the score file '%s'!\n", filename);
+        ok = 0;
+    }
+    fclose(in);
+    free(buf);
+
+    //The last run. A score that fits into one run stays in memory.
+    if (ok && sp->n_runs > 0 && sp->sc.n_events > 0) ok = spool_write_run(sp);
+    if (ok && sp->n_runs == 0) ok = score_sort(&sp->sc);
+    if (ok && sp->n_runs > 0){
+        free(sp->sc.events); //The events of the runs are read back from the spool file
+        sp->sc.events = NULL;
+        sp->sc.capacity = 0;
+        ok = spool_start_merge(sp);
+    }
+
+    //The mix tracks, numbered in the order of their first note (see score_make_playlist_in).
+    if (ok && (sp->sc.n_tracks > 1 || sp->sc.tracks[0].gain != 1.0 || sp->sc.tracks[0].pan != 0.0)){
+        sp->tracks = (mix_track *)malloc(sp->sc.n_tracks * sizeof(mix_track));
+        if (sp->tracks == NULL){
+            fprintf(stderr, "Out of memory!\n");
+            ok = 0;
+        }
+        for (i = 0; ok && i < sp->sc.n_tracks; i++){
+            sp->tracks[i].index = -1;
+            sp->tracks[i].gain = sp->sc.tracks[i].gain;
+            sp->tracks[i].pan = sp->sc.tracks[i].pan;
+        }
+    }
+
+    t1 = wall_time();
+    mb = (double)bytes / (1024.0 * 1024.0);
+    fprintf(stderr, "Spooled %lld notes (%.3f MB) in %d sorted runs (%.1f MB on disk) in %.3f ms, %.1f MB/s\n",
+            (long long)sp->n_events, mb, sp->n_runs > 0 ? sp->n_runs : 1, (double)sp->file_bytes / (1024.0 * 1024.0),
+            1000.0 * (t1 - t0), t1 > t0 ? mb / (t1 - t0) : 0.0);
+    return ok;
+}
+
+//The next event in time order: from the runs, or from the score index if there is no spool file.
+//Returns 1 if there is one, 0 at the end of the score and -1 if the spool file cannot be read.
+static int spool_pop(score_spool *sp, spool_event *e){
+    spool_run *r;
+    score_event *s;
+
+    if (sp->n_runs == 0){
+        if (sp->mem_pos >= sp->sc.n_events) return 0;
+        s = &sp->sc.events[sp->mem_pos++];
+        e->freq = s->freq;
+        e->index = s->index;
+        e->bar = s->bar;
+        e->track = s->track;
+        e->seq = s->seq;
+        return 1;
+    }
+
+    if (sp->heap_size == 0) return 0;
+    r = &sp->runs[sp->heap[0]];
+    *e = r->buf[r->pos++];
+    if (r->pos == r->n){
+        if (r->left > 0){
+            if (!spool_fill(sp, r)) return -1;
+        }
+        else sp->heap[0] = sp->heap[--sp->heap_size];
+    }
+    if (sp->heap_size > 0) spool_heap_down(sp, 0);
+    return 1;
+}
+
+/*The next note of the playlist of the spooled score, with its start time and track set as in score_make_playlist_in:
+exact duplicates are skipped, and the tempo changes are applied. The note is lazy (see note_init), and it stays valid
+until it is given back with score_spool_recycle. Returns NULL at the end of the playlist; 'failed' is then set
+if the spool file could not be read or there was not enough memory. */
+note *score_spool_next(score_spool *sp){
+    spool_event e, *c;
+    note *n;
+    mix_track *track;
+    score_tempo *tp;
+    int j, r;
+    double pos;
+
+    while ((r = spool_pop(sp, &e)) > 0){
+        //Looking for an exact duplicate (same frequency and track) among all the notes with the same time.
+        if (sp->n_chord > 0 && (sp->chord[0].bar != e.bar || sp->chord[0].index != e.index)) sp->n_chord = 0;
+        for (j = sp->n_chord - 1; j >= 0 && (sp->chord[j].freq != e.freq || sp->chord[j].track != e.track); j--);
+        if (j >= 0) continue;
+        if (sp->n_chord == sp->chord_capacity){
+            c = (spool_event *)realloc(sp->chord, (sp->chord_capacity + 16) * sizeof(spool_event));
+            if (c == NULL){
+                fprintf(stderr, "Out of memory!\n");
+                sp->failed = 1;
+                return NULL;
+            }
+            sp->chord = c;
+            sp->chord_capacity += 16;
+        }
+        sp->chord[sp->n_chord++] = e;
+
+        //The record of a note that has ended, or a new one.
+        if (sp->free_notes != NULL){
+            n = sp->free_notes;
+            sp->free_notes = n->next;
+        }
+        else n = (note *)arena_alloc(&sp->notes, sizeof(note));
+        if (n == NULL){
+            fprintf(stderr, "Out of memory!\n");
+            sp->failed = 1;
+            return NULL;
+        }
+        note_init(n, e.freq, e.bar, e.index, NULL);
+
+        if (sp->tracks != NULL){
+            track = &sp->tracks[e.track];
+            if (track->index < 0) track->index = sp->n_used++;
+            n->track = track;
+        }
+
+        //Entering the tempo sections that begin at or before the note.
+        pos = e.bar + e.index;
+        while (sp->k < sp->sc.n_tempos && sp->sc.tempos[sp->k].bar + sp->sc.tempos[sp->k].index <= pos){
+            tp = &sp->sc.tempos[sp->k];
+            sp->section_time += (tp->bar + tp->index - sp->section_pos) / sp->factor;
+            sp->section_pos = tp->bar + tp->index;
+            sp->factor = tp->factor;
+            sp->k++;
+        }
+        n->time = sp->section_time + (pos - sp->section_pos) / sp->factor;
+        n->tempo = sp->factor;
+
+        sp->n_notes++;
+        if (++sp->live_notes > sp->peak_live_notes) sp->peak_live_notes = sp->live_notes;
+        return n;
+    }
+    if (r < 0) sp->failed = 1;
+    return NULL;
+}
+
+//Giving back a note of score_spool_next that has ended; its record is used for a later note.
+void score_spool_recycle(score_spool *sp, note *n){
+    n->next = sp->free_notes;
+    sp->free_notes = n;
+    sp->live_notes--;
+}
+
+//Releasing the memory of the spool and removing its spool file.
+void score_spool_free(score_spool *sp){
+    int i;
+
+    if (sp->f != NULL) fclose(sp->f);
+    if (sp->path[0] != '\0') remove(sp->path);
+    for (i = 0; i < sp->n_runs; i++) free(sp->runs[i].buf);
+    free(sp->runs);
+    free(sp->heap);
+    free(sp->chord);
+    free(sp->tracks);
+    arena_free(&sp->notes);
+    score_free(&sp->sc);
+    memset(sp, 0, sizeof(score_spool));
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#ifndef SCORE_SPOOL_H
+#define SCORE_SPOOL_H
+
+#include<stdio.h>
+#include<stdlib.h>
+#include <stdint.h>
+#include"score.h"
+
+#define DEFAULT_SPOOL_RUN_EVENTS (1 << 20) //Notes sorted in memory before they are written as a run (32 MB of events)
+#define SPOOL_READ_BYTES (1 << 20) //Bytes of the score file read at a time
+#define SPOOL_READ_EVENTS 2048 //Events of a run read at a time during the merge
+
+//A note event as it is stored in a run of the spool file.
+typedef struct spool_event_struct{
+	double freq;
+	double index;
+	int bar;
+	int track; //Position of the track in score.tracks
+	int64_t seq; //Position of the event in the score file
+} spool_event;
+
+//A sorted run in the spool file, and its read buffer during the merge.
+typedef struct spool_run_struct{
+	int64_t offset; //Position of the next unread event in the spool file in bytes
+	int64_t left; //Events of the run that have not been read into the buffer yet
+	spool_event* buf;
+	int n; //Events in the buffer
+	int pos; //Next event of the buffer
+} spool_run;
+
+/*A score that is sorted out of core. The notes are read in chunks, and every RS(run_events) notes are sorted and
+written to the spool file as a run. The runs are merged lazily into time order, and score_spool_next turns the merged
+events into playlist notes one at a time, so the memory does not depend on the length of the score.
+The notes are lazy (see note_init): their waveform is only made when they start to play. */
+typedef struct score_spool_struct{
+	score sc; //Tracks and tempo changes of the score, and the notes of the run that is being collected
+	int64_t n_events; //Notes of the score
+	int64_t seq_base; //Position in the file of the first note in sc
+	char path[1024]; //Spool file, empty if the score fits into one run
+	FILE* f;
+	int64_t file_bytes; //Bytes written to the spool file
+	spool_run* runs;
+	int n_runs;
+	int run_capacity;
+	int* heap; //Runs that have events left, ordered by their next event (binary heap)
+	int heap_size;
+	int mem_pos; //Next event of sc when there is no spool file
+	//Playlist state of score_spool_next
+	arena notes; //Note records; the records of notes that have ended are reused through free_notes
+	note* free_notes;
+	mix_track* tracks; //Mix track of every score track, index -1 until its first note (NULL: all notes on main_track)
+	int n_used; //Mix tracks that have notes
+	int k; //Next tempo change
+	double section_pos, section_time, factor; //Tempo section of the last note (see score_make_playlist_in)
+	spool_event* chord; //Events at the time of the last note, to find exact duplicates
+	int n_chord;
+	int chord_capacity;
+	int64_t n_notes; //Notes handed out
+	int64_t live_notes; //Note records in use
+	int64_t peak_live_notes;
+	int failed; //The playlist ended early because the spool file could not be read or there was not enough memory
+} score_spool;
+
+int score_spool_init(score_spool* sp);
+int score_spool_load_file(score_spool* sp, const char* filename);
+note* score_spool_next(score_spool* sp);
+void score_spool_recycle(score_spool* sp, note* n);
+void score_spool_free(score_spool* sp);
+
+#endif // SCORE_SPOOL_H
@@ -0,0 +1,152 @@
+/*
+Library interface of the sequencer.
+A sequencer holds everything one render needs: its settings, the score, the arena of the playlist and the statistics.
+While a sequencer function runs, the calling thread renders with the settings of the sequencer (render_settings_use),
+and the threads of the render inherit them, so renders with different settings can run in parallel threads of one
+process. The only state that renders share is read-only (the note table) or locked (the prototype cache).
+Errors are returned as SEQUENCER_ERROR_* codes; the library never ends the process.
+*/
+
+#define _CRT_SECURE_NO_WARNINGS
+
+#include <string.h>
+#include "sequencer.h"
+#include "note_table.h"
+#include "prototype.h"
+#include "batch.h"
+#include "file_map.h"
+#include "wall_clock.h"
+
+//Preparing the state that all sequencers share: the note table and the prototype cache.
+//Must be called once before the first sequencer is used, while only one thread runs.
+void sequencer_library_init(void){
+    note_table_builtin();
+    prototype_cache_init();
+}
+
+//Releasing the shared state. No render may be running.
+void sequencer_library_free(void){
+    prototype_cache_free();
+}
+
+//Initializing a sequencer with the current settings of the calling thread. Its settings can be changed afterwards.
+//Returns SEQUENCER_OK or SEQUENCER_ERROR_MEMORY.
+int sequencer_init(sequencer *s){
+    memset(s, 0, sizeof(sequencer));
+    s->settings = *render_settings_current();
+    s->bar_length = DEFAULT_BAR_LENGTH;
+    arena_init(&s->notes, DEFAULT_SLAB_SIZE);
+    s->error = score_init(&s->sc, 0) ? SEQUENCER_OK : SEQUENCER_ERROR_MEMORY;
+    return s->error;
+}
+
+//Replacing the score and the playlist of the sequencer with the score text. 't0' is the time the load began.
+//The size of the text, the notes parsed and the time up to the end of the parse are kept for the parse report.
+//The settings of the sequencer must be in use.
+static int sequencer_load(sequencer *s, const char *text, size_t len, double t0){
+    double t_sort, t_playlist;
+    int count;
+
+    score_clear(&s->sc);
+    arena_reset(&s->notes);
+    s->playlist = NULL;
+    s->score_bytes = 0;
+    s->score_notes = 0;
+    memset(&s->stats, 0, sizeof(s->stats));
+    if (RS(rate) < MIN_SAMPLE_RATE || RS(rate) > MAX_SAMPLE_RATE) return SEQUENCER_ERROR_SETTINGS;
+
+    count = score_parse(&s->sc, text, len);
+    t_sort = wall_time();
+    s->score_bytes = len;
+    s->score_notes = count < 0 ? 0 : count;
+    s->stats.load_ms = 1000.0 * (t_sort - t0);
+    if (count < 0 || !score_sort(&s->sc)) return SEQUENCER_ERROR_MEMORY;
+    if (s->sc.n_invalid > 0) return SEQUENCER_ERROR_INPUT;
+    t_playlist = wall_time();
+    s->playlist = score_make_playlist_in(&s->sc, &s->notes);
+
+    s->stats.sort_ms = 1000.0 * (t_playlist - t_sort);
+    s->stats.playlist_ms = 1000.0 * (wall_time() - t_playlist);
+    if (s->playlist == NULL) return s->sc.n_events > 0 ? SEQUENCER_ERROR_MEMORY : SEQUENCER_ERROR_EMPTY;
+    return SEQUENCER_OK;
+}
+
+//Loading a score file (see score_parse) and building its playlist. The file is memory-mapped and parsed in place.
+int sequencer_load_file(sequencer *s, const char *filename){
+    render_settings *previous = render_settings_use(&s->settings);
+    double t0 = wall_time();
+    file_map m;
+
+    if (!file_map_open(&m, filename)){
+        score_clear(&s->sc);
+        arena_reset(&s->notes);
+        s->playlist = NULL;
+        s->error = SEQUENCER_ERROR_OPEN;
+    }
+    else{
+        s->error = sequencer_load(s, m.data, m.size, t0);
+        file_map_close(&m);
+    }
+    render_settings_use(previous);
+    return s->error;
+}
+
+//Loading a score from the text in memory ('len' bytes), for example a score that came over the network.
+int sequencer_load_text(sequencer *s, const char *text, size_t len){
+    render_settings *previous = render_settings_use(&s->settings);
+
+    s->error = sequencer_load(s, text, len, wall_time());
+    render_settings_use(previous);
+    return s->error;
+}
+
+/*Rendering the loaded playlist into the .wav file 'filename' with render_file, on settings.threads threads.
+The statistics of the render are left in s->stats, together with the stage times of the load.
+Returns SEQUENCER_OK, SEQUENCER_ERROR_EMPTY if no score with notes is loaded, or SEQUENCER_ERROR_RENDER. */
+int sequencer_render(sequencer *s, const char *filename){
+    render_settings *previous;
+    render_stats stats;
+
+    if (s->playlist == NULL) return s->error = SEQUENCER_ERROR_EMPTY;
+
+    //The stage times of the load are taken over, everything else starts from zero.
+    memset(&stats, 0, sizeof(stats));
+    stats.load_ms = s->stats.load_ms;
+    stats.sort_ms = s->stats.sort_ms;
+    stats.playlist_ms = s->stats.playlist_ms;
+    stats.note_allocs = s->notes.n_allocs;
+    stats.note_peak_bytes = s->notes.peak_bytes;
+
+    previous = render_settings_use(&s->settings);
+    s->error = render_file(s->playlist, s->bar_length, filename, &stats) ? SEQUENCER_OK : SEQUENCER_ERROR_RENDER;
+    render_settings_use(previous);
+    s->stats = stats;
+    return s->error;
+}
+
+//Loading the score file 'score_file' and rendering it into 'out_file'.
+int sequencer_render_file(sequencer *s, const char *score_file, const char *out_file){
+    if (sequencer_load_file(s, score_file) != SEQUENCER_OK) return s->error;
+    return sequencer_render(s, out_file);
+}
+
+//Description of a result of the sequencer functions.
+const char *sequencer_error_text(int error){
+    switch (error){
+        case SEQUENCER_OK: return "ok";
+        case SEQUENCER_ERROR_MEMORY: return "out of memory";
+        case SEQUENCER_ERROR_OPEN: return "score file doesn't open";
+        case SEQUENCER_ERROR_INPUT: return "score has notes with an invalid index";
+        case SEQUENCER_ERROR_EMPTY: return "score has no notes";
+        case SEQUENCER_ERROR_SETTINGS: return "sample rate out of range";
+        case SEQUENCER_ERROR_RENDER: return "rendering failed";
+    }
+    return "unknown error";
+}
+
+//Releasing the memory of the sequencer.
+void sequencer_free(sequencer *s){
+    score_free(&s->sc);
+    arena_free(&s->notes);
+    s->playlist = NULL;
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#ifndef SEQUENCER_H
+#define SEQUENCER_H
+
+#include<stdio.h>
+#include<stdlib.h>
+#include <stdint.h>
+#include"render_settings.h"
+#include"score.h"
+#include"render.h"
+
+//Results of the sequencer functions.
+#define SEQUENCER_OK 0
+#define SEQUENCER_ERROR_MEMORY 1 //Not enough memory
+#define SEQUENCER_ERROR_OPEN 2 //The score file cannot be opened
+#define SEQUENCER_ERROR_INPUT 3 //The score has notes with an index that is not from 0.0 to below 1.0
+#define SEQUENCER_ERROR_EMPTY 4 //The score has no notes
+#define SEQUENCER_ERROR_SETTINGS 5 //The sample rate is not from MIN_SAMPLE_RATE to MAX_SAMPLE_RATE
+#define SEQUENCER_ERROR_RENDER 6 //The output file cannot be written, or memory ran out during the render
+
+/*A render context: a score, its playlist and the settings it is rendered with. Nothing of it is shared with other
+sequencers, so every thread of a program can load and render with a sequencer of its own at the same time. */
+typedef struct sequencer_struct{
+	render_settings settings; //Settings of the loads and renders, a copy of the current settings at sequencer_init
+	int bar_length; //Duration of one bar in seconds, DEFAULT_BAR_LENGTH at sequencer_init
+	score sc; //The score of the last load
+	arena notes; //Notes of the playlist
+	note* playlist; //Playlist of the score, NULL if no score is loaded
+	size_t score_bytes; //Bytes of the score text of the last load
+	int score_notes; //Notes parsed by the last load; the time of the map and the parse is stats.load_ms
+	render_stats stats; //Statistics of the last load and render
+	int error; //Result of the last call, SEQUENCER_OK or one of the errors
+} sequencer;
+
+void sequencer_library_init(void);
+void sequencer_library_free(void);
+int sequencer_init(sequencer* s);
+int sequencer_load_file(sequencer* s, const char* filename);
+int sequencer_load_text(sequencer* s, const char* text, size_t len);
+int sequencer_render(sequencer* s, const char* filename);
+int sequencer_render_file(sequencer* s, const char* score_file, const char* out_file);
+const char* sequencer_error_text(int error);
+void sequencer_free(sequencer* s);
+
+#endif // SEQUENCER_H
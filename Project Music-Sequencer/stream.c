@@ -0,0 +1,190 @@
+/*
+Streaming output.
+render_stream hands out the song a few frames at a time: each read synthesizes only as much as the reader asks for
+(rounded up to the look-ahead block), so a player or an encoder connected through a pipe gets the first samples
+right away instead of after the whole song has been rendered.
+*/
+
+#define _CRT_SECURE_NO_WARNINGS
+
+#include <string.h>
+#include "stream.h"
+#include "score.h"
+#include "wall_clock.h"
+
+/*Opening a stream over a playlist: the notes are scheduled and a render cursor is placed on every track at the first frame.
+The playlist must stay valid until the stream is closed. lookahead <= 0 selects DEFAULT_STREAM_LOOKAHEAD.
+Returns 1 on success and 0 if there is not enough memory or the impulse response of the reverb cannot be read. */
+int render_stream_open(render_stream *s, note *head, int bar_length, int lookahead){
+    memset(s, 0, sizeof(render_stream));
+    if (lookahead <= 0) lookahead = DEFAULT_STREAM_LOOKAHEAD;
+    s->lookahead = lookahead;
+
+    s->mix_r = (double *)malloc(lookahead * sizeof(double));
+    s->mix_l = (double *)malloc(lookahead * sizeof(double));
+    if (!s->mix_r || !s->mix_l){
+        fprintf(stderr, "Out of memory!\n");
+        render_stream_close(s);
+        return 0;
+    }
+    if (RS(reverb) != NULL){
+        s->reverb = (reverb *)malloc(sizeof(reverb));
+        if (!s->reverb) fprintf(stderr, "Out of memory!\n");
+        if (!s->reverb || !reverb_init(s->reverb, RS(reverb), RS(wet))){
+            free(s->reverb);
+            s->reverb = NULL;
+            render_stream_close(s);
+            return 0;
+        }
+    }
+
+    s->total_frames = schedule_notes(head, bar_length);
+    if (!mix_bus_init(&s->bus, head) || !mix_cursor_seek(&s->cursor, &s->bus, 0)){
+        render_stream_close(s);
+        return 0;
+    }
+    return 1;
+}
+
+/*Reading the next n_frames frames as interleaved 16-bit R/L samples (the same values as in the .wav file).
+Returns the number of frames read: less than n_frames at the end of the song, 0 after it, and -1 if there is not enough memory. */
+int64_t render_stream_read(render_stream *s, int16_t *pcm, int64_t n_frames){
+    int64_t done = 0, k, start, end;
+    double t0;
+
+    while (done < n_frames){
+        //Rendering the next block when everything in the buffer has been read.
+        if (s->buf_pos == s->buf_len){
+            start = s->cursor.pos;
+            s->buf_pos = s->buf_len = 0;
+            if (start >= s->total_frames){
+                //After the song, the frames the reverb still holds.
+                if (s->reverb == NULL) break;
+                t0 = wall_time();
+                s->buf_len = (int)reverb_drain(s->reverb, s->mix_r, s->mix_l, s->lookahead);
+                s->reverb_ms += 1000.0 * (wall_time() - t0);
+                if (s->buf_len == 0) break;
+                continue;
+            }
+            end = start + s->lookahead;
+            if (end > s->total_frames) end = s->total_frames;
+            if (!mix_cursor_run(&s->cursor, &s->bus, end, s->mix_r, s->mix_l)) return -1;
+            s->buf_len = (int)(end - start);
+            if (s->reverb){
+                t0 = wall_time();
+                s->buf_len = (int)reverb_run(s->reverb, s->mix_r, s->mix_l, end - start);
+                s->reverb_ms += 1000.0 * (wall_time() - t0);
+                continue;
+            }
+        }
+
+        k = s->buf_len - s->buf_pos;
+        if (k > n_frames - done) k = n_frames - done;
+        s->clipped += wav_convert(s->mix_r + s->buf_pos, s->mix_l + s->buf_pos, pcm + 2 * done, k, s->pos);
+        s->buf_pos += (int)k;
+        s->pos += k;
+        done += k;
+    }
+    return done;
+}
+
+void render_stream_close(render_stream *s){
+    mix_cursor_free(&s->cursor);
+    mix_bus_free(&s->bus);
+    free(s->mix_r);
+    free(s->mix_l);
+    if (s->reverb){
+        reverb_free(s->reverb);
+        free(s->reverb);
+    }
+    memset(s, 0, sizeof(render_stream));
+}
+
+/*Rendering a score file to 'out' (for example stdout) while it is being synthesized, as raw PCM or as a .wav file.
+Every block is flushed at once, so the reader at the other end of a pipe can start playing or encoding immediately.
+The time to the first samples and the render speed are reported on stderr, followed by the JSON report if RS(report) is set.
+Returns 1 on success and 0 if the score cannot be read, there is not enough memory or the output cannot be written. */
+int stream_score(const char *score_file, int bar_length, int format, FILE *out){
+    score sc;
+    arena notes;
+    note *head;
+    render_stream s;
+    render_stats stats;
+    int16_t *pcm;
+    int64_t n;
+    double t0, t_first = 0, t1, t;
+    int ok = 1;
+
+    memset(&stats, 0, sizeof(stats));
+    stats.name = score_file;
+    t0 = wall_time();
+    arena_init(&notes, DEFAULT_SLAB_SIZE);
+    if (!score_init(&sc, 0)) return 0;
+
+    if (!score_load_file(&sc, score_file)){
+        fprintf(stderr, "Error: file doesn't open!\n");
+        score_free(&sc);
+        return 0;
+    }
+    t = wall_time();
+    stats.load_ms = 1000.0 * (t - t0);
+    head = NULL;
+    if (score_sort(&sc)){
+        stats.sort_ms = 1000.0 * (wall_time() - t);
+        t = wall_time();
+        head = score_make_playlist_in(&sc, &notes);
+        stats.playlist_ms = 1000.0 * (wall_time() - t);
+    }
+    score_free(&sc);
+    if (head == NULL){
+        fprintf(stderr, "Input playlist is empty!\n");
+        arena_free(&notes);
+        return 0;
+    }
+
+    t = wall_time();
+    if (!render_stream_open(&s, head, bar_length, DEFAULT_STREAM_LOOKAHEAD)){
+        arena_free(&notes);
+        return 0;
+    }
+    stats.schedule_ms = 1000.0 * (wall_time() - t);
+    pcm = (int16_t *)malloc(2 * (size_t)s.lookahead * sizeof(int16_t));
+    if (pcm == NULL){
+        fprintf(stderr, "Out of memory!\n");
+        ok = 0;
+    }
+
+    //The length of the song is known from the schedule, so the .wav header can be written before the samples.
+    if (ok && format == STREAM_WAV) write_wav_header(out, s.total_frames, WAV_PCM16);
+
+    while (ok){
+        t = wall_time();
+        n = render_stream_read(&s, pcm, s.lookahead);
+        stats.synth_ms += 1000.0 * (wall_time() - t);
+        if (n == 0) break;
+
+        t = wall_time();
+        if (n < 0 || fwrite(pcm, 2 * sizeof(int16_t), (size_t)n, out) != (size_t)n || fflush(out) != 0) ok = 0;
+        stats.write_ms += 1000.0 * (wall_time() - t);
+        if (t_first == 0) t_first = wall_time();
+    }
+    if (!ok) fprintf(stderr, "Streaming stopped: the output cannot be written or there is not enough memory.\n");
+    t1 = wall_time();
+
+    fprintf(stderr, "Streamed %lld frames (%.1f s), first samples after %.1f ms, %.1fx realtime\n",
+            (long long)s.pos, (double)s.pos / RS(rate), 1000.0 * (t_first - t0), t1 > t0 ? (double)s.pos / RS(rate) / (t1 - t0) : 0.0);
+
+    stats.frames = s.pos;
+    stats.clipped = s.clipped;
+    stats.reverb_ms = s.reverb_ms;
+    stats.total_ms = 1000.0 * (t1 - t0);
+    stats.note_allocs = notes.n_allocs;
+    stats.note_peak_bytes = notes.peak_bytes;
+    mix_cursor_stats(&s.cursor, &stats);
+    if (ok && RS(report)) render_stats_report(&stats, stderr);
+
+    free(pcm);
+    render_stream_close(&s);
+    arena_free(&notes);
+    return ok;
+}
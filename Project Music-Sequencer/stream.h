@@ -0,0 +1,44 @@
+#pragma once
+
+#ifndef STREAM_H
+#define STREAM_H
+
+#include<stdio.h>
+#include<stdlib.h>
+#include <stdint.h>
+#include"render.h"
+#include"mix_bus.h"
+#include"reverb.h"
+
+#define DEFAULT_STREAM_LOOKAHEAD 1024 //Frames rendered ahead of the reader (23 ms at 44.1 kHz).
+
+//Output formats of stream_score.
+#define STREAM_RAW 0 //Interleaved 16-bit R/L samples without a header
+#define STREAM_WAV 1 //A .wav header followed by the samples
+
+/*Pull-based render of a playlist. The frames are synthesized only when they are read,
+at most 'lookahead' frames ahead of the reader, so the first samples are available at once
+and the memory does not depend on the length of the song.
+The output is the same as the one of render_file. With RS(reverb) set, the first samples wait for the first block of
+the reverb, one render block (RS(block_frames)). */
+typedef struct render_stream_struct{
+	mix_bus bus; //The tracks of the playlist
+	int64_t total_frames; //Length of the song in frames
+	int64_t pos; //Next frame returned to the reader
+	mix_cursor cursor; //Renders the frames after the look-ahead buffer
+	double* mix_r; //Look-ahead buffer: rendered frames that were not read yet
+	double* mix_l;
+	int lookahead; //Capacity of the look-ahead buffer in frames
+	int buf_pos; //Next unread frame in the buffer
+	int buf_len; //Frames in the buffer
+	uint64_t clipped; //Samples read so far that were beyond WAV_CLIP_LEVEL
+	reverb* reverb; //Master-bus reverb, NULL = none (RS(reverb) when the stream was opened)
+	double reverb_ms; //Wall time spent in the reverb
+} render_stream;
+
+int render_stream_open(render_stream* s, note* head, int bar_length, int lookahead);
+int64_t render_stream_read(render_stream* s, int16_t* pcm, int64_t n_frames);
+void render_stream_close(render_stream* s);
+int stream_score(const char* score_file, int bar_length, int format, FILE* out);
+
+#endif // STREAM_H
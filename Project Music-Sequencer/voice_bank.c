@@ -0,0 +1,754 @@
+/*
+Voice bank for the synthesis loop.
+The state of all sounding notes is kept in contiguous arrays, so the Karplus-Strong feedback filter,
+the amplitude boost and the pan can be computed for several voices at once with SSE2/AVX instructions.
+Reading and writing the delay lines stays scalar, because every voice has its own delay length.
+A voice leaves the bank as soon as it has decayed below the release threshold or its length has run out,
+so the work per sample follows the number of audible voices.
+Besides the double-precision reference there are three smaller number formats (PRECISION_...):
+32-bit floats, which halve the delay-line memory and fit twice as many voices in a SIMD register,
+and Q31/Q15 fixed point, where the feedback filter is integer arithmetic on 32-bit or 16-bit delay lines.
+*/
+
+#define _CRT_SECURE_NO_WARNINGS
+
+#include "voice_bank.h"
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#define VB_USE_AVX
+#endif
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define VB_USE_SSE2
+#endif
+
+#define PI 3.14159265358979323846
+
+static const char *precision_names[PRECISION_COUNT] = { "double", "float", "q31", "q15" };
+
+//Name of a number format, as used on the command line.
+const char *precision_name(int precision){
+    return precision >= 0 && precision < PRECISION_COUNT ? precision_names[precision] : "unknown";
+}
+
+//Number format with the given name, -1 if there is none.
+int precision_from_name(const char *name){
+    int i;
+
+    for (i = 0; i < PRECISION_COUNT; i++){
+        if (strcmp(name, precision_names[i]) == 0) return i;
+    }
+    return -1;
+}
+
+//Resizing one array of the bank. Returns 0 if there is not enough memory.
+static int grow_array(void **p, int capacity, size_t size){
+    void *t = realloc(*p, capacity * size);
+    if (t == NULL) return 0;
+    *p = t;
+    return 1;
+}
+
+//Making room for at least 'capacity' voices. Only the arrays of the number format of the bank are allocated.
+static int voice_bank_reserve(voice_bank *b, int capacity){
+    int ok = 1;
+
+    if (capacity <= b->capacity) return 1;
+
+    ok &= grow_array((void **)&b->waveform, capacity, sizeof(void *));
+    ok &= grow_array((void **)&b->wave_length, capacity, sizeof(int));
+    ok &= grow_array((void **)&b->input_idx, capacity, sizeof(int));
+    ok &= grow_array((void **)&b->output_idx, capacity, sizeof(int));
+    ok &= grow_array((void **)&b->n_sampled, capacity, sizeof(int));
+    ok &= grow_array((void **)&b->length, capacity, sizeof(int));
+    ok &= grow_array((void **)&b->env_floor, capacity, sizeof(double));
+
+    if (b->precision == PRECISION_DOUBLE){
+        ok &= grow_array((void **)&b->out_tminus1, capacity, sizeof(double));
+        ok &= grow_array((void **)&b->previous_input, capacity, sizeof(double));
+        ok &= grow_array((void **)&b->f_amp, capacity, sizeof(double));
+        ok &= grow_array((void **)&b->balance, capacity, sizeof(double));
+        ok &= grow_array((void **)&b->balance_r, capacity, sizeof(double));
+        ok &= grow_array((void **)&b->output, capacity, sizeof(double));
+        ok &= grow_array((void **)&b->new_input, capacity, sizeof(double));
+        ok &= grow_array((void **)&b->mix_l, capacity, sizeof(double));
+        ok &= grow_array((void **)&b->mix_r, capacity, sizeof(double));
+    }
+    else{
+        ok &= grow_array((void **)&b->gain_l, capacity, sizeof(float));
+        ok &= grow_array((void **)&b->gain_r, capacity, sizeof(float));
+        ok &= grow_array((void **)&b->mix_l_f, capacity, sizeof(float));
+        ok &= grow_array((void **)&b->mix_r_f, capacity, sizeof(float));
+    }
+    if (b->precision == PRECISION_FLOAT){
+        ok &= grow_array((void **)&b->out_tminus1_f, capacity, sizeof(float));
+        ok &= grow_array((void **)&b->previous_input_f, capacity, sizeof(float));
+        ok &= grow_array((void **)&b->output_f, capacity, sizeof(float));
+        ok &= grow_array((void **)&b->new_input_f, capacity, sizeof(float));
+    }
+    if (b->precision == PRECISION_Q31 || b->precision == PRECISION_Q15){
+        ok &= grow_array((void **)&b->out_tminus1_q, capacity, sizeof(int32_t));
+        ok &= grow_array((void **)&b->previous_input_q, capacity, sizeof(int32_t));
+        ok &= grow_array((void **)&b->output_q, capacity, sizeof(int32_t));
+        ok &= grow_array((void **)&b->new_input_q, capacity, sizeof(int32_t));
+        ok &= grow_array((void **)&b->floor_q, capacity, sizeof(int32_t));
+    }
+
+    if (!ok){
+        fprintf(stderr, "Out of memory!\n");
+        return 0;
+    }
+    b->capacity = capacity;
+    return 1;
+}
+
+//Taking a delay line of 'len' samples: a recycled one of the same length if there is one, otherwise a new one from the arena.
+//A free line stores the link to the next free one in its first bytes, so it is never smaller than a pointer.
+static void *delay_get(voice_bank *b, int len){
+    void *w;
+    size_t bytes = len * (size_t)b->sample_size;
+
+    if (len < b->delay_free_size && b->delay_free[len] != NULL){
+        w = b->delay_free[len];
+        memcpy(&b->delay_free[len], w, sizeof(void *));
+        b->delay_reused++;
+    }
+    else w = arena_alloc(&b->delay_arena, bytes > sizeof(void *) ? bytes : sizeof(void *));
+
+    if (w != NULL) b->delay_allocs++;
+    return w;
+}
+
+//Returning a delay line to the free list of its length.
+static void delay_put(voice_bank *b, void *w, int len){
+    void **t;
+    int size;
+
+    if (len >= b->delay_free_size){
+        size = len + 1 > 2 * b->delay_free_size ? len + 1 : 2 * b->delay_free_size;
+        t = (void **)realloc(b->delay_free, size * sizeof(void *));
+        if (t == NULL) return; //The line stays in the arena and is released with it.
+        memset(t + b->delay_free_size, 0, (size - b->delay_free_size) * sizeof(void *));
+        b->delay_free = t;
+        b->delay_free_size = size;
+    }
+    memcpy(w, &b->delay_free[len], sizeof(void *));
+    b->delay_free[len] = w;
+}
+
+//Converting a value of the double-precision model to fixed point with 'shift' fraction bits.
+static int32_t to_fixed(double x, int shift){
+    double y = floor(x * (double)((int64_t)1 << shift) + 0.5);
+    double max = (double)(((int64_t)1 << shift) - 1);
+
+    if (y > max) y = max;
+    if (y < -max) y = -max;
+    return (int32_t)y;
+}
+
+//Initializing an empty bank with room for 'capacity' voices, synthesizing in the number format 'precision'.
+//Voices are released when the peak of one period of their output falls below 'threshold' (0 keeps them for their whole length).
+//Returns 0 if there is not enough memory.
+int voice_bank_init(voice_bank *b, int capacity, double threshold, int precision){
+    double cutoff_frequency = 30000.0;
+    double RC = 1.0 / (cutoff_frequency * 2 * PI);
+    static const int sizes[PRECISION_COUNT] = { sizeof(double), sizeof(float), sizeof(int32_t), sizeof(int16_t) };
+
+    memset(b, 0, sizeof(voice_bank));
+    arena_init(&b->delay_arena, 256 * 1024);
+
+    //The filter factors are the same as in KS_string_sample.
+    b->alpha = 1.0 / (1.0 + RC * RS(rate));
+    b->one_minus_alpha = 1 - b->alpha;
+    b->threshold = threshold > 0 ? threshold : 0;
+
+    if (precision < 0 || precision >= PRECISION_COUNT) precision = PRECISION_DOUBLE;
+    b->precision = precision;
+    b->sample_size = sizes[precision];
+    b->alpha_f = (float)b->alpha;
+    b->one_minus_alpha_f = (float)b->one_minus_alpha;
+
+    //In fixed point the whole filter is one sum of three products, with the decay folded into the factors.
+    b->q_shift = precision == PRECISION_Q15 ? 15 : 31;
+    b->coef_q[0] = to_fixed(0.999 * .25 * b->alpha, b->q_shift);
+    b->coef_q[1] = to_fixed(0.999 * .75 * b->alpha, b->q_shift);
+    b->coef_q[2] = to_fixed(b->one_minus_alpha, b->q_shift);
+
+    if (capacity < 8) capacity = 8;
+    return voice_bank_reserve(b, capacity);
+}
+
+//Adding a note as the last voice of the bank. It plays until its end_sample, unless it decays below the threshold first.
+//The voice gets its own copy of the note's initial waveform (converted to the number format of the bank),
+//so the note itself is never modified and several banks (one per render thread) can play the same note.
+//A lazy note (see note_init) gets its waveform from its seed here.
+int voice_bank_add(voice_bank *b, note *n){
+    int v, k;
+    double balance, f_amp, scale;
+    const double *w = n->waveform;
+    double *t;
+    void *waveform;
+
+    if (b->n_voices == b->capacity && !voice_bank_reserve(b, 2 * b->capacity)) return 0;
+
+    waveform = delay_get(b, n->wave_length);
+    if (waveform == NULL){
+        fprintf(stderr, "Out of memory!\n");
+        return 0;
+    }
+
+    //The waveform of a lazy note: straight into the delay line in double precision, otherwise into the scratch buffer.
+    if (w == NULL){
+        if (b->precision == PRECISION_DOUBLE) t = (double *)waveform;
+        else{
+            if (n->wave_length > b->lazy_capacity){
+                t = (double *)realloc(b->lazy_waveform, n->wave_length * sizeof(double));
+                if (t == NULL){
+                    delay_put(b, waveform, n->wave_length);
+                    fprintf(stderr, "Out of memory!\n");
+                    return 0;
+                }
+                b->lazy_waveform = t;
+                b->lazy_capacity = n->wave_length;
+            }
+            t = b->lazy_waveform;
+        }
+        note_waveform(n, t);
+        w = t;
+    }
+
+    v = b->n_voices++;
+    b->waveform[v] = waveform;
+    b->wave_length[v] = n->wave_length;
+    b->input_idx[v] = n->input_idx;
+    b->output_idx[v] = n->output_idx;
+    b->n_sampled[v] = n->n_sampled;
+
+    //Pan: low notes go to the left channel, high notes to the right one.
+    balance = (n->freq - 525.0);
+    if (balance < 0) balance = (525.0 + balance) / 525.0;
+    else balance = balance / (5000.0 - 525.0);
+    f_amp = (pow(n->freq, .33) / 18.0);
+
+    //The voice is inaudible when its output times the larger of the two channel gains is under the threshold.
+    b->length[v] = n->n_sampled + (int)(n->end_sample - n->start_sample);
+    b->env_floor[v] = b->threshold / (f_amp * (balance > 1.0 - balance ? balance : 1.0 - balance));
+
+    switch (b->precision){
+    case PRECISION_DOUBLE:
+        if (w != waveform) memcpy(waveform, w, n->wave_length * sizeof(double));
+        b->out_tminus1[v] = n->out_tminus1;
+        b->previous_input[v] = n->previous_input;
+        b->f_amp[v] = f_amp;
+        b->balance[v] = balance;
+        b->balance_r[v] = 1.0 - balance;
+        break;
+
+    case PRECISION_FLOAT:
+        for (k = 0; k < n->wave_length; k++) ((float *)waveform)[k] = (float)w[k];
+        b->out_tminus1_f[v] = (float)n->out_tminus1;
+        b->previous_input_f[v] = (float)n->previous_input;
+        b->gain_l[v] = (float)(f_amp * balance);
+        b->gain_r[v] = (float)(f_amp * (1.0 - balance));
+        break;
+
+    default:
+        for (k = 0; k < n->wave_length; k++){
+            if (b->q_shift == 15) ((int16_t *)waveform)[k] = (int16_t)to_fixed(w[k], 15);
+            else ((int32_t *)waveform)[k] = to_fixed(w[k], 31);
+        }
+        b->out_tminus1_q[v] = to_fixed(n->out_tminus1, b->q_shift);
+        b->previous_input_q[v] = to_fixed(n->previous_input, b->q_shift);
+
+        //The gains also scale the fixed-point output back to 1.0 = full scale.
+        scale = 1.0 / (double)((int64_t)1 << b->q_shift);
+        b->gain_l[v] = (float)(f_amp * balance * scale);
+        b->gain_r[v] = (float)(f_amp * (1.0 - balance) * scale);
+        b->floor_q[v] = b->env_floor[v] * ((int64_t)1 << b->q_shift) < 2147483647.0
+                      ? (int32_t)ceil(b->env_floor[v] * ((int64_t)1 << b->q_shift)) : 2147483647;
+        break;
+    }
+    return 1;
+}
+
+//Copying the state of voice 'from' to voice 'to'.
+static void voice_bank_move(voice_bank *b, int to, int from){
+    b->waveform[to] = b->waveform[from];
+    b->wave_length[to] = b->wave_length[from];
+    b->input_idx[to] = b->input_idx[from];
+    b->output_idx[to] = b->output_idx[from];
+    b->n_sampled[to] = b->n_sampled[from];
+    b->length[to] = b->length[from];
+    b->env_floor[to] = b->env_floor[from];
+
+    switch (b->precision){
+    case PRECISION_DOUBLE:
+        b->out_tminus1[to] = b->out_tminus1[from];
+        b->previous_input[to] = b->previous_input[from];
+        b->f_amp[to] = b->f_amp[from];
+        b->balance[to] = b->balance[from];
+        b->balance_r[to] = b->balance_r[from];
+        break;
+    case PRECISION_FLOAT:
+        b->out_tminus1_f[to] = b->out_tminus1_f[from];
+        b->previous_input_f[to] = b->previous_input_f[from];
+        b->gain_l[to] = b->gain_l[from];
+        b->gain_r[to] = b->gain_r[from];
+        break;
+    default:
+        b->out_tminus1_q[to] = b->out_tminus1_q[from];
+        b->previous_input_q[to] = b->previous_input_q[from];
+        b->gain_l[to] = b->gain_l[from];
+        b->gain_r[to] = b->gain_r[from];
+        b->floor_q[to] = b->floor_q[from];
+        break;
+    }
+}
+
+//Removing voice v. The order of the remaining voices is kept.
+void voice_bank_remove(voice_bank *b, int v){
+    if (v < 0 || v >= b->n_voices) return;
+    delay_put(b, b->waveform[v], b->wave_length[v]);
+    b->n_voices--;
+    for (; v < b->n_voices; v++) voice_bank_move(b, v, v + 1);
+}
+
+/*Feedback filter and gains for all voices.
+Per voice this is the arithmetic of KS_string_sample followed by the amplitude boost and the pan of render_file,
+in the same order of operations, so the result is bit-identical to the scalar code. */
+static void voice_bank_kernel(voice_bank *b){
+    int v = 0;
+    int n = b->n_voices;
+    double o, ni, s;
+
+#ifdef VB_USE_AVX
+    {
+        const __m256d k_decay = _mm256_set1_pd(0.999);
+        const __m256d k_prev = _mm256_set1_pd(.25);
+        const __m256d k_cur = _mm256_set1_pd(.75);
+        const __m256d k_alpha = _mm256_set1_pd(b->alpha);
+        const __m256d k_1malpha = _mm256_set1_pd(b->one_minus_alpha);
+        __m256d vo, vni, vs;
+
+        for (; v + 4 <= n; v += 4){
+            vo = _mm256_loadu_pd(b->output + v);
+            vni = _mm256_add_pd(_mm256_mul_pd(k_prev, _mm256_loadu_pd(b->out_tminus1 + v)), _mm256_mul_pd(k_cur, vo));
+            vni = _mm256_mul_pd(k_decay, vni);
+            vni = _mm256_add_pd(_mm256_mul_pd(k_alpha, vni), _mm256_mul_pd(k_1malpha, _mm256_loadu_pd(b->previous_input + v)));
+            _mm256_storeu_pd(b->previous_input + v, vni);
+            _mm256_storeu_pd(b->new_input + v, vni);
+            _mm256_storeu_pd(b->out_tminus1 + v, vo);
+
+            vs = _mm256_mul_pd(vo, _mm256_loadu_pd(b->f_amp + v));
+            _mm256_storeu_pd(b->mix_l + v, _mm256_mul_pd(_mm256_loadu_pd(b->balance + v), vs));
+            _mm256_storeu_pd(b->mix_r + v, _mm256_mul_pd(_mm256_loadu_pd(b->balance_r + v), vs));
+        }
+    }
+#endif
+#ifdef VB_USE_SSE2
+    {
+        const __m128d k_decay = _mm_set1_pd(0.999);
+        const __m128d k_prev = _mm_set1_pd(.25);
+        const __m128d k_cur = _mm_set1_pd(.75);
+        const __m128d k_alpha = _mm_set1_pd(b->alpha);
+        const __m128d k_1malpha = _mm_set1_pd(b->one_minus_alpha);
+        __m128d vo, vni, vs;
+
+        for (; v + 2 <= n; v += 2){
+            vo = _mm_loadu_pd(b->output + v);
+            vni = _mm_add_pd(_mm_mul_pd(k_prev, _mm_loadu_pd(b->out_tminus1 + v)), _mm_mul_pd(k_cur, vo));
+            vni = _mm_mul_pd(k_decay, vni);
+            vni = _mm_add_pd(_mm_mul_pd(k_alpha, vni), _mm_mul_pd(k_1malpha, _mm_loadu_pd(b->previous_input + v)));
+            _mm_storeu_pd(b->previous_input + v, vni);
+            _mm_storeu_pd(b->new_input + v, vni);
+            _mm_storeu_pd(b->out_tminus1 + v, vo);
+
+            vs = _mm_mul_pd(vo, _mm_loadu_pd(b->f_amp + v));
+            _mm_storeu_pd(b->mix_l + v, _mm_mul_pd(_mm_loadu_pd(b->balance + v), vs));
+            _mm_storeu_pd(b->mix_r + v, _mm_mul_pd(_mm_loadu_pd(b->balance_r + v), vs));
+        }
+    }
+#endif
+    for (; v < n; v++){
+        o = b->output[v];
+        ni = 0.999 * ((.25 * b->out_tminus1[v]) + (.75 * o));
+        ni = b->alpha * ni + b->one_minus_alpha * b->previous_input[v];
+        b->previous_input[v] = ni;
+        b->new_input[v] = ni;
+        b->out_tminus1[v] = o;
+
+        s = o * b->f_amp[v];
+        b->mix_l[v] = b->balance[v] * s;
+        b->mix_r[v] = b->balance_r[v] * s;
+    }
+}
+
+//The same filter in single precision: 8 voices per AVX register, 4 per SSE register.
+static void voice_bank_kernel_f(voice_bank *b){
+    int v = 0;
+    int n = b->n_voices;
+    float o, ni;
+
+#ifdef VB_USE_AVX
+    {
+        const __m256 k_decay = _mm256_set1_ps(0.999f);
+        const __m256 k_prev = _mm256_set1_ps(.25f);
+        const __m256 k_cur = _mm256_set1_ps(.75f);
+        const __m256 k_alpha = _mm256_set1_ps(b->alpha_f);
+        const __m256 k_1malpha = _mm256_set1_ps(b->one_minus_alpha_f);
+        __m256 vo, vni;
+
+        for (; v + 8 <= n; v += 8){
+            vo = _mm256_loadu_ps(b->output_f + v);
+            vni = _mm256_add_ps(_mm256_mul_ps(k_prev, _mm256_loadu_ps(b->out_tminus1_f + v)), _mm256_mul_ps(k_cur, vo));
+            vni = _mm256_mul_ps(k_decay, vni);
+            vni = _mm256_add_ps(_mm256_mul_ps(k_alpha, vni), _mm256_mul_ps(k_1malpha, _mm256_loadu_ps(b->previous_input_f + v)));
+            _mm256_storeu_ps(b->previous_input_f + v, vni);
+            _mm256_storeu_ps(b->new_input_f + v, vni);
+            _mm256_storeu_ps(b->out_tminus1_f + v, vo);
+            _mm256_storeu_ps(b->mix_l_f + v, _mm256_mul_ps(_mm256_loadu_ps(b->gain_l + v), vo));
+            _mm256_storeu_ps(b->mix_r_f + v, _mm256_mul_ps(_mm256_loadu_ps(b->gain_r + v), vo));
+        }
+    }
+#endif
+#ifdef VB_USE_SSE2
+    {
+        const __m128 k_decay = _mm_set1_ps(0.999f);
+        const __m128 k_prev = _mm_set1_ps(.25f);
+        const __m128 k_cur = _mm_set1_ps(.75f);
+        const __m128 k_alpha = _mm_set1_ps(b->alpha_f);
+        const __m128 k_1malpha = _mm_set1_ps(b->one_minus_alpha_f);
+        __m128 vo, vni;
+
+        for (; v + 4 <= n; v += 4){
+            vo = _mm_loadu_ps(b->output_f + v);
+            vni = _mm_add_ps(_mm_mul_ps(k_prev, _mm_loadu_ps(b->out_tminus1_f + v)), _mm_mul_ps(k_cur, vo));
+            vni = _mm_mul_ps(k_decay, vni);
+            vni = _mm_add_ps(_mm_mul_ps(k_alpha, vni), _mm_mul_ps(k_1malpha, _mm_loadu_ps(b->previous_input_f + v)));
+            _mm_storeu_ps(b->previous_input_f + v, vni);
+            _mm_storeu_ps(b->new_input_f + v, vni);
+            _mm_storeu_ps(b->out_tminus1_f + v, vo);
+            _mm_storeu_ps(b->mix_l_f + v, _mm_mul_ps(_mm_loadu_ps(b->gain_l + v), vo));
+            _mm_storeu_ps(b->mix_r_f + v, _mm_mul_ps(_mm_loadu_ps(b->gain_r + v), vo));
+        }
+    }
+#endif
+    for (; v < n; v++){
+        o = b->output_f[v];
+        ni = 0.999f * ((.25f * b->out_tminus1_f[v]) + (.75f * o));
+        ni = b->alpha_f * ni + b->one_minus_alpha_f * b->previous_input_f[v];
+        b->previous_input_f[v] = ni;
+        b->new_input_f[v] = ni;
+        b->out_tminus1_f[v] = o;
+        b->mix_l_f[v] = b->gain_l[v] * o;
+        b->mix_r_f[v] = b->gain_r[v] * o;
+    }
+}
+
+//One step of the fixed-point filter, rounded to nearest, as in the kernels. The factors add up to less than 1,
+//so it cannot overflow.
+static int32_t fixed_filter(const voice_bank *b, int32_t prev_out, int32_t out, int32_t prev_in){
+    int64_t acc = b->coef_q[0] * prev_out + b->coef_q[1] * out + b->coef_q[2] * prev_in;
+
+    return (int32_t)((acc + ((int64_t)1 << (b->q_shift - 1))) >> b->q_shift);
+}
+
+//The filter in Q31. The products need 64 bits.
+static void voice_bank_kernel_q31(voice_bank *b){
+    int v;
+    int n = b->n_voices;
+    const int64_t c0 = b->coef_q[0], c1 = b->coef_q[1], c2 = b->coef_q[2];
+    int64_t acc;
+    int32_t o, ni;
+
+    for (v = 0; v < n; v++){
+        o = b->output_q[v];
+        acc = c0 * b->out_tminus1_q[v] + c1 * o + c2 * b->previous_input_q[v];
+        ni = (int32_t)((acc + ((int64_t)1 << 30)) >> 31);
+        b->previous_input_q[v] = ni;
+        b->new_input_q[v] = ni;
+        b->out_tminus1_q[v] = o;
+        b->mix_l_f[v] = b->gain_l[v] * (float)o;
+        b->mix_r_f[v] = b->gain_r[v] * (float)o;
+    }
+}
+
+//The filter in Q15. Samples and factors are 16-bit, so the products and their sum fit in 32 bits
+//and compilers can vectorize the loop with 4 or 8 voices per register.
+static void voice_bank_kernel_q15(voice_bank *b){
+    int v;
+    int n = b->n_voices;
+    const int32_t c0 = (int32_t)b->coef_q[0], c1 = (int32_t)b->coef_q[1], c2 = (int32_t)b->coef_q[2];
+    int32_t o, ni;
+
+    for (v = 0; v < n; v++){
+        o = b->output_q[v];
+        ni = (c0 * b->out_tminus1_q[v] + c1 * o + c2 * b->previous_input_q[v] + (1 << 14)) >> 15;
+        b->previous_input_q[v] = ni;
+        b->new_input_q[v] = ni;
+        b->out_tminus1_q[v] = o;
+        b->mix_l_f[v] = b->gain_l[v] * (float)o;
+        b->mix_r_f[v] = b->gain_r[v] * (float)o;
+    }
+}
+
+/*The envelope test of a voice. The delay line holds exactly the samples the voice outputs during its next period,
+so it is inaudible from now on when none of them reaches its floor.
+It is run once per period (when the read position wraps around), which costs one compare per sample on average. */
+static int delay_below(const double *w, int len, double floor_level){
+    int k;
+
+    for (k = 0; k < len; k++){
+        if (fabs(w[k]) >= floor_level) return 0;
+    }
+    return 1;
+}
+
+//The envelope test of voice v in any number format.
+static int voice_below(const voice_bank *b, int v){
+    const void *w = b->waveform[v];
+    int len = b->wave_length[v], k;
+    float floor_f;
+    int32_t floor_q;
+
+    switch (b->precision){
+    case PRECISION_DOUBLE:
+        return delay_below((const double *)w, len, b->env_floor[v]);
+    case PRECISION_FLOAT:
+        floor_f = (float)b->env_floor[v];
+        for (k = 0; k < len; k++){
+            if (fabsf(((const float *)w)[k]) >= floor_f) return 0;
+        }
+        return 1;
+    case PRECISION_Q15:
+        floor_q = b->floor_q[v];
+        for (k = 0; k < len; k++){
+            if (abs(((const int16_t *)w)[k]) >= floor_q) return 0;
+        }
+        return 1;
+    default:
+        floor_q = b->floor_q[v];
+        for (k = 0; k < len; k++){
+            if (((const int32_t *)w)[k] >= floor_q || -((const int32_t *)w)[k] >= floor_q) return 0;
+        }
+        return 1;
+    }
+}
+
+//Moving voice v to the next sample after its new input has been written. Returns 1 if the voice has played its last sample.
+static int voice_advance(voice_bank *b, int v){
+    int done = 0;
+
+    b->output_idx[v]++;
+    if (b->output_idx[v] == b->wave_length[v]){
+        b->output_idx[v] = 0;
+        done = voice_below(b, v);
+    }
+    b->input_idx[v]++;
+    if (b->input_idx[v] == b->wave_length[v]) b->input_idx[v] = 0;
+    b->n_sampled[v]++;
+    if (b->n_sampled[v] >= b->length[v]) done = 1;
+    return done;
+}
+
+//voice_bank_sample in single precision and in fixed point: the voices are mixed in 32-bit floats.
+static void voice_bank_sample_small(voice_bank *b, double *l, double *r){
+    int v, kept;
+    int n = b->n_voices;
+    float sum_l = 0, sum_r = 0;
+
+    //Reading the rightmost element of each delay line, and filtering.
+    if (b->precision == PRECISION_FLOAT){
+        for (v = 0; v < n; v++) b->output_f[v] = ((float *)b->waveform[v])[b->output_idx[v]];
+        voice_bank_kernel_f(b);
+        for (v = 0; v < n; v++) ((float *)b->waveform[v])[b->input_idx[v]] = b->new_input_f[v];
+    }
+    else if (b->precision == PRECISION_Q15){
+        for (v = 0; v < n; v++) b->output_q[v] = ((int16_t *)b->waveform[v])[b->output_idx[v]];
+        voice_bank_kernel_q15(b);
+        for (v = 0; v < n; v++) ((int16_t *)b->waveform[v])[b->input_idx[v]] = (int16_t)b->new_input_q[v];
+    }
+    else{
+        for (v = 0; v < n; v++) b->output_q[v] = ((int32_t *)b->waveform[v])[b->output_idx[v]];
+        voice_bank_kernel_q31(b);
+        for (v = 0; v < n; v++) ((int32_t *)b->waveform[v])[b->input_idx[v]] = b->new_input_q[v];
+    }
+
+    //Mixing in voice order and releasing the voices that have ended.
+    kept = 0;
+    for (v = 0; v < n; v++){
+        sum_l += b->mix_l_f[v];
+        sum_r += b->mix_r_f[v];
+
+        if (voice_advance(b, v)) delay_put(b, b->waveform[v], b->wave_length[v]);
+        else{
+            if (kept != v) voice_bank_move(b, kept, v);
+            kept++;
+        }
+    }
+    b->n_voices = kept;
+
+    *l = sum_l;
+    *r = sum_r;
+}
+
+/*Generating one sample of every voice and mixing them into the left and right channels.
+Afterwards the voices that have played their last sample are released: the ones whose length has run out,
+and the ones whose next period is below their floor. The other voices are moved together,
+so the order of the bank stays the playlist order. */
+void voice_bank_sample(voice_bank *b, double *l, double *r){
+    int v, kept, done;
+    int n = b->n_voices;
+    double sum_l = 0, sum_r = 0;
+    double *w;
+
+    if (b->precision != PRECISION_DOUBLE){
+        voice_bank_sample_small(b, l, r);
+        return;
+    }
+
+    //Reading the rightmost element of each delay line.
+    for (v = 0; v < n; v++) b->output[v] = ((double *)b->waveform[v])[b->output_idx[v]];
+
+    voice_bank_kernel(b);
+
+    //Feeding the filtered samples back into the delay lines, and mixing in voice order.
+    kept = 0;
+    for (v = 0; v < n; v++){
+        w = (double *)b->waveform[v];
+        w[b->input_idx[v]] = b->new_input[v];
+        done = 0;
+
+        b->output_idx[v]++;
+        if (b->output_idx[v] == b->wave_length[v]){
+            b->output_idx[v] = 0;
+            done = delay_below(w, b->wave_length[v], b->env_floor[v]);
+        }
+        b->input_idx[v]++;
+        if (b->input_idx[v] == b->wave_length[v]) b->input_idx[v] = 0;
+        b->n_sampled[v]++;
+        if (b->n_sampled[v] >= b->length[v]) done = 1;
+
+        sum_l += b->mix_l[v];
+        sum_r += b->mix_r[v];
+
+        if (done) delay_put(b, b->waveform[v], b->wave_length[v]);
+        else{
+            if (kept != v) voice_bank_move(b, kept, v);
+            kept++;
+        }
+    }
+    b->n_voices = kept;
+
+    *l = sum_l;
+    *r = sum_r;
+}
+
+//voice_bank_skip in single precision and in fixed point, one sample at a time through voice_advance.
+static int voice_bank_skip_small(voice_bank *b, int v, int64_t count){
+    void *w = b->waveform[v];
+    int64_t k;
+    int32_t o, ni;
+    float of, nif;
+
+    for (k = 0; k < count; k++){
+        if (b->precision == PRECISION_FLOAT){
+            of = ((float *)w)[b->output_idx[v]];
+            nif = 0.999f * ((.25f * b->out_tminus1_f[v]) + (.75f * of));
+            nif = b->alpha_f * nif + b->one_minus_alpha_f * b->previous_input_f[v];
+            b->previous_input_f[v] = nif;
+            b->out_tminus1_f[v] = of;
+            ((float *)w)[b->input_idx[v]] = nif;
+        }
+        else{
+            o = b->precision == PRECISION_Q15 ? ((int16_t *)w)[b->output_idx[v]] : ((int32_t *)w)[b->output_idx[v]];
+            ni = fixed_filter(b, b->out_tminus1_q[v], o, b->previous_input_q[v]);
+            b->previous_input_q[v] = ni;
+            b->out_tminus1_q[v] = o;
+            if (b->precision == PRECISION_Q15) ((int16_t *)w)[b->input_idx[v]] = (int16_t)ni;
+            else ((int32_t *)w)[b->input_idx[v]] = ni;
+        }
+        if (voice_advance(b, v)) return 0;
+    }
+    return 1;
+}
+
+/*Advancing voice v by 'count' samples without mixing it.
+Used to bring a note that started before a render segment to the state it has at the segment start.
+The arithmetic and the release test are the same as in voice_bank_sample, so the voice continues exactly as in a serial render.
+Returns 0 if the voice would have been released within these samples (it is left in the bank for the caller to remove). */
+int voice_bank_skip(voice_bank *b, int v, int64_t count){
+    double *w = (double *)b->waveform[v];
+    int len = b->wave_length[v];
+    int in = b->input_idx[v], out = b->output_idx[v];
+    double prev_out, prev_in;
+    double o, ni;
+    int64_t k;
+
+    if (count >= b->length[v] - b->n_sampled[v]) return 0;
+    if (b->precision != PRECISION_DOUBLE) return voice_bank_skip_small(b, v, count);
+
+    prev_out = b->out_tminus1[v];
+    prev_in = b->previous_input[v];
+    for (k = 0; k < count; k++){
+        o = w[out];
+        ni = 0.999 * ((.25 * prev_out) + (.75 * o));
+        ni = b->alpha * ni + b->one_minus_alpha * prev_in;
+        prev_in = ni;
+        prev_out = o;
+        w[in] = ni;
+
+        out++;
+        if (out == len){
+            out = 0;
+            if (delay_below(w, len, b->env_floor[v])) return 0;
+        }
+        in++;
+        if (in == len) in = 0;
+    }
+
+    b->input_idx[v] = in;
+    b->output_idx[v] = out;
+    b->out_tminus1[v] = prev_out;
+    b->previous_input[v] = prev_in;
+    b->n_sampled[v] += (int)count;
+    return 1;
+}
+
+//Releasing the arrays and the delay lines of the bank.
+void voice_bank_free(voice_bank *b){
+    arena_free(&b->delay_arena);
+    free(b->delay_free);
+    free(b->lazy_waveform);
+    free(b->waveform);
+    free(b->wave_length);
+    free(b->input_idx);
+    free(b->output_idx);
+    free(b->n_sampled);
+    free(b->out_tminus1);
+    free(b->previous_input);
+    free(b->f_amp);
+    free(b->balance);
+    free(b->balance_r);
+    free(b->length);
+    free(b->env_floor);
+    free(b->output);
+    free(b->new_input);
+    free(b->mix_l);
+    free(b->mix_r);
+    free(b->out_tminus1_f);
+    free(b->previous_input_f);
+    free(b->output_f);
+    free(b->new_input_f);
+    free(b->gain_l);
+    free(b->gain_r);
+    free(b->mix_l_f);
+    free(b->mix_r_f);
+    free(b->out_tminus1_q);
+    free(b->previous_input_q);
+    free(b->output_q);
+    free(b->new_input_q);
+    free(b->floor_q);
+    memset(b, 0, sizeof(voice_bank));
+}
@@ -0,0 +1,98 @@
+#pragma once
+
+#ifndef VOICE_BANK_H
+#define VOICE_BANK_H
+
+#include<stdio.h>
+#include<stdlib.h>
+#include <stdint.h>
+#include"note_io.h"
+#include"arena.h"
+
+//Number formats of the synthesis (RS(precision)). The delay lines, the filter state and the mix of a bank use one of them.
+#define PRECISION_DOUBLE 0 //64-bit floating point, the reference
+#define PRECISION_FLOAT 1 //32-bit floating point delay lines, filter and mix
+#define PRECISION_Q31 2 //32-bit fixed-point delay lines and filter, the mix in 32-bit floating point
+#define PRECISION_Q15 3 //16-bit fixed-point delay lines and filter, the mix in 32-bit floating point
+#define PRECISION_COUNT 4
+
+//The active voices of a render in structure-of-arrays form.
+//Voice v of the bank is the v-th sounding note in playlist order, so the mix is summed in the same order as before.
+//Every voice is released on its own, when its length runs out or when its envelope has decayed below the threshold.
+//Everything that is constant for a note (gains, pan, filter factors) is computed once in voice_bank_add.
+typedef struct voice_bank_struct{
+	int n_voices; //Number of active voices
+	int capacity; //Allocated length of every array below
+	int precision; //Number format of the bank (PRECISION_...). Only the arrays of this format are allocated.
+	int sample_size; //Bytes of one delay-line sample
+
+	//Karplus-Strong state
+	void** waveform; //Delay line of each voice (a private copy, owned by the bank), in the number format of the bank
+	int* wave_length;
+	int* input_idx;
+	int* output_idx;
+	int* n_sampled; //Samples generated for each voice
+	double* out_tminus1; //PRECISION_DOUBLE
+	double* previous_input;
+
+	//Per-voice constants
+	double* f_amp; //Amplitude boost for high frequencies notes
+	double* balance; //Gain of the left channel
+	double* balance_r; //Gain of the right channel (1.0 - balance)
+
+	//Release of each voice
+	int* length; //Samples the voice plays at most (length cap, or the frame at which it is stolen)
+	double* env_floor; //Output level under which the voice is below the threshold in both channels
+	double threshold; //Release threshold as a linear amplitude (full scale = 1.0)
+
+	//Scratch arrays filled by the kernel for the current sample
+	double* output;
+	double* new_input;
+	double* mix_l;
+	double* mix_r;
+
+	//Low-pass filter factors, shared by all voices
+	double alpha;
+	double one_minus_alpha;
+
+	//State, gains and scratch arrays of PRECISION_FLOAT
+	float* out_tminus1_f;
+	float* previous_input_f;
+	float* output_f;
+	float* new_input_f;
+	float* gain_l; //f_amp * balance (in the fixed-point formats also scaled from fixed point to 1.0 = full scale)
+	float* gain_r; //f_amp * (1.0 - balance)
+	float* mix_l_f; //Also used by the fixed-point formats
+	float* mix_r_f;
+	float alpha_f;
+	float one_minus_alpha_f;
+
+	//State and scratch arrays of PRECISION_Q31 and PRECISION_Q15
+	int32_t* out_tminus1_q;
+	int32_t* previous_input_q;
+	int32_t* output_q;
+	int32_t* new_input_q;
+	int32_t* floor_q; //env_floor in fixed point
+	int64_t coef_q[3]; //Feedback filter factors in fixed point: previous output, output, previous input
+	int q_shift; //Fraction bits: 31 or 15
+
+	//Delay lines are taken from an arena and recycled through one free list per delay length (that is, per pitch).
+	arena delay_arena;
+	void** delay_free; //delay_free[len]: a free delay line of length len, the next free one is stored in its first element
+	int delay_free_size; //Number of entries in delay_free
+	size_t delay_allocs; //Delay lines handed out
+	size_t delay_reused; //Delay lines handed out from a free list
+	double* lazy_waveform; //Waveform of a lazy note before it is converted to the number format of the bank
+	int lazy_capacity; //Values of lazy_waveform
+} voice_bank;
+
+int voice_bank_init(voice_bank* b, int capacity, double threshold, int precision);
+int voice_bank_add(voice_bank* b, note* n);
+void voice_bank_remove(voice_bank* b, int v);
+void voice_bank_sample(voice_bank* b, double* l, double* r);
+int voice_bank_skip(voice_bank* b, int v, int64_t count);
+void voice_bank_free(voice_bank* b);
+const char* precision_name(int precision);
+int precision_from_name(const char* name);
+
+#endif // VOICE_BANK_H
@@ -0,0 +1,27 @@
+/*
+Wall-clock timer for the timing reports.
+*/
+
+#define _CRT_SECURE_NO_WARNINGS
+
+#include "wall_clock.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+//Time in seconds from an arbitrary starting point, with (at least) microsecond resolution.
+double wall_time(void){
+#ifdef _WIN32
+    LARGE_INTEGER freq, t;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&t);
+    return (double)t.QuadPart / (double)freq.QuadPart;
+#else
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (double)t.tv_sec + 1e-9 * (double)t.tv_nsec;
+#endif
+}
@@ -0,0 +1,8 @@
+#pragma once
+
+#ifndef WALL_CLOCK_H
+#define WALL_CLOCK_H
+
+double wall_time(void);
+
+#endif // WALL_CLOCK_H
@@ -0,0 +1,531 @@
+/*
+Block output stage for the .wav file.
+Instead of writing every channel of every frame with its own fwrite call,
+the mixed frames are collected in a block, converted to 16-bit PCM in one pass and written at once.
+The conversion soft-clips with a rational approximation of tanh (no calls to the math library), optionally adds
+TPDF dither, and interleaves the channels into 16-bit samples, 4 frames at a time with AVX or 2 with SSE2.
+The file is written in one pass: the header is written with length 0 and patched when the file is complete.
+With the reverb, the blocks are queued for a thread of their own that adds the reverb, converts and writes them,
+so the convolution runs beside the synthesis.
+*/
+
+#define _CRT_SECURE_NO_WARNINGS
+
+#include <string.h>
+#include "wav_writer.h"
+#include "wall_clock.h"
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#define WW_USE_AVX
+#endif
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define WW_USE_SSE2
+#endif
+
+#ifdef _WIN32
+#define file_seek _fseeki64
+#define file_tell _ftelli64
+#else
+#define file_seek fseeko
+#define file_tell ftello
+#endif
+
+#define DITHER_FRAMES 256 //Frames of dither noise generated at a time
+#define DITHER_OFFSET 32768.5 //Makes the dithered value positive, so truncation rounds it to the nearest step
+
+//tanh(x) = x * P(x^2) / Q(x^2) on [-TANH_CLAMP, TANH_CLAMP], beyond which tanh is 1 within WAV_TANH_ERROR.
+//Minimax coefficients of the rational approximation (odd degree 13 over even degree 6).
+#define TANH_CLAMP 7.90531110763549805
+#define TANH_P13 -2.76076847742355e-16
+#define TANH_P11 2.00018790482477e-13
+#define TANH_P9 -8.60467152213735e-11
+#define TANH_P7 5.12229709037114e-08
+#define TANH_P5 1.48572235717979e-05
+#define TANH_P3 6.37261928875436e-04
+#define TANH_P1 4.89352455891786e-03
+#define TANH_Q6 1.19825839466702e-06
+#define TANH_Q4 1.18534705686654e-04
+#define TANH_Q2 2.26843463243900e-03
+#define TANH_Q0 4.89352518554385e-03
+
+//Converting n frames of a block to the output format and writing them to the file.
+static void wav_writer_write(wav_writer *w, const double *r, const double *l, int64_t n){
+    w->clipped += wav_convert_to(r, l, w->pcm, n, w->frame, w->format);
+    w->frame += n;
+    if (fwrite(w->pcm, 2 * wav_sample_bytes(w->format), (size_t)n, w->f) != (size_t)n) w->failed = 1;
+}
+
+//The reverb thread: the queued blocks are taken in order, the reverb is added and the frames that come out of it
+//are written. The block is then given back to the queue. The thread ends when the writer is closed and the queue is empty.
+static void wav_writer_reverb_thread(void *arg){
+    wav_writer *w = (wav_writer *)arg;
+    int64_t n;
+    double t0;
+    int k;
+
+    for (;;){
+        pool_mutex_lock(&w->lock);
+        while (w->n_queued == 0 && !w->stop) pool_cond_wait(&w->wake, &w->lock);
+        k = w->head;
+        n = w->n_queued > 0 ? w->slot_frames[k] : -1;
+        pool_mutex_unlock(&w->lock);
+        if (n < 0) return;
+
+        t0 = wall_time();
+        n = reverb_run(w->reverb, w->slot_r[k], w->slot_l[k], n);
+        w->reverb_ms += 1000.0 * (wall_time() - t0);
+        if (n > 0) wav_writer_write(w, w->slot_r[k], w->slot_l[k], n);
+
+        pool_mutex_lock(&w->lock);
+        w->head = (w->head + 1) % w->n_slots;
+        w->n_queued--;
+        pool_cond_signal(&w->wake);
+        pool_mutex_unlock(&w->lock);
+    }
+}
+
+//Releasing the blocks of the queue of the reverb thread.
+static void wav_writer_free_slots(wav_writer *w, int n){
+    int i;
+
+    for (i = 0; i < n; i++){
+        if (w->slot_r) free(w->slot_r[i]);
+        if (w->slot_l) free(w->slot_l[i]);
+    }
+    free(w->slot_r);
+    free(w->slot_l);
+    free(w->slot_frames);
+    w->slot_r = w->slot_l = NULL;
+    w->slot_frames = NULL;
+}
+
+//Starting the reverb thread with a queue of WAV_REVERB_QUEUE_SECONDS of blocks. If there is not enough memory or the
+//thread cannot be started, the reverb runs in wav_writer_flush instead; the output is the same.
+static void wav_writer_start_reverb(wav_writer *w){
+    int i, ok, n = (int)((int64_t)WAV_REVERB_QUEUE_SECONDS * RS(rate) / w->block_frames);
+
+    if (n < 2) n = 2;
+    w->slot_r = (double **)calloc(n, sizeof(double *));
+    w->slot_l = (double **)calloc(n, sizeof(double *));
+    w->slot_frames = (int *)calloc(n, sizeof(int));
+    ok = w->slot_r && w->slot_l && w->slot_frames;
+    for (i = 0; ok && i < n; i++){
+        w->slot_r[i] = (double *)malloc(w->block_frames * sizeof(double));
+        w->slot_l[i] = (double *)malloc(w->block_frames * sizeof(double));
+        ok = w->slot_r[i] && w->slot_l[i];
+    }
+
+    if (ok){
+        w->n_slots = n;
+        w->head = w->n_queued = w->stop = 0;
+        pool_mutex_init(&w->lock);
+        pool_cond_init(&w->wake);
+        if (!pool_thread_start(&w->thread, wav_writer_reverb_thread, w)){
+            pool_cond_destroy(&w->wake);
+            pool_mutex_destroy(&w->lock);
+            w->n_slots = 0;
+            ok = 0;
+        }
+    }
+    if (!ok) wav_writer_free_slots(w, n);
+}
+
+//Letting the reverb thread finish the queue, and waiting for it.
+static void wav_writer_stop_reverb(wav_writer *w){
+    int n = w->n_slots;
+
+    if (n == 0) return;
+    pool_mutex_lock(&w->lock);
+    w->stop = 1;
+    pool_cond_signal(&w->wake);
+    pool_mutex_unlock(&w->lock);
+    pool_thread_join(w->thread);
+
+    pool_cond_destroy(&w->wake);
+    pool_mutex_destroy(&w->lock);
+    w->n_slots = 0;
+    wav_writer_free_slots(w, n);
+}
+
+//Allocating the block buffers, and the reverb if RS(reverb) is set. block_frames <= 0 selects the default block size.
+//Returns 1 on success and 0 if there is not enough memory or the impulse response cannot be read.
+int wav_writer_open(wav_writer *w, FILE *f, int block_frames){
+    if (block_frames <= 0) block_frames = DEFAULT_BLOCK_FRAMES;
+
+    w->f = f;
+    w->block_frames = block_frames;
+    w->n_frames = 0;
+    w->clipped = 0;
+    w->frame = 0;
+    w->failed = 0;
+    w->reverb = NULL;
+    w->reverb_ms = 0;
+    w->n_slots = 0;
+    w->slot_r = w->slot_l = NULL;
+    w->slot_frames = NULL;
+    w->format = RS(format);
+    w->mix_r = (double *)calloc(block_frames, sizeof(double));
+    w->mix_l = (double *)calloc(block_frames, sizeof(double));
+    w->pcm = calloc(2 * (size_t)block_frames, wav_sample_bytes(w->format));
+
+    if (!w->mix_r || !w->mix_l || !w->pcm){
+        fprintf(stderr, "Out of memory!\n");
+        wav_writer_close(w);
+        return 0;
+    }
+    if (RS(reverb) != NULL){
+        w->reverb = (reverb *)malloc(sizeof(reverb));
+        if (!w->reverb) fprintf(stderr, "Out of memory!\n");
+        if (!w->reverb || !reverb_init(w->reverb, RS(reverb), RS(wet))){
+            free(w->reverb);
+            w->reverb = NULL;
+            wav_writer_close(w);
+            return 0;
+        }
+        wav_writer_start_reverb(w);
+    }
+    return 1;
+}
+
+//Adding one mixed frame to the block. The block is written out when it is full.
+void wav_writer_put(wav_writer *w, double r, double l){
+    w->mix_r[w->n_frames] = r;
+    w->mix_l[w->n_frames] = l;
+    w->n_frames++;
+
+    if (w->n_frames == w->block_frames) wav_writer_flush(w);
+}
+
+//Adding n mixed frames (for example a whole render segment) to the output, a block at a time.
+void wav_writer_put_block(wav_writer *w, const double *r, const double *l, int64_t n){
+    int64_t k;
+
+    while (n > 0){
+        k = w->block_frames - w->n_frames;
+        if (k > n) k = n;
+        memcpy(w->mix_r + w->n_frames, r, (size_t)k * sizeof(double));
+        memcpy(w->mix_l + w->n_frames, l, (size_t)k * sizeof(double));
+        w->n_frames += (int)k;
+        r += k;
+        l += k;
+        n -= k;
+        if (w->n_frames == w->block_frames) wav_writer_flush(w);
+    }
+}
+
+//Soft clipping: tanh(x) within WAV_TANH_ERROR, the same value as the SIMD paths of wav_convert.
+double wav_tanh(double x){
+    double x2, p, q;
+
+    if (x > TANH_CLAMP) x = TANH_CLAMP;
+    if (x < -TANH_CLAMP) x = -TANH_CLAMP;
+    x2 = x * x;
+    p = ((((((TANH_P13 * x2 + TANH_P11) * x2 + TANH_P9) * x2 + TANH_P7) * x2 + TANH_P5) * x2 + TANH_P3) * x2 + TANH_P1);
+    q = (((TANH_Q6 * x2 + TANH_Q4) * x2 + TANH_Q2) * x2 + TANH_Q0);
+    return x * p / q;
+}
+
+#ifdef WW_USE_AVX
+static __m256d wav_tanh_avx(__m256d x){
+    __m256d x2, p, q;
+
+    x = _mm256_min_pd(_mm256_max_pd(x, _mm256_set1_pd(-TANH_CLAMP)), _mm256_set1_pd(TANH_CLAMP));
+    x2 = _mm256_mul_pd(x, x);
+    p = _mm256_add_pd(_mm256_mul_pd(_mm256_set1_pd(TANH_P13), x2), _mm256_set1_pd(TANH_P11));
+    p = _mm256_add_pd(_mm256_mul_pd(p, x2), _mm256_set1_pd(TANH_P9));
+    p = _mm256_add_pd(_mm256_mul_pd(p, x2), _mm256_set1_pd(TANH_P7));
+    p = _mm256_add_pd(_mm256_mul_pd(p, x2), _mm256_set1_pd(TANH_P5));
+    p = _mm256_add_pd(_mm256_mul_pd(p, x2), _mm256_set1_pd(TANH_P3));
+    p = _mm256_add_pd(_mm256_mul_pd(p, x2), _mm256_set1_pd(TANH_P1));
+    q = _mm256_add_pd(_mm256_mul_pd(_mm256_set1_pd(TANH_Q6), x2), _mm256_set1_pd(TANH_Q4));
+    q = _mm256_add_pd(_mm256_mul_pd(q, x2), _mm256_set1_pd(TANH_Q2));
+    q = _mm256_add_pd(_mm256_mul_pd(q, x2), _mm256_set1_pd(TANH_Q0));
+    return _mm256_div_pd(_mm256_mul_pd(x, p), q);
+}
+#endif
+
+#ifdef WW_USE_SSE2
+static __m128d wav_tanh_sse2(__m128d x){
+    __m128d x2, p, q;
+
+    x = _mm_min_pd(_mm_max_pd(x, _mm_set1_pd(-TANH_CLAMP)), _mm_set1_pd(TANH_CLAMP));
+    x2 = _mm_mul_pd(x, x);
+    p = _mm_add_pd(_mm_mul_pd(_mm_set1_pd(TANH_P13), x2), _mm_set1_pd(TANH_P11));
+    p = _mm_add_pd(_mm_mul_pd(p, x2), _mm_set1_pd(TANH_P9));
+    p = _mm_add_pd(_mm_mul_pd(p, x2), _mm_set1_pd(TANH_P7));
+    p = _mm_add_pd(_mm_mul_pd(p, x2), _mm_set1_pd(TANH_P5));
+    p = _mm_add_pd(_mm_mul_pd(p, x2), _mm_set1_pd(TANH_P3));
+    p = _mm_add_pd(_mm_mul_pd(p, x2), _mm_set1_pd(TANH_P1));
+    q = _mm_add_pd(_mm_mul_pd(_mm_set1_pd(TANH_Q6), x2), _mm_set1_pd(TANH_Q4));
+    q = _mm_add_pd(_mm_mul_pd(q, x2), _mm_set1_pd(TANH_Q2));
+    q = _mm_add_pd(_mm_mul_pd(q, x2), _mm_set1_pd(TANH_Q0));
+    return _mm_div_pd(_mm_mul_pd(x, p), q);
+}
+#endif
+
+/*TPDF dither of the frames first_frame .. first_frame + n - 1, in 16-bit steps (-1 to 1, triangular).
+The noise of a frame is a hash of its position in the song, so it is the same for any number of threads,
+segment length or block size. */
+static void dither_noise(int64_t first_frame, int n, double *d_r, double *d_l){
+    uint64_t z;
+    int i;
+
+    for (i = 0; i < n; i++){
+        z = (uint64_t)(first_frame + i) * 0x9E3779B97F4A7C15ULL + 0x632BE59BD9B4E019ULL;
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+        z ^= z >> 31;
+        d_r[i] = ((double)(z & 0xFFFF) + (double)((z >> 16) & 0xFFFF)) * (1.0 / 65536.0) - 1.0;
+        d_l[i] = ((double)((z >> 32) & 0xFFFF) + (double)(z >> 48)) * (1.0 / 65536.0) - 1.0;
+    }
+}
+
+/*Converting n frames: soft clipping, optional dither (d_r/d_l, NULL = none) and interleaving.
+Without dither the value is truncated toward zero; with dither it is rounded to the nearest step.
+Returns the number of samples beyond WAV_CLIP_LEVEL. */
+static int64_t convert_run(const double *r, const double *l, int16_t *pcm, int64_t n, const double *d_r, const double *d_l){
+    int64_t i = 0, clipped = 0;
+    double vr, vl;
+    int ir, il;
+#ifdef WW_USE_AVX
+    static const int bit_count[16] = { 0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4 };
+    __m256d xr, xl, scale256 = _mm256_set1_pd(WAV_FULL_SCALE), level256 = _mm256_set1_pd(WAV_CLIP_LEVEL);
+    __m256d sign256 = _mm256_set1_pd(-0.0), offset256 = _mm256_set1_pd(DITHER_OFFSET);
+    __m128i jr, jl;
+#endif
+#ifdef WW_USE_SSE2
+    __m128d yr, yl, scale128 = _mm_set1_pd(WAV_FULL_SCALE), level128 = _mm_set1_pd(WAV_CLIP_LEVEL);
+    __m128d sign128 = _mm_set1_pd(-0.0), offset128 = _mm_set1_pd(DITHER_OFFSET);
+    __m128i kr, kl;
+    int m;
+#endif
+
+#ifdef WW_USE_AVX
+    for (; i + 4 <= n; i += 4){
+        xr = _mm256_loadu_pd(r + i);
+        xl = _mm256_loadu_pd(l + i);
+        clipped += bit_count[_mm256_movemask_pd(_mm256_cmp_pd(_mm256_andnot_pd(sign256, xr), level256, _CMP_GT_OQ))]
+                 + bit_count[_mm256_movemask_pd(_mm256_cmp_pd(_mm256_andnot_pd(sign256, xl), level256, _CMP_GT_OQ))];
+        xr = _mm256_mul_pd(wav_tanh_avx(xr), scale256);
+        xl = _mm256_mul_pd(wav_tanh_avx(xl), scale256);
+        if (d_r){
+            xr = _mm256_add_pd(_mm256_add_pd(xr, _mm256_loadu_pd(d_r + i)), offset256);
+            xl = _mm256_add_pd(_mm256_add_pd(xl, _mm256_loadu_pd(d_l + i)), offset256);
+        }
+        jr = _mm256_cvttpd_epi32(xr);
+        jl = _mm256_cvttpd_epi32(xl);
+        if (d_r){
+            jr = _mm_sub_epi32(jr, _mm_set1_epi32(32768));
+            jl = _mm_sub_epi32(jl, _mm_set1_epi32(32768));
+        }
+        _mm_storeu_si128((__m128i *)(pcm + 2 * i), _mm_packs_epi32(_mm_unpacklo_epi32(jr, jl), _mm_unpackhi_epi32(jr, jl)));
+    }
+#endif
+#ifdef WW_USE_SSE2
+    for (; i + 2 <= n; i += 2){
+        yr = _mm_loadu_pd(r + i);
+        yl = _mm_loadu_pd(l + i);
+        m = _mm_movemask_pd(_mm_cmpgt_pd(_mm_andnot_pd(sign128, yr), level128));
+        clipped += (m & 1) + (m >> 1);
+        m = _mm_movemask_pd(_mm_cmpgt_pd(_mm_andnot_pd(sign128, yl), level128));
+        clipped += (m & 1) + (m >> 1);
+        yr = _mm_mul_pd(wav_tanh_sse2(yr), scale128);
+        yl = _mm_mul_pd(wav_tanh_sse2(yl), scale128);
+        if (d_r){
+            yr = _mm_add_pd(_mm_add_pd(yr, _mm_loadu_pd(d_r + i)), offset128);
+            yl = _mm_add_pd(_mm_add_pd(yl, _mm_loadu_pd(d_l + i)), offset128);
+        }
+        kr = _mm_cvttpd_epi32(yr);
+        kl = _mm_cvttpd_epi32(yl);
+        if (d_r){
+            kr = _mm_sub_epi32(kr, _mm_set1_epi32(32768));
+            kl = _mm_sub_epi32(kl, _mm_set1_epi32(32768));
+        }
+        kr = _mm_unpacklo_epi32(kr, kl);
+        _mm_storel_epi64((__m128i *)(pcm + 2 * i), _mm_packs_epi32(kr, kr));
+    }
+#endif
+    for (; i < n; i++){
+        clipped += (fabs(r[i]) > WAV_CLIP_LEVEL) + (fabs(l[i]) > WAV_CLIP_LEVEL);
+        vr = wav_tanh(r[i]) * WAV_FULL_SCALE;
+        vl = wav_tanh(l[i]) * WAV_FULL_SCALE;
+        if (d_r){
+            ir = (int)(vr + d_r[i] + DITHER_OFFSET) - 32768;
+            il = (int)(vl + d_l[i] + DITHER_OFFSET) - 32768;
+        }
+        else{
+            ir = (int)vr;
+            il = (int)vl;
+        }
+        pcm[2 * i] = (int16_t)ir;
+        pcm[2 * i + 1] = (int16_t)il;
+    }
+    return clipped;
+}
+
+/*Transforming n mixed frames to interleaved 2-byte signed integers (soft clipping with tanh, see wav_tanh).
+Channel order is R, L, as in the file. first_frame is the position of the first frame in the song; it selects
+the dither noise when RS(dither) is set. Returns the number of samples beyond WAV_CLIP_LEVEL. */
+int64_t wav_convert(const double *r, const double *l, int16_t *pcm, int64_t n, int64_t first_frame){
+    double d_r[DITHER_FRAMES], d_l[DITHER_FRAMES];
+    int64_t i, k, clipped = 0;
+
+    if (!RS(dither)) return convert_run(r, l, pcm, n, NULL, NULL);
+
+    for (i = 0; i < n; i += k){
+        k = n - i < DITHER_FRAMES ? n - i : DITHER_FRAMES;
+        dither_noise(first_frame + i, (int)k, d_r, d_l);
+        clipped += convert_run(r + i, l + i, pcm + 2 * i, k, d_r, d_l);
+    }
+    return clipped;
+}
+
+/*Transforming n mixed frames to interleaved 32-bit floats: the values of wav_convert before they are rounded to
+16 bits (soft clipping, full scale WAV_FULL_SCALE / 32768), without dither. Returns the number of samples beyond WAV_CLIP_LEVEL. */
+int64_t wav_convert_float(const double *r, const double *l, float *out, int64_t n){
+    int64_t i = 0, clipped = 0;
+    const double scale = WAV_FULL_SCALE / 32768.0;
+#ifdef WW_USE_AVX
+    static const int bit_count[16] = { 0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4 };
+    __m256d xr, xl, scale256 = _mm256_set1_pd(scale), level256 = _mm256_set1_pd(WAV_CLIP_LEVEL), sign256 = _mm256_set1_pd(-0.0);
+    __m128 fr, fl;
+#endif
+#ifdef WW_USE_SSE2
+    __m128d yr, yl, scale128 = _mm_set1_pd(scale), level128 = _mm_set1_pd(WAV_CLIP_LEVEL), sign128 = _mm_set1_pd(-0.0);
+    __m128 gr;
+    int m;
+#endif
+
+#ifdef WW_USE_AVX
+    for (; i + 4 <= n; i += 4){
+        xr = _mm256_loadu_pd(r + i);
+        xl = _mm256_loadu_pd(l + i);
+        clipped += bit_count[_mm256_movemask_pd(_mm256_cmp_pd(_mm256_andnot_pd(sign256, xr), level256, _CMP_GT_OQ))]
+                 + bit_count[_mm256_movemask_pd(_mm256_cmp_pd(_mm256_andnot_pd(sign256, xl), level256, _CMP_GT_OQ))];
+        fr = _mm256_cvtpd_ps(_mm256_mul_pd(wav_tanh_avx(xr), scale256));
+        fl = _mm256_cvtpd_ps(_mm256_mul_pd(wav_tanh_avx(xl), scale256));
+        _mm_storeu_ps(out + 2 * i, _mm_unpacklo_ps(fr, fl));
+        _mm_storeu_ps(out + 2 * i + 4, _mm_unpackhi_ps(fr, fl));
+    }
+#endif
+#ifdef WW_USE_SSE2
+    for (; i + 2 <= n; i += 2){
+        yr = _mm_loadu_pd(r + i);
+        yl = _mm_loadu_pd(l + i);
+        m = _mm_movemask_pd(_mm_cmpgt_pd(_mm_andnot_pd(sign128, yr), level128));
+        clipped += (m & 1) + (m >> 1);
+        m = _mm_movemask_pd(_mm_cmpgt_pd(_mm_andnot_pd(sign128, yl), level128));
+        clipped += (m & 1) + (m >> 1);
+        gr = _mm_unpacklo_ps(_mm_cvtpd_ps(_mm_mul_pd(wav_tanh_sse2(yr), scale128)),
+                             _mm_cvtpd_ps(_mm_mul_pd(wav_tanh_sse2(yl), scale128)));
+        _mm_storeu_ps(out + 2 * i, gr);
+    }
+#endif
+    for (; i < n; i++){
+        clipped += (fabs(r[i]) > WAV_CLIP_LEVEL) + (fabs(l[i]) > WAV_CLIP_LEVEL);
+        out[2 * i] = (float)(wav_tanh(r[i]) * scale);
+        out[2 * i + 1] = (float)(wav_tanh(l[i]) * scale);
+    }
+    return clipped;
+}
+
+//Converting n frames to the sample format 'format' (see wav_convert and wav_convert_float).
+int64_t wav_convert_to(const double *r, const double *l, void *out, int64_t n, int64_t first_frame, int format){
+    if (format == WAV_FLOAT32) return wav_convert_float(r, l, (float *)out, n);
+    return wav_convert(r, l, (int16_t *)out, n, first_frame);
+}
+
+//Size of one sample of a format in bytes.
+int wav_sample_bytes(int format){
+    return format == WAV_FLOAT32 ? (int)sizeof(float) : (int)sizeof(int16_t);
+}
+
+/*Starting a .wav file whose length is not known yet. An output that can seek back gets a header of length 0, to be
+completed by wav_header_patch. One that cannot (a pipe) gets the header of a stream of unknown length, which
+players read to the end of the file.
+Returns 1 if the header can be patched, and 0 otherwise. */
+int wav_header_start(FILE *f, int format){
+    int seekable = file_seek(f, 0, SEEK_CUR) == 0;
+
+    write_wav_header(f, seekable ? 0 : WAV_UNKNOWN_LENGTH, format);
+    return seekable;
+}
+
+/*Completing a .wav file that was started with write_wav_header(f, 0, format) and has 'frames' frames of samples:
+the header is written again with the length (as RF64 if the samples take more than 4 GiB).
+Returns 1 on success and 0 if the file cannot be patched (for example a pipe). */
+int wav_header_patch(FILE *f, int64_t frames, int format){
+    if (fflush(f) != 0 || file_seek(f, 0, SEEK_SET) != 0) return 0;
+    write_wav_header(f, frames, format);
+    return fflush(f) == 0 && file_seek(f, 0, SEEK_END) == 0;
+}
+
+//Converting the stored frames to the output format and writing them to the file. With the reverb, the frames that
+//come out of it are written; the others follow with the next block or when the writer is closed. With the reverb
+//thread, the block is only queued: it is swapped with a free block of the queue, which the thread is done with.
+void wav_writer_flush(wav_writer *w){
+    int64_t n = w->n_frames;
+    double *t, t0;
+    int k;
+
+    if (w->n_frames == 0) return;
+
+    if (w->n_slots > 0){
+        pool_mutex_lock(&w->lock);
+        while (w->n_queued == w->n_slots) pool_cond_wait(&w->wake, &w->lock);
+        k = (w->head + w->n_queued) % w->n_slots;
+        t = w->slot_r[k];
+        w->slot_r[k] = w->mix_r;
+        w->mix_r = t;
+        t = w->slot_l[k];
+        w->slot_l[k] = w->mix_l;
+        w->mix_l = t;
+        w->slot_frames[k] = w->n_frames;
+        w->n_queued++;
+        pool_cond_signal(&w->wake);
+        pool_mutex_unlock(&w->lock);
+        w->n_frames = 0;
+        return;
+    }
+
+    if (w->reverb){
+        t0 = wall_time();
+        n = reverb_run(w->reverb, w->mix_r, w->mix_l, n);
+        w->reverb_ms += 1000.0 * (wall_time() - t0);
+    }
+    if (n > 0) wav_writer_write(w, w->mix_r, w->mix_l, n);
+    w->n_frames = 0;
+}
+
+//Writing out the last (partial) block and the frames still in the reverb, and releasing the buffers.
+//The file itself is closed by the caller.
+void wav_writer_close(wav_writer *w){
+    int64_t n;
+    double t0;
+
+    if (w->mix_r && w->mix_l && w->pcm){
+        wav_writer_flush(w);
+        wav_writer_stop_reverb(w);
+        while (w->reverb){
+            t0 = wall_time();
+            n = reverb_drain(w->reverb, w->mix_r, w->mix_l, w->block_frames);
+            w->reverb_ms += 1000.0 * (wall_time() - t0);
+            if (n == 0) break;
+            wav_writer_write(w, w->mix_r, w->mix_l, n);
+        }
+    }
+    if (w->reverb){
+        reverb_free(w->reverb);
+        free(w->reverb);
+        w->reverb = NULL;
+    }
+
+    free(w->mix_r);
+    free(w->mix_l);
+    free(w->pcm);
+    w->mix_r = w->mix_l = NULL;
+    w->pcm = NULL;
+    w->n_frames = 0;
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#ifndef WAV_WRITER_H
+#define WAV_WRITER_H
+
+#include<stdio.h>
+#include<stdlib.h>
+#include<math.h>
+#include <stdint.h>
+#include"note_io.h"
+#include"reverb.h"
+#include"worker_pool.h"
+
+#define DEFAULT_BLOCK_FRAMES 4096 //Default number of stereo frames collected before they are written to the file.
+#define WAV_CLIP_LEVEL 1.0 //Mixed samples beyond this level are counted as clipped by tanh.
+#define WAV_FULL_SCALE 32700 //16-bit value of a soft-clipped sample of 1.0
+#define WAV_TANH_ERROR 3e-7 //Largest absolute error of the tanh approximation of wav_convert (0.01 of a 16-bit step)
+#define WAV_REVERB_QUEUE_SECONDS 16 //Audio the reverb thread may be behind the mix (two segments of the render)
+
+//Block output stage. The synthesis loop mixes samples into the l/r buffers,
+//and the whole block is converted to interleaved 16-bit PCM (or 32-bit floats) and written with a single fwrite.
+//With RS(reverb) set, the reverb is added to every block before it is converted. The reverb, the conversion and
+//the fwrite then run on a thread of their own: full blocks are queued for it, and the synthesis goes on meanwhile.
+typedef struct wav_writer_struct{
+	FILE* f; //Output file (header already written)
+	double* mix_r; //Right channel mix of the current block (before clipping)
+	double* mix_l; //Left channel mix of the current block (before clipping)
+	void* pcm; //Interleaved R/L output buffer, 2 * block_frames samples of the format
+	int format; //WAV_PCM16 or WAV_FLOAT32 (RS(format) when the writer was opened)
+	int block_frames; //Capacity of the block in frames
+	int n_frames; //Number of frames currently stored in the block
+	uint64_t clipped; //Samples written so far that were beyond WAV_CLIP_LEVEL
+	int64_t frame; //Frames converted so far (position of the block in the song, for the dither)
+	int failed; //1 if a block could not be written
+	reverb* reverb; //Master-bus reverb added to the mix before the conversion, NULL = none (RS(reverb) when the writer was opened)
+	double reverb_ms; //Wall time spent in the reverb (on the reverb thread, beside the synthesis)
+	int n_slots; //Blocks of the queue of the reverb thread, 0 = the reverb runs in wav_writer_flush
+	double** slot_r; //Queue of the reverb thread: the blocks handed over by wav_writer_flush, in order
+	double** slot_l;
+	int* slot_frames; //Frames of every block of the queue
+	int head; //Next block of the queue for the reverb thread
+	int n_queued; //Blocks in the queue, including the one the reverb thread works on
+	int stop; //Set by wav_writer_close: no more blocks follow
+	pool_mutex lock; //Guards head, n_queued and stop
+	pool_cond wake; //Signalled when a block is queued, a block is done or the writer is closed
+	pool_thread_id thread;
+} wav_writer;
+
+int wav_writer_open(wav_writer* w, FILE* f, int block_frames);
+void wav_writer_put(wav_writer* w, double r, double l);
+void wav_writer_put_block(wav_writer* w, const double* r, const double* l, int64_t n);
+void wav_writer_flush(wav_writer* w);
+void wav_writer_close(wav_writer* w);
+double wav_tanh(double x);
+int64_t wav_convert(const double* r, const double* l, int16_t* pcm, int64_t n, int64_t first_frame);
+int64_t wav_convert_float(const double* r, const double* l, float* out, int64_t n);
+int64_t wav_convert_to(const double* r, const double* l, void* out, int64_t n, int64_t first_frame, int format);
+int wav_sample_bytes(int format);
+int wav_header_start(FILE* f, int format);
+int wav_header_patch(FILE* f, int64_t frames, int format);
+
+#endif // WAV_WRITER_H
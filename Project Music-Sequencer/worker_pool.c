@@ -0,0 +1,237 @@
+/*
+A small fork-join worker pool.
+parallel_for starts the worker threads, every worker takes the next free job number until all jobs are done,
+and the call returns when the last job has finished. The calling thread works as one of the workers.
+The workers render with the settings of the calling thread (see render_settings.h).
+pool_thread_start runs one function on a thread of its own, for work that goes on beside the caller; the thread
+is paced with a mutex and a condition variable.
+Win32 threads are used on Windows and POSIX threads everywhere else.
+*/
+
+#define _CRT_SECURE_NO_WARNINGS
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "worker_pool.h"
+#include "render_settings.h"
+
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+//State shared by the workers of one parallel_for call.
+typedef struct pool_struct{
+    pool_job_fn fn;
+    void* ctx;
+    int n_jobs;
+    int next_job; //Next job that has not been taken yet
+    render_settings* settings; //Current settings of the thread that called parallel_for
+    pool_mutex lock;
+} pool;
+
+void pool_mutex_init(pool_mutex *m){
+#ifdef _WIN32
+    InitializeCriticalSection(m);
+#else
+    pthread_mutex_init(m, NULL);
+#endif
+}
+
+void pool_mutex_lock(pool_mutex *m){
+#ifdef _WIN32
+    EnterCriticalSection(m);
+#else
+    pthread_mutex_lock(m);
+#endif
+}
+
+void pool_mutex_unlock(pool_mutex *m){
+#ifdef _WIN32
+    LeaveCriticalSection(m);
+#else
+    pthread_mutex_unlock(m);
+#endif
+}
+
+void pool_mutex_destroy(pool_mutex *m){
+#ifdef _WIN32
+    DeleteCriticalSection(m);
+#else
+    pthread_mutex_destroy(m);
+#endif
+}
+
+void pool_cond_init(pool_cond *c){
+#ifdef _WIN32
+    InitializeConditionVariable(c);
+#else
+    pthread_cond_init(c, NULL);
+#endif
+}
+
+//Waiting until the condition is signalled. The mutex is held by the caller; it is released during the wait.
+void pool_cond_wait(pool_cond *c, pool_mutex *m){
+#ifdef _WIN32
+    SleepConditionVariableCS(c, m, INFINITE);
+#else
+    pthread_cond_wait(c, m);
+#endif
+}
+
+void pool_cond_signal(pool_cond *c){
+#ifdef _WIN32
+    WakeConditionVariable(c);
+#else
+    pthread_cond_signal(c);
+#endif
+}
+
+void pool_cond_destroy(pool_cond *c){
+#ifdef _WIN32
+    (void)c;
+#else
+    pthread_cond_destroy(c);
+#endif
+}
+
+//Number of processors available to the program (at least 1).
+int cpu_count(void){
+    long n;
+#ifdef _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    n = (long)info.dwNumberOfProcessors;
+#else
+    n = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+    return n < 1 ? 1 : (int)n;
+}
+
+//Worker loop: taking job numbers one by one until none are left.
+static void pool_work(pool *p){
+    int job;
+
+    for (;;){
+        pool_mutex_lock(&p->lock);
+        job = p->next_job < p->n_jobs ? p->next_job++ : -1;
+        pool_mutex_unlock(&p->lock);
+
+        if (job < 0) return;
+        p->fn(p->ctx, job);
+    }
+}
+
+#ifdef _WIN32
+static DWORD WINAPI pool_thread(LPVOID arg){
+    render_settings_use(((pool *)arg)->settings);
+    pool_work((pool *)arg);
+    return 0;
+}
+#else
+static void *pool_thread(void *arg){
+    render_settings_use(((pool *)arg)->settings);
+    pool_work((pool *)arg);
+    return NULL;
+}
+#endif
+
+//Start of a thread of pool_thread_start.
+typedef struct pool_start_struct{
+    pool_thread_fn fn;
+    void* arg;
+    render_settings* settings; //Current settings of the thread that called pool_thread_start
+} pool_start;
+
+#ifdef _WIN32
+static DWORD WINAPI pool_single_thread(LPVOID arg){
+#else
+static void *pool_single_thread(void *arg){
+#endif
+    pool_start start = *(pool_start *)arg;
+
+    free(arg);
+    render_settings_use(start.settings);
+    start.fn(start.arg);
+#ifdef _WIN32
+    return 0;
+#else
+    return NULL;
+#endif
+}
+
+//Running fn(arg) on a new thread, with the settings of the calling thread. The thread is waited for with
+//pool_thread_join. Returns 1 on success and 0 if the thread cannot be started.
+int pool_thread_start(pool_thread_id *t, pool_thread_fn fn, void *arg){
+    pool_start *start = (pool_start *)malloc(sizeof(pool_start));
+
+    if (start == NULL) return 0;
+    start->fn = fn;
+    start->arg = arg;
+    start->settings = render_settings_current();
+#ifdef _WIN32
+    *t = CreateThread(NULL, 0, pool_single_thread, start, 0, NULL);
+    if (*t != NULL) return 1;
+#else
+    if (pthread_create(t, NULL, pool_single_thread, start) == 0) return 1;
+#endif
+    free(start);
+    return 0;
+}
+
+void pool_thread_join(pool_thread_id t){
+#ifdef _WIN32
+    WaitForSingleObject(t, INFINITE);
+    CloseHandle(t);
+#else
+    pthread_join(t, NULL);
+#endif
+}
+
+//Running jobs 0..n_jobs-1 on up to n_threads threads (n_threads <= 0 means one thread per processor).
+//If a thread cannot be started, its share of the work is done by the remaining threads.
+void parallel_for(int n_jobs, int n_threads, pool_job_fn fn, void *ctx){
+    pool p;
+    int i, started = 0;
+#ifdef _WIN32
+    HANDLE *threads;
+#else
+    pthread_t *threads;
+#endif
+
+    if (n_jobs <= 0) return;
+    if (n_threads <= 0) n_threads = cpu_count();
+    if (n_threads > n_jobs) n_threads = n_jobs;
+
+    p.fn = fn;
+    p.ctx = ctx;
+    p.n_jobs = n_jobs;
+    p.next_job = 0;
+    p.settings = render_settings_current();
+    pool_mutex_init(&p.lock);
+
+    threads = n_threads > 1 ? calloc(n_threads - 1, sizeof(*threads)) : NULL;
+    if (threads != NULL){
+        for (i = 0; i < n_threads - 1; i++){
+#ifdef _WIN32
+            threads[started] = CreateThread(NULL, 0, pool_thread, &p, 0, NULL);
+            if (threads[started] == NULL) break;
+#else
+            if (pthread_create(&threads[started], NULL, pool_thread, &p) != 0) break;
+#endif
+            started++;
+        }
+    }
+
+    pool_work(&p);
+
+    for (i = 0; i < started; i++){
+#ifdef _WIN32
+        WaitForSingleObject(threads[i], INFINITE);
+        CloseHandle(threads[i]);
+#else
+        pthread_join(threads[i], NULL);
+#endif
+    }
+    free(threads);
+    pool_mutex_destroy(&p.lock);
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#ifndef WORKER_POOL_H
+#define WORKER_POOL_H
+
+#ifdef _WIN32
+#include <windows.h>
+typedef CRITICAL_SECTION pool_mutex;
+typedef CONDITION_VARIABLE pool_cond;
+typedef HANDLE pool_thread_id;
+#else
+#include <pthread.h>
+typedef pthread_mutex_t pool_mutex;
+typedef pthread_cond_t pool_cond;
+typedef pthread_t pool_thread_id;
+#endif
+
+//A job of parallel_for: 'ctx' is shared by all jobs, 'job' is the job number from 0 to n_jobs - 1.
+typedef void (*pool_job_fn)(void* ctx, int job);
+
+//The function of a thread started with pool_thread_start.
+typedef void (*pool_thread_fn)(void* arg);
+
+int cpu_count(void);
+void parallel_for(int n_jobs, int n_threads, pool_job_fn fn, void* ctx);
+
+void pool_mutex_init(pool_mutex* m);
+void pool_mutex_lock(pool_mutex* m);
+void pool_mutex_unlock(pool_mutex* m);
+void pool_mutex_destroy(pool_mutex* m);
+
+void pool_cond_init(pool_cond* c);
+void pool_cond_wait(pool_cond* c, pool_mutex* m);
+void pool_cond_signal(pool_cond* c);
+void pool_cond_destroy(pool_cond* c);
+
+int pool_thread_start(pool_thread_id* t, pool_thread_fn fn, void* arg);
+void pool_thread_join(pool_thread_id t);
+
+#endif // WORKER_POOL_H